@@ -29,7 +29,9 @@
 #if !HAVE_SOCK_NONBLOCK
 # include <fcntl.h>
 #endif
+#include <limits.h>
 #include <poll.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,9 +59,16 @@ sqlbox_res_clear(struct sqlbox_res *p)
 void
 sqlbox_stmt_free(struct sqlbox_stmt *p)
 {
+	struct sqlbox_push	*push;
+
 	if (p == NULL)
 		return;
 
+	while ((push = TAILQ_FIRST(&p->pushq)) != NULL) {
+		TAILQ_REMOVE(&p->pushq, push, entries);
+		sqlbox_res_clear(&push->res);
+		free(push);
+	}
 	sqlbox_res_clear(&p->res);
 	free(p);
 }
@@ -78,11 +87,26 @@ sqlbox_clear(struct sqlbox *box, int intent)
 {
 	struct sqlbox_db 	*db;
 	struct sqlbox_stmt	*stmt;
+	struct sqlbox_grant	*g;
+	struct sqlbox_ticket	*t;
 
 	if (box == NULL)
 		return;
 	if (box->fd != -1)
 		close(box->fd);
+	sqlbox_ring_unmap(box->ring);
+	free(box->wbuf);
+	free(box->rbuf);
+
+	while ((g = TAILQ_FIRST(&box->grantq)) != NULL) {
+		TAILQ_REMOVE(&box->grantq, g, entries);
+		free(g);
+	}
+
+	while ((t = TAILQ_FIRST(&box->ticketq)) != NULL) {
+		TAILQ_REMOVE(&box->ticketq, t, entries);
+		sqlbox_ticket_free(t);
+	}
 
 	while ((db = TAILQ_FIRST(&box->dbq)) != NULL) {
 		if (!intent)
@@ -112,6 +136,10 @@ sqlbox_clear(struct sqlbox *box, int intent)
 				"%zu still open on exit (auto rollback)", 
 				db->src->fname, db->trans);
 		TAILQ_REMOVE(&box->dbq, db, entries);
+		sqlbox_stmtcache_clear(box, db);
+		sqlbox_debug(&box->cfg, "%s: %zu busy retries, "
+			"%" PRIu64 " us waiting", db->src->fname,
+			db->busyretries, db->busywait);
 		sqlbox_debug(&box->cfg, 
 			"sqlite3_close: %s", db->src->fname);
 		sqlite3_close(db->db);
@@ -131,6 +159,13 @@ sqlbox_clear(struct sqlbox *box, int intent)
 		sqlbox_stmt_free(stmt);
 	}
 
+	sqlbox_handle_clear(&box->dbs);
+	sqlbox_handle_clear(&box->stmts);
+	sqlbox_roles_free(box);
+	free(box->stmtstats);
+	free(box->batch);
+	sqlbox_lock_free(box);
+
 	if (box->free_msg_dat)
 		free(box->cfg.msg.dat);
 }
@@ -139,30 +174,116 @@ void
 sqlbox_free(struct sqlbox *box)
 {
 
+	/* Don't lose any queued asynchronous operations. */
+
+	if (box != NULL && !sqlbox_flush(box))
+		sqlbox_warnx(&box->cfg, "sqlbox_flush");
+	else if (box != NULL && !sqlbox_ticket_drain(box))
+		sqlbox_warnx(&box->cfg, "sqlbox_ticket_drain");
+	else if (box != NULL && !sqlbox_stream_drain(box))
+		sqlbox_warnx(&box->cfg, "sqlbox_stream_drain");
 	sqlbox_clear(box, 1);
 	free(box);
 }
 
+/*
+ * Free a box without flushing or draining it, as the server does when
+ * a client goes away.
+ * See sqlbox_clear() for "intent".
+ */
+void
+sqlbox_detach(struct sqlbox *box, int intent)
+{
+
+	sqlbox_clear(box, intent);
+	free(box);
+}
+
 /*
  * Verify internal consistency.
  * Returns FALSE on failure, TRUE on success.
  */
-static int
+int
 sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 {
-	size_t	 i, j;
+	size_t			  i, j;
+	const struct sqlbox_tune *tune;
 
 	if (cfg == NULL)
 		return 1;
 
-	/* We mustn't have a NULL filename. */
+	/* Threads can't take turns on these transports. */
+
+	if ((cfg->flags & SQLBOX_CFG_SHARED) &&
+	    (cfg->flags & (SQLBOX_CFG_RING|SQLBOX_CFG_NONBLOCK))) {
+		sqlbox_warnx(cfg, "shared boxes can't be "
+			"non-blocking or use shared memory");
+		return 0;
+	}
+
+	/* Channels are passed over the socket. */
+
+	if ((cfg->flags & SQLBOX_CFG_CHANNEL) &&
+	    (cfg->flags & SQLBOX_CFG_RING)) {
+		sqlbox_warnx(cfg, "boxes with channels "
+			"can't use shared memory");
+		return 0;
+	}
+
+	/* We mustn't have a NULL filename or bad tuning. */
 
-	for (i = 0; i < cfg->srcs.srcsz; i++)
+	for (i = 0; i < cfg->srcs.srcsz; i++) {
+		tune = &cfg->srcs.srcs[i].tune;
 		if (cfg->srcs.srcs[i].fname == NULL) {
 			sqlbox_warnx(cfg, "source %zu "
 				"has NULL filename", i);
 			return 0;
+		} else if (tune->journal < SQLBOX_JOURNAL_DEFAULT ||
+		    tune->journal > SQLBOX_JOURNAL_OFF) {
+			sqlbox_warnx(cfg, "source %zu has invalid "
+				"journal mode %d", i, tune->journal);
+			return 0;
+		} else if (tune->sync < SQLBOX_SYNC_DEFAULT ||
+		    tune->sync > SQLBOX_SYNC_EXTRA) {
+			sqlbox_warnx(cfg, "source %zu has invalid "
+				"synchronous level %d", i, tune->sync);
+			return 0;
+		} else if (tune->temp < SQLBOX_TEMP_DEFAULT ||
+		    tune->temp > SQLBOX_TEMP_MEMORY) {
+			sqlbox_warnx(cfg, "source %zu has invalid "
+				"temporary store %d", i, tune->temp);
+			return 0;
+		} else if (tune->mmapsz < 0) {
+			sqlbox_warnx(cfg, "source %zu has negative "
+				"mmap size", i);
+			return 0;
+		} else if (tune->pagesz != 0 && (tune->pagesz < 512 ||
+		    tune->pagesz > 65536 || 
+		    (tune->pagesz & (tune->pagesz - 1)))) {
+			sqlbox_warnx(cfg, "source %zu has invalid "
+				"page size %zu", i, tune->pagesz);
+			return 0;
+		} else if (tune->busytimeo > INT_MAX) {
+			sqlbox_warnx(cfg, "source %zu has invalid "
+				"busy timeout %zu", i, tune->busytimeo);
+			return 0;
+		} else if (tune->jitter > 100 &&
+		    tune->jitter != SQLBOX_JITTER_NONE) {
+			sqlbox_warnx(cfg, "source %zu has invalid "
+				"back-off jitter %zu", i, tune->jitter);
+			return 0;
+		} else if ((tune->backoff != 0 ? tune->backoff :
+		    SQLBOX_BACKOFF) > (tune->backoffmax != 0 ?
+		    tune->backoffmax : SQLBOX_BACKOFF_MAX)) {
+			sqlbox_warnx(cfg, "source %zu has back-off "
+				"exceeding its maximum", i);
+			return 0;
+		} else if (tune->busymax > INT_MAX) {
+			sqlbox_warnx(cfg, "source %zu has invalid "
+				"maximum busy wait %zu", i, tune->busymax);
+			return 0;
 		}
+	}
 
 	/* We mustn't have a NULL statement. */
 
@@ -244,12 +365,14 @@ sqlbox_cfg_vrfy(const struct sqlbox_cfg *cfg)
 
 /*
  * Zero and initialise the memory required by an sqlbox.
+ * If "ring" is not NULL, it's the shared-memory transport, which is
+ * then owned by the box.
  * Call sqlbox_clear() regardless of the return value.
  * Returns FALSE on memory allocation failure and TRUE otherwise.
  */
 static int
 sqlbox_init(struct sqlbox *box,
-	const struct sqlbox_cfg *cfg, int fd, pid_t pid)
+	const struct sqlbox_cfg *cfg, int fd, pid_t pid, void *ring)
 {
 
 	memset(box, 0, sizeof(struct sqlbox));
@@ -262,26 +385,115 @@ sqlbox_init(struct sqlbox *box,
 	box->role = box->cfg.roles.defrole;
 	box->fd = fd;
 	box->pid = pid;
+	box->statop = SQLBOX_OP__MAX;
+
+	if (ring != NULL)
+		sqlbox_ring_attach(box, ring, pid == (pid_t)-1);
 
 	TAILQ_INIT(&box->dbq);
 	TAILQ_INIT(&box->stmtq);
+	TAILQ_INIT(&box->grantq);
+	TAILQ_INIT(&box->ticketq);
 	return 1;
 }
 
+/*
+ * Allocate the client side of a box whose server process "pid" is at
+ * the other end of "fd".
+ * If "ring" is not NULL, it's the shared-memory transport.
+ * On success, "fd" and "ring" are owned by the returned box.
+ * Returns the box or NULL on memory allocation (or, with
+ * SQLBOX_CFG_SHARED, lock initialisation) failure.
+ */
+struct sqlbox *
+sqlbox_attach(const struct sqlbox_cfg *cfg, int fd, pid_t pid, void *ring)
+{
+	struct sqlbox	*p;
+
+	if ((p = calloc(1, sizeof(struct sqlbox))) == NULL) {
+		sqlbox_warn(cfg, "calloc");
+		return NULL;
+	} else if (!sqlbox_init(p, cfg, fd, pid, ring)) {
+		free(p);
+		return NULL;
+	} else if (!sqlbox_lock_alloc(p)) {
+		p->fd = -1;
+		p->ring = NULL;
+		sqlbox_detach(p, 1);
+		return NULL;
+	}
+	return p;
+}
+
+/*
+ * Run the server side of a box over "fd" until the client exits.
+ * If "ring" is not NULL, frames go over the shared-memory transport and
+ * the socket is only used for wakeups.
+ * This is called in the child process and never returns.
+ * We can do whatever we want with "cfg" because we manage the memory
+ * for it.
+ */
+void
+sqlbox_serve(const struct sqlbox_cfg *cfg, int fd, void *ring)
+{
+	struct sqlbox	*box;
+	int		 rc;
+
+	if ((box = sqlbox_attach(cfg, fd, (pid_t)-1, ring)) == NULL)
+		_exit(EXIT_FAILURE);
+	else if (!sqlbox_roles_compile(box)) {
+		sqlbox_warnx(cfg, "sqlbox_roles_compile");
+		sqlbox_detach(box, 0);
+		_exit(EXIT_FAILURE);
+	} else if (!sqlbox_stats_alloc(box)) {
+		sqlbox_warnx(cfg, "sqlbox_stats_alloc");
+		sqlbox_detach(box, 0);
+		_exit(EXIT_FAILURE);
+	}
+
+#if !HAVE_ARC4RANDOM
+	srandom(getpid());
+#endif
+#if HAVE_PLEDGE
+	if (pledge((cfg->flags & SQLBOX_CFG_CHANNEL) ?
+	    "stdio rpath cpath wpath flock fattr sendfd" :
+	    "stdio rpath cpath wpath flock fattr", NULL) == -1) {
+		sqlbox_warn(cfg, "pledge");
+		_exit(EXIT_FAILURE);
+	}
+#endif
+
+	if (!(rc = sqlbox_main_loop(box)))
+		sqlbox_warnx(cfg, "sqlbox_main_loop");
+
+	/* 
+	 * If the client opened channels, serve them all together.
+	 * The multiplexer then owns the box.
+	 */
+
+	if (rc && box->mux != NULL) {
+		if (!(rc = sqlbox_mux_run(box->mux, -1)))
+			sqlbox_warnx(cfg, "sqlbox_mux_run");
+	} else
+		sqlbox_detach(box, rc);
+	_exit(rc ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
 /*
  * Given an open socket pair, fork our protected child process and begin
  * waiting for instructions.
+ * If "ring" is not NULL, frames go over the shared-memory transport and
+ * the socket is only used for wakeups; on success, it's owned by the
+ * returned box.
  * Don't touch "cfg" if we fail: let the caller handle that.
  * If any descriptors in "fds" are closed, they're reassigned to -1.
  * The caller should close any remaining descriptors on failure.
  */
 static struct sqlbox *
-sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2])
+sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2], void *ring)
 {
-	struct sqlbox	 box;
 	struct sqlbox	*p;
 	pid_t		 pid;
-	int		 rc;
 
 	if (!sqlbox_cfg_vrfy(cfg)) {
 		sqlbox_warnx(cfg, "sqlbox_cfg_vrfy");
@@ -297,68 +509,45 @@ sqlbox_alloc_fd(struct sqlbox_cfg *cfg, int fds[2])
 	 */
 
 	if (pid > 0) {
-		if ((p = calloc(1, sizeof(struct sqlbox))) == NULL) {
-			sqlbox_warn(cfg, "calloc");
-			return NULL;
-		} else if (close(fds[0]) == -1) {
+		if (close(fds[0]) == -1) {
 			sqlbox_warn(cfg, "close");
-			free(p);
 			return NULL;
 		}
-		close(fds[0]);
 		fds[0] = -1;
-		if (!sqlbox_init(p, cfg, fds[1], pid)) {
-			free(p);
-			p = NULL;
-		}
+		if ((p = sqlbox_attach(cfg, fds[1], pid, ring)) != NULL)
+			fds[1] = -1;
 		return p;
 	}
 
 	/*
 	 * From here on out, we're in the child process so we don't
 	 * return to the parent caller.
-	 * We can now do whatever we want with "cfg" because we manage
-	 * the memory for it.
 	 */
 
 	close(fds[1]);
 	fds[1] = -1;
-	if (!sqlbox_init(&box, cfg, fds[0], (pid_t)-1)) {
-		sqlbox_clear(&box, 0);
-		_exit(EXIT_FAILURE);
-	}
-
-#if !HAVE_ARC4RANDOM
-	srandom(getpid());
-#endif
-#if HAVE_PLEDGE
-	if (pledge("stdio rpath cpath "
-	           "wpath flock fattr", NULL) == -1) {
-		sqlbox_warn(cfg, "pledge");
-		_exit(EXIT_FAILURE);
-	}
-#endif
-
-	if (!(rc = sqlbox_main_loop(&box)))
-		sqlbox_warnx(&box.cfg, "sqlbox_main_loop");
-
-	sqlbox_clear(&box, rc);
-	_exit(rc ? EXIT_SUCCESS : EXIT_FAILURE);
+	sqlbox_serve(cfg, fds[0], ring);
+	/* NOTREACHED */
+	return NULL;
 }
 
-struct sqlbox *
-sqlbox_alloc(struct sqlbox_cfg *cfg)
+/*
+ * Create the socket pair used between client and server.
+ * If "nonblock" is zero, the sockets are left blocking.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_socketpair(const struct sqlbox_cfg *cfg, int fd[2], int nonblock)
 {
-	int	 	 fl = SOCK_STREAM;
-	int		 fd[2];
-	struct sqlbox	*p;
+	int	 fl = SOCK_STREAM;
 
 #if HAVE_SOCK_NONBLOCK
-	fl |= SOCK_NONBLOCK;
+	if (nonblock)
+		fl |= SOCK_NONBLOCK;
 #endif
 	if (socketpair(AF_UNIX, fl, 0, fd) == -1) {
 		sqlbox_warn(cfg, "socketpair");
-		return NULL;
+		return 0;
 	}
 
 #if !defined(MSG_NOSIGNAL)
@@ -371,7 +560,7 @@ sqlbox_alloc(struct sqlbox_cfg *cfg)
 		sqlbox_warn(cfg, "setsockopt");
 		close(fd[0]);
 		close(fd[1]);
-		return NULL;
+		return 0;
 	}
 #else
 # error Neither MSG_NOSIGNAL nor SO_NOSIGPIPE defined.
@@ -379,22 +568,52 @@ sqlbox_alloc(struct sqlbox_cfg *cfg)
 #endif /* !MSG_NOSIGNAL */
 
 #if !HAVE_SOCK_NONBLOCK
-	if ((fl = fcntl(fd[0], F_GETFL, 0)) == -1 ||
-	    fcntl(fd[0], F_SETFL, fl | O_NONBLOCK) == -1 ||
-	    (fl = fcntl(fd[1], F_GETFL, 0)) == -1 ||
-	    fcntl(fd[1], F_SETFL, fl | O_NONBLOCK) == -1) {
+	if (nonblock &&
+	    ((fl = fcntl(fd[0], F_GETFL, 0)) == -1 ||
+	     fcntl(fd[0], F_SETFL, fl | O_NONBLOCK) == -1 ||
+	     (fl = fcntl(fd[1], F_GETFL, 0)) == -1 ||
+	     fcntl(fd[1], F_SETFL, fl | O_NONBLOCK) == -1)) {
 		sqlbox_warn(cfg, "fcntl");
 		close(fd[0]);
 		close(fd[1]);
-		return NULL;
+		return 0;
 	}
 #endif
-	if ((p = sqlbox_alloc_fd(cfg, fd)) == NULL) {
+	return 1;
+}
+
+struct sqlbox *
+sqlbox_alloc(struct sqlbox_cfg *cfg)
+{
+	int		 fd[2];
+	struct sqlbox	*p;
+	void		*ring = NULL;
+
+	if (!sqlbox_socketpair(cfg, fd, 1)) {
+		sqlbox_warnx(cfg, "sqlbox_socketpair");
+		return NULL;
+	}
+
+	/* 
+	 * The shared-memory transport must be mapped before forking so
+	 * that it's inherited by the child.
+	 */
+
+	if (cfg != NULL && (cfg->flags & SQLBOX_CFG_RING) &&
+	    (ring = sqlbox_ring_alloc(cfg)) == NULL) {
+		sqlbox_warnx(cfg, "sqlbox_ring_alloc");
+		close(fd[0]);
+		close(fd[1]);
+		return NULL;
+	}
+
+	if ((p = sqlbox_alloc_fd(cfg, fd, ring)) == NULL) {
 		sqlbox_warnx(cfg, "sqlbox_alloc_fd");
 		if (fd[0] != -1)
 			close(fd[0]);
 		if (fd[1] != -1)
 			close(fd[1]);
+		sqlbox_ring_unmap(ring);
 	}
 
 	return p;
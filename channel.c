@@ -0,0 +1,179 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+static struct sqlbox *
+sqlbox_channel_locked(struct sqlbox *box)
+{
+	struct sqlbox	*p;
+	int		 fd;
+
+	if (!(box->cfg.flags & SQLBOX_CFG_CHANNEL)) {
+		sqlbox_warnx(&box->cfg, "channel: "
+			"SQLBOX_CFG_CHANNEL not set");
+		return NULL;
+	} else if (box->ring != NULL) {
+		sqlbox_warnx(&box->cfg, "channel: shared-memory "
+			"transport not supported");
+		return NULL;
+	}
+
+	/* The descriptor mustn't be behind unread answers. */
+
+	if (!sqlbox_flush(box)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_flush");
+		return NULL;
+	} else if (!sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_ticket_drain");
+		return NULL;
+	} else if (!sqlbox_stream_drain(box)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_stream_drain");
+		return NULL;
+	}
+
+	if (!sqlbox_write_frame(box, SQLBOX_OP_CHANNEL, NULL, 0)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_write_frame");
+		return NULL;
+	} else if (!sqlbox_flush(box)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_flush");
+		return NULL;
+	} else if (!sqlbox_recvfd(box, &fd)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_recvfd");
+		return NULL;
+	} 
+	
+	if ((p = sqlbox_attach(&box->cfg, fd, box->pid, NULL)) == NULL) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_attach");
+		close(fd);
+		return NULL;
+	}
+
+	/* Data from sqlbox_msg_set_dat() belongs to the box. */
+
+	if (box->free_msg_dat)
+		p->cfg.msg.dat = NULL;
+	return p;
+}
+
+struct sqlbox *
+sqlbox_channel(struct sqlbox *box)
+{
+	struct sqlbox	*p;
+
+	sqlbox_lock_sync(box);
+	p = sqlbox_channel_locked(box);
+	sqlbox_unlock_sync(box);
+	return p;
+}
+
+/*
+ * Create a channel and send the client its end.
+ * The box and its new channel are then served together by one
+ * multiplexer (see sqlbox_mux_run()), which is created for the first
+ * channel.
+ * This is only allowed with SQLBOX_CFG_CHANNEL, as otherwise we've
+ * pledged not to send descriptors.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_op_channel(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_mux	*mux;
+	struct sqlbox		*p;
+	int			 fd[2];
+
+	if (sz != 0) {
+		sqlbox_warnx(&box->cfg, "channel: "
+			"bad frame size: %zu", sz);
+		return 0;
+	} else if (!(box->cfg.flags & SQLBOX_CFG_CHANNEL)) {
+		sqlbox_warnx(&box->cfg, "channel: "
+			"SQLBOX_CFG_CHANNEL not set");
+		return 0;
+	} else if (box->ring != NULL) {
+		sqlbox_warnx(&box->cfg, "channel: shared-memory "
+			"transport not supported");
+		return 0;
+	}
+
+	if (box->mux == NULL) {
+		if ((mux = sqlbox_mux_alloc(&box->cfg)) == NULL) {
+			sqlbox_warnx(&box->cfg, 
+				"channel: sqlbox_mux_alloc");
+			return 0;
+		} else if (!sqlbox_mux_add(mux, box)) {
+			sqlbox_warnx(&box->cfg, 
+				"channel: sqlbox_mux_add");
+			sqlbox_mux_free(mux);
+			return 0;
+		}
+		if (box->free_msg_dat)
+			mux->cfg.msg.dat = NULL;
+	}
+
+	if (!sqlbox_socketpair(&box->cfg, fd, 1)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_socketpair");
+		return 0;
+	} else if ((p = sqlbox_attach
+	           (&box->cfg, fd[0], (pid_t)-1, NULL)) == NULL) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_attach");
+		close(fd[0]);
+		close(fd[1]);
+		return 0;
+	}
+
+	if (box->free_msg_dat)
+		p->cfg.msg.dat = NULL;
+
+	if (!sqlbox_roles_compile(p)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_roles_compile");
+		sqlbox_detach(p, 1);
+		close(fd[1]);
+		return 0;
+	} else if (!sqlbox_stats_alloc(p)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_stats_alloc");
+		sqlbox_detach(p, 1);
+		close(fd[1]);
+		return 0;
+	} else if (!sqlbox_mux_add(box->mux, p)) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_mux_add");
+		sqlbox_detach(p, 1);
+		close(fd[1]);
+		return 0;
+	} 
+	
+	if (!sqlbox_sendfd(box, fd[1])) {
+		sqlbox_warnx(&box->cfg, "channel: sqlbox_sendfd");
+		close(fd[1]);
+		return 0;
+	}
+	close(fd[1]);
+	return 1;
+}
@@ -22,6 +22,7 @@
 #include COMPAT_ENDIAN_H
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,27 +33,8 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-/*
- * Return TRUE if the current role has the ability to open or close the
- * given close (or no roles are specified), FALSE if otherwise.
- */
 static int
-sqlbox_rolecheck_src(struct sqlbox *box, size_t idx)
-{
-	size_t	 i;
-
-	if (box->cfg.roles.rolesz == 0)
-		return 1;
-	for (i = 0; i < box->cfg.roles.roles[box->role].srcsz; i++)
-		if (box->cfg.roles.roles[box->role].srcs[i] == idx)
-			return 1;
-	sqlbox_warnx(&box->cfg, "close: source %zu "
-		"denied to role %zu", idx, box->role);
-	return 0;
-}
-
-int
-sqlbox_close(struct sqlbox *box, size_t src)
+sqlbox_close_locked(struct sqlbox *box, size_t src)
 {
 	uint32_t	 v = htole32(src);
 
@@ -64,6 +46,17 @@ sqlbox_close(struct sqlbox *box, size_t src)
 	return 1;
 }
 
+int
+sqlbox_close(struct sqlbox *box, size_t src)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_close_locked(box, src);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
 /*
  * Close a database.
  * First check if the identifier is valid, then whether our role permits
@@ -75,7 +68,6 @@ int
 sqlbox_op_close(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_db *db;
-	int		  rc = 0;
 
 	/* Check source exists and we can close it. */
 
@@ -89,9 +81,9 @@ sqlbox_op_close(struct sqlbox *box, const char *buf, size_t sz)
 		sqlbox_warnx(&box->cfg, "close: sqlbox_db_find");
 		return 0;
 	}
-	if (!sqlbox_rolecheck_src(box, db->idx)) {
+	if (!sqlbox_rolecheck(box, SQLBOX_PERM_SRC, db->idx)) {
 		sqlbox_warnx(&box->cfg, "%s: close: "
-			"sqlbox_rolecheck_src", db->src->fname);
+			"sqlbox_rolecheck", db->src->fname);
 		return 0;
 	}
 
@@ -115,19 +107,106 @@ sqlbox_op_close(struct sqlbox *box, const char *buf, size_t sz)
 		return 0;
 	}
 
+	return sqlbox_db_release(box, db);
+}
+
+/*
+ * Finalise a statement that's been removed from all queues (server),
+ * keeping its compiled form in the cache of its connection.
+ * A reader connection is then returned to the multiplexer.
+ */
+void
+sqlbox_stmt_release(struct sqlbox *box, struct sqlbox_stmt *st)
+{
+
+	if (st->rdb != NULL) {
+		sqlbox_stmtcache_put(box, st->rdb, st->idx, st->stmt);
+		sqlbox_mux_reader_put(box, st->rdb);
+	} else
+		sqlbox_stmtcache_put(box, st->db, st->idx, st->stmt);
+	sqlbox_stmt_free(st);
+}
+
+/*
+ * Finalise all statements (server), keeping their compiled forms in
+ * the caches of their sources.
+ */
+void
+sqlbox_stmt_release_all(struct sqlbox *box)
+{
+	struct sqlbox_stmt	*st;
+
+	while ((st = TAILQ_FIRST(&box->stmtq)) != NULL) {
+		TAILQ_REMOVE(&box->stmtq, st, gentries);
+		TAILQ_REMOVE(&st->db->stmtq, st, entries);
+		sqlbox_handle_free(&box->stmts, st->id);
+		sqlbox_stmt_release(box, st);
+	}
+}
+
+/*
+ * Roll back any transaction left open on "db" (server), including one
+ * begun by the client's own statements.
+ * Returns FALSE if it couldn't be rolled back, TRUE otherwise.
+ */
+int
+sqlbox_db_rollback(struct sqlbox *box, struct sqlbox_db *db)
+{
+
+	if (db->trans == 0 && sqlite3_get_autocommit(db->db))
+		return 1;
+	sqlbox_debug(&box->cfg, "sqlite3_exec: %s, "
+		"ROLLBACK TRANSACTION", db->src->fname);
+	if (sqlite3_exec(db->db, "ROLLBACK TRANSACTION",
+	    NULL, NULL, NULL) != SQLITE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: rollback: %s", 
+			db->src->fname, sqlite3_errmsg(db->db));
+		return 0;
+	}
+	db->trans = 0;
+	return 1;
+}
+
+/*
+ * Remove "db", which must have no statements, from the box (server).
+ * It's then closed or, if the box is multiplexed (see sqlbox_mux_run()),
+ * kept for the next opening of its source unless its transaction can't
+ * be rolled back.
+ * Returns FALSE if closing fails, TRUE otherwise.
+ */
+int
+sqlbox_db_release(struct sqlbox *box, struct sqlbox_db *db)
+{
+	int	 rc = 1;
+
+	assert(TAILQ_EMPTY(&db->stmtq));
+
 	/* 
 	 * Remove from queue so we don't double close, but let the
 	 * underlying close have us error out if it fails.
 	 */
 
 	TAILQ_REMOVE(&box->dbq, db, entries);
+	sqlbox_handle_free(&box->dbs, db->id);
+
+	if (box->mux != NULL && sqlbox_db_rollback(box, db)) {
+		sqlbox_stats_db(box, db);
+		db->id = 0;
+		TAILQ_INSERT_TAIL(&box->mux->idle->dbq, db, entries);
+		return 1;
+	}
+
+	sqlbox_stmtcache_clear(box, db);
+	sqlbox_debug(&box->cfg, "%s: %zu busy retries, %" PRIu64
+		" us waiting", db->src->fname, db->busyretries,
+		db->busywait);
+	sqlbox_stats_db(box, db);
 	sqlbox_debug(&box->cfg, "sqlite3_close: %s", db->src->fname);
-	if (sqlite3_close(db->db) != SQLITE_OK)
+	if (sqlite3_close(db->db) != SQLITE_OK) {
 		sqlbox_warnx(&box->cfg, "%s: close: %s", 
 			db->src->fname, sqlite3_errmsg(db->db));
-	else
-		rc = 1;
-
+		rc = 0;
+	}
 	free(db);
 	return rc;
 }
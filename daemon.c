@@ -0,0 +1,661 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include COMPAT_ENDIAN_H
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Fill in the address of "path".
+ * If it begins with "@", it's in the abstract namespace (Linux).
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_sun(const struct sqlbox_cfg *cfg, const char *path,
+	struct sockaddr_un *sun, socklen_t *len)
+{
+	size_t	 sz = strlen(path);
+
+	memset(sun, 0, sizeof(struct sockaddr_un));
+	sun->sun_family = AF_UNIX;
+	if (sz == 0 || sz >= sizeof(sun->sun_path)) {
+		sqlbox_warnx(cfg, "%s: bad socket path", path);
+		return 0;
+	}
+	memcpy(sun->sun_path, path, sz);
+	*len = offsetof(struct sockaddr_un, sun_path) + sz;
+
+	if (path[0] == '@')
+		sun->sun_path[0] = '\0';
+	else
+		*len += 1;
+	return 1;
+}
+
+/*
+ * Make a connected socket like those of sqlbox_socketpair().
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_sockopt(const struct sqlbox_cfg *cfg, int fd)
+{
+	int	 fl;
+
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+	fl = 1;
+	if (setsockopt(fd, SOL_SOCKET, 
+	    SO_NOSIGPIPE, &fl, sizeof(int)) == -1) {
+		sqlbox_warn(cfg, "setsockopt");
+		return 0;
+	}
+#endif
+	if ((fl = fcntl(fd, F_GETFL, 0)) == -1 ||
+	    fcntl(fd, F_SETFL, fl | O_NONBLOCK) == -1) {
+		sqlbox_warn(cfg, "fcntl");
+		return 0;
+	}
+	return 1;
+}
+
+int
+sqlbox_listen(const char *path, const struct sqlbox_cfg *cfg)
+{
+	struct sockaddr_un	 sun;
+	socklen_t		 len;
+	int			 fd;
+
+	if (!sqlbox_sun(cfg, path, &sun, &len))
+		return -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		sqlbox_warn(cfg, "socket");
+		return -1;
+	} else if (bind(fd, (struct sockaddr *)&sun, len) == -1) {
+		sqlbox_warn(cfg, "%s: bind", path);
+		close(fd);
+		return -1;
+	} else if (listen(fd, SOMAXCONN) == -1) {
+		sqlbox_warn(cfg, "%s: listen", path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+struct sqlbox *
+sqlbox_connect(const char *path, struct sqlbox_cfg *cfg)
+{
+	struct sockaddr_un	 sun;
+	socklen_t		 len;
+	struct sqlbox		*box;
+	int			 fd;
+
+	if (cfg != NULL && (cfg->flags & SQLBOX_CFG_RING)) {
+		sqlbox_warnx(cfg, "connect: shared-memory "
+			"transport not supported");
+		return NULL;
+	} else if (!sqlbox_cfg_vrfy(cfg)) {
+		sqlbox_warnx(cfg, "connect: sqlbox_cfg_vrfy");
+		return NULL;
+	} else if (!sqlbox_sun(cfg, path, &sun, &len))
+		return NULL;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		sqlbox_warn(cfg, "socket");
+		return NULL;
+	}
+	while (connect(fd, (struct sockaddr *)&sun, len) == -1)
+		if (errno != EINTR) {
+			sqlbox_warn(cfg, "%s: connect", path);
+			close(fd);
+			return NULL;
+		}
+
+	if (!sqlbox_sockopt(cfg, fd)) {
+		close(fd);
+		return NULL;
+	} else if ((box = sqlbox_attach(cfg, fd, (pid_t)-1, NULL)) == NULL) {
+		sqlbox_warnx(cfg, "connect: sqlbox_attach");
+		close(fd);
+		return NULL;
+	}
+	return box;
+}
+
+/*
+ * Whether the client of "box" must be served exclusively: it holds
+ * locks that would have other clients' operations wait on it.
+ * These are open transactions, including those begun by the client's
+ * own statements, and statements that have been stepped but not run to
+ * completion.
+ */
+static int
+sqlbox_mux_locked(const struct sqlbox *box)
+{
+	const struct sqlbox_db		*db;
+	const struct sqlbox_stmt	*st;
+
+	if (box->batchtrans)
+		return 1;
+	TAILQ_FOREACH(db, &box->dbq, entries)
+		if (db->trans || !sqlite3_get_autocommit(db->db))
+			return 1;
+	TAILQ_FOREACH(st, &box->stmtq, gentries)
+		if (st->rdb == NULL && sqlite3_stmt_busy(st->stmt))
+			return 1;
+	return 0;
+}
+
+/*
+ * Whether the operation in "frame" steps a statement of "box" with a
+ * reader connection, so it may be run by a worker thread.
+ */
+static int
+sqlbox_mux_parallel(struct sqlbox *box, const char *frame, size_t framesz)
+{
+	const struct sqlbox_stmt *st;
+	uint32_t		  v[2];
+
+	if (framesz < sizeof(v))
+		return 0;
+	memcpy(v, frame, sizeof(v));
+	switch (le32toh(v[0])) {
+	case SQLBOX_OP_STEP:
+	case SQLBOX_OP_STEP_TICKET:
+	case SQLBOX_OP_STREAM:
+		break;
+	default:
+		return 0;
+	}
+
+	/* Not finding it is an error for the operation to report. */
+
+	if (le32toh(v[1]) == 0)
+		st = TAILQ_LAST(&box->stmtq, sqlbox_stmtq);
+	else
+		st = sqlbox_handle_get(&box->stmts, le32toh(v[1]));
+	return st != NULL && st->rdb != NULL;
+}
+
+/*
+ * Allocate a multiplexer for boxes with configuration "cfg", which may
+ * be NULL.
+ * Returns the multiplexer or NULL on memory allocation failure.
+ */
+struct sqlbox_mux *
+sqlbox_mux_alloc(const struct sqlbox_cfg *cfg)
+{
+	struct sqlbox_mux	*mux;
+
+	if ((mux = calloc(1, sizeof(struct sqlbox_mux))) == NULL) {
+		sqlbox_warn(cfg, "calloc");
+		return NULL;
+	}
+	if (cfg != NULL)
+		mux->cfg = *cfg;
+	TAILQ_INIT(&mux->readq);
+
+	/* 
+	 * Sources released by clients are kept open on the queue of
+	 * this box, which has no client of its own.
+	 */
+
+	if ((mux->idle = sqlbox_attach
+	    (&mux->cfg, -1, (pid_t)-1, NULL)) == NULL) {
+		sqlbox_warnx(cfg, "sqlbox_attach");
+		free(mux);
+		return NULL;
+	}
+	return mux;
+}
+
+/*
+ * Whether the source of "db" is in write-ahead log mode, so that a
+ * reader connection holds no lock that writers wait on.
+ * This is queried each time as any writer may change the mode.
+ * Returns FALSE if not or it can't be determined, TRUE otherwise.
+ */
+int
+sqlbox_mux_wal(struct sqlbox *box, const struct sqlbox_db *db)
+{
+	sqlite3_stmt		*stmt;
+	const unsigned char	*mode;
+	int			 rc = 0;
+
+	if (sqlite3_prepare_v2(db->db, "PRAGMA journal_mode", 
+	    -1, &stmt, NULL) != SQLITE_OK) {
+		sqlbox_warnx(&box->cfg, "%s: sqlite3_prepare_v2: %s",
+			db->src->fname, sqlite3_errmsg(db->db));
+		return 0;
+	}
+	if (sqlite3_step(stmt) == SQLITE_ROW &&
+	    (mode = sqlite3_column_text(stmt, 0)) != NULL)
+		rc = strcmp((const char *)mode, "wal") == 0;
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+/*
+ * Get a connection to the source of "db", which must be opened by a
+ * multiplexed box, for a parallel statement: an idle one or a new one.
+ * Worker threads are started with the first.
+ * Returns the connection or NULL on failure.
+ */
+struct sqlbox_db *
+sqlbox_mux_reader_get(struct sqlbox *box, const struct sqlbox_db *db)
+{
+	struct sqlbox_mux	*mux = box->mux;
+	struct sqlbox_db	*rdb;
+
+	assert(mux != NULL);
+	if (mux->workers == NULL &&
+	    (mux->workers = sqlbox_workers_alloc(&mux->cfg)) == NULL) {
+		sqlbox_warnx(&box->cfg, "sqlbox_workers_alloc");
+		return NULL;
+	}
+
+	TAILQ_FOREACH(rdb, &mux->readq, entries)
+		if (rdb->idx == db->idx) {
+			TAILQ_REMOVE(&mux->readq, rdb, entries);
+			return rdb;
+		}
+
+	if ((rdb = calloc(1, sizeof(struct sqlbox_db))) == NULL) {
+		sqlbox_warn(&box->cfg, "calloc");
+		return NULL;
+	}
+	TAILQ_INIT(&rdb->stmtq);
+	TAILQ_INIT(&rdb->cacheq);
+	rdb->src = db->src;
+	rdb->idx = db->idx;
+	rdb->cachemax = db->cachemax;
+	if ((rdb->db = sqlbox_wrap_open(box, rdb->src)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: "
+			"sqlbox_wrap_open", rdb->src->fname);
+		free(rdb);
+		return NULL;
+	} else if (!sqlbox_db_tune(box, rdb)) {
+		sqlbox_warnx(&box->cfg, "%s: "
+			"sqlbox_db_tune", rdb->src->fname);
+		sqlite3_close(rdb->db);
+		free(rdb);
+		return NULL;
+	}
+	return rdb;
+}
+
+/*
+ * Return a connection from sqlbox_mux_reader_get() for other parallel
+ * statements, with its statement cache.
+ */
+void
+sqlbox_mux_reader_put(struct sqlbox *box, struct sqlbox_db *rdb)
+{
+
+	sqlbox_stats_db(box, rdb);
+	TAILQ_INSERT_HEAD(&box->mux->readq, rdb, entries);
+}
+
+/*
+ * Have the multiplexer serve "box" as well.
+ * Returns FALSE on memory allocation failure, TRUE on success.
+ */
+int
+sqlbox_mux_add(struct sqlbox_mux *mux, struct sqlbox *box)
+{
+	void	*pp;
+
+	if (mux->boxsz == mux->boxmax) {
+		pp = reallocarray(mux->boxes, 
+			mux->boxmax + 16, sizeof(struct sqlbox *));
+		if (pp == NULL) {
+			sqlbox_warn(&box->cfg, "reallocarray");
+			return 0;
+		}
+		mux->boxes = pp;
+		mux->boxmax += 16;
+	}
+	mux->boxes[mux->boxsz++] = box;
+	box->mux = mux;
+	return 1;
+}
+
+/*
+ * Create a box served by the multiplexer on the connected socket "fd",
+ * which it then owns.
+ * The box starts in the default role.
+ * Returns the box or NULL on failure.
+ */
+static struct sqlbox *
+sqlbox_mux_attach(struct sqlbox_mux *mux, int fd)
+{
+	struct sqlbox	*box;
+
+	if ((box = sqlbox_attach(&mux->cfg, fd, (pid_t)-1, NULL)) == NULL) {
+		sqlbox_warnx(&mux->cfg, "sqlbox_attach");
+		close(fd);
+		return NULL;
+	} else if (!sqlbox_roles_compile(box)) {
+		sqlbox_warnx(&mux->cfg, "sqlbox_roles_compile");
+		sqlbox_detach(box, 1);
+		return NULL;
+	} else if (!sqlbox_stats_alloc(box)) {
+		sqlbox_warnx(&mux->cfg, "sqlbox_stats_alloc");
+		sqlbox_detach(box, 1);
+		return NULL;
+	} else if (!sqlbox_mux_add(mux, box)) {
+		sqlbox_detach(box, 1);
+		return NULL;
+	}
+	return box;
+}
+
+/*
+ * The client of "box" has gone away (or is being dropped).
+ * Its sources are kept for other clients.
+ */
+static void
+sqlbox_mux_drop(struct sqlbox *box)
+{
+	struct sqlbox_db	*db;
+
+	sqlbox_stmt_release_all(box);
+	while ((db = TAILQ_FIRST(&box->dbq)) != NULL)
+		sqlbox_db_release(box, db);
+	sqlbox_detach(box, 1);
+}
+
+/*
+ * Drop all boxes of the multiplexer, close its sources, and free it.
+ */
+void
+sqlbox_mux_free(struct sqlbox_mux *mux)
+{
+	struct sqlbox_db	*db;
+	size_t			 i;
+
+	/* Workers first: they may be using boxes. */
+
+	sqlbox_workers_free(mux->workers);
+	for (i = 0; i < mux->boxsz; i++)
+		sqlbox_mux_drop(mux->boxes[i]);
+	while ((db = TAILQ_FIRST(&mux->readq)) != NULL) {
+		TAILQ_REMOVE(&mux->readq, db, entries);
+		TAILQ_INSERT_TAIL(&mux->idle->dbq, db, entries);
+	}
+	sqlbox_detach(mux->idle, 1);
+	free(mux->boxes);
+	free(mux);
+}
+
+/*
+ * Run all operations the client of "box" has sent.
+ * Reads block only to finish a frame that's been partly read.
+ * Stepping a parallel statement is handed to a worker, which also
+ * flushes the answers: the remaining operations wait for it.
+ * Returns FALSE if the client should be dropped, TRUE otherwise.
+ */
+static int
+sqlbox_mux_serve(struct sqlbox *box, char **buf, size_t *bufsz)
+{
+	const char	*frame;
+	size_t		 framesz;
+	int		 c;
+
+	do {
+		c = sqlbox_read_frame(box, buf, bufsz, &frame, &framesz);
+		if (c < 0) {
+			sqlbox_warnx(&box->cfg, "sqlbox_read_frame");
+			return 0;
+		} else if (c == 0)
+			return 0;
+		if (sqlbox_mux_parallel(box, frame, framesz)) {
+			if (sqlbox_workers_submit
+			    (box->mux->workers, box, frame, framesz))
+				return 1;
+			sqlbox_warnx(&box->cfg, "sqlbox_workers_submit");
+			return 0;
+		}
+		if (!sqlbox_dispatch(box, frame, framesz))
+			return 0;
+	} while (box->rbufpos < box->rbufsz);
+
+	/* Don't leave queued answers until the next read. */
+
+	if (!sqlbox_flush(box)) {
+		sqlbox_warnx(&box->cfg, "sqlbox_flush");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Accept a new client on "lfd" and give it a box of its own.
+ * Failing to accept isn't fatal to the daemon.
+ */
+static void
+sqlbox_mux_accept(struct sqlbox_mux *mux, int lfd)
+{
+	int	 fd;
+
+	if ((fd = accept(lfd, NULL, NULL)) == -1) {
+		if (errno != EINTR && errno != EAGAIN &&
+		    errno != EWOULDBLOCK && errno != ECONNABORTED)
+			sqlbox_warn(&mux->cfg, "accept");
+	} else if (!sqlbox_sockopt(&mux->cfg, fd))
+		close(fd);
+	else if (sqlbox_mux_attach(mux, fd) == NULL)
+		sqlbox_warnx(&mux->cfg, "sqlbox_mux_attach");
+}
+
+/*
+ * Remove "box", whose worker failed, from the multiplexer and drop it.
+ */
+static void
+sqlbox_mux_remove(struct sqlbox_mux *mux, struct sqlbox *box)
+{
+	size_t	 i;
+
+	for (i = 0; i < mux->boxsz; i++)
+		if (mux->boxes[i] == box)
+			break;
+	assert(i < mux->boxsz);
+	for ( ; i + 1 < mux->boxsz; i++)
+		mux->boxes[i] = mux->boxes[i + 1];
+	mux->boxsz--;
+	sqlbox_mux_drop(box);
+}
+
+/*
+ * Serve all boxes of the multiplexer, and new clients connecting to
+ * "lfd" if it's not -1, one operation at a time except for those
+ * handed to worker threads.
+ * Boxes may be added while running (see sqlbox_op_channel()).
+ * If "lfd" is -1, this returns TRUE once all clients have gone away;
+ * otherwise only on failure.
+ * The multiplexer and its boxes are freed on return.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_mux_run(struct sqlbox_mux *mux, int lfd)
+{
+	struct sqlbox		*box, *locked = NULL;
+	struct pollfd		*pfds = NULL;
+	size_t			 i, j, n, pfdmax = 0, bufsz = 0;
+	char			*buf = NULL;
+	void			*pp;
+	int			 rc = 0, timeo, c;
+
+	while (lfd != -1 || mux->boxsz > 0) {
+		if (mux->boxsz + 2 > pfdmax) {
+			pp = reallocarray(pfds, 
+				mux->boxmax + 2, sizeof(struct pollfd));
+			if (pp == NULL) {
+				sqlbox_warn(&mux->cfg, "reallocarray");
+				goto out;
+			}
+			pfds = pp;
+			pfdmax = mux->boxmax + 2;
+		}
+
+		/* 
+		 * Listen for new clients, finished workers, and from all
+		 * clients unless one holds locks: then only from that one.
+		 * Clients with a working worker are left alone.
+		 * Slot i + 2 is for boxes[i].
+		 * Don't wait if frames have already been read ahead.
+		 */
+
+		n = mux->boxsz;
+		pfds[0].fd = lfd;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		pfds[1].fd = mux->workers == NULL ? -1 :
+			sqlbox_workers_fd(mux->workers);
+		pfds[1].events = POLLIN;
+		pfds[1].revents = 0;
+		timeo = INFTIM;
+		for (i = 0; i < n; i++) {
+			box = mux->boxes[i];
+			pfds[i + 2].fd = !box->working &&
+				(locked == NULL || locked == box) ? 
+				box->fd : -1;
+			pfds[i + 2].events = POLLIN;
+			pfds[i + 2].revents = 0;
+			if (pfds[i + 2].fd != -1 && 
+			    box->rbufpos < box->rbufsz)
+				timeo = 0;
+		}
+
+		if (poll(pfds, n + 2, timeo) == -1) {
+			if (errno == EINTR)
+				continue;
+			sqlbox_warn(&mux->cfg, "poll");
+			goto out;
+		} else if (pfds[0].revents & (POLLERR|POLLNVAL)) {
+			sqlbox_warnx(&mux->cfg, "poll: listening socket");
+			goto out;
+		}
+
+		/* 
+		 * Boxes added while serving are appended after the first
+		 * "n", so move them down over dropped ones.
+		 */
+
+		for (i = j = 0; i < n; i++) {
+			box = mux->boxes[i];
+			if (!box->working &&
+			    (pfds[i + 2].revents != 0 ||
+			     box->rbufpos < box->rbufsz) &&
+			    (locked == NULL || locked == box) &&
+			    !sqlbox_mux_serve(box, &buf, &bufsz)) {
+				if (locked == box)
+					locked = NULL;
+				sqlbox_mux_drop(box);
+				continue;
+			}
+
+			/* Not ours until its worker is done. */
+
+			if (box->working) {
+				mux->boxes[j++] = box;
+				continue;
+			}
+			if (locked == NULL && sqlbox_mux_locked(box))
+				locked = box;
+			else if (locked == box && !sqlbox_mux_locked(box))
+				locked = NULL;
+			mux->boxes[j++] = box;
+		}
+		for ( ; i < mux->boxsz; i++)
+			mux->boxes[j++] = mux->boxes[i];
+		mux->boxsz = j;
+
+		/* Boxes whose workers have finished are served again. */
+
+		if (pfds[1].revents & POLLIN)
+			while ((box = sqlbox_workers_done
+			    (mux->workers, &c)) != NULL) {
+				if (c)
+					continue;
+				if (locked == box)
+					locked = NULL;
+				sqlbox_mux_remove(mux, box);
+			}
+
+		if (pfds[0].revents & POLLIN)
+			sqlbox_mux_accept(mux, lfd);
+	}
+
+	rc = 1;
+out:
+	sqlbox_mux_free(mux);
+	free(pfds);
+	free(buf);
+	return rc;
+}
+
+int
+sqlbox_daemon(struct sqlbox_cfg *cfg, int fd)
+{
+	struct sqlbox_mux	*mux;
+
+	if (cfg != NULL && (cfg->flags & SQLBOX_CFG_RING)) {
+		sqlbox_warnx(cfg, "daemon: shared-memory "
+			"transport not supported");
+		return 0;
+	} else if (!sqlbox_cfg_vrfy(cfg)) {
+		sqlbox_warnx(cfg, "daemon: sqlbox_cfg_vrfy");
+		return 0;
+	} else if ((mux = sqlbox_mux_alloc(cfg)) == NULL) {
+		sqlbox_warnx(cfg, "daemon: sqlbox_mux_alloc");
+		return 0;
+	}
+
+	/* As in sqlbox_serve(), but also accepting clients. */
+
+#if HAVE_PLEDGE
+	if (pledge((mux->cfg.flags & SQLBOX_CFG_CHANNEL) ?
+	    "stdio rpath cpath wpath flock fattr unix sendfd" :
+	    "stdio rpath cpath wpath flock fattr unix", NULL) == -1) {
+		sqlbox_warn(cfg, "daemon: pledge");
+		sqlbox_mux_free(mux);
+		return 0;
+	}
+#endif
+
+	sqlbox_mux_run(mux, fd);
+	return 0;
+}
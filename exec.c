@@ -32,25 +32,6 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-/*
- * Return TRUE if the current role has the ability to prepare the given
- * statement (or no roles are specified), FALSE if otherwise.
- */
-static int
-sqlbox_rolecheck_stmt(struct sqlbox *box, size_t idx)
-{
-	size_t	 i;
-
-	if (box->cfg.roles.rolesz == 0)
-		return 1;
-	for (i = 0; i < box->cfg.roles.roles[box->role].stmtsz; i++)
-		if (box->cfg.roles.roles[box->role].stmts[i] == idx)
-			return 1;
-	sqlbox_warnx(&box->cfg, "exec: statement "
-		"%zu denied to role %zu", idx, box->role);
-	return 0;
-}
-
 /*
  * Shared by both asynchronous and synchronous version.
  * Sends the exec instruction to the server.
@@ -118,20 +99,22 @@ sqlbox_exec_inner(struct sqlbox *box,
 	val = htole32(pos - 4);
 	memcpy(buf, (char *)&val, sizeof(uint32_t));
 
-	/* Write data, free our buffer. */
+	/* Queue data, free our buffer. */
 
-	if (!sqlbox_write(box, buf, pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
-		sqlbox_warnx(&box->cfg, "exec: sqlbox_write");
+	if (!sqlbox_queue(box, buf, pos)) {
+		sqlbox_warnx(&box->cfg, "exec: sqlbox_queue");
 		free(buf);
 		return 0;
 	}
 
+	sqlbox_stats_sent(box, op, 
+		buf + sizeof(uint32_t) * 2, pos - sizeof(uint32_t) * 2);
 	free(buf);
 	return 1;
 }
 
-int
-sqlbox_exec_async(struct sqlbox *box, size_t srcid, size_t pstmt, 
+static int
+sqlbox_exec_async_locked(struct sqlbox *box, size_t srcid, size_t pstmt, 
 	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
 {
 
@@ -144,8 +127,20 @@ sqlbox_exec_async(struct sqlbox *box, size_t srcid, size_t pstmt,
 	return 1;
 }
 
-enum sqlbox_code
-sqlbox_exec(struct sqlbox *box, size_t srcid, size_t pstmt, 
+int
+sqlbox_exec_async(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_exec_async_locked(box, srcid, pstmt, psz, ps, opts);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+static enum sqlbox_code
+sqlbox_exec_locked(struct sqlbox *box, size_t srcid, size_t pstmt, 
 	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
 {
 	uint32_t	 val;
@@ -164,14 +159,48 @@ sqlbox_exec(struct sqlbox *box, size_t srcid, size_t pstmt,
 	return (enum sqlbox_code)le32toh(val);
 }
 
+enum sqlbox_code
+sqlbox_exec(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
+{
+	enum sqlbox_code	 code;
+
+	sqlbox_lock_sync(box);
+	code = sqlbox_exec_locked(box, srcid, pstmt, psz, ps, opts);
+	sqlbox_unlock_sync(box);
+	return code;
+}
+
+size_t
+sqlbox_exec_submit(struct sqlbox *box, size_t srcid, size_t pstmt, 
+	size_t psz, const struct sqlbox_parm *ps, unsigned long opts)
+{
+	struct sqlbox_ticket	*t;
+
+	if ((t = sqlbox_ticket_alloc(box)) == NULL) {
+		sqlbox_warnx(&box->cfg, "exec-submit: sqlbox_ticket_alloc");
+		return 0;
+	} else if (!sqlbox_exec_inner(box, SQLBOX_OP_EXEC_TICKET,
+	    srcid, pstmt, psz, ps, opts)) {
+		sqlbox_warnx(&box->cfg, "exec-submit: sqlbox_exec_inner");
+		sqlbox_ticket_abort(box, t);
+		return 0;
+	}
+
+	return sqlbox_ticket_push(box, t, SQLBOX_OP_EXEC_TICKET, NULL);
+}
+
 /*
  * Prepare and bind parameters to a statement in one step.
  * Do not send anything back to the client: this is done by the caller
  * depending upon the mode.
  * Return the allocated statement on success, NULL on failure.
+ * If "denied" is not NULL, it's set if the role doesn't permit the
+ * statement.
  */
 static enum sqlbox_code
-sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz,
+	int *denied)
 {
 	size_t	 		 idx, cols, psz, parmsz;
 	struct sqlbox_db	*db;
@@ -213,12 +242,14 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 			"bad statement %zu", db->src->fname, idx);
 		return SQLBOX_CODE_ERROR;
 	}
-	if (!sqlbox_rolecheck_stmt(box, idx)) {
+	if (!sqlbox_rolecheck(box, SQLBOX_PERM_STMT, idx)) {
 		sqlbox_warnx(&box->cfg, "%s: exec: "
-			"sqlbox_rolecheck_stmt", db->src->fname);
+			"sqlbox_rolecheck", db->src->fname);
 		sqlbox_warnx(&box->cfg, "%s: exec: "
 			"statement: %s", db->src->fname, 
 			box->cfg.stmts.stmts[idx].stmt);
+		if (denied != NULL)
+			*denied = 1;
 		return SQLBOX_CODE_ERROR;
 	}
 	pst = &box->cfg.stmts.stmts[idx];
@@ -258,9 +289,9 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 				db->src->fname, pst->stmt);
 		}
 	} else {
-		if ((stmt = sqlbox_wrap_prep(box, db, pst)) == NULL) {
+		if ((stmt = sqlbox_stmtcache_get(box, db, idx)) == NULL) {
 			sqlbox_warnx(&box->cfg, 
-				"%s: exec: sqlbox_wrap_prep", 
+				"%s: exec: sqlbox_stmtcache_get", 
 				db->src->fname);
 			sqlbox_warnx(&box->cfg, "%s: exec: "
 				"statement: %s", 
@@ -277,7 +308,7 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 			sqlbox_warnx(&box->cfg, "%s: exec: "
 				"statement: %s", 
 				db->src->fname, pst->stmt);
-			sqlbox_wrap_finalise(box, db, pst, stmt);
+			sqlbox_stmtcache_put(box, db, idx, stmt);
 			free(parms);
 			return SQLBOX_CODE_ERROR;
 		}
@@ -301,7 +332,7 @@ sqlbox_op_exec(struct sqlbox *box, const char *buf, size_t sz)
 				"statement: %s", 
 				db->src->fname, pst->stmt);
 		}
-		sqlbox_wrap_finalise(box, db, pst, stmt);
+		sqlbox_stmtcache_put(box, db, idx, stmt);
 	}
 
 	return code;
@@ -313,7 +344,7 @@ sqlbox_op_exec_sync(struct sqlbox *box, const char *buf, size_t sz)
 	enum sqlbox_code code;
 	uint32_t	 ack;
 
-	code = sqlbox_op_exec(box, buf, sz);
+	code = sqlbox_op_exec(box, buf, sz, NULL);
 	if (code == SQLBOX_CODE_ERROR) {
 		sqlbox_warnx(&box->cfg, "exec-sync: sqlbox_op_exec");
 		return 0;
@@ -334,7 +365,7 @@ sqlbox_op_exec_async(struct sqlbox *box, const char *buf, size_t sz)
 {
 	enum sqlbox_code	 code;
 
-	code = sqlbox_op_exec(box, buf, sz);
+	code = sqlbox_op_exec(box, buf, sz, NULL);
 	if (code == SQLBOX_CODE_ERROR) {
 		sqlbox_warnx(&box->cfg, "exec-async: sqlbox_op_exec");
 		return 0;
@@ -342,3 +373,26 @@ sqlbox_op_exec_async(struct sqlbox *box, const char *buf, size_t sz)
 
 	return 1;
 }
+
+int
+sqlbox_op_exec_ticket(struct sqlbox *box, const char *buf, size_t sz)
+{
+	enum sqlbox_code	 code;
+	int			 denied = 0;
+
+	/* 
+	 * Errors are reported to the client, not fatal, except for
+	 * role violations as in the other modes.
+	 */
+
+	code = sqlbox_op_exec(box, buf, sz, &denied);
+	if (code == SQLBOX_CODE_ERROR)
+		sqlbox_warnx(&box->cfg, "exec-ticket: sqlbox_op_exec");
+	if (denied)
+		return 0;
+
+	if (sqlbox_ticket_reply(box, code, 0, 0))
+		return 1;
+	sqlbox_warnx(&box->cfg, "exec-ticket: sqlbox_ticket_reply");
+	return 0;
+}
@@ -0,0 +1,383 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Rows are packed into frames of about this size: a batch larger than
+ * this is sent as several frames, the last of which is answered.
+ */
+#define	SQLBOX_BATCH_MAX	(SQLBOX_FRAME * 64)
+
+static	const struct sqlbox_pstmt batch_begin = {
+	.stmt = (char *)"BEGIN IMMEDIATE TRANSACTION"
+};
+
+static	const struct sqlbox_pstmt batch_commit = {
+	.stmt = (char *)"COMMIT TRANSACTION"
+};
+
+/*
+ * Fill in the frame header in "buf", which is filled to "pos", then
+ * queue it.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_exec_batch_frame(struct sqlbox *box, char *buf, 
+	size_t pos, size_t first, size_t rows, int last)
+{
+	uint32_t	 val;
+
+	val = htole32(pos - 4);
+	memcpy(buf, (char *)&val, sizeof(uint32_t));
+	val = htole32(first);
+	memcpy(buf + sizeof(uint32_t) * 5, (char *)&val, sizeof(uint32_t));
+	val = htole32(rows);
+	memcpy(buf + sizeof(uint32_t) * 6, (char *)&val, sizeof(uint32_t));
+	val = htole32(last);
+	memcpy(buf + sizeof(uint32_t) * 7, (char *)&val, sizeof(uint32_t));
+
+	if (!sqlbox_queue(box, buf, pos)) {
+		sqlbox_warnx(&box->cfg, "exec-batch: sqlbox_queue");
+		return 0;
+	}
+	sqlbox_stats_sent(box, SQLBOX_OP_EXEC_BATCH, 
+		buf + sizeof(uint32_t) * 2, pos - sizeof(uint32_t) * 2);
+	return 1;
+}
+
+static enum sqlbox_code
+sqlbox_exec_batch_locked(struct sqlbox *box, size_t srcid, size_t pstmt,
+	size_t nrows, size_t ncols, const struct sqlbox_parm *ps,
+	unsigned long flags, enum sqlbox_code *codes)
+{
+	size_t		 i, pos, hdrsz, first = 0, 
+			 bufsz = SQLBOX_FRAME;
+	uint32_t	 val, *fails = NULL;
+	char		*buf;
+	enum sqlbox_code code = SQLBOX_CODE_OK;
+
+	if (nrows == 0)
+		return SQLBOX_CODE_OK;
+	if (nrows > UINT32_MAX) {
+		sqlbox_warnx(&box->cfg, "exec-batch: too many rows");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	/* Make sure explicit-sized strings are NUL terminated. */
+
+	for (i = 0; i < nrows * ncols; i++) 
+		if (ps[i].type == SQLBOX_PARM_STRING &&
+		    ps[i].sz > 0 &&
+		    ps[i].sparm[ps[i].sz - 1] != '\0') {
+			sqlbox_warnx(&box->cfg, "exec-batch: row %zu "
+				"parameter %zu is malformed", 
+				i / ncols, i % ncols);
+			return SQLBOX_CODE_ERROR;
+		}
+
+	if ((buf = calloc(bufsz, 1)) == NULL) {
+		sqlbox_warn(&box->cfg, "exec-batch: calloc");
+		return SQLBOX_CODE_ERROR;
+	}
+
+	/* 
+	 * Pack the header: frame size, operation, flags, source, and
+	 * statement, then the first row, number of rows, and whether
+	 * it's the last frame, which we fill in when flushing.
+	 */
+
+	pos = sizeof(uint32_t);
+	val = htole32(SQLBOX_OP_EXEC_BATCH);
+	memcpy(buf + pos, (char *)&val, sizeof(uint32_t));
+	pos += sizeof(uint32_t);
+	val = htole32(flags);
+	memcpy(buf + pos, (char *)&val, sizeof(uint32_t));
+	pos += sizeof(uint32_t);
+	val = htole32(srcid);
+	memcpy(buf + pos, (char *)&val, sizeof(uint32_t));
+	pos += sizeof(uint32_t);
+	val = htole32(pstmt);
+	memcpy(buf + pos, (char *)&val, sizeof(uint32_t));
+	pos += sizeof(uint32_t);
+	hdrsz = pos + sizeof(uint32_t) * 3;
+	pos = hdrsz;
+
+	/* Pack rows, flushing frames as they fill. */
+
+	for (i = 0; i < nrows; i++) {
+		if (!sqlbox_parm_pack(box, ncols, 
+		    &ps[i * ncols], &buf, &pos, &bufsz)) {
+			sqlbox_warnx(&box->cfg, 
+				"exec-batch: sqlbox_parm_pack");
+			free(buf);
+			return SQLBOX_CODE_ERROR;
+		}
+		if (pos < SQLBOX_BATCH_MAX && i < nrows - 1)
+			continue;
+		if (!sqlbox_exec_batch_frame(box, buf, pos,
+		    first, i - first + 1, i == nrows - 1)) {
+			sqlbox_warnx(&box->cfg, "exec-batch: "
+				"sqlbox_exec_batch_frame");
+			free(buf);
+			return SQLBOX_CODE_ERROR;
+		}
+		first = i + 1;
+		pos = hdrsz;
+	}
+	free(buf);
+
+	/* 
+	 * The last frame is answered with the number of rows that
+	 * violated constraints, then their indices.
+	 */
+
+	if (!sqlbox_read(box, (char *)&val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "exec-batch: sqlbox_read");
+		return SQLBOX_CODE_ERROR;
+	}
+	val = le32toh(val);
+
+	if (codes != NULL)
+		for (i = 0; i < nrows; i++)
+			codes[i] = SQLBOX_CODE_OK;
+	if (val == 0)
+		return SQLBOX_CODE_OK;
+
+	if (val > nrows) {
+		sqlbox_warnx(&box->cfg, "exec-batch: bad "
+			"number of rows: %" PRIu32, val);
+		return SQLBOX_CODE_ERROR;
+	} else if ((fails = calloc(val, sizeof(uint32_t))) == NULL) {
+		sqlbox_warn(&box->cfg, "exec-batch: calloc");
+		return SQLBOX_CODE_ERROR;
+	} else if (!sqlbox_read(box, 
+	           (char *)fails, val * sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "exec-batch: sqlbox_read");
+		free(fails);
+		return SQLBOX_CODE_ERROR;
+	}
+
+	for (i = 0; i < val; i++) {
+		if (le32toh(fails[i]) >= nrows) {
+			sqlbox_warnx(&box->cfg, "exec-batch: bad row: "
+				"%" PRIu32, le32toh(fails[i]));
+			code = SQLBOX_CODE_ERROR;
+			break;
+		}
+		if (codes != NULL)
+			codes[le32toh(fails[i])] = SQLBOX_CODE_CONSTRAINT;
+		code = SQLBOX_CODE_CONSTRAINT;
+	}
+
+	free(fails);
+	return code;
+}
+
+enum sqlbox_code
+sqlbox_exec_batch(struct sqlbox *box, size_t srcid, size_t pstmt,
+	size_t nrows, size_t ncols, const struct sqlbox_parm *ps,
+	unsigned long flags, enum sqlbox_code *codes)
+{
+	enum sqlbox_code	 code;
+
+	sqlbox_lock_sync(box);
+	code = sqlbox_exec_batch_locked(box, srcid, pstmt, nrows, ncols,
+		ps, flags, codes);
+	sqlbox_unlock_sync(box);
+	return code;
+}
+
+/*
+ * Execute one frame of a batch, appending the indices of rows violating
+ * constraints to the box.
+ * If this is the first frame, open the transaction, if asked; if the
+ * last, close it and write back the violating rows.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_exec_batch(struct sqlbox *box, const char *buf, size_t sz)
+{
+	size_t			 i, idx, first, rows, cols, psz, parmsz;
+	uint32_t		 val;
+	struct sqlbox_db	*db;
+	sqlite3_stmt		*stmt;
+	const struct sqlbox_pstmt *pst;
+	struct sqlbox_parm	*parms;
+	unsigned long		 flags;
+	int			 last;
+	enum sqlbox_code	 code;
+	void			*pp;
+
+	if (sz < sizeof(uint32_t) * 6) {
+		sqlbox_warnx(&box->cfg, "exec-batch: bad frame size");
+		return 0;
+	}
+
+	flags = le32toh(((const uint32_t *)buf)[0]);
+	db = sqlbox_db_find(box, le32toh(((const uint32_t *)buf)[1]));
+	idx = le32toh(((const uint32_t *)buf)[2]);
+	first = le32toh(((const uint32_t *)buf)[3]);
+	rows = le32toh(((const uint32_t *)buf)[4]);
+	last = le32toh(((const uint32_t *)buf)[5]);
+	buf += sizeof(uint32_t) * 6;
+	sz -= sizeof(uint32_t) * 6;
+
+	if (db == NULL) {
+		sqlbox_warnx(&box->cfg, "exec-batch: sqlbox_db_find");
+		return 0;
+	} else if (idx >= box->cfg.stmts.stmtsz) {
+		sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+			"bad statement %zu", db->src->fname, idx);
+		return 0;
+	} else if (!sqlbox_rolecheck(box, SQLBOX_PERM_STMT, idx)) {
+		sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+			"sqlbox_rolecheck", db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+			"statement: %s", db->src->fname, 
+			box->cfg.stmts.stmts[idx].stmt);
+		return 0;
+	}
+	pst = &box->cfg.stmts.stmts[idx];
+
+	/* The first frame starts the batch. */
+
+	if (first == 0) {
+		box->batchsz = 0;
+		box->batchtrans = 0;
+		if (flags & SQLBOX_STMT_TRANS) {
+			if (db->trans) {
+				sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+					"transaction %zu already open", 
+					db->src->fname, db->trans);
+				return 0;
+			}
+			if (sqlbox_wrap_exec(box, db, &batch_begin, 0) !=
+			    SQLBOX_CODE_OK) {
+				sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+					"sqlbox_wrap_exec", db->src->fname);
+				return 0;
+			}
+			box->batchtrans = 1;
+		}
+	}
+
+	if ((stmt = sqlbox_stmtcache_get(box, db, idx)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+			"sqlbox_stmtcache_get", db->src->fname);
+		sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+			"statement: %s", db->src->fname, pst->stmt);
+		return 0;
+	}
+
+	for (i = 0; i < rows; i++) {
+		psz = sqlbox_parm_unpack(box, &parms, &parmsz, buf, sz);
+		if (psz == 0) {
+			sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+				"sqlbox_parm_unpack", db->src->fname);
+			break;
+		}
+		buf += psz;
+		sz -= psz;
+
+		if (!sqlbox_parm_bind
+		    (box, db, pst, stmt, parms, parmsz)) {
+			sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+				"sqlbox_parm_bind", db->src->fname);
+			free(parms);
+			break;
+		}
+		free(parms);
+
+		code = sqlbox_wrap_step(box, db, pst, stmt, 
+			&cols, (flags & SQLBOX_STMT_CONSTRAINT));
+		if (code == SQLBOX_CODE_ERROR) {
+			sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+				"sqlbox_wrap_step: row %zu", 
+				db->src->fname, first + i);
+			break;
+		}
+
+		/* Reset returns the step's constraint: ignore it. */
+
+		(void)sqlite3_reset(stmt);
+		if (code != SQLBOX_CODE_CONSTRAINT)
+			continue;
+
+		if (box->batchsz == box->batchmax) {
+			pp = reallocarray(box->batch, box->batchmax == 0 ? 
+				64 : box->batchmax * 2, sizeof(uint32_t));
+			if (pp == NULL) {
+				sqlbox_warn(&box->cfg, "reallocarray");
+				break;
+			}
+			box->batch = pp;
+			box->batchmax = box->batchmax == 0 ?
+				64 : box->batchmax * 2;
+		}
+		box->batch[box->batchsz++] = htole32(first + i);
+	}
+
+	sqlbox_stmtcache_put(box, db, idx, stmt);
+
+	if (i < rows) {
+		sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+			"statement: %s", db->src->fname, pst->stmt);
+		return 0;
+	} else if (sz != 0) {
+		sqlbox_warnx(&box->cfg, "exec-batch: bad frame size");
+		return 0;
+	} else if (!last)
+		return 1;
+
+	/* The last frame ends the batch. */
+
+	if (box->batchtrans) {
+		box->batchtrans = 0;
+		if (sqlbox_wrap_exec(box, db, &batch_commit, 0) !=
+		    SQLBOX_CODE_OK) {
+			sqlbox_warnx(&box->cfg, "%s: exec-batch: "
+				"sqlbox_wrap_exec", db->src->fname);
+			return 0;
+		}
+	}
+
+	val = htole32(box->batchsz);
+	if (!sqlbox_write(box, (char *)&val, sizeof(uint32_t)) ||
+	    (box->batchsz > 0 && !sqlbox_write(box, (char *)box->batch, 
+	     box->batchsz * sizeof(uint32_t)))) {
+		sqlbox_warnx(&box->cfg, "exec-batch: sqlbox_write");
+		return 0;
+	}
+	box->batchsz = 0;
+	return 1;
+}
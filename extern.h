@@ -19,31 +19,75 @@
 
 /*
  * This is an important value.
- * It's the size of the "baseline" frame for transferring data and
+ * It's the size of the "baseline" buffer for transferring data and
  * operations.
- * It should be less than the block size for socketpair() but big enough
- * to hold an average payload of data (parameters to bind, results).
+ * Frames on the wire are exactly as long as their payload (plus the
+ * length and operation header), so this is only used for sizing
+ * buffers: it should be big enough to hold an average payload of data
+ * (parameters to bind, results) without reallocation.
  */
 #define	SQLBOX_FRAME	1024
 
+/*
+ * Frames for asynchronous operations are queued until a response is
+ * needed or the queue would grow beyond this.
+ */
+#define	SQLBOX_QUEUE_MAX (SQLBOX_FRAME * 64)
+
+/*
+ * Size of the buffer used to read ahead of small reads, which lets the
+ * server consume several queued frames with each read.
+ */
+#define	SQLBOX_READ_AHEAD (SQLBOX_FRAME * 16)
+
+/*
+ * Maximum unanswered tickets before the client reads their answers.
+ * Otherwise, both sides might block writing: the client its requests
+ * and the server its answers.
+ * Answers are 16 bytes, so this keeps them well within the socket or
+ * ring buffer.
+ */
+#define	SQLBOX_TICKET_MAX 1024
+
+/*
+ * Maximum length of a frame read by a multiplexer, which serves all of
+ * its clients from one buffer.
+ * A client sending a longer frame is dropped.
+ */
+#define	SQLBOX_MUX_FRAME_MAX (SQLBOX_FRAME * 1024 * 16)
+
 enum	sqlbox_op {
+	SQLBOX_OP_CHANNEL,
 	SQLBOX_OP_CLOSE,
 	SQLBOX_OP_EXEC_ASYNC,
+	SQLBOX_OP_EXEC_BATCH,
 	SQLBOX_OP_EXEC_SYNC,
+	SQLBOX_OP_EXEC_TICKET,
 	SQLBOX_OP_FINAL,
+	SQLBOX_OP_FLIGHT,
 	SQLBOX_OP_LASTID,
+	SQLBOX_OP_LASTID_TICKET,
 	SQLBOX_OP_MSG_SET_DAT,
+	SQLBOX_OP_MSG_SET_SLOW,
 	SQLBOX_OP_OPEN_ASYNC,
 	SQLBOX_OP_OPEN_SYNC,
+	SQLBOX_OP_OPEN_TICKET,
 	SQLBOX_OP_PING,
+	SQLBOX_OP_PREFETCH,
 	SQLBOX_OP_PREPARE_BIND_ASYNC,
 	SQLBOX_OP_PREPARE_BIND_SYNC,
+	SQLBOX_OP_PREPARE_BIND_TICKET,
 	SQLBOX_OP_REBIND,
+	SQLBOX_OP_RESET,
 	SQLBOX_OP_ROLE,
+	SQLBOX_OP_STATS,
 	SQLBOX_OP_STEP,
+	SQLBOX_OP_STEP_TICKET,
+	SQLBOX_OP_STMT_STATS,
+	SQLBOX_OP_STREAM,
 	SQLBOX_OP_TRANS_CLOSE,
 	SQLBOX_OP_TRANS_OPEN,
-	SQLBOX_OP__MAX
+	SQLBOX_OP__MAX /* at most SQLBOX_STATS_OPS (see stats.c) */
 };
 
 /*
@@ -60,6 +104,17 @@ struct	sqlbox_res {
 	int			 done;
 };
 
+/*
+ * A batch of rows pushed to a streaming statement (client only) and
+ * not yet returned by sqlbox_step().
+ */
+struct	sqlbox_push {
+	struct sqlbox_res	 res; /* parsed batch */
+	TAILQ_ENTRY(sqlbox_push) entries;
+};
+
+TAILQ_HEAD(sqlbox_pushq, sqlbox_push);
+
 /*
  * A statement.
  */
@@ -69,14 +124,49 @@ struct	sqlbox_stmt {
 	size_t			 id; /* statement identifier */
 	const struct sqlbox_pstmt *pstmt; /* prepared statement */
 	struct sqlbox_db	*db; /* source */
+	struct sqlbox_db	*rdb; /* reader connection or NULL (server) */
 	struct sqlbox_res	 res; /* results, if any */
 	unsigned long		 flags; /* stepping flags */
+	size_t			 pf_rows; /* prefetch rows or 0 (any) */
+	size_t			 pf_bytes; /* prefetch bytes or 0 (default) */
+	size_t			 pf_window; /* adaptive window in rows */
+	size_t			 stream; /* stream credits or 0 (client) */
+	size_t			 granted; /* credits outstanding (client) */
+	int			 streamend; /* got last batch (client) */
+	size_t			 stepping; /* step tickets outstanding (client) */
+	struct sqlbox_pushq	 pushq; /* pushed batches (client) */
 	TAILQ_ENTRY(sqlbox_stmt) entries; /* per-database */
 	TAILQ_ENTRY(sqlbox_stmt) gentries; /* global */
 };
 
 TAILQ_HEAD(sqlbox_stmtq, sqlbox_stmt);
 
+/*
+ * Default maximum number of compiled statements cached per database.
+ */
+#define	SQLBOX_STMTCACHE_MAX	64
+
+/*
+ * Default back-off from a busy or locked database: the first wait and
+ * the longest in microseconds, and the percentage of each randomised.
+ */
+#define	SQLBOX_BACKOFF		1000
+#define	SQLBOX_BACKOFF_MAX	100000
+#define	SQLBOX_BACKOFF_JITTER	50
+
+/*
+ * A compiled statement not in use, kept for the next preparation of the
+ * same statement on the same database (server only).
+ */
+struct	sqlbox_cstmt {
+	sqlite3_stmt		*stmt; /* reset statement */
+	size_t			 idx; /* statement idx */
+	TAILQ_ENTRY(sqlbox_cstmt) entries; /* lru (newest first) */
+	TAILQ_ENTRY(sqlbox_cstmt) ientries; /* by statement idx */
+};
+
+TAILQ_HEAD(sqlbox_cstmtq, sqlbox_cstmt);
+
 /*
  * A database connection.
  * There can be any number of these simultaneously in existence.
@@ -85,6 +175,15 @@ TAILQ_HEAD(sqlbox_stmtq, sqlbox_stmt);
 struct	sqlbox_db {
 	sqlite3			*db; /* database or NULL */
 	struct sqlbox_stmtq	 stmtq; /* used list */
+	struct sqlbox_cstmtq	 cacheq; /* cached statements */
+	struct sqlbox_cstmtq	*cacheidx; /* cached by idx or NULL */
+	size_t			 cachesz; /* length of cacheq */
+	size_t			 cachemax; /* maximum length of cacheq */
+	size_t			 cachehits; /* found in cache */
+	size_t			 cachemiss; /* not found in cache */
+	size_t			 busyretries; /* retries when busy or locked */
+	uint64_t		 busywait; /* microseconds backed off */
+	uint64_t		 busynow; /* of current busy handling */
 	size_t			 id; /* source identifier */
 	size_t			 idx; /* source idx */
 	size_t		 	 trans; /* if >0, exp. transaction */
@@ -94,18 +193,197 @@ struct	sqlbox_db {
 
 TAILQ_HEAD(sqlbox_dbq, sqlbox_db);
 
+/*
+ * Credits granted to a streaming statement (client only).
+ * The server answers each credit with exactly one frame, in order, so
+ * these say whose rows are next on the wire.
+ */
+struct	sqlbox_grant {
+	struct sqlbox_stmt	*st; /* streaming statement */
+	size_t			 credits; /* frames yet to be read */
+	TAILQ_ENTRY(sqlbox_grant) entries;
+};
+
+TAILQ_HEAD(sqlbox_grantq, sqlbox_grant);
+
+/*
+ * A slot in a table of identifiers (see handle.c).
+ */
+struct	sqlbox_handle {
+	void			*p; /* object or NULL if unused */
+	size_t			 id; /* identifier (kept when unused) */
+	size_t			 next; /* next unused slot plus one */
+};
+
+struct	sqlbox_handles {
+	struct sqlbox_handle	*hs; /* slots */
+	size_t			 hsz; /* number of slots */
+	size_t			 free; /* first unused slot plus one */
+};
+
+/*
+ * Permissions checked by sqlbox_rolecheck().
+ */
+enum	sqlbox_perm {
+	SQLBOX_PERM_ROLE, /* transition to role */
+	SQLBOX_PERM_SRC, /* open or close source */
+	SQLBOX_PERM_STMT, /* prepare or exec statement */
+	SQLBOX_PERM__MAX
+};
+
+/*
+ * Per-role bitsets of one permission, compiled from struct sqlbox_roles
+ * by sqlbox_roles_compile().
+ * Role "r" has the bits at bits[r * words].
+ */
+struct	sqlbox_perms {
+	uint64_t		*bits; /* bitsets of all roles */
+	size_t			 words; /* words per role */
+	size_t			 max; /* number of bits per role */
+};
+
+/*
+ * An operation submitted with a ticket (client).
+ * The server answers these in order, so the oldest outstanding ticket
+ * is always the next to be answered.
+ */
+struct	sqlbox_ticket {
+	enum sqlbox_op		 op; /* submitted operation */
+	struct sqlbox_stmt	*st; /* statement being prepared or NULL */
+	struct sqlbox_stmt	*step; /* statement being stepped or NULL */
+	int			 done; /* answer has been read */
+	int			 waited; /* being waited on (shared) */
+	struct sqlbox_result	 res; /* answer, if done */
+	TAILQ_ENTRY(sqlbox_ticket) entries;
+};
+
+TAILQ_HEAD(sqlbox_ticketq, sqlbox_ticket);
+
+/*
+ * Boxes forked ahead of time by sqlbox_pool_alloc() (client).
+ * Each has opened the sources in "srcs", in order, so they have the
+ * identifiers one through "srcsz".
+ */
+struct	sqlbox_pool {
+	struct sqlbox_cfg	*cfg; /* configuration of all boxes */
+	size_t			*srcs; /* sources opened by each box */
+	size_t			 srcsz; /* length of srcs */
+	struct sqlbox		**boxes; /* idle boxes */
+	size_t			 boxsz; /* number of idle boxes */
+	size_t			 boxmax; /* allocated size of boxes */
+};
+
+/*
+ * A process forked early on to fork boxes (client).
+ * See sqlbox_launcher_alloc().
+ */
+struct	sqlbox_launcher {
+	int			 fd; /* control channel */
+	pid_t			 pid; /* launcher process */
+};
+
+/*
+ * Boxes served one operation at a time by one process (server), sharing
+ * the sources they've released.
+ * See sqlbox_daemon() and sqlbox_op_channel().
+ */
+struct	sqlbox_mux {
+	struct sqlbox_cfg	 cfg; /* configuration of new boxes */
+	struct sqlbox		*idle; /* holds released sources */
+	struct sqlbox_dbq	 readq; /* idle reader connections */
+	struct sqlbox_workers	*workers; /* for parallel statements */
+	struct sqlbox		**boxes; /* boxes being served */
+	size_t			 boxsz; /* number of boxes */
+	size_t			 boxmax; /* allocated size of boxes */
+};
+
+/*
+ * Worker threads stepping SQLBOX_STMT_PARALLEL statements of a
+ * multiplexer.
+ */
+#define	SQLBOX_WORKERS	 4
+
+struct	sqlbox_lock;
+struct	sqlbox_workers;
+struct	sqlbox_ring;
+struct	iovec;
+
+/*
+ * What the operation being run has worked on, reported if it's slow
+ * (server).
+ * The database is only valid while the operation runs.
+ */
+struct	sqlbox_slowrec {
+	const struct sqlbox_db	  *db; /* database or NULL */
+	const struct sqlbox_pstmt *pst; /* statement or NULL */
+	size_t			   retries; /* of db when noted */
+	uint64_t		   rows; /* rows stepped */
+};
+
 struct	sqlbox {
 	struct sqlbox_cfg 	 cfg; /* configuration */
 	size_t			 role; /* current role */
 	struct sqlbox_dbq	 dbq; /* all databases */
 	struct sqlbox_stmtq	 stmtq; /* all statements */
+	struct sqlbox_handles	 dbs; /* databases by id */
+	struct sqlbox_handles	 stmts; /* statements by id */
 	int		  	 fd; /* comm channel or -1 */
-	size_t			 lastid; /* last db id */
 	pid_t		  	 pid; /* child or (pid_t)-1 */
 	int			 free_msg_dat; /* free sqlbox_msg dat? */
+	void			*ring; /* shared-memory transport or NULL */
+	struct sqlbox_ring	*ring_tx; /* ring we write (if ring) */
+	struct sqlbox_ring	*ring_rx; /* ring we read (if ring) */
+	size_t			 ring_spin; /* polls before sleeping */
+	char			*wbuf; /* queued frames */
+	size_t			 wbufsz; /* length of queued frames */
+	size_t			 wbufmax; /* allocated size of wbuf */
+	char			*rbuf; /* read-ahead buffer or NULL */
+	size_t			 rbufpos; /* position in rbuf */
+	size_t			 rbufsz; /* length of data in rbuf */
+	size_t			 rbufmax; /* allocated size of rbuf */
+	int			 wbufdrain; /* drain streams before writing */
+	int			 draining; /* reading pushed frames */
+	struct sqlbox_grantq	 grantq; /* credits in flight (client) */
+	struct sqlbox_ticketq	 ticketq; /* submitted (client) */
+	struct sqlbox_ticket	*ticketnext; /* oldest unanswered */
+	size_t			 ticketpend; /* tickets unanswered */
+	size_t			 ticketlast; /* last ticket number */
+	struct sqlbox_perms	 perms[SQLBOX_PERM__MAX]; /* (server) */
+	uint32_t		*batch; /* batch constraint rows (server) */
+	size_t			 batchsz; /* length of batch */
+	size_t			 batchmax; /* allocated size of batch */
+	int			 batchtrans; /* batch opened transaction */
+	struct sqlbox_mux	*mux; /* serving us (server) or NULL */
+	int			 working; /* operation on a worker (server) */
+	struct sqlbox_lock	*lock; /* if SQLBOX_CFG_SHARED (client) */
+	struct sqlbox_stats	 stats; /* see sqlbox_stats() */
+	struct sqlbox_stmtstats	*stmtstats; /* by statement (server) */
+	enum sqlbox_op		 statop; /* last frame written (client) */
+	uint64_t		 statstart; /* when statop was written */
+	struct sqlbox_slowrec	 slow; /* of current operation (server) */
+	struct sqlbox_flightev	 flight[SQLBOX_FLIGHT_EVENTS]; /* recorder */
+	size_t			 flightpos; /* events ever recorded */
 };
 
-void	 sqlbox_sleep(size_t);
+int	 sqlbox_backoff(const struct sqlbox_tune *, size_t, uint64_t *);
+uint64_t sqlbox_flight(struct sqlbox *, uint32_t, uint32_t,
+		const char *, size_t, uint64_t);
+void	 sqlbox_flight_warn(struct sqlbox *);
+struct sqlbox *sqlbox_attach(const struct sqlbox_cfg *, int, pid_t, void *);
+int	 sqlbox_cfg_vrfy(const struct sqlbox_cfg *);
+int	 sqlbox_db_release(struct sqlbox *, struct sqlbox_db *);
+int	 sqlbox_db_rollback(struct sqlbox *, struct sqlbox_db *);
+int	 sqlbox_db_tune(struct sqlbox *, struct sqlbox_db *);
+void	 sqlbox_detach(struct sqlbox *, int);
+int	 sqlbox_dispatch(struct sqlbox *, const char *, size_t);
+void	 sqlbox_serve(const struct sqlbox_cfg *, int, void *)
+		__attribute__((noreturn));
+int	 sqlbox_socketpair(const struct sqlbox_cfg *, int [2], int);
+size_t	 sqlbox_handle_alloc(struct sqlbox *, struct sqlbox_handles *, void *);
+void	 sqlbox_handle_clear(struct sqlbox_handles *);
+void	 sqlbox_handle_free(struct sqlbox_handles *, size_t);
+void	*sqlbox_handle_get(const struct sqlbox_handles *, size_t);
+int	 sqlbox_handle_set(struct sqlbox *, struct sqlbox_handles *, size_t, void *);
 struct sqlbox_db *sqlbox_db_find(struct sqlbox *, size_t);
 struct sqlbox_stmt *sqlbox_stmt_find(struct sqlbox *, size_t);
 void	 sqlbox_warn(const struct sqlbox_cfg *, const char *, ...)
@@ -115,8 +393,66 @@ void	 sqlbox_warnx(const struct sqlbox_cfg *, const char *, ...)
 void	 sqlbox_debug(const struct sqlbox_cfg *, const char *, ...)
 		__attribute__((format(printf, 2, 3)));
 int	 sqlbox_main_loop(struct sqlbox *);
+void	 sqlbox_lock(struct sqlbox *);
+int	 sqlbox_lock_alloc(struct sqlbox *);
+void	 sqlbox_lock_free(struct sqlbox *);
+int	 sqlbox_lock_poll(struct sqlbox *);
+int	 sqlbox_lock_reader(struct sqlbox *);
+void	 sqlbox_lock_sync(struct sqlbox *);
+void	 sqlbox_lock_unreader(struct sqlbox *);
+void	 sqlbox_unlock(struct sqlbox *);
+void	 sqlbox_unlock_sync(struct sqlbox *);
+struct sqlbox_workers *sqlbox_workers_alloc(const struct sqlbox_cfg *);
+struct sqlbox *sqlbox_workers_done(struct sqlbox_workers *, int *);
+int	 sqlbox_workers_fd(const struct sqlbox_workers *);
+void	 sqlbox_workers_free(struct sqlbox_workers *);
+int	 sqlbox_workers_submit(struct sqlbox_workers *, 
+		struct sqlbox *, const char *, size_t);
+int	 sqlbox_mux_add(struct sqlbox_mux *, struct sqlbox *);
+struct sqlbox_mux *sqlbox_mux_alloc(const struct sqlbox_cfg *);
+void	 sqlbox_mux_free(struct sqlbox_mux *);
+int	 sqlbox_mux_wal(struct sqlbox *, const struct sqlbox_db *);
+struct sqlbox_db *sqlbox_mux_reader_get(struct sqlbox *, const struct sqlbox_db *);
+void	 sqlbox_mux_reader_put(struct sqlbox *, struct sqlbox_db *);
+int	 sqlbox_mux_run(struct sqlbox_mux *, int);
+int	 sqlbox_rolecheck(struct sqlbox *, enum sqlbox_perm, size_t);
+int	 sqlbox_stats_alloc(struct sqlbox *);
+void	 sqlbox_stats_answer(struct sqlbox *);
+void	 sqlbox_stats_db(struct sqlbox *, struct sqlbox_db *);
+uint64_t sqlbox_stats_now(void);
+void	 sqlbox_stats_sent(struct sqlbox *, enum sqlbox_op,
+		const char *, size_t);
+struct sqlbox_stmtstats *sqlbox_stats_stmt(struct sqlbox *,
+		const struct sqlbox_pstmt *);
+void	 sqlbox_stats_time(struct sqlbox_opstats *, uint64_t);
+void	 sqlbox_slow_note(struct sqlbox *, const struct sqlbox_db *,
+		const struct sqlbox_pstmt *);
+void	 sqlbox_slow_report(struct sqlbox *, enum sqlbox_op, uint64_t);
+void	 sqlbox_stmtcache_clear(struct sqlbox *, struct sqlbox_db *);
+sqlite3_stmt *sqlbox_stmtcache_get(struct sqlbox *, struct sqlbox_db *, size_t);
+void	 sqlbox_stmtcache_put(struct sqlbox *, struct sqlbox_db *,
+		size_t, sqlite3_stmt *);
+int	 sqlbox_roles_compile(struct sqlbox *);
+void	 sqlbox_roles_free(struct sqlbox *);
 void	 sqlbox_res_clear(struct sqlbox_res *);
+int	 sqlbox_res_parse(struct sqlbox *, struct sqlbox_res *,
+		const char *, size_t);
+int	 sqlbox_stmt_batch(struct sqlbox *, struct sqlbox_stmt *);
+int	 sqlbox_stream_drain(struct sqlbox *);
+int	 sqlbox_stream_next(struct sqlbox *, struct sqlbox_stmt *);
+void	 sqlbox_ticket_abort(struct sqlbox *, struct sqlbox_ticket *);
+struct sqlbox_ticket *sqlbox_ticket_alloc(struct sqlbox *);
+int	 sqlbox_ticket_drain(struct sqlbox *);
+void	 sqlbox_ticket_free(struct sqlbox_ticket *);
+int	 sqlbox_ticket_read(struct sqlbox *);
+int	 sqlbox_ticket_ready(struct sqlbox *, size_t *);
+size_t	 sqlbox_ticket_push(struct sqlbox *, struct sqlbox_ticket *,
+		enum sqlbox_op, struct sqlbox_stmt *);
+int	 sqlbox_ticket_reply(struct sqlbox *, enum sqlbox_code, size_t, int64_t);
 
+int			 sqlbox_wrap_backoff(struct sqlbox *,
+				struct sqlbox_db *, size_t, uint64_t *);
+int			 sqlbox_wrap_busy(void *, int);
 enum sqlbox_code	 sqlbox_wrap_exec(struct sqlbox *,
 				struct sqlbox_db *, 
 				const struct sqlbox_pstmt *, int);
@@ -134,8 +470,25 @@ enum sqlbox_code	 sqlbox_wrap_step(struct sqlbox *,
 				const struct sqlbox_pstmt *,
 				sqlite3_stmt *, size_t *, int);
 
+void	*sqlbox_ring_alloc(const struct sqlbox_cfg *);
+void	 sqlbox_ring_attach(struct sqlbox *, void *, int);
+ssize_t	 sqlbox_ring_read(struct sqlbox *, char *, size_t);
+void	 sqlbox_ring_unmap(void *);
+int	 sqlbox_ring_writev(struct sqlbox *, const struct iovec *, int);
+ssize_t	 sqlbox_ring_tryread(struct sqlbox *, char *, size_t);
+ssize_t	 sqlbox_ring_trywrite(struct sqlbox *, const char *, size_t);
+int	 sqlbox_ring_wakeups(struct sqlbox *);
+
+ssize_t	 sqlbox_fill_some(struct sqlbox *, size_t);
+int	 sqlbox_flush_some(struct sqlbox *);
+int	 sqlbox_queue(struct sqlbox *, const char *, size_t);
 int	 sqlbox_read(struct sqlbox *, char *, size_t);
+int	 sqlbox_read_full(struct sqlbox *, char *, size_t, int);
+int	 sqlbox_send_frame(struct sqlbox *,
+		enum sqlbox_op, const char *, size_t);
 int	 sqlbox_read_frame(struct sqlbox *, char **, size_t *, const char **, size_t *);
+int	 sqlbox_recvfd(struct sqlbox *, int *);
+int	 sqlbox_sendfd(struct sqlbox *, int);
 int	 sqlbox_write(struct sqlbox *, const char *, size_t);
 int	 sqlbox_write_frame(struct sqlbox *,
 		enum sqlbox_op, const char *, size_t);
@@ -148,23 +501,39 @@ int	 sqlbox_parm_pack(struct sqlbox *, size_t,
 size_t	 sqlbox_parm_unpack(struct sqlbox *, struct sqlbox_parm **, 
 		size_t *, const char *, size_t);
 
+int	 sqlbox_op_channel(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_close(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_exec_async(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_exec_batch(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_exec_sync(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_exec_ticket(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_finalise(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_flight(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_lastid(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_lastid_ticket(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_msg_set_dat(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_msg_set_slow(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_open_async(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_open_sync(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_open_ticket(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_ping(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_prefetch(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_prepare_bind_async(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_prepare_bind_sync(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_prepare_bind_ticket(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_rebind(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_reset(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_role(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_stats(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_step(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_step_ticket(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_stmt_stats(struct sqlbox *, const char *, size_t);
+int	 sqlbox_op_stream(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_trans_close(struct sqlbox *, const char *, size_t);
 int	 sqlbox_op_trans_open(struct sqlbox *, const char *, size_t);
 
 void	 sqlbox_stmt_free(struct sqlbox_stmt *);
+void	 sqlbox_stmt_release(struct sqlbox *, struct sqlbox_stmt *);
+void	 sqlbox_stmt_release_all(struct sqlbox *);
 
 #endif /* !EXTERN_H */
@@ -32,8 +32,8 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-int
-sqlbox_finalise(struct sqlbox *box, size_t id)
+static int
+sqlbox_finalise_locked(struct sqlbox *box, size_t id)
 {
 	uint32_t	 	 v = htole32(id);
 	struct sqlbox_stmt	*st;
@@ -48,7 +48,19 @@ sqlbox_finalise(struct sqlbox *box, size_t id)
 		sqlbox_warnx(&box->cfg, "finalise: sqlbox_stmt_find");
 		return 0;
 	}
+
+	/* Don't leave rows in flight for a freed statement. */
+
+	if (st->granted > 0 && !sqlbox_stream_drain(box)) {
+		sqlbox_warnx(&box->cfg, "finalise: sqlbox_stream_drain");
+		return 0;
+	}
+	if (st->stepping > 0 && !sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "finalise: sqlbox_ticket_drain");
+		return 0;
+	}
 	TAILQ_REMOVE(&box->stmtq, st, gentries);
+	sqlbox_handle_free(&box->stmts, st->id);
 	sqlbox_stmt_free(st);
 
 	/* Now pass to the server. */
@@ -62,6 +74,17 @@ sqlbox_finalise(struct sqlbox *box, size_t id)
 	return 1;
 }
 
+int
+sqlbox_finalise(struct sqlbox *box, size_t id)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_finalise_locked(box, id);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
 int
 sqlbox_op_finalise(struct sqlbox *box, const char *buf, size_t sz)
 {
@@ -80,7 +103,7 @@ sqlbox_op_finalise(struct sqlbox *box, const char *buf, size_t sz)
 	}
 	TAILQ_REMOVE(&box->stmtq, st, gentries);
 	TAILQ_REMOVE(&st->db->stmtq, st, entries);
-	sqlbox_wrap_finalise(box, st->db, st->pstmt, st->stmt);
-	sqlbox_stmt_free(st);
+	sqlbox_handle_free(&box->stmts, st->id);
+	sqlbox_stmt_release(box, st);
 	return 1;
 }
@@ -0,0 +1,275 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+#include COMPAT_ENDIAN_H
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+static	const char *const types[] = {
+	"send", /* SQLBOX_FLIGHT_SEND */
+	"answer", /* SQLBOX_FLIGHT_ANSWER */
+	"run", /* SQLBOX_FLIGHT_RUN */
+	"write", /* SQLBOX_FLIGHT_WRITE */
+	"read", /* SQLBOX_FLIGHT_READ */
+	"poll", /* SQLBOX_FLIGHT_POLL */
+};
+
+const char *
+sqlbox_flight_type(size_t type)
+{
+
+	return type < sizeof(types) / sizeof(types[0]) ? 
+		types[type] : NULL;
+}
+
+/*
+ * Record an event of "type" into the flight recorder.
+ * The operation "op" may be UINT32_MAX if there's none.
+ * If "buf" isn't NULL, it's the operation's payload of size "sz";
+ * otherwise, "sz" is the number of bytes transferred.
+ * If "start" isn't zero, it's when the event began and the time taken
+ * is recorded.
+ * Returns the time taken.
+ */
+uint64_t
+sqlbox_flight(struct sqlbox *box, uint32_t type, uint32_t op,
+	const char *buf, size_t sz, uint64_t start)
+{
+	struct sqlbox_flightev	*ev;
+	uint64_t		 now = sqlbox_stats_now();
+	uint32_t		 val;
+	size_t			 i;
+
+	ev = &box->flight[box->flightpos++ % SQLBOX_FLIGHT_EVENTS];
+	ev->time = start != 0 ? start : now;
+	ev->nsec = start != 0 ? now - start : 0;
+	ev->type = type;
+	ev->op = op;
+	ev->size = sz > UINT32_MAX ? UINT32_MAX : sz;
+	for (i = 0; i < 3; i++) {
+		ev->args[i] = 0;
+		if (buf == NULL || sz < (i + 1) * sizeof(uint32_t))
+			continue;
+		memcpy(&val, buf + i * sizeof(uint32_t), sizeof(uint32_t));
+		ev->args[i] = le32toh(val);
+	}
+	return ev->nsec;
+}
+
+/*
+ * Copy the recorded events of "box" into "evs", oldest first.
+ * Returns the number of events copied.
+ */
+static size_t
+sqlbox_flight_copy(const struct sqlbox *box, struct sqlbox_flightev *evs)
+{
+	size_t	 i, n, first;
+
+	if (box->flightpos < SQLBOX_FLIGHT_EVENTS) {
+		n = box->flightpos;
+		first = 0;
+	} else {
+		n = SQLBOX_FLIGHT_EVENTS;
+		first = box->flightpos % SQLBOX_FLIGHT_EVENTS;
+	}
+	for (i = 0; i < n; i++)
+		evs[i] = box->flight[(first + i) % SQLBOX_FLIGHT_EVENTS];
+	return n;
+}
+
+/*
+ * Convert "n" events to little-endian order for dumping.
+ */
+static void
+sqlbox_flight_htole(struct sqlbox_flightev *evs, size_t n)
+{
+	size_t	 i, j;
+
+	for (i = 0; i < n; i++) {
+		evs[i].time = htole64(evs[i].time);
+		evs[i].nsec = htole64(evs[i].nsec);
+		evs[i].type = htole32(evs[i].type);
+		evs[i].op = htole32(evs[i].op);
+		evs[i].size = htole32(evs[i].size);
+		for (j = 0; j < 3; j++)
+			evs[i].args[j] = htole32(evs[i].args[j]);
+	}
+}
+
+/*
+ * Pass the recorded events of "box" to the message system, oldest
+ * first, as a timeline relative to the oldest.
+ * This is used when the server fails, since it has nowhere to dump.
+ */
+void
+sqlbox_flight_warn(struct sqlbox *box)
+{
+	struct sqlbox_flightev	 evs[SQLBOX_FLIGHT_EVENTS];
+	const char		*op, *type;
+	size_t			 i, n;
+
+	if ((n = sqlbox_flight_copy(box, evs)) == 0)
+		return;
+	for (i = 0; i < n; i++) {
+		op = sqlbox_stats_op(evs[i].op);
+		type = sqlbox_flight_type(evs[i].type);
+		sqlbox_warnx(&box->cfg, "flight: +%" PRIu64 " us: "
+			"%s %s: %" PRIu32 " B (%" PRIu32 " %" PRIu32 
+			" %" PRIu32 "), %" PRIu64 " us", 
+			(evs[i].time - evs[0].time) / 1000,
+			type == NULL ? "unknown" : type,
+			op == NULL ? "-" : op, evs[i].size, 
+			evs[i].args[0], evs[i].args[1], evs[i].args[2],
+			evs[i].nsec / 1000);
+	}
+}
+
+/*
+ * Write all of "buf" of size "sz" to "fd".
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_flight_write(struct sqlbox *box, int fd, const void *buf, size_t sz)
+{
+	const char	*cp = buf;
+	ssize_t		 wsz;
+
+	while (sz > 0) {
+		if ((wsz = write(fd, cp, sz)) == -1) {
+			if (errno == EINTR)
+				continue;
+			sqlbox_warn(&box->cfg, "flight: write");
+			return 0;
+		}
+		cp += wsz;
+		sz -= wsz;
+	}
+	return 1;
+}
+
+/*
+ * Write the events recorded by both ends of "box" to "fd": a header,
+ * then the events of the client and those of the server, each preceded
+ * by which end and how many.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_flight_dump_locked(struct sqlbox *box, int fd)
+{
+	struct sqlbox_flightev	 client[SQLBOX_FLIGHT_EVENTS],
+				 server[SQLBOX_FLIGHT_EVENTS];
+	uint32_t		 hdr[4], val;
+	size_t			 cn, sn;
+
+	cn = sqlbox_flight_copy(box, client);
+
+	if (!sqlbox_write_frame(box, SQLBOX_OP_FLIGHT, NULL, 0)) {
+		sqlbox_warnx(&box->cfg, "flight: sqlbox_write_frame");
+		return 0;
+	} else if (!sqlbox_read(box, (char *)&val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "flight: sqlbox_read");
+		return 0;
+	} else if ((sn = le32toh(val)) > SQLBOX_FLIGHT_EVENTS) {
+		sqlbox_warnx(&box->cfg, "flight: bad count: %zu", sn);
+		return 0;
+	} else if (sn > 0 && sqlbox_read_full(box, (char *)server, 
+	           sn * sizeof(struct sqlbox_flightev), 0) <= 0) {
+		sqlbox_warnx(&box->cfg, "flight: sqlbox_read_full");
+		return 0;
+	}
+
+	sqlbox_flight_htole(client, cn);
+	memcpy(hdr, SQLBOX_FLIGHT_MAGIC, 8);
+	hdr[2] = htole32(SQLBOX_FLIGHT_VERSION);
+	hdr[3] = htole32(2);
+	if (!sqlbox_flight_write(box, fd, hdr, sizeof(hdr)))
+		return 0;
+
+	hdr[0] = htole32(0);
+	hdr[1] = htole32(cn);
+	if (!sqlbox_flight_write(box, fd, hdr, sizeof(uint32_t) * 2) ||
+	    !sqlbox_flight_write(box, fd, client, 
+	     cn * sizeof(struct sqlbox_flightev)))
+		return 0;
+
+	hdr[0] = htole32(1);
+	hdr[1] = htole32(sn);
+	if (!sqlbox_flight_write(box, fd, hdr, sizeof(uint32_t) * 2) ||
+	    !sqlbox_flight_write(box, fd, server, 
+	     sn * sizeof(struct sqlbox_flightev)))
+		return 0;
+
+	return 1;
+}
+
+int
+sqlbox_flight_dump(struct sqlbox *box, int fd)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_flight_dump_locked(box, fd);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+/*
+ * Write out the number of events recorded followed by the events,
+ * oldest first.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_op_flight(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_flightev	 evs[SQLBOX_FLIGHT_EVENTS];
+	char			 out[sizeof(uint32_t) + sizeof(evs)];
+	uint32_t		 val;
+	size_t			 n;
+
+	if (sz != 0) {
+		sqlbox_warnx(&box->cfg, "flight: bad frame size: %zu", sz);
+		return 0;
+	}
+
+	n = sqlbox_flight_copy(box, evs);
+	sqlbox_flight_htole(evs, n);
+	val = htole32(n);
+	memcpy(out, &val, sizeof(uint32_t));
+	memcpy(out + sizeof(uint32_t), evs, 
+		n * sizeof(struct sqlbox_flightev));
+
+	if (!sqlbox_write(box, out, 
+	    sizeof(uint32_t) + n * sizeof(struct sqlbox_flightev))) {
+		sqlbox_warnx(&box->cfg, "flight: sqlbox_write");
+		return 0;
+	}
+	return 1;
+}
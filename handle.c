@@ -0,0 +1,169 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Identifiers of databases and statements index a table of slots.
+ * The low SQLBOX_HANDLE_BITS are the slot plus one; the bits above
+ * that are the slot's generation, bumped whenever the slot's released,
+ * so that stale identifiers don't find new objects.
+ * Identifiers must fit into the 32 bits used on the wire.
+ */
+#define	SQLBOX_HANDLE_BITS	16
+#define	SQLBOX_HANDLE_MASK	((1U << SQLBOX_HANDLE_BITS) - 1)
+#define	SQLBOX_HANDLE_GENS	(1U << (32 - SQLBOX_HANDLE_BITS))
+
+/*
+ * Grow the table to at least "sz" slots, adding new slots to the list
+ * of unused slots so that lower slots are used first.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_handle_grow(struct sqlbox *box, 
+	struct sqlbox_handles *h, size_t sz)
+{
+	size_t	 i, nsz;
+	void	*pp;
+
+	if (sz <= h->hsz)
+		return 1;
+	if (sz > SQLBOX_HANDLE_MASK) {
+		sqlbox_warnx(&box->cfg, "too many handles");
+		return 0;
+	}
+
+	nsz = h->hsz == 0 ? 16 : h->hsz * 2;
+	if (nsz < sz)
+		nsz = sz;
+	if (nsz > SQLBOX_HANDLE_MASK)
+		nsz = SQLBOX_HANDLE_MASK;
+
+	pp = reallocarray(h->hs, nsz, sizeof(struct sqlbox_handle));
+	if (pp == NULL) {
+		sqlbox_warn(&box->cfg, "reallocarray");
+		return 0;
+	}
+	h->hs = pp;
+	memset(&h->hs[h->hsz], 0, 
+		(nsz - h->hsz) * sizeof(struct sqlbox_handle));
+
+	for (i = nsz; i > h->hsz; i--) {
+		h->hs[i - 1].id = i;
+		h->hs[i - 1].next = h->free;
+		h->free = i;
+	}
+	h->hsz = nsz;
+	return 1;
+}
+
+/*
+ * Allocate a new identifier for "p" (server).
+ * Returns the non-zero identifier or zero on failure.
+ */
+size_t
+sqlbox_handle_alloc(struct sqlbox *box, 
+	struct sqlbox_handles *h, void *p)
+{
+	struct sqlbox_handle	*hp;
+
+	if (h->free == 0 && !sqlbox_handle_grow(box, h, h->hsz + 1))
+		return 0;
+
+	hp = &h->hs[h->free - 1];
+	h->free = hp->next;
+	hp->p = p;
+	hp->next = 0;
+	return hp->id;
+}
+
+/*
+ * Register "p" under an identifier allocated by the server (client).
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_handle_set(struct sqlbox *box, 
+	struct sqlbox_handles *h, size_t id, void *p)
+{
+	size_t	 slot = id & SQLBOX_HANDLE_MASK;
+
+	if (slot == 0 || id > UINT32_MAX) {
+		sqlbox_warnx(&box->cfg, "bad identifier: %zu", id);
+		return 0;
+	} else if (!sqlbox_handle_grow(box, h, slot))
+		return 0;
+
+	h->hs[slot - 1].id = id;
+	h->hs[slot - 1].p = p;
+	return 1;
+}
+
+/*
+ * Look up the object with identifier "id".
+ * Returns the object or NULL if not found.
+ */
+void *
+sqlbox_handle_get(const struct sqlbox_handles *h, size_t id)
+{
+	size_t	 slot = id & SQLBOX_HANDLE_MASK;
+
+	if (slot == 0 || slot > h->hsz || 
+	    h->hs[slot - 1].id != id)
+		return NULL;
+	return h->hs[slot - 1].p;
+}
+
+/*
+ * Release identifier "id", if in use, bumping its slot's generation.
+ */
+void
+sqlbox_handle_free(struct sqlbox_handles *h, size_t id)
+{
+	size_t	 gen, slot = id & SQLBOX_HANDLE_MASK;
+
+	if (slot == 0 || slot > h->hsz || 
+	    h->hs[slot - 1].id != id || 
+	    h->hs[slot - 1].p == NULL)
+		return;
+
+	gen = ((id >> SQLBOX_HANDLE_BITS) + 1) % SQLBOX_HANDLE_GENS;
+	h->hs[slot - 1].id = (gen << SQLBOX_HANDLE_BITS) | slot;
+	h->hs[slot - 1].p = NULL;
+	h->hs[slot - 1].next = h->free;
+	h->free = slot;
+}
+
+void
+sqlbox_handle_clear(struct sqlbox_handles *h)
+{
+
+	free(h->hs);
+	memset(h, 0, sizeof(struct sqlbox_handles));
+}
@@ -20,9 +20,11 @@
 # include <sys/queue.h>
 #endif 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include COMPAT_ENDIAN_H
 
 #include <assert.h>
+#include <errno.h>
 #include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -35,206 +37,716 @@
 #include "sqlbox.h"
 #include "extern.h"
 
+/*
+ * Wait until the channel is ready for "events" (POLLIN or POLLOUT).
+ * This is only called after the non-blocking descriptor reports that it
+ * would block, so most operations never poll(2) at all.
+ * On most systems (OpenBSD, FreeBSD, Linux, etc.), poll(2) sets
+ * POLLHUP when the descriptor closes.
+ * On SunOS, however, POLLIN is returned with an EOF returned by the
+ * read(2).
+ * When reading, we let the hangup through so that read(2) reports the
+ * end of file (possibly after pending data).
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_io_wait(struct sqlbox *box, short events)
+{
+	struct pollfd	 pfd = { .fd = box->fd, .events = events };
+	const char	*dir = events == POLLIN ? "read" : "write";
+	uint64_t	 start = sqlbox_stats_now();
+
+	box->stats.syscalls++;
+	if (poll(&pfd, 1, INFTIM) == -1) {
+		sqlbox_warn(&box->cfg, "poll (%s)", dir);
+		return 0;
+	}
+	sqlbox_flight(box, SQLBOX_FLIGHT_POLL, UINT32_MAX, NULL, 0, start);
+	box->stats.polls++;
+	if ((pfd.revents & (POLLNVAL|POLLERR))) {
+		sqlbox_warnx(&box->cfg, "poll (%s): nval", dir);
+		return 0;
+	} else if ((pfd.revents & POLLHUP)) {
+		if (events == POLLIN)
+			return 1;
+		sqlbox_warnx(&box->cfg, "poll (%s): hangup", dir);
+		return 0;
+	} else if (!(events & pfd.revents)) {
+		sqlbox_warnx(&box->cfg, "poll (%s): bad revent", dir);
+		return 0;
+	}
+
+	return 1;
+}
+
 /*
  * This is called by both the client and the server, so it can't contain
  * any specifities.
- * Simply performs a blocking write of the sized buffer, which must not
- * be zero-length.
+ * Performs a blocking gathered write of all "iovcnt" buffers in "iov",
+ * which are modified in the process.
  * Returns FALSE on failure, TRUE on success.
  */
-int
-sqlbox_write(struct sqlbox *box, const char *buf, size_t sz)
+static int
+sqlbox_writev(struct sqlbox *box, struct iovec *iov, int iovcnt)
 {
-	struct pollfd	  pfd = { .fd = box->fd, .events = POLLOUT };
-	ssize_t		  wsz;
-	size_t		  tsz = 0;
-	int		  rc = 0, fl = 0;
+	struct msghdr	 msg;
+	ssize_t		 wsz;
+	size_t		 sz = 0;
+	int		 i, rc, fl = 0;
+	uint64_t	 start = sqlbox_stats_now();
 
 #ifdef	MSG_NOSIGNAL
 	fl = MSG_NOSIGNAL;
 #endif /* MSG_NOSIGNAL */
 
-	for (;;) {
-		if (poll(&pfd, 1, INFTIM) == -1) {
-			sqlbox_warn(&box->cfg, "ppoll (write)");
-			break;
-		} else if ((pfd.revents & (POLLNVAL|POLLERR)))  {
-			sqlbox_warnx(&box->cfg, 
-				"ppoll (write): nval");
-			break;
-		} else if ((pfd.revents & POLLHUP)) {
-			sqlbox_warnx(&box->cfg, 
-				"ppoll (write): hangup");
-			break;
-		} else if (!(POLLOUT & pfd.revents)) {
-			sqlbox_warnx(&box->cfg, 
-				"ppoll (write): bad revent");
-			break;
-		}
+	for (i = 0; i < iovcnt; i++)
+		sz += iov[i].iov_len;
+	box->stats.txbytes += sz;
+
+	if (box->ring != NULL) {
+		rc = sqlbox_ring_writev(box, iov, iovcnt);
+		sqlbox_flight(box, SQLBOX_FLIGHT_WRITE, 
+			UINT32_MAX, NULL, sz, start);
+		return rc;
+	}
+
+	memset(&msg, 0, sizeof(struct msghdr));
 
+	while (iovcnt > 0) {
 		/*
-		 * Use send(2) with MSG_NOSIGNAL instead of write(2) because we
-		 * can avoid masking SIGPIPE in the event that the child closes
-		 * its part of the socket *after* the poll(2), above.
+		 * Use sendmsg(2) with MSG_NOSIGNAL instead of writev(2)
+		 * because we can avoid masking SIGPIPE in the event
+		 * that the child closes its part of the socket.
 		 */
 
-		wsz = send(pfd.fd, buf + tsz, sz - tsz, fl);
-		if (wsz == -1) {
-			sqlbox_warn(&box->cfg, "send");
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		box->stats.syscalls++;
+		if ((wsz = sendmsg(box->fd, &msg, fl)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				sqlbox_warn(&box->cfg, "sendmsg");
+				return 0;
+			}
+			if (!sqlbox_io_wait(box, POLLOUT))
+				return 0;
+			continue;
+		}
+
+		/* Skip over what's been written. */
+
+		while (iovcnt > 0 && (size_t)wsz >= iov->iov_len) {
+			wsz -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + wsz;
+			iov->iov_len -= wsz;
+		}
+	}
+
+	sqlbox_flight(box, SQLBOX_FLIGHT_WRITE, UINT32_MAX, NULL, sz, start);
+	return 1;
+}
+
+/*
+ * Write out all queued frames followed by the "iovcnt" buffers in
+ * "iov" (which may be zero) in a single gathered write.
+ * If the queue has requests other than stream credits, first read any
+ * rows the server owes to streaming statements: the server won't read
+ * our requests until it has written them, so we'd otherwise risk both
+ * sides blocking on a full channel.
+ * The queue is emptied regardless of success: if the write fails, the
+ * channel is unusable anyway.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_write_queued(struct sqlbox *box,
+	const struct iovec *iov, int iovcnt)
+{
+	struct iovec	 v[4];
+	int		 i, n = 0;
+
+	assert(iovcnt < 4);
+
+	if (box->wbufdrain) {
+		box->wbufdrain = 0;
+		if (!sqlbox_stream_drain(box)) {
+			box->wbufsz = 0;
 			return 0;
-		} else if ((tsz += wsz) == sz) {
-			rc = 1;
-			break;
 		}
 	}
 
-	return rc;
+	if (box->wbufsz > 0) {
+		v[n].iov_base = box->wbuf;
+		v[n++].iov_len = box->wbufsz;
+		box->wbufsz = 0;
+	}
+	for (i = 0; i < iovcnt; i++)
+		if (iov[i].iov_len > 0)
+			v[n++] = iov[i];
+
+	return n == 0 ? 1 : sqlbox_writev(box, v, n);
 }
 
 /*
- * Called by the client only, so it doesn't respond to end of file in
- * any but erroring out.
- * Performs a non-blocking read of the sized buffer, which must not be
- * zero-length.
+ * Queue the "iovcnt" buffers in "iov" for a later gathered write.
+ * If the queue would grow beyond SQLBOX_QUEUE_MAX, write out the queue
+ * and the buffers immediately instead of copying.
  * Returns FALSE on failure, TRUE on success.
  */
+static int
+sqlbox_queuev(struct sqlbox *box, const struct iovec *iov, int iovcnt)
+{
+	size_t	 sz = 0, max;
+	int	 i;
+	void	*pp;
+
+	for (i = 0; i < iovcnt; i++)
+		sz += iov[i].iov_len;
+
+	if (!TAILQ_EMPTY(&box->grantq))
+		box->wbufdrain = 1;
+
+	/* 
+	 * Non-blocking boxes never write here: the queue is written by
+	 * sqlbox_process() instead, so it may grow without bound.
+	 */
+
+	if (!(box->cfg.flags & SQLBOX_CFG_NONBLOCK) &&
+	    box->wbufsz + sz > SQLBOX_QUEUE_MAX)
+		return sqlbox_write_queued(box, iov, iovcnt);
+
+	if (box->wbufsz + sz > box->wbufmax) {
+		max = SQLBOX_QUEUE_MAX;
+		while (max < box->wbufsz + sz)
+			max *= 2;
+		if ((pp = realloc(box->wbuf, max)) == NULL) {
+			sqlbox_warn(&box->cfg, "realloc");
+			return 0;
+		}
+		box->wbuf = pp;
+		box->wbufmax = max;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(box->wbuf + box->wbufsz, 
+			iov[i].iov_base, iov[i].iov_len);
+		box->wbufsz += iov[i].iov_len;
+	}
+
+	return 1;
+}
+
+/*
+ * Write all queued frames.
+ * This is called automatically before reading any response, so it's
+ * only needed by callers wanting asynchronous operations to be
+ * processed without waiting for a synchronous one.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_flush_locked(struct sqlbox *box)
+{
+
+	if (box->wbufsz == 0)
+		return 1;
+	if (!sqlbox_write_queued(box, NULL, 0)) {
+		sqlbox_warnx(&box->cfg, "flush: sqlbox_write_queued");
+		return 0;
+	}
+	return 1;
+}
+
 int
-sqlbox_read(struct sqlbox *box, char *buf, size_t sz)
+sqlbox_flush(struct sqlbox *box)
 {
-	struct pollfd	 pfd = { .fd = box->fd, .events = POLLIN };
-	ssize_t		 rsz;
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_flush_locked(box);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+/*
+ * Write as much of the queue as possible without blocking (client).
+ * Whatever isn't written is kept at the front of the queue.
+ * Returns <0 on failure, 0 if the queue was written, >0 if some
+ * remains.
+ */
+int
+sqlbox_flush_some(struct sqlbox *box)
+{
+	ssize_t		 wsz;
 	size_t		 tsz = 0;
+	int		 fl = 0;
+	uint64_t	 start;
+
+#ifdef	MSG_NOSIGNAL
+	fl = MSG_NOSIGNAL;
+#endif /* MSG_NOSIGNAL */
+
+	/* This only happens with streams, which always block. */
+
+	if (box->wbufdrain) {
+		box->wbufdrain = 0;
+		if (!sqlbox_stream_drain(box)) {
+			box->wbufsz = 0;
+			return -1;
+		}
+	}
+
+	start = sqlbox_stats_now();
+	while (tsz < box->wbufsz) {
+		if (box->ring != NULL) {
+			wsz = sqlbox_ring_trywrite(box, 
+				box->wbuf + tsz, box->wbufsz - tsz);
+			if (wsz < 0) {
+				box->wbufsz = 0;
+				return -1;
+			}
+		} else {
+			box->stats.syscalls++;
+			wsz = send(box->fd, box->wbuf + tsz, 
+				box->wbufsz - tsz, fl);
+			if (wsz == -1 && errno == EINTR)
+				continue;
+			if (wsz == -1 && 
+			    (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (wsz == -1) {
+				sqlbox_warn(&box->cfg, "send");
+				box->wbufsz = 0;
+				return -1;
+			}
+		}
+		if (wsz == 0)
+			break;
+		tsz += wsz;
+		box->stats.txbytes += wsz;
+	}
+	if (tsz > 0)
+		sqlbox_flight(box, SQLBOX_FLIGHT_WRITE, 
+			UINT32_MAX, NULL, tsz, start);
+
+	memmove(box->wbuf, box->wbuf + tsz, box->wbufsz - tsz);
+	box->wbufsz -= tsz;
+	return box->wbufsz > 0;
+}
+
+/*
+ * This is called by both the client and the server, so it can't contain
+ * any specifities.
+ * Simply performs a blocking write of the sized buffer, which must not
+ * be zero-length, after any queued frames.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_write(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct iovec	 iov = { .iov_base = (void *)buf, .iov_len = sz };
 
 	assert(sz > 0);
+	box->stats.txframes++;
+	return sqlbox_write_queued(box, &iov, 1);
+}
 
-	/*
-	 * On most systems (OpenBSD, FreeBSD, Linux, etc.), poll(2) sets
-	 * POLLHUP when the descriptor closes.
-	 * On SunOS, however, POLLIN is returned with an EOF returned by the
-	 * read(2).
-	 */
+/*
+ * Queue a fully-formed frame "buf" of length "sz" (which must not be
+ * zero) for writing with the next flush.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_queue(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct iovec	 iov = { .iov_base = (void *)buf, .iov_len = sz };
 
-	for (;;) {
-		if (poll(&pfd, 1, INFTIM) == -1) {
-			sqlbox_warn(&box->cfg, "ppoll (read)");
+	assert(sz > 0);
+	box->stats.txframes++;
+	return sqlbox_queuev(box, &iov, 1);
+}
+
+/*
+ * Send descriptor "sfd" with a single byte, after any queued frames.
+ * This can't be used with the shared-memory transport.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_sendfd(struct sqlbox *box, int sfd)
+{
+	struct msghdr	 msg;
+	struct iovec	 iov;
+	struct cmsghdr	*cmsg;
+	char		 c = 1;
+	int		 fl = 0;
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+#ifdef	MSG_NOSIGNAL
+	fl = MSG_NOSIGNAL;
+#endif /* MSG_NOSIGNAL */
+
+	assert(box->ring == NULL);
+	if (!sqlbox_flush(box))
+		return 0;
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	memset(&cbuf, 0, sizeof(cbuf));
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	memcpy(CMSG_DATA(cmsg), &sfd, sizeof(int));
+
+	while (sendmsg(box->fd, &msg, fl) == -1) {
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			sqlbox_warn(&box->cfg, "sendmsg");
 			return 0;
-		} else if ((pfd.revents & (POLLNVAL|POLLERR)))  {
-			sqlbox_warnx(&box->cfg, 
-				"poll (read): nval");
+		}
+		if (!sqlbox_io_wait(box, POLLOUT))
 			return 0;
-		} else if ((pfd.revents & POLLHUP)) {
-			sqlbox_warnx(&box->cfg, 
-				"poll (read): hangup");
+	}
+	return 1;
+}
+
+/*
+ * Receive a descriptor sent with sqlbox_sendfd() into "rfd".
+ * Nothing may have been read ahead of it.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_recvfd(struct sqlbox *box, int *rfd)
+{
+	struct msghdr	 msg;
+	struct iovec	 iov;
+	struct cmsghdr	*cmsg;
+	ssize_t		 ssz;
+	char		 c;
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+	assert(box->ring == NULL);
+	*rfd = -1;
+
+	if (box->rbufpos < box->rbufsz) {
+		sqlbox_warnx(&box->cfg, "recvmsg: unread frames");
+		return 0;
+	}
+
+	for (;;) {
+		memset(&msg, 0, sizeof(struct msghdr));
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof(cbuf.buf);
+		if ((ssz = recvmsg(box->fd, &msg, 0)) != -1)
+			break;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			sqlbox_warn(&box->cfg, "recvmsg");
 			return 0;
-		} else if (!(POLLIN & pfd.revents)) {
-			sqlbox_warnx(&box->cfg, 
-				"poll (read): bad revent");
+		}
+		if (!sqlbox_io_wait(box, POLLIN))
 			return 0;
+	}
+
+	if (ssz == 0) {
+		sqlbox_warnx(&box->cfg, "recvmsg: unexpected eof");
+		return 0;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(rfd, CMSG_DATA(cmsg), sizeof(int));
+
+	if (*rfd == -1) {
+		sqlbox_warnx(&box->cfg, "recvmsg: no descriptor");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Perform a blocking read of at most "sz" bytes into "buf", either from
+ * the socket or the shared-memory ring.
+ * Returns <0 on failure, 0 on EOF, otherwise the bytes read.
+ */
+static ssize_t
+sqlbox_io_read(struct sqlbox *box, char *buf, size_t sz)
+{
+	ssize_t		 rsz;
+	uint64_t	 start = sqlbox_stats_now();
+
+	if (box->ring != NULL) {
+		if ((rsz = sqlbox_ring_read(box, buf, sz)) > 0) {
+			box->stats.rxbytes += rsz;
+			sqlbox_flight(box, SQLBOX_FLIGHT_READ, 
+				UINT32_MAX, NULL, rsz, start);
 		}
+		return rsz;
+	}
 
-		if ((rsz = read(pfd.fd, buf + tsz, sz - tsz)) == -1) {
+	for (;;) {
+		box->stats.syscalls++;
+		if ((rsz = read(box->fd, buf, sz)) != -1) {
+			if (rsz > 0) {
+				box->stats.rxbytes += rsz;
+				sqlbox_flight(box, SQLBOX_FLIGHT_READ, 
+					UINT32_MAX, NULL, rsz, start);
+			}
+			return rsz;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
 			sqlbox_warn(&box->cfg, "read");
+			return -1;
+		}
+		if (!sqlbox_io_wait(box, POLLIN))
+			return -1;
+	}
+}
+
+/*
+ * Perform a blocking read of exactly "sz" bytes into "buf".
+ * Any queued frames are written first, as we're usually reading the
+ * response to them.
+ * Small reads are served from the read-ahead buffer, which is filled
+ * with as much as is available, so that the server drains several
+ * frames from each read(2).
+ * If "eofok" is non-zero, an end of file before any bytes are read is
+ * not an error.
+ * Returns <0 on failure, 0 on (allowed) EOF, >0 on success.
+ */
+int
+sqlbox_read_full(struct sqlbox *box, char *buf, size_t sz, int eofok)
+{
+	ssize_t		 rsz;
+	size_t		 tsz = 0, n;
+
+	if (!box->draining && !sqlbox_flush(box))
+		return -1;
+
+	while (tsz < sz) {
+		if (box->rbufpos < box->rbufsz) {
+			n = box->rbufsz - box->rbufpos;
+			if (n > sz - tsz)
+				n = sz - tsz;
+			memcpy(buf + tsz, box->rbuf + box->rbufpos, n);
+			box->rbufpos += n;
+			tsz += n;
+			continue;
+		}
+
+		/* Large reads go directly into the buffer. */
+
+		if (sz - tsz >= SQLBOX_READ_AHEAD) {
+			rsz = sqlbox_io_read(box, buf + tsz, sz - tsz);
+			if (rsz > 0) {
+				tsz += rsz;
+				continue;
+			}
+		} else {
+			if (box->rbuf == NULL) {
+				box->rbuf = malloc(SQLBOX_READ_AHEAD);
+				if (box->rbuf == NULL) {
+					sqlbox_warn(&box->cfg, "malloc");
+					return -1;
+				}
+				box->rbufmax = SQLBOX_READ_AHEAD;
+			}
+			rsz = sqlbox_io_read(box, box->rbuf, box->rbufmax);
+			box->rbufpos = 0;
+			box->rbufsz = rsz > 0 ? rsz : 0;
+			if (rsz > 0)
+				continue;
+		}
+
+		if (rsz < 0)
+			return -1;
+		else if (tsz == 0 && eofok)
 			return 0;
+
+		sqlbox_warnx(&box->cfg, "read: eof with "
+			"unfinished read (%zu B < %zu B)", tsz, sz);
+		return -1;
+	}
+
+	return 1;
+}
+
+/*
+ * Read whatever is available without blocking into the read-ahead
+ * buffer (client).
+ * Unread data is first moved to the front of the buffer, which is
+ * grown to hold at least "want" bytes of it.
+ * Returns <0 on failure (including end of file), otherwise the number
+ * of bytes read (possibly zero).
+ */
+ssize_t
+sqlbox_fill_some(struct sqlbox *box, size_t want)
+{
+	size_t		 max, avail;
+	ssize_t		 rsz;
+	void		*pp;
+	uint64_t	 start;
+
+	avail = box->rbufsz - box->rbufpos;
+	if (avail > 0 && box->rbufpos > 0)
+		memmove(box->rbuf, box->rbuf + box->rbufpos, avail);
+	box->rbufpos = 0;
+	box->rbufsz = avail;
+
+	if (box->rbuf == NULL || box->rbufmax < want) {
+		max = SQLBOX_READ_AHEAD;
+		while (max < want)
+			max *= 2;
+		if ((pp = realloc(box->rbuf, max)) == NULL) {
+			sqlbox_warn(&box->cfg, "realloc");
+			return -1;
+		}
+		box->rbuf = pp;
+		box->rbufmax = max;
+	}
+
+	if (box->rbufsz == box->rbufmax)
+		return 0;
+
+	start = sqlbox_stats_now();
+	if (box->ring != NULL) {
+		rsz = sqlbox_ring_tryread(box, 
+			box->rbuf + box->rbufsz, box->rbufmax - box->rbufsz);
+		if (rsz > 0) {
+			box->rbufsz += rsz;
+			box->stats.rxbytes += rsz;
+			sqlbox_flight(box, SQLBOX_FLIGHT_READ, 
+				UINT32_MAX, NULL, rsz, start);
+		}
+		return rsz;
+	}
+
+	for (;;) {
+		box->stats.syscalls++;
+		rsz = read(box->fd, box->rbuf + box->rbufsz, 
+			box->rbufmax - box->rbufsz);
+		if (rsz > 0) {
+			box->rbufsz += rsz;
+			box->stats.rxbytes += rsz;
+			sqlbox_flight(box, SQLBOX_FLIGHT_READ, 
+				UINT32_MAX, NULL, rsz, start);
+			return rsz;
 		} else if (rsz == 0) {
 			sqlbox_warnx(&box->cfg, "read: eof");
+			return -1;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
 			return 0;
-		} else if ((tsz += rsz) == sz)
-			break;
+		} else if (errno != EINTR) {
+			sqlbox_warn(&box->cfg, "read");
+			return -1;
+		}
 	}
+}
+
+/*
+ * Called by the client only, so it doesn't respond to end of file in
+ * any but erroring out.
+ * Performs a blocking read of the sized buffer, which must not be
+ * zero-length, after reading the answers to any submitted tickets.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_read(struct sqlbox *box, char *buf, size_t sz)
+{
 
+	assert(sz > 0);
+	if (!sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "read: sqlbox_ticket_drain");
+		return 0;
+	} else if (sqlbox_read_full(box, buf, sz, 0) <= 0)
+		return 0;
+	box->stats.rxframes++;
+	sqlbox_stats_answer(box);
 	return 1;
 }
 
 /*
- * Read a single frame, which is of size at least the baseline frame.
+ * Read a single frame.
+ * Frames consist of a 32-bit little-endian length followed by exactly
+ * that many bytes of payload, so only the header size is fixed.
  * The frame is set in "frame" and is of length "framesz", both of which
  * are initialised to NULL and 0, respectively.
+ * The buffer "buf" of size "bufsz" is grown to fit the frame, if
+ * required, and is reused across calls.
+ * Multiplexed boxes share this buffer, so they don't accept frames
+ * longer than SQLBOX_MUX_FRAME_MAX.
  * Return <0 on failure, 0 on EOF without data, >0 on success.
  */
 int
 sqlbox_read_frame(struct sqlbox *box, char **buf, 
 	size_t *bufsz, const char **frame, size_t *framesz)
 {
-	struct pollfd	 pfd = { .fd = box->fd, .events = POLLIN };
-	ssize_t		 rsz;
-	size_t		 sz = 0, bsz;
+	size_t		 bsz;
 	void		*pp;
+	uint32_t	 len;
+	int		 c;
 
 	*frame = NULL;
 	*framesz = 0;
 
 	/* 
-	 * We want to read at least a frame size of data.
-	 * Frame sizes are SQLBOX_FRAME bytes.
+	 * Start with a baseline buffer so that most frames never need
+	 * reallocation.
 	 */
 	
-	bsz = SQLBOX_FRAME;
 	if (*bufsz == 0) {
 		assert(*buf == NULL);
-		if ((*buf = malloc(bsz)) == NULL) {
+		if ((*buf = malloc(SQLBOX_FRAME)) == NULL) {
 			sqlbox_warn(&box->cfg, "malloc");
 			return -1;
 		}
-		*bufsz = bsz;
+		*bufsz = SQLBOX_FRAME;
 	}
-	assert(*bufsz >= bsz);
-
-	/*
-	 * Start by reading the frame basis, which is always of size
-	 * SQLBOX_FRAME bytes.
-	 * This will also contain the real size of the frame, which, if
-	 * greater than 1020 bytes, will involve the reading of
-	 * subsequent frames.
-	 */
-
-	while (sz < bsz) {
-		if (poll(&pfd, 1, INFTIM) == -1) {
-			sqlbox_warn(&box->cfg, "ppoll");
-			return -1;
-		} else if ((pfd.revents & (POLLNVAL|POLLERR)))  {
-			sqlbox_warnx(&box->cfg, "ppoll: nval");
-			return -1;
-		} else if ((pfd.revents & POLLHUP) && 
-		           !(pfd.revents & POLLIN)) {
-			sqlbox_warnx(&box->cfg, "ppoll: hup");
-			break;
-		} else if (!(POLLIN & pfd.revents)) {
-			sqlbox_warnx(&box->cfg, "ppoll: bad event");
-			return -1;
-		}
-
-		rsz = read(pfd.fd, *buf + sz, bsz - sz);
-		if (rsz == -1) {
-			sqlbox_warn(&box->cfg, "read");
-			return -1;
-		} else if (rsz == 0 && sz == 0) {
-			return 0;
-		} else if (rsz == 0)
-			break;
 
-		/* 
-		 * Make sure we've read the entire initial frame.
-		 * The whole point is that it should come in one packet,
-		 * so warn here if it doesn't.
-		 */
+	/* Read the frame header, which may be EOF. */
 
-		if ((sz += rsz) < bsz)
-			sqlbox_warnx(&box->cfg, "read: frame basis "
-				"fragmented (%zd B < %zu B)", rsz, bsz);
-	}
-	if (sz < bsz) {
-		sqlbox_warnx(&box->cfg, "read: eof with "
-			"unfinished frame(%zu B < %zu B)", sz, bsz);
-		return -1;
-	}
+	c = sqlbox_read_full(box, (char *)&len, sizeof(uint32_t), 1);
+	if (c <= 0)
+		return c;
 
 	/* 
 	 * Reallocate the extended buffer, if necessary.
 	 * Remember that the frame size does NOT include the size of the
-	 * frame size integer.
+	 * frame size integer, but we keep the integer at the head of
+	 * the buffer so that the payload's alignment is unchanged.
 	 */
 
-	*framesz = le32toh(*(uint32_t *)*buf);
+	*framesz = le32toh(len);
+	if (box->mux != NULL && *framesz > SQLBOX_MUX_FRAME_MAX) {
+		sqlbox_warnx(&box->cfg, "read: frame "
+			"too long (%zu B)", *framesz);
+		*framesz = 0;
+		return -1;
+	}
 	bsz = *framesz + sizeof(uint32_t);
 
 	if (bsz > *bufsz) {
@@ -245,71 +757,70 @@ sqlbox_read_frame(struct sqlbox *box, char **buf,
 		*buf = pp;
 		*bufsz = bsz;
 	}
+	memcpy(*buf, &len, sizeof(uint32_t));
 	*frame = *buf + sizeof(uint32_t);
 
-	/* Everything was in the first frame. */
-
-	if (bsz <= SQLBOX_FRAME)
-		return 1;
-
-	/* Now read the rest of the frame. */
-
-	while (sz < bsz) {
-		if (poll(&pfd, 1, INFTIM) == -1) {
-			sqlbox_warn(&box->cfg, "ppoll");
-			return -1;
-		} else if ((pfd.revents & (POLLNVAL|POLLERR)))  {
-			sqlbox_warnx(&box->cfg, "ppoll: nval");
-			return -1;
-		} else if ((pfd.revents & POLLHUP) && 
-		           !(pfd.revents & POLLIN)) {
-			sqlbox_warnx(&box->cfg, "ppoll: hup");
-			break;
-		} else if (!(POLLIN & pfd.revents)) {
-			sqlbox_warnx(&box->cfg, "ppoll: bad event");
-			return -1;
-		}
-
-		rsz = read(pfd.fd, *buf + sz, bsz - sz);
-		if (rsz == -1) {
-			sqlbox_warn(&box->cfg, "read");
-			return -1;
-		} else if (rsz == 0) {
-			sqlbox_warnx(&box->cfg, "read: eof");
-			return -1;
-		}
-		sz += rsz;
+	if (*framesz > 0 && sqlbox_read_full
+	    (box, *buf + sizeof(uint32_t), *framesz, 0) <= 0) {
+		sqlbox_warnx(&box->cfg, "read: eof with "
+			"unfinished frame (%zu B)", *framesz);
+		return -1;
 	}
 
+	box->stats.rxframes++;
 	return 1;
 }
 
 /*
- * Write a buffer "buf" of length "sz" into a frame of type "op".
- * FIXME: for the time being, "sz" must fit in SQLBOX_FRAME - 8 bytes
- * (the latter for 2 32-bit integers).
+ * Queue a buffer "buf" of length "sz" into a frame of type "op".
+ * The frame consists only of the 8-byte header (length and operation)
+ * and the payload itself: there is no padding.
+ * It's written along with any other queued frames before the next read
+ * or with sqlbox_flush().
  * Return TRUE on success, FALSE on failure.
  */
 int
 sqlbox_write_frame(struct sqlbox *box,
 	enum sqlbox_op op, const char *buf, size_t sz)
 {
-	char		 frame[SQLBOX_FRAME];
-	uint32_t	 tmp;
+	uint32_t	 hdr[2];
+	struct iovec	 iov[2];
+
+	hdr[0] = htole32(sz + sizeof(uint32_t));
+	hdr[1] = htole32(op);
 
-	memset(frame, 0, sizeof(frame));
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = sz;
 
-	/* Account for operation... */
+	box->stats.txframes++;
+	sqlbox_stats_sent(box, op, buf, sz);
+	return sqlbox_queuev(box, iov, sz > 0 ? 2 : 1);
+}
 
-	tmp = htole32(sz + sizeof(uint32_t));
-	memcpy(frame, &tmp, sizeof(uint32_t));
+/*
+ * Like sqlbox_write_frame(), but write the frame (and anything queued
+ * before it) immediately.
+ * This is used for stream credits, which must not wait on the queue.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_send_frame(struct sqlbox *box,
+	enum sqlbox_op op, const char *buf, size_t sz)
+{
+	uint32_t	 hdr[2];
+	struct iovec	 iov[2];
 
-	tmp = htole32(op);
-	memcpy(frame + sizeof(uint32_t), &tmp, sizeof(uint32_t));
+	hdr[0] = htole32(sz + sizeof(uint32_t));
+	hdr[1] = htole32(op);
 
-	assert(sz <= SQLBOX_FRAME - sizeof(uint32_t) * 2);
-	memcpy(frame + sizeof(uint32_t) * 2, buf, sz);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = sz;
 
-	return sqlbox_write(box, frame, sizeof(frame));
+	box->stats.txframes++;
+	sqlbox_stats_sent(box, op, buf, sz);
+	return sqlbox_write_queued(box, iov, sz > 0 ? 2 : 1);
 }
-
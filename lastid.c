@@ -30,8 +30,8 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-int
-sqlbox_lastid(struct sqlbox *box, size_t id, int64_t *res)
+static int
+sqlbox_lastid_locked(struct sqlbox *box, size_t id, int64_t *res)
 {
 	uint32_t	 v = htole32(id);
 	int64_t		 ack;
@@ -50,31 +50,101 @@ sqlbox_lastid(struct sqlbox *box, size_t id, int64_t *res)
 }
 
 int
-sqlbox_op_lastid(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_lastid(struct sqlbox *box, size_t id, int64_t *res)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_lastid_locked(box, id, res);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+size_t
+sqlbox_lastid_submit(struct sqlbox *box, size_t id)
+{
+	uint32_t		 v = htole32(id);
+	struct sqlbox_ticket	*t;
+
+	if ((t = sqlbox_ticket_alloc(box)) == NULL) {
+		sqlbox_warnx(&box->cfg, 
+			"lastid-submit: sqlbox_ticket_alloc");
+		return 0;
+	} else if (!sqlbox_write_frame(box, SQLBOX_OP_LASTID_TICKET, 
+	    (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, 
+			"lastid-submit: sqlbox_write_frame");
+		sqlbox_ticket_abort(box, t);
+		return 0;
+	}
+
+	return sqlbox_ticket_push(box, t, SQLBOX_OP_LASTID_TICKET, NULL);
+}
+
+/*
+ * Look up the last insertion row identifier of a database.
+ * Return the database or NULL on failure.
+ */
+static struct sqlbox_db *
+sqlbox_op_lastid_inner(struct sqlbox *box, 
+	const char *buf, size_t sz, int64_t *res)
 {
 	struct sqlbox_db	*db;
-	int64_t			 ack;
 
 	/* Look up the statement in our global list. */
 
 	if (sz != sizeof(uint32_t)) {
 		sqlbox_warnx(&box->cfg, "lastid: "
 			"bad frame size: %zu", sz);
-		return 0;
+		return NULL;
 	}
 	if ((db = sqlbox_db_find
 	    (box, le32toh(*(uint32_t *)buf))) == NULL) {
 		sqlbox_warnx(&box->cfg, "lastid: sqlbox_db_find");
-		return 0;
+		return NULL;
 	}
 
 	sqlbox_debug(&box->cfg, "sqlite3_last_insert_rowid: %s", 
 		db->src->fname);
-	ack = htole64(sqlite3_last_insert_rowid(db->db));
+	*res = sqlite3_last_insert_rowid(db->db);
+	return db;
+}
+
+int
+sqlbox_op_lastid(struct sqlbox *box, const char *buf, size_t sz)
+{
+	int64_t		 ack;
+
+	if (sqlbox_op_lastid_inner(box, buf, sz, &ack) == NULL) {
+		sqlbox_warnx(&box->cfg, "lastid: sqlbox_op_lastid_inner");
+		return 0;
+	}
 
+	ack = htole64(ack);
 	if (!sqlbox_write(box, (char *)&ack, sizeof(int64_t))) {
 		sqlbox_warnx(&box->cfg, "lastid: sqlbox_write");
 		return 0;
 	}
 	return 1;
 }
+
+int
+sqlbox_op_lastid_ticket(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_db	*db;
+	int64_t			 val = 0;
+
+	/* Errors are reported to the client, not fatal. */
+
+	db = sqlbox_op_lastid_inner(box, buf, sz, &val);
+	if (db == NULL)
+		sqlbox_warnx(&box->cfg, 
+			"lastid-ticket: sqlbox_op_lastid_inner");
+
+	if (sqlbox_ticket_reply(box, db == NULL ? 
+	    SQLBOX_CODE_ERROR : SQLBOX_CODE_OK, 
+	    db == NULL ? 0 : db->id, val))
+		return 1;
+	sqlbox_warnx(&box->cfg, "lastid-ticket: sqlbox_ticket_reply");
+	return 0;
+}
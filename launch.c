@@ -0,0 +1,721 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include COMPAT_ENDIAN_H
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * A configuration being serialised for the launcher.
+ */
+struct	sqlbox_cfgpack {
+	char	*buf;
+	size_t	 sz; /* length of data */
+	size_t	 max; /* allocated size of buf */
+	int	 fail; /* memory allocation failed */
+};
+
+/*
+ * A configuration being deserialised by the launcher.
+ */
+struct	sqlbox_cfgunpack {
+	const char *buf;
+	size_t	 sz; /* remaining data */
+	int	 fail; /* data was truncated */
+};
+
+static void
+sqlbox_cfgpack_data(struct sqlbox_cfgpack *p, const void *v, size_t sz)
+{
+	size_t	 nmax;
+	void	*pp;
+
+	if (p->fail)
+		return;
+	if (p->sz + sz > p->max) {
+		nmax = p->max == 0 ? SQLBOX_FRAME : p->max * 2;
+		while (nmax < p->sz + sz)
+			nmax *= 2;
+		if ((pp = realloc(p->buf, nmax)) == NULL) {
+			p->fail = 1;
+			return;
+		}
+		p->buf = pp;
+		p->max = nmax;
+	}
+	memcpy(p->buf + p->sz, v, sz);
+	p->sz += sz;
+}
+
+static void
+sqlbox_cfgpack_u32(struct sqlbox_cfgpack *p, size_t v)
+{
+	uint32_t	 val = htole32(v);
+
+	sqlbox_cfgpack_data(p, &val, sizeof(uint32_t));
+}
+
+static void
+sqlbox_cfgpack_u64(struct sqlbox_cfgpack *p, uint64_t v)
+{
+	uint64_t	 val = htole64(v);
+
+	sqlbox_cfgpack_data(p, &val, sizeof(uint64_t));
+}
+
+/*
+ * Strings include their NUL terminator so the launcher can use them in
+ * place.
+ */
+static void
+sqlbox_cfgpack_str(struct sqlbox_cfgpack *p, const char *v)
+{
+	size_t	 sz = strlen(v) + 1;
+
+	sqlbox_cfgpack_u32(p, sz);
+	sqlbox_cfgpack_data(p, v, sz);
+}
+
+static void
+sqlbox_cfgpack_idx(struct sqlbox_cfgpack *p, const size_t *v, size_t sz)
+{
+	size_t	 i;
+
+	sqlbox_cfgpack_u32(p, sz);
+	for (i = 0; i < sz; i++)
+		sqlbox_cfgpack_u32(p, v[i]);
+}
+
+static const void *
+sqlbox_cfgunpack_data(struct sqlbox_cfgunpack *u, size_t sz)
+{
+	const void	*v = u->buf;
+
+	if (u->fail || u->sz < sz) {
+		u->fail = 1;
+		return NULL;
+	}
+	u->buf += sz;
+	u->sz -= sz;
+	return v;
+}
+
+static size_t
+sqlbox_cfgunpack_u32(struct sqlbox_cfgunpack *u)
+{
+	uint32_t	 val;
+	const void	*v;
+
+	if ((v = sqlbox_cfgunpack_data(u, sizeof(uint32_t))) == NULL)
+		return 0;
+	memcpy(&val, v, sizeof(uint32_t));
+	return le32toh(val);
+}
+
+static uint64_t
+sqlbox_cfgunpack_u64(struct sqlbox_cfgunpack *u)
+{
+	uint64_t	 val;
+	const void	*v;
+
+	if ((v = sqlbox_cfgunpack_data(u, sizeof(uint64_t))) == NULL)
+		return 0;
+	memcpy(&val, v, sizeof(uint64_t));
+	return le64toh(val);
+}
+
+static char *
+sqlbox_cfgunpack_str(struct sqlbox_cfgunpack *u)
+{
+	size_t		 sz = sqlbox_cfgunpack_u32(u);
+	const char	*v;
+
+	if (sz == 0 || (v = sqlbox_cfgunpack_data(u, sz)) == NULL) {
+		u->fail = 1;
+		return NULL;
+	} else if (v[sz - 1] != '\0') {
+		u->fail = 1;
+		return NULL;
+	}
+	return (char *)v;
+}
+
+/*
+ * Allocate an array of "sz" elements of size "esz", failing if there
+ * can't possibly be that many elements (of at least "min" bytes) left.
+ */
+static void *
+sqlbox_cfgunpack_array(struct sqlbox_cfgunpack *u, 
+	size_t sz, size_t esz, size_t min)
+{
+	void	*v;
+
+	if (u->fail || sz == 0)
+		return NULL;
+	if (sz > u->sz / min || (v = calloc(sz, esz)) == NULL) {
+		u->fail = 1;
+		return NULL;
+	}
+	return v;
+}
+
+static size_t *
+sqlbox_cfgunpack_idx(struct sqlbox_cfgunpack *u, size_t *sz)
+{
+	size_t	 i, *v;
+
+	*sz = sqlbox_cfgunpack_u32(u);
+	v = sqlbox_cfgunpack_array(u, *sz, sizeof(size_t), sizeof(uint32_t));
+	for (i = 0; v != NULL && i < *sz; i++)
+		v[i] = sqlbox_cfgunpack_u32(u);
+	return v;
+}
+
+/*
+ * Integers that may be wider than 32 bits are passed as 64 bits.
+ */
+static void
+sqlbox_cfgpack_tune(struct sqlbox_cfgpack *p, const struct sqlbox_tune *t)
+{
+
+	sqlbox_cfgpack_u32(p, t->journal);
+	sqlbox_cfgpack_u32(p, t->sync);
+	sqlbox_cfgpack_u32(p, t->temp);
+	sqlbox_cfgpack_u64(p, t->cachesz);
+	sqlbox_cfgpack_u64(p, t->mmapsz);
+	sqlbox_cfgpack_u64(p, t->pagesz);
+	sqlbox_cfgpack_u64(p, t->busytimeo);
+	sqlbox_cfgpack_u64(p, t->backoff);
+	sqlbox_cfgpack_u64(p, t->backoffmax);
+	sqlbox_cfgpack_u64(p, t->jitter);
+	sqlbox_cfgpack_u64(p, t->busymax);
+}
+
+/*
+ * Serialise "cfg" (which may be NULL) into "p".
+ * Callbacks are passed as addresses: they're only meaningful because
+ * the launcher was forked from this program.
+ * The message data pointer is not passed.
+ */
+static void
+sqlbox_cfg_pack(struct sqlbox_cfgpack *p, const struct sqlbox_cfg *cfg)
+{
+	size_t	 i;
+
+	if (cfg == NULL) {
+		sqlbox_cfgpack_u32(p, 0);
+		return;
+	}
+	sqlbox_cfgpack_u32(p, 1);
+	sqlbox_cfgpack_u32(p, cfg->flags);
+	sqlbox_cfgpack_data(p, &cfg->msg.func, sizeof(cfg->msg.func));
+	sqlbox_cfgpack_data(p, &cfg->msg.func_short, 
+		sizeof(cfg->msg.func_short));
+	sqlbox_cfgpack_data(p, &cfg->msg.func_slow, 
+		sizeof(cfg->msg.func_slow));
+	sqlbox_cfgpack_data(p, &cfg->msg.slow, sizeof(cfg->msg.slow));
+
+	sqlbox_cfgpack_u32(p, cfg->stmts.stmtsz);
+	for (i = 0; i < cfg->stmts.stmtsz; i++)
+		sqlbox_cfgpack_str(p, cfg->stmts.stmts[i].stmt);
+
+	sqlbox_cfgpack_u32(p, cfg->srcs.srcsz);
+	for (i = 0; i < cfg->srcs.srcsz; i++) {
+		sqlbox_cfgpack_str(p, cfg->srcs.srcs[i].fname);
+		sqlbox_cfgpack_u32(p, cfg->srcs.srcs[i].mode);
+		sqlbox_cfgpack_u32(p, cfg->srcs.srcs[i].cachesz);
+		sqlbox_cfgpack_tune(p, &cfg->srcs.srcs[i].tune);
+	}
+
+	sqlbox_cfgpack_u32(p, cfg->roles.rolesz);
+	sqlbox_cfgpack_u32(p, cfg->roles.defrole);
+	for (i = 0; i < cfg->roles.rolesz; i++) {
+		sqlbox_cfgpack_idx(p, cfg->roles.roles[i].roles,
+			cfg->roles.roles[i].rolesz);
+		sqlbox_cfgpack_idx(p, cfg->roles.roles[i].stmts,
+			cfg->roles.roles[i].stmtsz);
+		sqlbox_cfgpack_idx(p, cfg->roles.roles[i].srcs,
+			cfg->roles.roles[i].srcsz);
+	}
+
+	sqlbox_cfgpack_u32(p, cfg->filts.filtsz);
+	for (i = 0; i < cfg->filts.filtsz; i++) {
+		sqlbox_cfgpack_u32(p, cfg->filts.filts[i].col);
+		sqlbox_cfgpack_u32(p, cfg->filts.filts[i].stmt);
+		sqlbox_cfgpack_u32(p, cfg->filts.filts[i].type);
+		sqlbox_cfgpack_data(p, &cfg->filts.filts[i].filt,
+			sizeof(cfg->filts.filts[i].filt));
+		sqlbox_cfgpack_data(p, &cfg->filts.filts[i].free,
+			sizeof(cfg->filts.filts[i].free));
+	}
+}
+
+/*
+ * Free the arrays allocated by sqlbox_cfg_unpack().
+ * Strings point into the serialised buffer and aren't freed.
+ */
+static void
+sqlbox_cfg_unpack_free(struct sqlbox_cfg *cfg)
+{
+	size_t	 i;
+
+	for (i = 0; i < cfg->roles.rolesz; i++) {
+		free(cfg->roles.roles[i].roles);
+		free(cfg->roles.roles[i].stmts);
+		free(cfg->roles.roles[i].srcs);
+	}
+	free(cfg->roles.roles);
+	free(cfg->stmts.stmts);
+	free(cfg->srcs.srcs);
+	free(cfg->filts.filts);
+	memset(cfg, 0, sizeof(struct sqlbox_cfg));
+}
+
+static void
+sqlbox_cfgunpack_tune(struct sqlbox_cfgunpack *u, struct sqlbox_tune *t)
+{
+
+	t->journal = (int)sqlbox_cfgunpack_u32(u);
+	t->sync = (int)sqlbox_cfgunpack_u32(u);
+	t->temp = (int)sqlbox_cfgunpack_u32(u);
+	t->cachesz = (int64_t)sqlbox_cfgunpack_u64(u);
+	t->mmapsz = (int64_t)sqlbox_cfgunpack_u64(u);
+	t->pagesz = sqlbox_cfgunpack_u64(u);
+	t->busytimeo = sqlbox_cfgunpack_u64(u);
+	t->backoff = sqlbox_cfgunpack_u64(u);
+	t->backoffmax = sqlbox_cfgunpack_u64(u);
+	t->jitter = sqlbox_cfgunpack_u64(u);
+	t->busymax = sqlbox_cfgunpack_u64(u);
+}
+
+/*
+ * Deserialise the configuration in "buf" into "cfg".
+ * If it was serialised from NULL, *cfgp is set to NULL.
+ * Call sqlbox_cfg_unpack_free() regardless of the return value.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_cfg_unpack(struct sqlbox_cfg *cfg, 
+	struct sqlbox_cfg **cfgp, const char *buf, size_t sz)
+{
+	struct sqlbox_cfgunpack	 u;
+	const void	*v;
+	size_t		 i, min;
+
+	memset(cfg, 0, sizeof(struct sqlbox_cfg));
+	memset(&u, 0, sizeof(struct sqlbox_cfgunpack));
+	u.buf = buf;
+	u.sz = sz;
+	*cfgp = cfg;
+
+	if (sqlbox_cfgunpack_u32(&u) == 0) {
+		*cfgp = NULL;
+		return !u.fail;
+	}
+	cfg->flags = sqlbox_cfgunpack_u32(&u);
+	if ((v = sqlbox_cfgunpack_data(&u, sizeof(cfg->msg.func))) != NULL)
+		memcpy(&cfg->msg.func, v, sizeof(cfg->msg.func));
+	if ((v = sqlbox_cfgunpack_data(&u, 
+	    sizeof(cfg->msg.func_short))) != NULL)
+		memcpy(&cfg->msg.func_short, v, 
+			sizeof(cfg->msg.func_short));
+	if ((v = sqlbox_cfgunpack_data(&u, 
+	    sizeof(cfg->msg.func_slow))) != NULL)
+		memcpy(&cfg->msg.func_slow, v, 
+			sizeof(cfg->msg.func_slow));
+	if ((v = sqlbox_cfgunpack_data(&u, sizeof(cfg->msg.slow))) != NULL)
+		memcpy(&cfg->msg.slow, v, sizeof(cfg->msg.slow));
+
+	/* Each element's smallest encoding bounds the array size. */
+
+	min = sizeof(uint32_t) + 1;
+	cfg->stmts.stmtsz = sqlbox_cfgunpack_u32(&u);
+	cfg->stmts.stmts = sqlbox_cfgunpack_array(&u, cfg->stmts.stmtsz,
+		sizeof(struct sqlbox_pstmt), min);
+	for (i = 0; cfg->stmts.stmts != NULL && 
+	     i < cfg->stmts.stmtsz; i++)
+		cfg->stmts.stmts[i].stmt = sqlbox_cfgunpack_str(&u);
+	if (cfg->stmts.stmts == NULL)
+		cfg->stmts.stmtsz = 0;
+
+	min = sizeof(uint32_t) * 6 + sizeof(uint64_t) * 8 + 1;
+	cfg->srcs.srcsz = sqlbox_cfgunpack_u32(&u);
+	cfg->srcs.srcs = sqlbox_cfgunpack_array(&u, cfg->srcs.srcsz,
+		sizeof(struct sqlbox_src), min);
+	for (i = 0; cfg->srcs.srcs != NULL && 
+	     i < cfg->srcs.srcsz; i++) {
+		cfg->srcs.srcs[i].fname = sqlbox_cfgunpack_str(&u);
+		cfg->srcs.srcs[i].mode = sqlbox_cfgunpack_u32(&u);
+		cfg->srcs.srcs[i].cachesz = sqlbox_cfgunpack_u32(&u);
+		sqlbox_cfgunpack_tune(&u, &cfg->srcs.srcs[i].tune);
+	}
+	if (cfg->srcs.srcs == NULL)
+		cfg->srcs.srcsz = 0;
+
+	min = sizeof(uint32_t) * 3;
+	cfg->roles.rolesz = sqlbox_cfgunpack_u32(&u);
+	cfg->roles.defrole = sqlbox_cfgunpack_u32(&u);
+	cfg->roles.roles = sqlbox_cfgunpack_array(&u, cfg->roles.rolesz,
+		sizeof(struct sqlbox_role), min);
+	for (i = 0; cfg->roles.roles != NULL && 
+	     i < cfg->roles.rolesz; i++) {
+		cfg->roles.roles[i].roles = sqlbox_cfgunpack_idx
+			(&u, &cfg->roles.roles[i].rolesz);
+		cfg->roles.roles[i].stmts = sqlbox_cfgunpack_idx
+			(&u, &cfg->roles.roles[i].stmtsz);
+		cfg->roles.roles[i].srcs = sqlbox_cfgunpack_idx
+			(&u, &cfg->roles.roles[i].srcsz);
+	}
+	if (cfg->roles.roles == NULL)
+		cfg->roles.rolesz = 0;
+
+	min = sizeof(uint32_t) * 3 + 
+		sizeof(cfg->filts.filts->filt) +
+		sizeof(cfg->filts.filts->free);
+	cfg->filts.filtsz = sqlbox_cfgunpack_u32(&u);
+	cfg->filts.filts = sqlbox_cfgunpack_array(&u, cfg->filts.filtsz,
+		sizeof(struct sqlbox_filt), min);
+	for (i = 0; cfg->filts.filts != NULL && 
+	     i < cfg->filts.filtsz; i++) {
+		cfg->filts.filts[i].col = sqlbox_cfgunpack_u32(&u);
+		cfg->filts.filts[i].stmt = sqlbox_cfgunpack_u32(&u);
+		cfg->filts.filts[i].type = sqlbox_cfgunpack_u32(&u);
+		if ((v = sqlbox_cfgunpack_data(&u, 
+		    sizeof(cfg->filts.filts[i].filt))) != NULL)
+			memcpy(&cfg->filts.filts[i].filt, v, 
+				sizeof(cfg->filts.filts[i].filt));
+		if ((v = sqlbox_cfgunpack_data(&u, 
+		    sizeof(cfg->filts.filts[i].free))) != NULL)
+			memcpy(&cfg->filts.filts[i].free, v, 
+				sizeof(cfg->filts.filts[i].free));
+	}
+	if (cfg->filts.filts == NULL)
+		cfg->filts.filtsz = 0;
+
+	return !u.fail && u.sz == 0;
+}
+
+/*
+ * Write all of "buf" to the blocking descriptor "fd".
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_launch_write(int fd, const char *buf, size_t sz)
+{
+	ssize_t	 ssz;
+	int	 fl = 0;
+
+#ifdef	MSG_NOSIGNAL
+	fl = MSG_NOSIGNAL;
+#endif /* MSG_NOSIGNAL */
+
+	while (sz > 0) 
+		if ((ssz = send(fd, buf, sz, fl)) == -1) {
+			if (errno != EINTR)
+				return 0;
+		} else {
+			buf += ssz;
+			sz -= ssz;
+		}
+	return 1;
+}
+
+/*
+ * Read all of "buf" from the blocking descriptor "fd".
+ * If "rfd" is not NULL, also receive a descriptor (or -1) into it.
+ * Returns FALSE on failure or end of file, TRUE on success.
+ */
+static int
+sqlbox_launch_read(int fd, char *buf, size_t sz, int *rfd)
+{
+	struct msghdr	 msg;
+	struct iovec	 iov;
+	struct cmsghdr	*cmsg;
+	ssize_t		 ssz;
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+	if (rfd != NULL)
+		*rfd = -1;
+
+	while (sz > 0) {
+		memset(&msg, 0, sizeof(struct msghdr));
+		iov.iov_base = buf;
+		iov.iov_len = sz;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (rfd != NULL && *rfd == -1) {
+			msg.msg_control = cbuf.buf;
+			msg.msg_controllen = sizeof(cbuf.buf);
+		}
+		if ((ssz = recvmsg(fd, &msg, 0)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		} else if (ssz == 0)
+			return 0;
+		for (cmsg = msg.msg_controllen ? 
+		     CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_RIGHTS &&
+			    rfd != NULL && *rfd == -1)
+				memcpy(rfd, CMSG_DATA(cmsg), sizeof(int));
+		buf += ssz;
+		sz -= ssz;
+	}
+	return 1;
+}
+
+/*
+ * Send the length "sz" and the descriptor "sfd" in one message.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_launch_sendfd(int fd, size_t sz, int sfd)
+{
+	struct msghdr	 msg;
+	struct iovec	 iov;
+	struct cmsghdr	*cmsg;
+	uint32_t	 val = htole32(sz);
+	ssize_t		 ssz;
+	int		 fl = 0;
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+#ifdef	MSG_NOSIGNAL
+	fl = MSG_NOSIGNAL;
+#endif /* MSG_NOSIGNAL */
+
+	memset(&msg, 0, sizeof(struct msghdr));
+	memset(&cbuf, 0, sizeof(cbuf));
+	iov.iov_base = &val;
+	iov.iov_len = sizeof(uint32_t);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	memcpy(CMSG_DATA(cmsg), &sfd, sizeof(int));
+
+	while ((ssz = sendmsg(fd, &msg, fl)) == -1)
+		if (errno != EINTR)
+			return 0;
+
+	/* The descriptor went with the first byte. */
+
+	return sqlbox_launch_write(fd, 
+		(char *)&val + ssz, sizeof(uint32_t) - ssz);
+}
+
+/*
+ * The launcher process: fork boxes as requested over "fd" until the
+ * parent goes away.
+ * Each request is a serialised configuration and the server end of the
+ * box's socket pair; each answer is the box process identifier or zero
+ * on failure.
+ * Never returns.
+ */
+static void
+sqlbox_launcher_main(int fd)
+{
+	struct sqlbox_cfg	 cfg, *cfgp;
+	char			*buf;
+	uint32_t		 val;
+	size_t			 sz;
+	pid_t			 pid;
+	int			 sfd;
+
+	/* Don't leave zombies: nobody waits for the boxes. */
+
+	signal(SIGCHLD, SIG_IGN);
+
+#if HAVE_PLEDGE
+	if (pledge("stdio rpath cpath wpath "
+	           "flock fattr proc recvfd", NULL) == -1)
+		_exit(EXIT_FAILURE);
+#endif
+
+	for (;;) {
+		if (!sqlbox_launch_read(fd, (char *)&val, 
+		    sizeof(uint32_t), &sfd))
+			break;
+		if (sfd == -1)
+			break;
+		sz = le32toh(val);
+		if ((buf = malloc(sz)) == NULL) {
+			close(sfd);
+			break;
+		} else if (!sqlbox_launch_read(fd, buf, sz, NULL)) {
+			free(buf);
+			close(sfd);
+			break;
+		}
+
+		pid = 0;
+		if (sqlbox_cfg_unpack(&cfg, &cfgp, buf, sz)) {
+			if ((pid = fork()) == -1) {
+				sqlbox_warn(cfgp, "fork");
+				pid = 0;
+			} else if (pid == 0) {
+				close(fd);
+				signal(SIGCHLD, SIG_DFL);
+				sqlbox_serve(cfgp, sfd, NULL);
+				/* NOTREACHED */
+			}
+		}
+
+		close(sfd);
+		sqlbox_cfg_unpack_free(&cfg);
+		free(buf);
+
+		val = htole32(pid);
+		if (!sqlbox_launch_write(fd, (char *)&val, sizeof(uint32_t)))
+			break;
+	}
+
+	_exit(EXIT_SUCCESS);
+}
+
+struct sqlbox_launcher *
+sqlbox_launcher_alloc(void)
+{
+	struct sqlbox_launcher	*l;
+	int			 fd[2];
+
+	if ((l = calloc(1, sizeof(struct sqlbox_launcher))) == NULL)
+		return NULL;
+	if (!sqlbox_socketpair(NULL, fd, 0)) {
+		free(l);
+		return NULL;
+	}
+	if ((l->pid = fork()) == -1) {
+		close(fd[0]);
+		close(fd[1]);
+		free(l);
+		return NULL;
+	} else if (l->pid == 0) {
+		close(fd[1]);
+		sqlbox_launcher_main(fd[0]);
+		/* NOTREACHED */
+	}
+
+	close(fd[0]);
+	l->fd = fd[1];
+	return l;
+}
+
+void
+sqlbox_launcher_free(struct sqlbox_launcher *l)
+{
+
+	if (l == NULL)
+		return;
+
+	/* The launcher exits when it reads end of file. */
+
+	close(l->fd);
+	while (waitpid(l->pid, NULL, 0) == -1 && errno == EINTR)
+		continue;
+	free(l);
+}
+
+struct sqlbox *
+sqlbox_launch(struct sqlbox_launcher *l, struct sqlbox_cfg *cfg)
+{
+	struct sqlbox_cfgpack	 p;
+	struct sqlbox	*box;
+	int		 fd[2];
+	uint32_t	 val;
+	pid_t		 pid;
+
+	if (cfg != NULL && (cfg->flags & SQLBOX_CFG_RING)) {
+		sqlbox_warnx(cfg, "launch: shared-memory "
+			"transport not supported");
+		return NULL;
+	} else if (!sqlbox_cfg_vrfy(cfg)) {
+		sqlbox_warnx(cfg, "launch: sqlbox_cfg_vrfy");
+		return NULL;
+	}
+
+	memset(&p, 0, sizeof(struct sqlbox_cfgpack));
+	sqlbox_cfg_pack(&p, cfg);
+	if (p.fail || p.sz > UINT32_MAX) {
+		sqlbox_warnx(cfg, "launch: sqlbox_cfg_pack");
+		free(p.buf);
+		return NULL;
+	}
+
+	if (!sqlbox_socketpair(cfg, fd, 1)) {
+		sqlbox_warnx(cfg, "launch: sqlbox_socketpair");
+		free(p.buf);
+		return NULL;
+	}
+
+	/* Hand over the server end, then wait for its process. */
+
+	if (!sqlbox_launch_sendfd(l->fd, p.sz, fd[0]) ||
+	    !sqlbox_launch_write(l->fd, p.buf, p.sz)) {
+		sqlbox_warn(cfg, "launch: send");
+		free(p.buf);
+		close(fd[0]);
+		close(fd[1]);
+		return NULL;
+	}
+	free(p.buf);
+	close(fd[0]);
+
+	if (!sqlbox_launch_read(l->fd, 
+	    (char *)&val, sizeof(uint32_t), NULL)) {
+		sqlbox_warnx(cfg, "launch: launcher exited");
+		close(fd[1]);
+		return NULL;
+	} else if ((pid = le32toh(val)) == 0) {
+		sqlbox_warnx(cfg, "launch: launcher failed");
+		close(fd[1]);
+		return NULL;
+	}
+
+	if ((box = sqlbox_attach(cfg, fd[1], pid, NULL)) == NULL) {
+		sqlbox_warnx(cfg, "launch: sqlbox_attach");
+		close(fd[1]);
+	}
+	return box;
+}
@@ -0,0 +1,260 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Serialises threads sharing a box with SQLBOX_CFG_SHARED (client).
+ * The mutex protects the box.
+ * It may be locked again by the thread holding it, as synchronous
+ * operations call one another.
+ * One thread at a time reads answers, releasing the mutex while waiting
+ * for the server; the others wait on the condition for their answers.
+ * Synchronous operations also count as reading, as their answers must
+ * not be taken by another thread.
+ */
+struct	sqlbox_lock {
+	pthread_mutex_t		 mutex;
+	pthread_cond_t		 cond; /* answers read */
+	pthread_t		 owner; /* thread holding the mutex */
+	size_t			 depth; /* times locked by owner */
+	int			 reading; /* a thread is reading */
+};
+
+/*
+ * Whether the calling thread holds the mutex.
+ */
+static int
+sqlbox_lock_owned(const struct sqlbox_lock *l)
+{
+
+	return l->depth > 0 && pthread_equal(l->owner, pthread_self());
+}
+
+/*
+ * Take the mutex, which mustn't be held by the calling thread.
+ */
+static void
+sqlbox_lock_take(struct sqlbox_lock *l, size_t depth)
+{
+
+	pthread_mutex_lock(&l->mutex);
+	l->owner = pthread_self();
+	l->depth = depth;
+}
+
+/*
+ * Release the mutex entirely to wait on the condition.
+ */
+static void
+sqlbox_lock_wait(struct sqlbox_lock *l)
+{
+	size_t	 depth = l->depth;
+
+	l->depth = 0;
+	pthread_cond_wait(&l->cond, &l->mutex);
+	l->owner = pthread_self();
+	l->depth = depth;
+}
+
+/*
+ * Allocate the lock if SQLBOX_CFG_SHARED is set.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_lock_alloc(struct sqlbox *box)
+{
+	struct sqlbox_lock	*l;
+	int			 er;
+
+	if (!(box->cfg.flags & SQLBOX_CFG_SHARED))
+		return 1;
+
+	if ((l = calloc(1, sizeof(struct sqlbox_lock))) == NULL) {
+		sqlbox_warn(&box->cfg, "calloc");
+		return 0;
+	} else if ((er = pthread_mutex_init(&l->mutex, NULL)) != 0) {
+		sqlbox_warnx(&box->cfg, "pthread_mutex_init: %s", 
+			strerror(er));
+		free(l);
+		return 0;
+	} else if ((er = pthread_cond_init(&l->cond, NULL)) != 0) {
+		sqlbox_warnx(&box->cfg, "pthread_cond_init: %s", 
+			strerror(er));
+		pthread_mutex_destroy(&l->mutex);
+		free(l);
+		return 0;
+	}
+	box->lock = l;
+	return 1;
+}
+
+void
+sqlbox_lock_free(struct sqlbox *box)
+{
+
+	if (box->lock == NULL)
+		return;
+	pthread_cond_destroy(&box->lock->cond);
+	pthread_mutex_destroy(&box->lock->mutex);
+	free(box->lock);
+	box->lock = NULL;
+}
+
+void
+sqlbox_lock(struct sqlbox *box)
+{
+
+	if (box->lock == NULL)
+		return;
+	if (sqlbox_lock_owned(box->lock))
+		box->lock->depth++;
+	else
+		sqlbox_lock_take(box->lock, 1);
+}
+
+void
+sqlbox_unlock(struct sqlbox *box)
+{
+
+	if (box->lock == NULL)
+		return;
+	assert(sqlbox_lock_owned(box->lock));
+	if (--box->lock->depth == 0)
+		pthread_mutex_unlock(&box->lock->mutex);
+}
+
+/*
+ * Lock the box for a synchronous operation, waiting for any thread
+ * reading answers to finish, and read answers ourselves until
+ * sqlbox_unlock_sync().
+ * Operations called while the box is already locked by the calling
+ * thread run as part of its operation.
+ */
+void
+sqlbox_lock_sync(struct sqlbox *box)
+{
+	struct sqlbox_lock	*l = box->lock;
+
+	if (l == NULL)
+		return;
+	if (sqlbox_lock_owned(l)) {
+		l->depth++;
+		return;
+	}
+	sqlbox_lock_take(l, 1);
+	while (l->reading)
+		sqlbox_lock_wait(l);
+	l->reading = 1;
+}
+
+/*
+ * Undo sqlbox_lock_sync(), waking threads whose answers we've read.
+ */
+void
+sqlbox_unlock_sync(struct sqlbox *box)
+{
+	struct sqlbox_lock	*l = box->lock;
+
+	if (l == NULL)
+		return;
+	assert(sqlbox_lock_owned(l));
+	if (--l->depth > 0)
+		return;
+	l->reading = 0;
+	pthread_cond_broadcast(&l->cond);
+	pthread_mutex_unlock(&l->mutex);
+}
+
+/*
+ * With the box locked, become the thread reading answers.
+ * If another thread is reading, wait until it has read an answer
+ * instead, after which the caller should check whether it's its own.
+ * Returns TRUE if reading, FALSE if waited.
+ */
+int
+sqlbox_lock_reader(struct sqlbox *box)
+{
+
+	if (box->lock->reading) {
+		sqlbox_lock_wait(box->lock);
+		return 0;
+	}
+	box->lock->reading = 1;
+	return 1;
+}
+
+/*
+ * Stop being the thread reading answers and wake the others.
+ */
+void
+sqlbox_lock_unreader(struct sqlbox *box)
+{
+
+	box->lock->reading = 0;
+	pthread_cond_broadcast(&box->lock->cond);
+}
+
+/*
+ * As the thread reading answers, wait for an answer to arrive without
+ * holding the lock, so that other threads may submit in the meantime.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_lock_poll(struct sqlbox *box)
+{
+	struct pollfd	 pfd = { .fd = box->fd, .events = POLLIN };
+	size_t		 depth = box->lock->depth;
+	int		 c;
+
+	if (box->rbufpos < box->rbufsz)
+		return 1;
+
+	box->lock->depth = 0;
+	pthread_mutex_unlock(&box->lock->mutex);
+	while ((c = poll(&pfd, 1, INFTIM)) == -1 && errno == EINTR)
+		continue;
+	sqlbox_lock_take(box->lock, depth);
+
+	if (c == -1) {
+		sqlbox_warn(&box->cfg, "poll");
+		return 0;
+	} else if (pfd.revents & (POLLNVAL|POLLERR)) {
+		sqlbox_warnx(&box->cfg, "poll: nval");
+		return 0;
+	}
+
+	/* Hangups are reported by reading. */
+
+	return 1;
+}
@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sqlite3.h>
@@ -45,39 +46,89 @@
 typedef	int (*sqlbox_op)(struct sqlbox *, const char *, size_t);
 
 static	const sqlbox_op ops[SQLBOX_OP__MAX] = {
+	sqlbox_op_channel, /* SQLBOX_OP_CHANNEL */
 	sqlbox_op_close, /* SQLBOX_OP_CLOSE */
 	sqlbox_op_exec_async, /* SQLBOX_OP_EXEC_ASYNC */
+	sqlbox_op_exec_batch, /* SQLBOX_OP_EXEC_BATCH */
 	sqlbox_op_exec_sync, /* SQLBOX_OP_EXEC_SYNC */
+	sqlbox_op_exec_ticket, /* SQLBOX_OP_EXEC_TICKET */
 	sqlbox_op_finalise, /* SQLBOX_OP_FINAL */
+	sqlbox_op_flight, /* SQLBOX_OP_FLIGHT */
 	sqlbox_op_lastid, /* SQLBOX_OP_LASTID */
+	sqlbox_op_lastid_ticket, /* SQLBOX_OP_LASTID_TICKET */
 	sqlbox_op_msg_set_dat, /* SQLBOX_OP_MSG_SET_DAT */
+	sqlbox_op_msg_set_slow, /* SQLBOX_OP_MSG_SET_SLOW */
 	sqlbox_op_open_async, /* SQLBOX_OP_OPEN_ASYNC */
 	sqlbox_op_open_sync, /* SQLBOX_OP_OPEN_SYNC */
+	sqlbox_op_open_ticket, /* SQLBOX_OP_OPEN_TICKET */
 	sqlbox_op_ping, /* SQLBOX_OP_PING */
+	sqlbox_op_prefetch, /* SQLBOX_OP_PREFETCH */
 	sqlbox_op_prepare_bind_async, /* SQLBOX_OP_PREPARE_BIND_ASYNC */
 	sqlbox_op_prepare_bind_sync, /* SQLBOX_OP_PREPARE_BIND_SYNC */
+	sqlbox_op_prepare_bind_ticket, /* SQLBOX_OP_PREPARE_BIND_TICKET */
 	sqlbox_op_rebind, /* SQLBOX_OP_REBIND */
+	sqlbox_op_reset, /* SQLBOX_OP_RESET */
 	sqlbox_op_role, /* SQLBOX_OP_ROLE */
+	sqlbox_op_stats, /* SQLBOX_OP_STATS */
 	sqlbox_op_step, /* SQLBOX_OP_STEP */
+	sqlbox_op_step_ticket, /* SQLBOX_OP_STEP_TICKET */
+	sqlbox_op_stmt_stats, /* SQLBOX_OP_STMT_STATS */
+	sqlbox_op_stream, /* SQLBOX_OP_STREAM */
 	sqlbox_op_trans_close, /* SQLBOX_OP_TRANS_CLOSE */
 	sqlbox_op_trans_open, /* SQLBOX_OP_TRANS_OPEN */
 };
 
 /*
- * This is a way for us to sleep between connection attempts.
- * To reduce lock contention, our sleep will be random.
+ * Sleep before retry "attempt" (from zero) of an operation on a busy
+ * or locked source with tuning "tune".
+ * The wait doubles with each attempt up to a maximum, with part of it
+ * random so that contending processes don't retry in lockstep.
+ * The time slept in microseconds is added to "waited", which is the
+ * total so far for this operation.
+ * Returns FALSE without sleeping if that's reached the source's maximum
+ * wait, TRUE otherwise.
  */
-void
-sqlbox_sleep(size_t attempt)
+int
+sqlbox_backoff(const struct sqlbox_tune *tune, size_t attempt,
+	uint64_t *waited)
 {
-	useconds_t	us;
+	uint64_t	 us, max, jitter;
+	struct timespec	 ts;
+
+	us = tune->backoff != 0 ? tune->backoff : SQLBOX_BACKOFF;
+	max = tune->backoffmax != 0 ? tune->backoffmax : SQLBOX_BACKOFF_MAX;
+	if (tune->jitter == SQLBOX_JITTER_NONE)
+		jitter = 0;
+	else if (tune->jitter == 0)
+		jitter = SQLBOX_BACKOFF_JITTER;
+	else
+		jitter = tune->jitter;
+
+	for ( ; attempt > 0 && us < max; attempt--)
+		us *= 2;
+	if (us > max)
+		us = max;
 
-	us = attempt > 100 ? 10000 :  /* 1/100 second */
-	     attempt > 10  ? 100000 : /* 1/10 second */
-	     250000;                  /* 1/4 second */
+	/* Take off up to "jitter" percent. */
+
+#if HAVE_ARC4RANDOM
+	us -= us * jitter / 100 * arc4random_uniform(1001) / 1000;
+#else
+	us -= us * jitter / 100 * (random() % 1001) / 1000;
+#endif
 
-	/* FIXME: don't use random(). */
-	usleep(us * (double)(random() / (double)RAND_MAX));
+	if (tune->busymax != 0) {
+		if (*waited >= tune->busymax * 1000)
+			return 0;
+		if (us > tune->busymax * 1000 - *waited)
+			us = tune->busymax * 1000 - *waited;
+	}
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+	*waited += us;
+	return 1;
 }
 
 struct sqlbox_stmt *
@@ -92,9 +143,8 @@ sqlbox_stmt_find(struct sqlbox *box, size_t id)
 	} else if (id == 0)
 		return TAILQ_LAST(&box->stmtq, sqlbox_stmtq);
 
-	TAILQ_FOREACH(stmt, &box->stmtq, gentries)
-		if (stmt->id == id)
-			return stmt;
+	if ((stmt = sqlbox_handle_get(&box->stmts, id)) != NULL)
+		return stmt;
 
 	sqlbox_warnx(&box->cfg, "cannot find statement: %zu", id);
 	return NULL;
@@ -113,20 +163,67 @@ sqlbox_db_find(struct sqlbox *box, size_t id)
 	} else if (id == 0)
 		return TAILQ_LAST(&box->dbq, sqlbox_dbq);
 
-	TAILQ_FOREACH(db, &box->dbq, entries)
-		if (db->id == id)
-			return db;
+	if ((db = sqlbox_handle_get(&box->dbs, id)) != NULL)
+		return db;
 
 	sqlbox_warnx(&box->cfg, "cannot find source: %zu", id);
 	return NULL;
 }
 
+/*
+ * Run the operation in "frame" of size "framesz", which is the frame
+ * payload beginning with the operation.
+ * Returns FALSE on failure (the client should be dropped), TRUE on
+ * success.
+ */
+int
+sqlbox_dispatch(struct sqlbox *box, const char *frame, size_t framesz)
+{
+	enum sqlbox_op	 op;
+	uint64_t	 start, elapsed;
+	int		 rc;
+
+	if (framesz < sizeof(uint32_t)) {
+		sqlbox_warnx(&box->cfg, "bad "
+			"frame size: %zu", framesz);
+		return 0;
+	}
+
+	op = (enum sqlbox_op)le32toh
+		(*(const uint32_t *)frame);
+	frame += sizeof(uint32_t);
+	framesz -= sizeof(uint32_t);
+
+	if (op >= SQLBOX_OP__MAX) {
+		sqlbox_warnx(&box->cfg, "unknown op: %d", op);
+		return 0;
+	}
+
+	memset(&box->slow, 0, sizeof(struct sqlbox_slowrec));
+	start = sqlbox_stats_now();
+	rc = (ops[op])(box, frame, framesz);
+	elapsed = sqlbox_flight(box, SQLBOX_FLIGHT_RUN, 
+		op, frame, framesz, start);
+	if (!rc) {
+		sqlbox_warnx(&box->cfg, "sqlbox_op(%d)", op);
+		return 0;
+	}
+	box->stats.ops[op].count++;
+	sqlbox_stats_time(&box->stats.ops[op], elapsed);
+
+	/* Only operations on a database are reported. */
+
+	if (box->cfg.msg.slow > 0 && box->slow.db != NULL &&
+	    elapsed / 1000 >= box->cfg.msg.slow)
+		sqlbox_slow_report(box, op, elapsed);
+	return 1;
+}
+
 int
 sqlbox_main_loop(struct sqlbox *box)
 {
 	size_t		 framesz, bufsz = 0;
 	const char	*frame;
-	enum sqlbox_op	 op;
 	int		 c, rc = 0;
 	char		*buf = NULL;
 
@@ -140,30 +237,21 @@ sqlbox_main_loop(struct sqlbox *box)
 			rc = 1;
 			break;
 		}
-
-		if (framesz < sizeof(uint32_t)) {
-			sqlbox_warnx(&box->cfg, "bad "
-				"frame size: %zu", framesz);
+		if (!sqlbox_dispatch(box, frame, framesz))
 			break;
-		}
 
-		op = (enum sqlbox_op)le32toh
-			(*(const uint32_t *)frame);
-		frame += sizeof(uint32_t);
-		framesz -= sizeof(uint32_t);
-
-		if (op >= SQLBOX_OP__MAX) {
-			sqlbox_warnx(&box->cfg, "unknown op: %d", op);
-			break;
-		}
+		/* Channels were opened: see sqlbox_mux_run(). */
 
-		if (!(ops[op])(box, frame, framesz)) {
-			sqlbox_warnx(&box->cfg, "sqlbox_op(%d)", op);
+		if (box->mux != NULL) {
+			rc = 1;
 			break;
 		}
 	}
 
+	/* Leave a timeline of what led up to the failure. */
+
+	if (!rc)
+		sqlbox_flight_warn(box);
 	free(buf);
 	return rc;
 }
-
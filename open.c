@@ -22,7 +22,10 @@
 #include COMPAT_ENDIAN_H
 
 #include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -32,27 +35,8 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-/*
- * Return TRUE if the current role has the ability to open or close the
- * given close (or no roles are specified), FALSE if otherwise.
- */
-static int
-sqlbox_rolecheck_src(struct sqlbox *box, size_t idx)
-{
-	size_t	 i;
-
-	if (box->cfg.roles.rolesz == 0)
-		return 1;
-	for (i = 0; i < box->cfg.roles.roles[box->role].srcsz; i++)
-		if (box->cfg.roles.roles[box->role].srcs[i] == idx)
-			return 1;
-	sqlbox_warnx(&box->cfg, "open: source %zu "
-		"denied to role %zu", idx, box->role);
-	return 0;
-}
-
-size_t
-sqlbox_open(struct sqlbox *box, size_t src)
+static size_t
+sqlbox_open_locked(struct sqlbox *box, size_t src)
 {
 	uint32_t	 v = htole32(src), ack;
 	size_t		 id;
@@ -72,8 +56,19 @@ sqlbox_open(struct sqlbox *box, size_t src)
 	return id;
 }
 
-int
-sqlbox_open_async(struct sqlbox *box, size_t src)
+size_t
+sqlbox_open(struct sqlbox *box, size_t src)
+{
+	size_t	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_open_locked(box, src);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+static int
+sqlbox_open_async_locked(struct sqlbox *box, size_t src)
 {
 	uint32_t	 v = htole32(src);
 
@@ -85,21 +80,126 @@ sqlbox_open_async(struct sqlbox *box, size_t src)
 	return 1;
 }
 
+int
+sqlbox_open_async(struct sqlbox *box, size_t src)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_open_async_locked(box, src);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+size_t
+sqlbox_open_submit(struct sqlbox *box, size_t src)
+{
+	uint32_t		 v = htole32(src);
+	struct sqlbox_ticket	*t;
+
+	if ((t = sqlbox_ticket_alloc(box)) == NULL) {
+		sqlbox_warnx(&box->cfg, "open-submit: sqlbox_ticket_alloc");
+		return 0;
+	} else if (!sqlbox_write_frame
+	    (box, SQLBOX_OP_OPEN_TICKET, (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "open-submit: sqlbox_write_frame");
+		sqlbox_ticket_abort(box, t);
+		return 0;
+	}
+
+	return sqlbox_ticket_push(box, t, SQLBOX_OP_OPEN_TICKET, NULL);
+}
+
+/*
+ * Run the pragma statement formatted from "fmt" on "db".
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_db_pragma(struct sqlbox *box, struct sqlbox_db *db, 
+	const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+static int
+sqlbox_db_pragma(struct sqlbox *box, struct sqlbox_db *db, 
+	const char *fmt, ...)
+{
+	char			 buf[64];
+	struct sqlbox_pstmt	 pst = { .stmt = buf };
+	va_list			 ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (sqlbox_wrap_exec(box, db, &pst, 0) == SQLBOX_CODE_OK)
+		return 1;
+	sqlbox_warnx(&box->cfg, "%s: %s", db->src->fname, buf);
+	return 0;
+}
+
+/*
+ * Apply the tuning of the source of "db", which has just been opened
+ * (server).
+ * Busy handling goes first so that the pragmas wait on other writers,
+ * then the page size as it can't be changed once the journal is in WAL
+ * mode.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_db_tune(struct sqlbox *box, struct sqlbox_db *db)
+{
+	const struct sqlbox_tune *tune = &db->src->tune;
+	static const char *const  journals[] = { NULL, "DELETE",
+		"TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF" };
+	static const char *const  syncs[] = { NULL, "OFF", 
+		"NORMAL", "FULL", "EXTRA" };
+	static const char *const  temps[] = { NULL, "FILE", "MEMORY" };
+
+	if (tune->busytimeo)
+		sqlite3_busy_timeout(db->db, (int)tune->busytimeo);
+	else
+		sqlite3_busy_handler(db->db, sqlbox_wrap_busy, db);
+	if (tune->pagesz && !sqlbox_db_pragma
+	    (box, db, "PRAGMA page_size = %zu", tune->pagesz))
+		return 0;
+	if (tune->journal && !sqlbox_db_pragma
+	    (box, db, "PRAGMA journal_mode = %s", journals[tune->journal]))
+		return 0;
+	if (tune->sync && !sqlbox_db_pragma
+	    (box, db, "PRAGMA synchronous = %s", syncs[tune->sync]))
+		return 0;
+	if (tune->cachesz && !sqlbox_db_pragma
+	    (box, db, "PRAGMA cache_size = %" PRId64, tune->cachesz))
+		return 0;
+	if (tune->mmapsz && !sqlbox_db_pragma
+	    (box, db, "PRAGMA mmap_size = %" PRId64, tune->mmapsz))
+		return 0;
+	if (tune->temp && !sqlbox_db_pragma
+	    (box, db, "PRAGMA temp_store = %s", temps[tune->temp]))
+		return 0;
+	return 1;
+}
+
 /*
  * Attempt to open a database.
  * First check if the index is valid, then whether our role permits
  * opening new databases.
  * Then do the open itself.
- * On success, writes back the unique identifier of the database.
- * Returns TRUE on success, FALSE on failure (nothing is allocated).
+ * Does not write anything back to the client: this is done by the
+ * caller depending upon the mode.
+ * Returns the unique identifier of the database or zero on failure
+ * (nothing is allocated).
+ * If "denied" is not NULL, it's set if the role doesn't permit the
+ * source.
  */
-static int
-sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
+static size_t
+sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz,
+	int *denied)
 {
 	size_t			 idx;
 	const char		*fn;
 	struct sqlbox_db	*db;
-	uint32_t		 ack;
+	int			 reused = 0;
 	struct sqlbox_pstmt	 fk = {
 		.stmt = (char *)"PRAGMA foreign_keys = ON;"
 	};
@@ -119,12 +219,30 @@ sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
 	}
 	assert(idx < box->cfg.srcs.srcsz);
 	fn = box->cfg.srcs.srcs[idx].fname;
-	if (!sqlbox_rolecheck_src(box, idx)) {
+	if (!sqlbox_rolecheck(box, SQLBOX_PERM_SRC, idx)) {
 		sqlbox_warnx(&box->cfg, "%s: open: "
-			"sqlbox_rolecheck_src", fn);
+			"sqlbox_rolecheck", fn);
+		if (denied != NULL)
+			*denied = 1;
 		return 0;
 	}
 
+	/* 
+	 * When multiplexed, take a previously-opened connection to the
+	 * source (with its page and statement caches) if we have one.
+	 */
+
+	if (box->mux != NULL)
+		TAILQ_FOREACH(db, &box->mux->idle->dbq, entries)
+			if (db->idx == idx) {
+				TAILQ_REMOVE(&box->mux->idle->dbq, 
+					db, entries);
+				sqlbox_debug(&box->cfg, "%s: open: "
+					"reusing connection", fn);
+				reused = 1;
+				goto add;
+			}
+
 	/* Allocate and prepare for open. */
 
 	if ((db = calloc(1, sizeof(struct sqlbox_db))) == NULL) {
@@ -133,10 +251,12 @@ sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
 	}
 
 	TAILQ_INIT(&db->stmtq);
-	db->id = ++box->lastid;
-	assert(db->id != 0);
+	TAILQ_INIT(&db->cacheq);
 	db->src = &box->cfg.srcs.srcs[idx];
 	db->idx = idx;
+	if (!(box->cfg.flags & SQLBOX_CFG_NOCACHE))
+		db->cachemax = db->src->cachesz != 0 ?
+			db->src->cachesz : SQLBOX_STMTCACHE_MAX;
 
 	if ((db->db = sqlbox_wrap_open(box, db->src)) == NULL) {
 		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_open", fn);
@@ -144,41 +264,97 @@ sqlbox_op_open(struct sqlbox *box, const char *buf, size_t sz, int sync)
 		return 0;
 	}
 
+	/* We always enable foreign keys. */
+
+	if (sqlbox_wrap_exec(box, db, &fk, 0) == SQLBOX_CODE_ERROR) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_exec", fn);
+		sqlite3_close(db->db);
+		free(db);
+		return 0;
+	} else if (!sqlbox_db_tune(box, db)) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_db_tune", fn);
+		sqlite3_close(db->db);
+		free(db);
+		return 0;
+	}
+
 	/* 
 	 * Add to list of available sources.
 	 * After this, the exit handler will properly close the database
 	 * so we don't need to.
+	 * On failure, a reused connection goes back to the idle list;
+	 * otherwise, its cached statements must be finalised before it
+	 * can be closed.
 	 */
-
+add:
+	if ((db->id = sqlbox_handle_alloc(box, &box->dbs, db)) == 0) {
+		sqlbox_warnx(&box->cfg, "%s: sqlbox_handle_alloc", fn);
+		if (reused) {
+			TAILQ_INSERT_TAIL
+				(&box->mux->idle->dbq, db, entries);
+			return 0;
+		}
+		sqlbox_stmtcache_clear(box, db);
+		sqlite3_close(db->db);
+		free(db);
+		return 0;
+	}
 	TAILQ_INSERT_TAIL(&box->dbq, db, entries);
+	sqlbox_slow_note(box, db, NULL);
+	return db->id;
+}
 
-	/* We always enable foreign keys. */
+int
+sqlbox_op_open_sync(struct sqlbox *box, const char *buf, size_t sz)
+{
+	size_t		 id;
+	uint32_t	 ack;
 
-	if (sqlbox_wrap_exec(box, db, &fk, 0) == SQLBOX_CODE_ERROR) {
-		sqlbox_warnx(&box->cfg, "%s: sqlbox_wrap_exec", fn);
+	if ((id = sqlbox_op_open(box, buf, sz, NULL)) == 0) {
+		sqlbox_warnx(&box->cfg, "open-sync: sqlbox_op_open");
 		return 0;
 	}
 
-	/* Conditionally write response. */
+	/* Synchronous version writes back the identifier. */
 
-	ack = htole32(db->id);
-	if (sync && !sqlbox_write(box, (char *)&ack, sizeof(uint32_t))) {
-		sqlbox_warnx(&box->cfg, "%s: open: sqlbox_write", fn);
+	ack = htole32(id);
+	if (!sqlbox_write(box, (char *)&ack, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "open-sync: sqlbox_write");
 		return 0;
 	}
 	return 1;
 }
 
 int
-sqlbox_op_open_sync(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_op_open_async(struct sqlbox *box, const char *buf, size_t sz)
 {
 
-	return sqlbox_op_open(box, buf, sz, 1);
+	if (sqlbox_op_open(box, buf, sz, NULL) == 0) {
+		sqlbox_warnx(&box->cfg, "open-async: sqlbox_op_open");
+		return 0;
+	}
+	return 1;
 }
 
 int
-sqlbox_op_open_async(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_op_open_ticket(struct sqlbox *box, const char *buf, size_t sz)
 {
+	size_t		 id;
+	int		 denied = 0;
+
+	/* 
+	 * Errors are reported to the client, not fatal, except for
+	 * role violations as in the other modes.
+	 */
+
+	if ((id = sqlbox_op_open(box, buf, sz, &denied)) == 0)
+		sqlbox_warnx(&box->cfg, "open-ticket: sqlbox_op_open");
+	if (denied)
+		return 0;
 
-	return sqlbox_op_open(box, buf, sz, 0);
+	if (sqlbox_ticket_reply(box, id == 0 ? 
+	    SQLBOX_CODE_ERROR : SQLBOX_CODE_OK, id, 0))
+		return 1;
+	sqlbox_warnx(&box->cfg, "open-ticket: sqlbox_ticket_reply");
+	return 0;
 }
@@ -279,7 +279,7 @@ sqlbox_parm_unpack_align(struct sqlbox *box,
 		return 0;
 
 	*buf += offs;
-	*bufsz += offs;
+	*bufsz -= offs;
 	return 1;
 }
 
@@ -0,0 +1,119 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Compare the latency of getting "-n" boxes ready for use (as for that
+ * many threads) with sqlbox_alloc(3) and sqlbox_open(3) ("cold")
+ * against opening channels to one box with sqlbox_channel(3)
+ * ("channel").
+ * Channels are measured first so that exiting processes of the other
+ * mode don't interfere.
+ * Each box then runs one statement and all are freed.
+ * Prints the mean time to get a box and the number of database
+ * processes left running.
+ */
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, n = 64;
+	struct sqlbox		*p, **boxes;
+	struct sqlbox_cfg	 cfg;
+	int			 c, mode;
+	double			 start, get;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"SELECT 1" },
+	};
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc recvfd", 
+	    NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((c = getopt(argc, argv, "n:")) != -1)
+		switch (c) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+
+	if ((boxes = calloc(n, sizeof(struct sqlbox *))) == NULL)
+		err(EXIT_FAILURE, NULL);
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 1;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = 1;
+	cfg.stmts.stmts = pstmts;
+	cfg.flags = SQLBOX_CFG_CHANNEL;
+
+	puts("# mode n ns/get processes");
+
+	for (mode = 0; mode < 2; mode++) {
+		p = NULL;
+		start = now();
+		if (mode == 0 && (p = sqlbox_alloc(&cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_alloc");
+		for (i = 0; i < n; i++) {
+			boxes[i] = mode == 0 ? 
+				sqlbox_channel(p) : sqlbox_alloc(&cfg);
+			if (boxes[i] == NULL)
+				errx(EXIT_FAILURE, "sqlbox_alloc");
+			if (!sqlbox_open(boxes[i], 0))
+				errx(EXIT_FAILURE, "sqlbox_open");
+		}
+		get = now() - start;
+		for (i = 0; i < n; i++) {
+			if (sqlbox_exec(boxes[i], 1, 0, 0, NULL, 0) != 
+			    SQLBOX_CODE_OK)
+				errx(EXIT_FAILURE, "sqlbox_exec");
+			sqlbox_free(boxes[i]);
+		}
+		sqlbox_free(p);
+		printf("%s %zu %.0f %zu\n", mode == 0 ? 
+			"channel" : "cold", n, get / n, mode == 0 ? 1 : n);
+	}
+
+	free(boxes);
+	return EXIT_SUCCESS;
+}
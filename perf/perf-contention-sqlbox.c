@@ -0,0 +1,382 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <sys/wait.h>
+
+#include <err.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Have "-p" processes, each with its own box on the same database
+ * file "-f", run "-n" operations at once and measure the contention.
+ * Operations are drawn from the "-m" mix of weights for immediate
+ * transactions of "-t" inserts, deferred transactions of "-t" reads,
+ * and single inserts and reads.
+ * Deferred transactions only read: one that reads then writes may not
+ * be able to upgrade its lock at all, which SQLite reports without
+ * waiting.
+ * This is run in rollback-journal then write-ahead log mode, the
+ * database and its logs removed before and after each.
+ * Prints the throughput over all processes, latency percentiles in
+ * nanoseconds of an operation, and the number of and microseconds
+ * spent in busy back-offs summed over all database processes.
+ */
+
+enum	kind {
+	KIND_IMMEDIATE,
+	KIND_DEFERRED,
+	KIND_INSERT,
+	KIND_READ,
+	KIND__MAX
+};
+
+#define	ROWS	1000 /* rows to read from */
+
+/*
+ * What a client process reports back after its latencies.
+ */
+struct	result {
+	double		 elapsed; /* nanoseconds for all operations */
+	uint64_t	 retries; /* busy back-offs */
+	uint64_t	 wait; /* microseconds backing off */
+};
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+dblcmp(const void *a, const void *b)
+{
+	double	 d1 = *(const double *)a, d2 = *(const double *)b;
+
+	return d1 < d2 ? -1 : d1 > d2;
+}
+
+static void
+rmdb(const char *fn)
+{
+	char	 buf[PATH_MAX];
+
+	unlink(fn);
+	snprintf(buf, sizeof(buf), "%s-journal", fn);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-wal", fn);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-shm", fn);
+	unlink(buf);
+}
+
+static void
+xwrite(int fd, const void *buf, size_t sz)
+{
+	ssize_t	 ssz;
+
+	for ( ; sz > 0; sz -= ssz, buf = (const char *)buf + ssz)
+		if ((ssz = write(fd, buf, sz)) == -1)
+			err(EXIT_FAILURE, "write");
+}
+
+static void
+xread(int fd, void *buf, size_t sz)
+{
+	ssize_t	 ssz;
+
+	for ( ; sz > 0; sz -= ssz, buf = (char *)buf + ssz)
+		if ((ssz = read(fd, buf, sz)) == -1)
+			err(EXIT_FAILURE, "read");
+		else if (ssz == 0)
+			errx(EXIT_FAILURE, "read: client exited");
+}
+
+/*
+ * Run one of the operations of the mix.
+ */
+static void
+run(struct sqlbox *p, enum kind kind, size_t txn)
+{
+	size_t			 i, id, n = 1;
+	struct sqlbox_parm	 parm;
+	const struct sqlbox_parmset *res;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+
+	if (kind == KIND_IMMEDIATE) {
+		if (!sqlbox_trans_immediate(p, 0, 1))
+			errx(EXIT_FAILURE, "sqlbox_trans_immediate");
+		n = txn;
+	} else if (kind == KIND_DEFERRED) {
+		if (!sqlbox_trans_deferred(p, 0, 1))
+			errx(EXIT_FAILURE, "sqlbox_trans_deferred");
+		n = txn;
+	}
+
+	for (i = 0; i < n; i++) {
+		parm.iparm = random() % ROWS + 1;
+		if (kind == KIND_IMMEDIATE || kind == KIND_INSERT) {
+			if (sqlbox_exec(p, 0, 1, 1, &parm, 0) != 
+			    SQLBOX_CODE_OK)
+				errx(EXIT_FAILURE, "sqlbox_exec");
+			continue;
+		}
+		if (!(id = sqlbox_prepare_bind(p, 0, 2, 1, &parm, 0)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+		if ((res = sqlbox_step(p, id)) == NULL || res->psz != 1)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (!sqlbox_finalise(p, id))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+	}
+
+	if (kind == KIND_IMMEDIATE || kind == KIND_DEFERRED)
+		if (!sqlbox_trans_commit(p, 0, 1))
+			errx(EXIT_FAILURE, "sqlbox_trans_commit");
+}
+
+/*
+ * A client process: wait on "go" for all to be started, then run "n"
+ * operations from the mix, and write the latencies of each then the
+ * results to "out".
+ */
+static void
+client(struct sqlbox_cfg *cfg, int go, int out, size_t n, 
+	const size_t *mix, size_t txn)
+{
+	struct sqlbox		*p;
+	struct sqlbox_stats	 st;
+	struct result		 res;
+	double			*lat, start;
+	size_t			 i, sum, r;
+	enum kind		 kind;
+	char			 c;
+
+	srandom(getpid());
+	for (sum = 0, i = 0; i < KIND__MAX; i++)
+		sum += mix[i];
+
+	if ((lat = calloc(n, sizeof(double))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	if ((p = sqlbox_alloc(cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (read(go, &c, 1) == -1)
+		err(EXIT_FAILURE, "read");
+
+	res.elapsed = now();
+	for (i = 0; i < n; i++) {
+		r = random() % sum;
+		for (kind = 0; r >= mix[kind]; kind++)
+			r -= mix[kind];
+		start = now();
+		run(p, kind, txn);
+		lat[i] = now() - start;
+	}
+
+	/* Transactions are asynchronous: make sure they're done. */
+
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	res.elapsed = now() - res.elapsed;
+
+	if (!sqlbox_stats(p, NULL, &st))
+		errx(EXIT_FAILURE, "sqlbox_stats");
+	res.retries = st.busyretries;
+	res.wait = st.busywait;
+	sqlbox_free(p);
+
+	xwrite(out, lat, n * sizeof(double));
+	xwrite(out, &res, sizeof(struct result));
+	free(lat);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, j, n = 1000, procs = 4, txn = 4;
+	size_t			 mix[KIND__MAX] = { 10, 10, 40, 40 };
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	 parm;
+	struct result		 res;
+	int			 ch, mode, status, go[2], *fds;
+	pid_t			*pids;
+	double			*lat, elapsed;
+	uint64_t		 retries, wait;
+	const char		*fn = "perf-contention.db";
+	struct sqlbox_src	 srcs[] = {
+		{ .mode = SQLBOX_SRC_RWC },
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE t "
+			"(id INTEGER PRIMARY KEY, x INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO t (x) VALUES (?)" },
+		{ .stmt = (char *)"SELECT x FROM t WHERE id = ?" },
+	};
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc", 
+	    NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((ch = getopt(argc, argv, "f:m:n:p:t:")) != -1)
+		switch (ch) {
+		case 'f':
+			fn = optarg;
+			break;
+		case 'm':
+			if (sscanf(optarg, "%zu:%zu:%zu:%zu", &mix[0], 
+			    &mix[1], &mix[2], &mix[3]) != 4 ||
+			    mix[0] + mix[1] + mix[2] + mix[3] == 0)
+				errx(EXIT_FAILURE, "-m: expected "
+					"immediate:deferred:insert:read");
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'p':
+			procs = atoi(optarg);
+			break;
+		case 't':
+			txn = atoi(optarg);
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+	if (n == 0 || procs == 0)
+		errx(EXIT_FAILURE, "-n, -p: must be positive");
+
+	srcs[0].fname = (char *)fn;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 1;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = 3;
+	cfg.stmts.stmts = pstmts;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+
+	if ((lat = calloc(n * procs, sizeof(double))) == NULL ||
+	    (pids = calloc(procs, sizeof(pid_t))) == NULL ||
+	    (fds = calloc(procs, sizeof(int))) == NULL)
+		err(EXIT_FAILURE, NULL);
+
+	puts("# mode procs n ops/s p50-ns p99-ns p999-ns retries wait-us");
+
+	for (mode = 0; mode < 2; mode++) {
+		srcs[0].tune.journal = mode == 0 ?
+			SQLBOX_JOURNAL_DELETE : SQLBOX_JOURNAL_WAL;
+		rmdb(fn);
+
+		/* Create the rows to read before any clients start. */
+
+		if ((p = sqlbox_alloc(&cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_alloc");
+		if (!sqlbox_open(p, 0))
+			errx(EXIT_FAILURE, "sqlbox_open");
+		if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		if (!sqlbox_trans_immediate(p, 0, 1))
+			errx(EXIT_FAILURE, "sqlbox_trans_immediate");
+		for (i = 0; i < ROWS; i++) {
+			parm.iparm = i;
+			if (sqlbox_exec(p, 0, 1, 1, &parm, 0) != 
+			    SQLBOX_CODE_OK)
+				errx(EXIT_FAILURE, "sqlbox_exec");
+		}
+		if (!sqlbox_trans_commit(p, 0, 1))
+			errx(EXIT_FAILURE, "sqlbox_trans_commit");
+		sqlbox_free(p);
+
+		/* Start all clients at once by closing "go". */
+
+		if (pipe(go) == -1)
+			err(EXIT_FAILURE, "pipe");
+		for (i = 0; i < procs; i++) {
+			int	 out[2];
+
+			if (pipe(out) == -1)
+				err(EXIT_FAILURE, "pipe");
+			if ((pids[i] = fork()) == -1)
+				err(EXIT_FAILURE, "fork");
+			if (pids[i] == 0) {
+				close(go[1]);
+				close(out[0]);
+				for (j = 0; j < i; j++)
+					close(fds[j]);
+				client(&cfg, go[0], out[1], 
+					n, mix, txn);
+				_exit(EXIT_SUCCESS);
+			}
+			close(out[1]);
+			fds[i] = out[0];
+		}
+		close(go[0]);
+		close(go[1]);
+
+		elapsed = 0.0;
+		retries = wait = 0;
+		for (i = 0; i < procs; i++) {
+			xread(fds[i], lat + i * n, n * sizeof(double));
+			xread(fds[i], &res, sizeof(struct result));
+			close(fds[i]);
+			if (res.elapsed > elapsed)
+				elapsed = res.elapsed;
+			retries += res.retries;
+			wait += res.wait;
+		}
+		for (i = 0; i < procs; i++) {
+			if (waitpid(pids[i], &status, 0) == -1)
+				err(EXIT_FAILURE, "waitpid");
+			if (!WIFEXITED(status) || 
+			    WEXITSTATUS(status) != EXIT_SUCCESS)
+				errx(EXIT_FAILURE, "client failed");
+		}
+
+		qsort(lat, n * procs, sizeof(double), dblcmp);
+		printf("%s %zu %zu %.0f %.0f %.0f %.0f %llu %llu\n", 
+			mode == 0 ? "journal" : "wal", procs, n * procs,
+			n * procs / (elapsed / 1e9),
+			lat[n * procs / 2], 
+			lat[n * procs * 99 / 100],
+			lat[n * procs * 999 / 1000],
+			(unsigned long long)retries,
+			(unsigned long long)wait);
+		fflush(stdout);
+	}
+
+	rmdb(fn);
+	free(lat);
+	free(pids);
+	free(fds);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Like perf-prep-insert-final and perf-rebind, but inserting "-b" rows
+ * at a time with sqlbox_exec_batch(3).
+ * With "-t", each batch is its own transaction.
+ */
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, stmtid, i, j, n, 
+				 rows = 10000, batch = 1000;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	*parms;
+	unsigned long		 flags = 0;
+	int			 c;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(col1 INT, col2 INT, col3 INT, col4 INT)" },
+		{ .stmt = (char *)"INSERT INTO foo "
+			"(col1, col2, col3, col4) VALUES (?,?,?,?)" },
+	};
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc", NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((c = getopt(argc, argv, "b:n:t")) != -1)
+		switch (c) {
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'n':
+			rows = atoi(optarg);
+			break;
+		case 't':
+			flags |= SQLBOX_STMT_TRANS;
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+
+	if (batch == 0)
+		batch = 1;
+	if ((parms = calloc(batch * 4, sizeof(struct sqlbox_parm))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (i = 0; i < batch * 4; i++)
+		parms[i].type = SQLBOX_PARM_INT;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 1;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = 2;
+	cfg.stmts.stmts = pstmts;
+
+	printf(">>> %zu insertions (batches of %zu)\n", rows, batch);
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (pledge("stdio", NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!(stmtid = sqlbox_prepare_bind(p, dbid, 0, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (sqlbox_step(p, stmtid) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	for (i = 0; i < rows; i += n) {
+		n = rows - i < batch ? rows - i : batch;
+		for (j = 0; j < n * 4; j++)
+#ifdef __OpenBSD__
+			parms[j].iparm = arc4random();
+#else
+			parms[j].iparm = random();
+#endif
+		if (sqlbox_exec_batch(p, dbid, 1, n, 4, 
+		    parms, flags, NULL) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec_batch");
+	}
+
+	if (!sqlbox_close(p, dbid))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	free(parms);
+	puts("<<< done");
+	return EXIT_SUCCESS;
+}
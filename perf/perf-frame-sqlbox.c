@@ -0,0 +1,216 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Measure the per-operation latency and wire bytes of the smallest
+ * round-trip operations: ping, single-row step, and synchronous exec.
+ * Byte counts are read from the Linux per-process I/O accounting of
+ * both this process (bytes received) and the child (bytes sent to
+ * it), so they're only available on Linux.
+ * With -r, the shared-memory transport is used instead, so only the
+ * wakeups (if any) go over the socket.
+ */
+
+enum	bench {
+	BENCH_PING,
+	BENCH_STEP,
+	BENCH_EXEC,
+	BENCH__MAX
+};
+
+static	const char *const benches[BENCH__MAX] = {
+	"ping", /* BENCH_PING */
+	"step", /* BENCH_STEP */
+	"exec", /* BENCH_EXEC */
+};
+
+/*
+ * Return the number of bytes read by process "pid" (as accounted by
+ * read(2) and friends) or zero if this isn't available.
+ */
+static uint64_t
+rchar(pid_t pid)
+{
+	FILE		*f;
+	char		 path[64];
+	uint64_t	 v = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+	if (fscanf(f, "rchar: %" SCNu64, &v) != 1)
+		v = 0;
+	fclose(f);
+	return v;
+}
+
+/*
+ * Find our only child process (the sqlbox server) or return -1.
+ */
+static pid_t
+child(void)
+{
+	FILE	*f;
+	char	 path[64];
+	int	 pid = -1;
+
+	snprintf(path, sizeof(path), 
+		"/proc/%d/task/%d/children", 
+		(int)getpid(), (int)getpid());
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+	if (fscanf(f, "%d", &pid) != 1)
+		pid = -1;
+	fclose(f);
+	return pid;
+}
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, rows = 10000, stmtid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	int			 c, ring = 0;
+	pid_t			 pid;
+	double			 start;
+	uint64_t		 in, out;
+	enum bench		 b;
+	const struct sqlbox_parmset *res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (col INT)" },
+		{ .stmt = (char *)"INSERT INTO foo "
+			"WITH RECURSIVE cte(x) AS "
+			"(SELECT random() UNION ALL"
+			" SELECT random() FROM cte LIMIT ?"
+		 	") SELECT abs(x) FROM cte;" },
+		{ .stmt = (char *)"SELECT col FROM foo" },
+		{ .stmt = (char *)"INSERT INTO foo (col) VALUES (?)" },
+	};
+	struct sqlbox_parm	 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc", NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((c = getopt(argc, argv, "n:r")) != -1)
+		switch (c) {
+		case 'n':
+			rows = atoi(optarg);
+			break;
+		case 'r':
+			ring = 1;
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	if (ring)
+		cfg.flags = SQLBOX_CFG_RING;
+
+	cfg.srcs.srcsz = 1;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = 4;
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (pledge("stdio rpath", NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	parm.iparm = rows;
+	if (sqlbox_exec(p, 0, 1, 1, &parm, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!(stmtid = sqlbox_prepare_bind(p, 0, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+
+	pid = child();
+	puts("# op n ns/op bytes-sent/op bytes-received/op");
+
+	for (b = 0; b < BENCH__MAX; b++) {
+		in = rchar(getpid());
+		out = pid == -1 ? 0 : rchar(pid);
+		start = now();
+		for (i = 0; i < rows; i++) 
+			switch (b) {
+			case BENCH_PING:
+				if (!sqlbox_ping(p))
+					errx(EXIT_FAILURE, "sqlbox_ping");
+				break;
+			case BENCH_STEP:
+				res = sqlbox_step(p, stmtid);
+				if (res == NULL)
+					errx(EXIT_FAILURE, "sqlbox_step");
+				if (res->psz != 1)
+					errx(EXIT_FAILURE, "res->psz != 1");
+				break;
+			case BENCH_EXEC:
+				parm.iparm = i;
+				if (sqlbox_exec(p, 0, 3, 1, &parm, 0) != 
+				    SQLBOX_CODE_OK)
+					errx(EXIT_FAILURE, "sqlbox_exec");
+				break;
+			default:
+				abort();
+			}
+		start = now() - start;
+		in = rchar(getpid()) - in;
+		out = pid == -1 ? 0 : rchar(pid) - out;
+		printf("%s %zu %.0f %.1f %.1f\n", benches[b], rows,
+			start / rows, (double)out / rows, 
+			(double)in / rows);
+	}
+
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	if (!sqlbox_close(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
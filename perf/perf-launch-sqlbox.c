@@ -0,0 +1,116 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Compare the time to create a box with sqlbox_alloc(3), which forks
+ * this process, against sqlbox_launch(3), which has a launcher forked
+ * at startup do so.
+ * Before creating boxes, "-m" megabytes of heap are touched to grow
+ * this process.
+ * Each of "-n" boxes is created, pinged, and freed.
+ */
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, rows = 200, mb = 512;
+	struct sqlbox		*p;
+	struct sqlbox_launcher	*l;
+	struct sqlbox_cfg	 cfg;
+	int			 c, mode;
+	double			 start;
+	char			*heap;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+
+	if (pledge("stdio rpath cpath wpath "
+	    "flock fattr proc sendfd recvfd", NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((c = getopt(argc, argv, "m:n:")) != -1)
+		switch (c) {
+		case 'm':
+			mb = atoi(optarg);
+			break;
+		case 'n':
+			rows = atoi(optarg);
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+
+	/* Do this first, while we're small. */
+
+	if ((l = sqlbox_launcher_alloc()) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launcher_alloc");
+
+	if (mb > 0) {
+		if ((heap = malloc(mb * 1024 * 1024)) == NULL)
+			err(EXIT_FAILURE, NULL);
+		memset(heap, 1, mb * 1024 * 1024);
+	} else
+		heap = NULL;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 1;
+	cfg.srcs.srcs = srcs;
+
+	puts("# mode heap-mb n ns/box");
+
+	for (mode = 0; mode < 2; mode++) {
+		start = now();
+		for (i = 0; i < rows; i++) {
+			p = mode == 0 ? 
+				sqlbox_alloc(&cfg) : sqlbox_launch(l, &cfg);
+			if (p == NULL)
+				errx(EXIT_FAILURE, "sqlbox_alloc");
+			if (!sqlbox_ping(p))
+				errx(EXIT_FAILURE, "sqlbox_ping");
+			sqlbox_free(p);
+		}
+		start = now() - start;
+		printf("%s %zu %zu %.0f\n", mode == 0 ? 
+			"alloc" : "launch", mb, rows, start / rows);
+	}
+
+	sqlbox_launcher_free(l);
+	free(heap);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,498 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#define	_GNU_SOURCE /* RTLD_NEXT */
+
+#include <dlfcn.h>
+#include <err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Time each call of the operations below "-n" times in-process, without
+ * forking, opening, or exiting in the measurement, across parameter
+ * counts ("parms"), result columns ("cols"), and value sizes ("size").
+ * Run only operation "-o" if given.
+ * Prints one line per operation and shape: the 50th, 99th, and 99.9th
+ * percentile latency in nanoseconds, operations per second over the
+ * whole run, and calls to the allocator per operation by the calling
+ * process.
+ * Asynchronous operations (exec-async) are timed as queued; the run
+ * they're counted over ends with a ping to drain them.
+ */
+
+#define	NPARMS	3
+#define	NCOLS	3
+#define	NSIZES	3
+
+static	const size_t parms[NPARMS] = { 1, 4, 16 };
+static	const size_t cols[NCOLS] = { 1, 4, 16 };
+static	const size_t sizes[NSIZES] = { 8, 256, 4096 };
+
+enum	stmt {
+	STMT_CREATE,
+	STMT_INSERT, /* by parms */
+	STMT_SELECT = STMT_INSERT + NPARMS, /* by parms */
+	STMT_ROWS = STMT_SELECT + NPARMS, /* by cols */
+	STMT__MAX = STMT_ROWS + NCOLS
+};
+
+/*
+ * Allocator calls are counted by wrapping the system allocator.
+ * Looking it up may itself allocate, which is served from "boot".
+ */
+static	void	*(*real_malloc)(size_t);
+static	void	*(*real_calloc)(size_t, size_t);
+static	void	*(*real_realloc)(void *, size_t);
+static	void	 (*real_free)(void *);
+static	size_t	  allocs;
+static	int	  resolving;
+static	union {
+	max_align_t	 align;
+	char		 buf[4096];
+} boot; /* suitably aligned for anything */
+static	size_t	  bootsz;
+
+static void
+resolve(void)
+{
+
+	resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	resolving = 0;
+	if (real_malloc == NULL || real_calloc == NULL ||
+	    real_realloc == NULL || real_free == NULL)
+		abort();
+}
+
+void *
+malloc(size_t sz)
+{
+
+	if (real_malloc == NULL)
+		resolve();
+	allocs++;
+	return real_malloc(sz);
+}
+
+void *
+calloc(size_t nm, size_t sz)
+{
+	void	*p;
+	size_t	 al = sizeof(max_align_t);
+
+	if (real_calloc == NULL && resolving) {
+		if (sz != 0 && nm > (sizeof(boot.buf) - bootsz) / sz)
+			return NULL;
+		/* Rounding up still fits: the room left is aligned. */
+		p = boot.buf + bootsz;
+		bootsz += (nm * sz + al - 1) / al * al;
+		return p;
+	}
+	if (real_calloc == NULL)
+		resolve();
+	allocs++;
+	return real_calloc(nm, sz);
+}
+
+void *
+realloc(void *p, size_t sz)
+{
+
+	if (real_realloc == NULL)
+		resolve();
+	allocs++;
+	return real_realloc(p, sz);
+}
+
+void
+free(void *p)
+{
+
+	if ((uintptr_t)p >= (uintptr_t)boot.buf &&
+	    (uintptr_t)p < (uintptr_t)(boot.buf + sizeof(boot.buf)))
+		return;
+	if (real_free == NULL)
+		resolve();
+	real_free(p);
+}
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+dblcmp(const void *a, const void *b)
+{
+	double	 d1 = *(const double *)a, d2 = *(const double *)b;
+
+	return d1 < d2 ? -1 : d1 > d2;
+}
+
+/*
+ * Where each measurement of a run goes.
+ */
+struct	run {
+	double	*lat; /* latency of each operation */
+	size_t	 n; /* operations */
+	double	 start; /* when the run began */
+	size_t	 allocs; /* allocator calls at start */
+};
+
+static void
+run_start(struct run *r)
+{
+
+	r->allocs = allocs;
+	r->start = now();
+}
+
+/*
+ * Print the results of run "r" of "op" in the given shape, where zero
+ * means it doesn't apply.
+ */
+static void
+run_print(struct run *r, const char *op, 
+	size_t np, size_t nc, size_t sz)
+{
+	double	 end = now();
+	size_t	 nallocs = allocs - r->allocs;
+
+	qsort(r->lat, r->n, sizeof(double), dblcmp);
+	printf("%s %zu %zu %zu %zu %.0f %.0f %.0f %.0f %.2f\n", 
+		op, np, nc, sz, r->n, 
+		r->lat[r->n / 2], 
+		r->lat[r->n * 99 / 100], 
+		r->lat[r->n * 999 / 1000],
+		r->n / ((end - r->start) / 1e9),
+		(double)nallocs / r->n);
+	fflush(stdout);
+}
+
+/*
+ * Fill in "np" parameters in "ps" with integers.
+ */
+static void
+fill_ints(struct sqlbox_parm *ps, size_t np)
+{
+	size_t	 i;
+
+	memset(ps, 0, np * sizeof(struct sqlbox_parm));
+	for (i = 0; i < np; i++) {
+		ps[i].type = SQLBOX_PARM_INT;
+		ps[i].iparm = i;
+	}
+}
+
+/*
+ * Append "s" to the NUL-terminated "buf" of "bufsz".
+ */
+static void
+cat(char *buf, const char *s, size_t bufsz)
+{
+	size_t	 len = strlen(buf);
+
+	if ((size_t)snprintf(buf + len, bufsz - len, "%s", s) >= 
+	    bufsz - len)
+		errx(EXIT_FAILURE, "statement too long");
+}
+
+/*
+ * Append to "buf" the string "s" "n" times separated by commas.
+ */
+static void
+list(char *buf, size_t bufsz, const char *s, size_t n)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			cat(buf, ", ", bufsz);
+		cat(buf, s, bufsz);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, j, k, n = 10000, id, srcid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	 ps[16];
+	struct run		 r;
+	int			 c;
+	int64_t			 lastid;
+	double			 start;
+	char			*val;
+	const char		*only = NULL;
+	char			 sql[STMT__MAX][1024], buf[64];
+	struct sqlbox_pstmt	 pstmts[STMT__MAX];
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC },
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC },
+	};
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc", 
+	    NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((c = getopt(argc, argv, "n:o:")) != -1)
+		switch (c) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'o':
+			only = optarg;
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+	if (n == 0)
+		errx(EXIT_FAILURE, "-n: must be positive");
+
+	/* Statements are sized by the shapes we run. */
+
+	memset(sql, 0, sizeof(sql));
+	cat(sql[STMT_CREATE], "CREATE TABLE t (", sizeof(sql[0]));
+	for (i = 0; i < parms[NPARMS - 1]; i++) {
+		snprintf(buf, sizeof(buf), "%sc%zu INTEGER", 
+			i > 0 ? ", " : "", i);
+		cat(sql[STMT_CREATE], buf, sizeof(sql[0]));
+	}
+	cat(sql[STMT_CREATE], ")", sizeof(sql[0]));
+	for (i = 0; i < NPARMS; i++) {
+		cat(sql[STMT_INSERT + i],
+			"INSERT INTO t (", sizeof(sql[0]));
+		for (j = 0; j < parms[i]; j++) {
+			snprintf(buf, sizeof(buf), 
+				"%sc%zu", j > 0 ? ", " : "", j);
+			cat(sql[STMT_INSERT + i], buf, sizeof(sql[0]));
+		}
+		cat(sql[STMT_INSERT + i], ") VALUES (", sizeof(sql[0]));
+		list(sql[STMT_INSERT + i], sizeof(sql[0]), "?", parms[i]);
+		cat(sql[STMT_INSERT + i], ")", sizeof(sql[0]));
+		cat(sql[STMT_SELECT + i], "SELECT ", sizeof(sql[0]));
+		list(sql[STMT_SELECT + i], sizeof(sql[0]), "?", parms[i]);
+	}
+	for (i = 0; i < NCOLS; i++) {
+		cat(sql[STMT_ROWS + i], "WITH RECURSIVE c(x) AS "
+			"(SELECT 1 UNION ALL SELECT x + 1 FROM c "
+			"WHERE x < ?1) SELECT ", sizeof(sql[0]));
+		list(sql[STMT_ROWS + i], sizeof(sql[0]), "?2", cols[i]);
+		cat(sql[STMT_ROWS + i], " FROM c", sizeof(sql[0]));
+	}
+	for (i = 0; i < STMT__MAX; i++)
+		pstmts[i].stmt = sql[i];
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 2;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = STMT__MAX;
+	cfg.stmts.stmts = pstmts;
+
+	if ((r.lat = calloc(n, sizeof(double))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	r.n = n;
+	if ((val = malloc(sizes[NSIZES - 1] + 1)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	memset(val, 'x', sizes[NSIZES - 1]);
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(srcid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, srcid, STMT_CREATE, 0, NULL, 0) != 
+	    SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	puts("# op parms cols size n p50-ns p99-ns p999-ns ops/s allocs/op");
+
+	if (only == NULL || strcmp(only, "ping") == 0) {
+		run_start(&r);
+		for (i = 0; i < n; i++) {
+			start = now();
+			if (!sqlbox_ping(p))
+				errx(EXIT_FAILURE, "sqlbox_ping");
+			r.lat[i] = now() - start;
+		}
+		run_print(&r, "ping", 0, 0, 0);
+	}
+
+	if (only == NULL || strcmp(only, "open") == 0) {
+		run_start(&r);
+		for (i = 0; i < n; i++) {
+			start = now();
+			if (!(id = sqlbox_open(p, 1)))
+				errx(EXIT_FAILURE, "sqlbox_open");
+			r.lat[i] = now() - start;
+			if (!sqlbox_close(p, id))
+				errx(EXIT_FAILURE, "sqlbox_close");
+		}
+		run_print(&r, "open", 0, 0, 0);
+	}
+
+	for (k = 0; k < NPARMS; k++) {
+		fill_ints(ps, parms[k]);
+		if (only == NULL || strcmp(only, "exec-sync") == 0) {
+			run_start(&r);
+			for (i = 0; i < n; i++) {
+				start = now();
+				if (sqlbox_exec(p, srcid, STMT_INSERT + k, 
+				    parms[k], ps, 0) != SQLBOX_CODE_OK)
+					errx(EXIT_FAILURE, "sqlbox_exec");
+				r.lat[i] = now() - start;
+			}
+			run_print(&r, "exec-sync", parms[k], 0, 0);
+		}
+		if (only == NULL || strcmp(only, "exec-async") == 0) {
+			run_start(&r);
+			for (i = 0; i < n; i++) {
+				start = now();
+				if (!sqlbox_exec_async(p, srcid, 
+				    STMT_INSERT + k, parms[k], ps, 0))
+					errx(EXIT_FAILURE, 
+						"sqlbox_exec_async");
+				r.lat[i] = now() - start;
+			}
+			if (!sqlbox_ping(p))
+				errx(EXIT_FAILURE, "sqlbox_ping");
+			run_print(&r, "exec-async", parms[k], 0, 0);
+		}
+		if (only == NULL || strcmp(only, "prepare-bind") == 0) {
+			run_start(&r);
+			for (i = 0; i < n; i++) {
+				start = now();
+				if (!(id = sqlbox_prepare_bind(p, srcid, 
+				    STMT_SELECT + k, parms[k], ps, 0)))
+					errx(EXIT_FAILURE, 
+						"sqlbox_prepare_bind");
+				r.lat[i] = now() - start;
+				if (!sqlbox_finalise(p, id))
+					errx(EXIT_FAILURE, 
+						"sqlbox_finalise");
+			}
+			run_print(&r, "prepare-bind", parms[k], 0, 0);
+		}
+		if (only == NULL || strcmp(only, "rebind") == 0) {
+			if (!(id = sqlbox_prepare_bind(p, srcid, 
+			    STMT_SELECT + k, parms[k], ps, 0)))
+				errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+			run_start(&r);
+			for (i = 0; i < n; i++) {
+				start = now();
+				if (!sqlbox_rebind(p, id, parms[k], ps))
+					errx(EXIT_FAILURE, "sqlbox_rebind");
+				if (sqlbox_step(p, id) == NULL)
+					errx(EXIT_FAILURE, "sqlbox_step");
+				r.lat[i] = now() - start;
+			}
+			run_print(&r, "rebind", parms[k], 0, 0);
+			if (!sqlbox_finalise(p, id))
+				errx(EXIT_FAILURE, "sqlbox_finalise");
+		}
+	}
+
+	/* Step through "n" rows of each shape, one by one or batched. */
+
+	for (j = 0; j < NCOLS; j++)
+		for (k = 0; k < NSIZES; k++) {
+			memset(ps, 0, 2 * sizeof(struct sqlbox_parm));
+			ps[0].type = SQLBOX_PARM_INT;
+			ps[0].iparm = n;
+			ps[1].type = SQLBOX_PARM_STRING;
+			ps[1].sparm = val;
+			ps[1].sz = sizes[k] + 1;
+			val[sizes[k]] = '\0';
+			for (c = 0; c < 2; c++) {
+				if (only != NULL && strcmp(only, c == 0 ? 
+				    "step-single" : "step-multi"))
+					continue;
+				if (!(id = sqlbox_prepare_bind(p, srcid, 
+				    STMT_ROWS + j, 2, ps, c == 0 ? 
+				    0 : SQLBOX_STMT_MULTI)))
+					errx(EXIT_FAILURE, 
+						"sqlbox_prepare_bind");
+				run_start(&r);
+				for (i = 0; i < n; i++) {
+					start = now();
+					if (sqlbox_step(p, id) == NULL)
+						errx(EXIT_FAILURE, 
+							"sqlbox_step");
+					r.lat[i] = now() - start;
+				}
+				run_print(&r, c == 0 ? "step-single" : 
+					"step-multi", 0, cols[j], sizes[k]);
+				if (!sqlbox_finalise(p, id))
+					errx(EXIT_FAILURE, 
+						"sqlbox_finalise");
+			}
+			val[sizes[k]] = 'x';
+		}
+
+	if (only == NULL || strcmp(only, "lastid") == 0) {
+		run_start(&r);
+		for (i = 0; i < n; i++) {
+			start = now();
+			if (!sqlbox_lastid(p, srcid, &lastid))
+				errx(EXIT_FAILURE, "sqlbox_lastid");
+			r.lat[i] = now() - start;
+		}
+		run_print(&r, "lastid", 0, 0, 0);
+	}
+
+	/* Transactions are asynchronous: wait for the commit. */
+
+	if (only == NULL || strcmp(only, "trans") == 0) {
+		run_start(&r);
+		for (i = 0; i < n; i++) {
+			start = now();
+			if (!sqlbox_trans_immediate(p, srcid, 1))
+				errx(EXIT_FAILURE, 
+					"sqlbox_trans_immediate");
+			if (!sqlbox_trans_commit(p, srcid, 1))
+				errx(EXIT_FAILURE, "sqlbox_trans_commit");
+			if (!sqlbox_ping(p))
+				errx(EXIT_FAILURE, "sqlbox_ping");
+			r.lat[i] = now() - start;
+		}
+		run_print(&r, "trans", 0, 0, 0);
+	}
+
+	sqlbox_free(p);
+	free(val);
+	free(r.lat);
+	return EXIT_SUCCESS;
+}
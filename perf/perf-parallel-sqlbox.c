@@ -0,0 +1,174 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Measure the latency of "-n" short lookups on one channel while
+ * another channel of the same database process steps a long query
+ * ("-s" rows counted) prepared without ("serial") and with
+ * ("parallel") SQLBOX_STMT_PARALLEL.
+ * The database is a file in write-ahead log mode, "-f", which is
+ * removed afterward along with its log.
+ * Prints the mean and maximum time for a lookup and the time for the
+ * long query.
+ */
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, n = 1000, t, id, src[2];
+	int64_t			 rows = 2000000;
+	struct sqlbox		*p, *c[2];
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	 parm;
+	const struct sqlbox_parmset *res;
+	int			 ch, mode;
+	double			 start, lstart, lat, sum, max, query;
+	const char		*fn = "perf-parallel.db";
+	char			 buf[PATH_MAX];
+	struct sqlbox_src	 srcs[] = {
+		{ .mode = SQLBOX_SRC_RWC },
+		{ .mode = SQLBOX_SRC_RO }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"PRAGMA journal_mode = WAL" },
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS (SELECT 1 "
+			"UNION ALL SELECT x + 1 FROM c WHERE x < ?) "
+			"SELECT count(*) FROM c" },
+		{ .stmt = (char *)"SELECT 1" },
+	};
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc recvfd", 
+	    NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((ch = getopt(argc, argv, "f:n:s:")) != -1)
+		switch (ch) {
+		case 'f':
+			fn = optarg;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 's':
+			rows = atoll(optarg);
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+
+	srcs[0].fname = srcs[1].fname = (char *)fn;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 2;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = 3;
+	cfg.stmts.stmts = pstmts;
+	cfg.flags = SQLBOX_CFG_CHANNEL;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+	parm.iparm = rows;
+
+	puts("# mode n ns/lookup max-ns/lookup ns/query");
+
+	for (mode = 0; mode < 2; mode++) {
+		if ((p = sqlbox_alloc(&cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_alloc");
+		if (!sqlbox_open(p, 0))
+			errx(EXIT_FAILURE, "sqlbox_open");
+		if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		for (i = 0; i < 2; i++) {
+			if ((c[i] = sqlbox_channel(p)) == NULL)
+				errx(EXIT_FAILURE, "sqlbox_channel");
+			if (!(src[i] = sqlbox_open(c[i], 1)))
+				errx(EXIT_FAILURE, "sqlbox_open");
+		}
+
+		/* 
+		 * Have the server step to the end at once: otherwise the
+		 * channel would be served exclusively in serial mode.
+		 */
+
+		id = sqlbox_prepare_bind(c[0], src[0], 1, 1, &parm,
+			SQLBOX_STMT_MULTI | 
+			(mode == 0 ? 0 : SQLBOX_STMT_PARALLEL));
+		if (id == 0)
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+
+		start = now();
+		if (!(t = sqlbox_step_submit(c[0], id)) ||
+		    !sqlbox_flush(c[0]))
+			errx(EXIT_FAILURE, "sqlbox_step_submit");
+
+		sum = max = 0.0;
+		for (i = 0; i < n; i++) {
+			lstart = now();
+			if (sqlbox_exec(c[1], src[1], 2, 0, NULL, 0) != 
+			    SQLBOX_CODE_OK)
+				errx(EXIT_FAILURE, "sqlbox_exec");
+			lat = now() - lstart;
+			sum += lat;
+			if (lat > max)
+				max = lat;
+		}
+
+		if (sqlbox_wait(c[0], t, NULL) != 1)
+			errx(EXIT_FAILURE, "sqlbox_wait");
+		if ((res = sqlbox_step(c[0], id)) == NULL ||
+		    res->psz != 1 || res->ps[0].iparm != rows)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		query = now() - start;
+		if (!sqlbox_finalise(c[0], id))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+
+		for (i = 0; i < 2; i++)
+			sqlbox_free(c[i]);
+		sqlbox_free(p);
+		printf("%s %zu %.0f %.0f %.0f\n", mode == 0 ? 
+			"serial" : "parallel", n, sum / n, max, query);
+	}
+
+	unlink(fn);
+	snprintf(buf, sizeof(buf), "%s-wal", fn);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-shm", fn);
+	unlink(buf);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Compare the latency of getting a box ready for use with
+ * sqlbox_alloc(3) and sqlbox_open(3) ("cold") against checking one
+ * out of a pool of "-p" boxes ("pool").
+ * Each of "-n" cycles gets a box, runs one statement, and releases the
+ * box (by freeing it or returning it to the pool).
+ * Prints the mean time to get the box and to run the full cycle.
+ */
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, rows = 1000, poolsz = 4;
+	struct sqlbox		*p;
+	struct sqlbox_pool	*pool;
+	struct sqlbox_cfg	 cfg;
+	int			 c, mode;
+	double			 start, get, cycle;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"SELECT 1" },
+	};
+	size_t			 open[] = { 0 };
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc", NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((c = getopt(argc, argv, "n:p:")) != -1)
+		switch (c) {
+		case 'n':
+			rows = atoi(optarg);
+			break;
+		case 'p':
+			poolsz = atoi(optarg);
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 1;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = 1;
+	cfg.stmts.stmts = pstmts;
+
+	if ((pool = sqlbox_pool_alloc(&cfg, poolsz, 1, open)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_pool_alloc");
+
+	puts("# mode n ns/get ns/cycle");
+
+	for (mode = 0; mode < 2; mode++) {
+		get = cycle = 0.0;
+		for (i = 0; i < rows; i++) {
+			start = now();
+			if (mode == 0) {
+				if ((p = sqlbox_alloc(&cfg)) == NULL)
+					errx(EXIT_FAILURE, "sqlbox_alloc");
+				if (!sqlbox_open(p, 0))
+					errx(EXIT_FAILURE, "sqlbox_open");
+			} else if ((p = sqlbox_pool_get(pool)) == NULL)
+				errx(EXIT_FAILURE, "sqlbox_pool_get");
+			get += now() - start;
+			if (sqlbox_exec(p, 1, 0, 0, NULL, 0) != 
+			    SQLBOX_CODE_OK)
+				errx(EXIT_FAILURE, "sqlbox_exec");
+			if (mode == 0)
+				sqlbox_free(p);
+			else if (!sqlbox_pool_put(pool, p))
+				errx(EXIT_FAILURE, "sqlbox_pool_put");
+			cycle += now() - start;
+		}
+		printf("%s %zu %.0f %.0f\n", mode == 0 ? 
+			"cold" : "pool", rows, get / rows, cycle / rows);
+	}
+
+	sqlbox_pool_free(pool);
+	return EXIT_SUCCESS;
+}
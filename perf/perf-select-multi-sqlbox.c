@@ -15,6 +15,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #include <err.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,10 +27,12 @@
 int
 main(int argc, char *argv[])
 {
-	size_t		 	 i, rows = 10000;
+	size_t		 	 i, rows = 10000, pfrows = 0, pfbytes = 0,
+				 credits = 0;
 	struct sqlbox		*p;
 	struct sqlbox_cfg	 cfg;
 	int			 c;
+	unsigned long		 flags = SQLBOX_STMT_MULTI;
 	struct sqlbox_src	 srcs[] = {
 		{ .fname = (char *)":memory:",
 		  .mode = SQLBOX_SRC_RW }
@@ -51,8 +54,20 @@ main(int argc, char *argv[])
 	if (pledge("stdio rpath cpath wpath flock fattr proc", NULL) == -1)
 		err(EXIT_FAILURE, "pledge");
 
-	while ((c = getopt(argc, argv, "n:")) != -1)
+	while ((c = getopt(argc, argv, "ab:n:r:s:")) != -1)
 		switch (c) {
+		case 'a':
+			flags = SQLBOX_STMT_ADAPTIVE;
+			break;
+		case 'b':
+			pfbytes = atoi(optarg);
+			break;
+		case 'r':
+			pfrows = atoi(optarg);
+			break;
+		case 's':
+			credits = atoi(optarg);
+			break;
 		case 'n':
 			rows = atoi(optarg);
 			break;
@@ -82,9 +97,13 @@ main(int argc, char *argv[])
 	if (!sqlbox_exec_async(p, 0, 1, 1, &parm, 0))
 		errx(EXIT_FAILURE, "sqlbox_exec_async");
 
-	if (!sqlbox_prepare_bind_async
-	    (p, 0, 2, 0, NULL, SQLBOX_STMT_MULTI))
+	if (!sqlbox_prepare_bind_async(p, 0, 2, 0, NULL, flags))
 		errx(EXIT_FAILURE, "sqlbox_prepare_bind_async");
+	if ((pfrows || pfbytes) &&
+	    !sqlbox_stmt_prefetch(p, 0, pfrows, pfbytes))
+		errx(EXIT_FAILURE, "sqlbox_stmt_prefetch");
+	if (credits && !sqlbox_stmt_stream(p, 0, credits))
+		errx(EXIT_FAILURE, "sqlbox_stmt_stream");
 
 	for (i = 0; i < rows; i++) {
 		if ((res = sqlbox_step(p, 0)) == NULL)
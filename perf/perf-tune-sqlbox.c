@@ -0,0 +1,138 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "../sqlbox.h"
+
+/*
+ * Compare "-n" single-row insertions, each its own transaction, into a
+ * new database "-f" with the SQLite defaults ("default") against a
+ * write-ahead log with normal synchronisation and memory-mapped I/O
+ * ("wal").
+ * The database is removed after each mode.
+ * Prints the mean time per insertion.
+ */
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+rm(const char *fn)
+{
+	char	 buf[PATH_MAX];
+
+	unlink(fn);
+	snprintf(buf, sizeof(buf), "%s-journal", fn);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-wal", fn);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-shm", fn);
+	unlink(buf);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, n = 1000;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	 parm;
+	int			 c, mode;
+	double			 start;
+	const char		*fn = "perf-tune.db";
+	struct sqlbox_src	 srcs[] = {
+		{ .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+	};
+
+	if (pledge("stdio rpath cpath wpath flock fattr proc", 
+	    NULL) == -1)
+		err(EXIT_FAILURE, "pledge");
+
+	while ((c = getopt(argc, argv, "f:n:")) != -1)
+		switch (c) {
+		case 'f':
+			fn = optarg;
+			break;
+		case 'n':
+			n = atoi(optarg);
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+
+	srcs[0].fname = (char *)fn;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = 1;
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = 2;
+	cfg.stmts.stmts = pstmts;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+
+	puts("# mode n ns/insert");
+
+	for (mode = 0; mode < 2; mode++) {
+		rm(fn);
+		memset(&srcs[0].tune, 0, sizeof(struct sqlbox_tune));
+		if (mode == 1) {
+			srcs[0].tune.journal = SQLBOX_JOURNAL_WAL;
+			srcs[0].tune.sync = SQLBOX_SYNC_NORMAL;
+			srcs[0].tune.mmapsz = 64 * 1024 * 1024;
+		}
+		if ((p = sqlbox_alloc(&cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_alloc");
+		if (!sqlbox_open(p, 0))
+			errx(EXIT_FAILURE, "sqlbox_open");
+		if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		start = now();
+		for (i = 0; i < n; i++) {
+			parm.iparm = i;
+			if (sqlbox_exec(p, 0, 1, 1, &parm, 0) != 
+			    SQLBOX_CODE_OK)
+				errx(EXIT_FAILURE, "sqlbox_exec");
+		}
+		printf("%s %zu %.0f\n", mode == 0 ? 
+			"default" : "wal", n, (now() - start) / n);
+		sqlbox_free(p);
+	}
+
+	rm(fn);
+	return EXIT_SUCCESS;
+}
@@ -31,8 +31,8 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-int
-sqlbox_ping(struct sqlbox *box)
+static int
+sqlbox_ping_locked(struct sqlbox *box)
 {
 	uint32_t	 syn, ack;
 
@@ -57,6 +57,17 @@ sqlbox_ping(struct sqlbox *box)
 	return 1;
 }
 
+int
+sqlbox_ping(struct sqlbox *box)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_ping_locked(box);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
 /*
  * Read an acknowledgement and write it back.
  * This just ping to see if we're alive.
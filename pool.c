@@ -0,0 +1,297 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Fork a new box and queue the opening of the pool's sources.
+ * The opens aren't acknowledged: see sqlbox_pool_fill().
+ * Returns the box or NULL on failure.
+ */
+static struct sqlbox *
+sqlbox_pool_spawn(struct sqlbox_pool *pool)
+{
+	struct sqlbox	*box;
+	size_t		 i;
+
+	if ((box = sqlbox_alloc(pool->cfg)) == NULL) {
+		sqlbox_warnx(pool->cfg, "pool: sqlbox_alloc");
+		return NULL;
+	}
+	for (i = 0; i < pool->srcsz; i++)
+		if (!sqlbox_open_async(box, pool->srcs[i])) {
+			sqlbox_warnx(pool->cfg, 
+				"pool: sqlbox_open_async");
+			sqlbox_free(box);
+			return NULL;
+		}
+	return box;
+}
+
+/*
+ * Return a box to the state of a freshly-spawned one (client).
+ * All statements are finalised, all databases but the pool's sources
+ * are closed, open transactions are rolled back, and the role reverts
+ * to the default.
+ * Returns FALSE on failure (the box should be freed), TRUE on success.
+ */
+static int
+sqlbox_pool_reset(struct sqlbox_pool *pool, struct sqlbox *box)
+{
+	struct sqlbox_stmt	*st;
+	struct sqlbox_ticket	*t;
+	uint32_t		 v = htole32(pool->srcsz);
+
+	if (!sqlbox_flush(box)) {
+		sqlbox_warnx(&box->cfg, "pool: sqlbox_flush");
+		return 0;
+	} else if (!sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "pool: sqlbox_ticket_drain");
+		return 0;
+	} else if (!sqlbox_stream_drain(box)) {
+		sqlbox_warnx(&box->cfg, "pool: sqlbox_stream_drain");
+		return 0;
+	}
+
+	/* Uncollected answers belong to the last user. */
+
+	while ((t = TAILQ_FIRST(&box->ticketq)) != NULL) {
+		TAILQ_REMOVE(&box->ticketq, t, entries);
+		sqlbox_ticket_free(t);
+	}
+	box->ticketnext = NULL;
+
+	while ((st = TAILQ_FIRST(&box->stmtq)) != NULL) {
+		TAILQ_REMOVE(&box->stmtq, st, gentries);
+		sqlbox_handle_free(&box->stmts, st->id);
+		sqlbox_stmt_free(st);
+	}
+
+	if (!sqlbox_write_frame
+	    (box, SQLBOX_OP_RESET, (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "pool: sqlbox_write_frame");
+		return 0;
+	} else if (!sqlbox_read(box, (char *)&v, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "pool: sqlbox_read");
+		return 0;
+	} else if (le32toh(v) != pool->srcsz) {
+		sqlbox_warnx(&box->cfg, "pool: %u of %zu sources "
+			"still open", le32toh(v), pool->srcsz);
+		return 0;
+	}
+	return 1;
+}
+
+int
+sqlbox_pool_fill(struct sqlbox_pool *pool)
+{
+	size_t		 i, start = pool->boxsz;
+	int		 rc = 1;
+
+	/* 
+	 * Fork everything first, then check them all: this way, the
+	 * children open their sources in parallel.
+	 */
+
+	while (pool->boxsz < pool->boxmax) {
+		pool->boxes[pool->boxsz] = sqlbox_pool_spawn(pool);
+		if (pool->boxes[pool->boxsz] == NULL) {
+			sqlbox_warnx(pool->cfg, 
+				"pool: sqlbox_pool_spawn");
+			rc = 0;
+			break;
+		}
+		pool->boxsz++;
+	}
+
+	for (i = start; i < pool->boxsz; )
+		if (!sqlbox_ping(pool->boxes[i])) {
+			sqlbox_warnx(pool->cfg, "pool: sqlbox_ping");
+			sqlbox_free(pool->boxes[i]);
+			pool->boxes[i] = pool->boxes[--pool->boxsz];
+			rc = 0;
+		} else
+			i++;
+
+	return rc;
+}
+
+struct sqlbox_pool *
+sqlbox_pool_alloc(struct sqlbox_cfg *cfg, size_t n, 
+	size_t srcsz, const size_t *srcs)
+{
+	struct sqlbox_pool	*pool;
+	size_t			 i;
+
+	for (i = 0; i < srcsz; i++)
+		if (cfg == NULL || srcs[i] >= cfg->srcs.srcsz) {
+			sqlbox_warnx(cfg, "pool: source %zu "
+				"not found", srcs[i]);
+			return NULL;
+		}
+
+	if ((pool = calloc(1, sizeof(struct sqlbox_pool))) == NULL) {
+		sqlbox_warn(cfg, "calloc");
+		return NULL;
+	}
+	pool->cfg = cfg;
+	pool->boxmax = n;
+	pool->srcsz = srcsz;
+
+	if (n > 0 && (pool->boxes = 
+	    calloc(n, sizeof(struct sqlbox *))) == NULL) {
+		sqlbox_warn(cfg, "calloc");
+		free(pool);
+		return NULL;
+	}
+	if (srcsz > 0 && (pool->srcs = 
+	    calloc(srcsz, sizeof(size_t))) == NULL) {
+		sqlbox_warn(cfg, "calloc");
+		free(pool->boxes);
+		free(pool);
+		return NULL;
+	}
+	if (srcsz > 0)
+		memcpy(pool->srcs, srcs, srcsz * sizeof(size_t));
+
+	if (!sqlbox_pool_fill(pool)) {
+		sqlbox_warnx(cfg, "pool: sqlbox_pool_fill");
+		sqlbox_pool_free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+struct sqlbox *
+sqlbox_pool_get(struct sqlbox_pool *pool)
+{
+	struct sqlbox	*box;
+
+	if (pool->boxsz > 0)
+		return pool->boxes[--pool->boxsz];
+
+	/* Empty pool: fall back to a cold start. */
+
+	if ((box = sqlbox_pool_spawn(pool)) == NULL) {
+		sqlbox_warnx(pool->cfg, "pool: sqlbox_pool_spawn");
+		return NULL;
+	} else if (!sqlbox_ping(box)) {
+		sqlbox_warnx(pool->cfg, "pool: sqlbox_ping");
+		sqlbox_free(box);
+		return NULL;
+	}
+	return box;
+}
+
+int
+sqlbox_pool_put(struct sqlbox_pool *pool, struct sqlbox *box)
+{
+
+	if (box == NULL)
+		return 1;
+
+	if (!sqlbox_pool_reset(pool, box)) {
+		sqlbox_warnx(pool->cfg, "pool: sqlbox_pool_reset");
+		sqlbox_free(box);
+		return 0;
+	}
+
+	if (pool->boxsz < pool->boxmax)
+		pool->boxes[pool->boxsz++] = box;
+	else
+		sqlbox_free(box);
+	return 1;
+}
+
+void
+sqlbox_pool_free(struct sqlbox_pool *pool)
+{
+
+	if (pool == NULL)
+		return;
+	while (pool->boxsz > 0)
+		sqlbox_free(pool->boxes[--pool->boxsz]);
+	free(pool->boxes);
+	free(pool->srcs);
+	free(pool);
+}
+
+/*
+ * Reset the box for its next user (see sqlbox_pool_reset()).
+ * Statements are put into the statement cache, so the next user will
+ * find them already compiled.
+ * Sources with identifiers up to the number given are kept (these are
+ * the sources opened by the pool) and others are closed.
+ * Writes back the number of sources kept.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_op_reset(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_db	*db, *next;
+	size_t			 keep;
+	uint32_t		 kept = 0;
+
+	if (sz != sizeof(uint32_t)) {
+		sqlbox_warnx(&box->cfg, "reset: "
+			"bad frame size: %zu", sz);
+		return 0;
+	}
+	keep = le32toh(*(uint32_t *)buf);
+
+	sqlbox_stmt_release_all(box);
+
+	/*
+	 * Roll back transactions however begun, as the next user mustn't
+	 * start in this one's.
+	 * If we can't roll back, closing will do it for us.
+	 */
+
+	for (db = TAILQ_FIRST(&box->dbq); db != NULL; db = next) {
+		next = TAILQ_NEXT(db, entries);
+		if (sqlbox_db_rollback(box, db) && 
+		    db->id > 0 && db->id <= keep)
+			kept++;
+		else
+			sqlbox_db_release(box, db);
+	}
+
+	sqlbox_debug(&box->cfg, "reset: transition "
+		"%zu -> %zu", box->role, box->cfg.roles.defrole);
+	box->role = box->cfg.roles.defrole;
+
+	kept = htole32(kept);
+	if (!sqlbox_write(box, (char *)&kept, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "reset: sqlbox_write");
+		return 0;
+	}
+	return 1;
+}
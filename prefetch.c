@@ -0,0 +1,105 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+static int
+sqlbox_stmt_prefetch_locked(struct sqlbox *box, 
+	size_t id, size_t rows, size_t bytes)
+{
+	uint32_t	 	 v[3];
+
+	/* Limits are passed as 32-bit values: saturate. */
+
+	if (rows > UINT32_MAX)
+		rows = UINT32_MAX;
+	if (bytes > UINT32_MAX)
+		bytes = UINT32_MAX;
+
+	/* FIXME: kill server if we don't find it. */
+
+	if (sqlbox_stmt_find(box, id) == NULL) {
+		sqlbox_warnx(&box->cfg, "prefetch: sqlbox_stmt_find");
+		return 0;
+	}
+
+	v[0] = htole32(id);
+	v[1] = htole32(rows);
+	v[2] = htole32(bytes);
+
+	if (!sqlbox_write_frame
+	    (box, SQLBOX_OP_PREFETCH, (char *)v, sizeof(v))) {
+		sqlbox_warnx(&box->cfg, "prefetch: sqlbox_write_frame");
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+sqlbox_stmt_prefetch(struct sqlbox *box, 
+	size_t id, size_t rows, size_t bytes)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_stmt_prefetch_locked(box, id, rows, bytes);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+/*
+ * Set the prefetch limits of a statement.
+ * This makes the statement multi-row if it wasn't already.
+ * The limits take effect with the next batch of rows.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_prefetch(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+	uint32_t		 v[3];
+
+	if (sz != sizeof(v)) {
+		sqlbox_warnx(&box->cfg, "prefetch: bad frame size");
+		return 0;
+	}
+	memcpy(v, buf, sizeof(v));
+	if ((st = sqlbox_stmt_find(box, le32toh(v[0]))) == NULL) {
+		sqlbox_warnx(&box->cfg, "prefetch: sqlbox_stmt_find");
+		return 0;
+	}
+
+	st->flags |= SQLBOX_STMT_MULTI;
+	st->pf_rows = le32toh(v[1]);
+	st->pf_bytes = le32toh(v[2]);
+	return 1;
+}
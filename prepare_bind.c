@@ -32,25 +32,6 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-/*
- * Return TRUE if the current role has the ability to prepare the given
- * statement (or no roles are specified), FALSE if otherwise.
- */
-static int
-sqlbox_rolecheck_stmt(struct sqlbox *box, size_t idx)
-{
-	size_t	 i;
-
-	if (box->cfg.roles.rolesz == 0)
-		return 1;
-	for (i = 0; i < box->cfg.roles.roles[box->role].stmtsz; i++)
-		if (box->cfg.roles.roles[box->role].stmts[i] == idx)
-			return 1;
-	sqlbox_warnx(&box->cfg, "prepare-bind: statement "
-		"%zu denied to role %zu", idx, box->role);
-	return 0;
-}
-
 /*
  * Shared by both asynchronous and synchronous version.
  * Sends the prepare-bind instruction to the server.
@@ -91,6 +72,7 @@ sqlbox_pbind(struct sqlbox *box, enum sqlbox_op op, size_t srcid,
 		free(st);
 		return NULL;
 	}
+	TAILQ_INIT(&st->pushq);
 
 	/* Skip the frame size til we get the packed parms. */
 
@@ -131,21 +113,23 @@ sqlbox_pbind(struct sqlbox *box, enum sqlbox_op op, size_t srcid,
 	val = htole32(pos - 4);
 	memcpy(buf, (char *)&val, sizeof(uint32_t));
 
-	/* Write data, free our buffer. */
+	/* Queue data, free our buffer. */
 
-	if (!sqlbox_write(box, buf, pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
-		sqlbox_warnx(&box->cfg, "prepare-bind: sqlbox_write");
+	if (!sqlbox_queue(box, buf, pos)) {
+		sqlbox_warnx(&box->cfg, "prepare-bind: sqlbox_queue");
 		free(buf);
 		free(st);
 		return NULL;
 	}
 
+	sqlbox_stats_sent(box, op, 
+		buf + sizeof(uint32_t) * 2, pos - sizeof(uint32_t) * 2);
 	free(buf);
 	return st;
 }
 
-int
-sqlbox_prepare_bind_async(struct sqlbox *box, size_t srcid,
+static int
+sqlbox_prepare_bind_async_locked(struct sqlbox *box, size_t srcid,
 	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
 	unsigned long opts)
 {
@@ -165,8 +149,22 @@ sqlbox_prepare_bind_async(struct sqlbox *box, size_t srcid,
 	return 1;
 }
 
-size_t
-sqlbox_prepare_bind(struct sqlbox *box, size_t srcid,
+int
+sqlbox_prepare_bind_async(struct sqlbox *box, size_t srcid,
+	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
+	unsigned long opts)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_prepare_bind_async_locked(box, srcid, pstmt, psz,
+		ps, opts);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+static size_t
+sqlbox_prepare_bind_locked(struct sqlbox *box, size_t srcid,
 	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
 	unsigned long opts)
 {
@@ -193,23 +191,71 @@ sqlbox_prepare_bind(struct sqlbox *box, size_t srcid,
 			"wrote back identifier of zero");
 		free(st);
 		return 0;
+	} else if (!sqlbox_handle_set(box, &box->stmts, st->id, st)) {
+		sqlbox_warnx(&box->cfg, 
+			"prepare-bind: sqlbox_handle_set");
+		free(st);
+		return 0;
 	}
 
 	TAILQ_INSERT_TAIL(&box->stmtq, st, gentries);
 	return st->id;
 }
 
+size_t
+sqlbox_prepare_bind(struct sqlbox *box, size_t srcid,
+	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
+	unsigned long opts)
+{
+	size_t	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_prepare_bind_locked(box, srcid, pstmt, psz, ps,
+		opts);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+size_t
+sqlbox_prepare_bind_submit(struct sqlbox *box, size_t srcid,
+	size_t pstmt, size_t psz, const struct sqlbox_parm *ps,
+	unsigned long opts)
+{
+	struct sqlbox_stmt	*st;
+	struct sqlbox_ticket	*t;
+
+	if ((t = sqlbox_ticket_alloc(box)) == NULL) {
+		sqlbox_warnx(&box->cfg, 
+			"prepare-bind-submit: sqlbox_ticket_alloc");
+		return 0;
+	} else if ((st = sqlbox_pbind(box, SQLBOX_OP_PREPARE_BIND_TICKET,
+	    srcid, pstmt, psz, ps, opts)) == NULL) {
+		sqlbox_warnx(&box->cfg, 
+			"prepare-bind-submit: sqlbox_pbind");
+		sqlbox_ticket_abort(box, t);
+		return 0;
+	}
+
+	/* The statement is registered when the ticket is answered. */
+
+	return sqlbox_ticket_push(box, 
+		t, SQLBOX_OP_PREPARE_BIND_TICKET, st);
+}
+
 /*
  * Prepare and bind parameters to a statement in one step.
  * Do not send anything back to the client: this is done by the caller
  * depending upon the mode.
  * Return the allocated statement on success, NULL on failure.
+ * If "denied" is not NULL, it's set if the role doesn't permit the
+ * statement.
  */
 static struct sqlbox_stmt *
-sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz)
+sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz,
+	int *denied)
 {
 	size_t	 		 idx, psz, parmsz;
-	struct sqlbox_db	*db;
+	struct sqlbox_db	*db, *cdb, *rdb = NULL;
 	sqlite3_stmt		*stmt = NULL;
 	struct sqlbox_stmt	*st;
 	struct sqlbox_pstmt	*pst = NULL;
@@ -244,12 +290,14 @@ sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz)
 		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
 			"bad statement %zu", db->src->fname, idx);
 		return NULL;
-	} else if (!sqlbox_rolecheck_stmt(box, idx)) {
+	} else if (!sqlbox_rolecheck(box, SQLBOX_PERM_STMT, idx)) {
 		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
-			"sqlbox_rolecheck_stmt", db->src->fname);
+			"sqlbox_rolecheck", db->src->fname);
 		sqlbox_warnx(&box->cfg, "%s: prepare-bind "
 			"statement: %s", db->src->fname, 
 			box->cfg.stmts.stmts[idx].stmt);
+		if (denied != NULL)
+			*denied = 1;
 		return NULL;
 	}
 	pst = &box->cfg.stmts.stmts[idx];
@@ -273,27 +321,47 @@ sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz)
 		return NULL;
 	}
 
+	/* 
+	 * Parallel statements on read-only sources of a multiplexed box
+	 * have a connection of their own so that they may be stepped
+	 * by a worker thread (see sqlbox_mux_run()).
+	 * Only in write-ahead log mode, as otherwise the reader's lock
+	 * would have writers served meanwhile wait on it.
+	 * The flag is otherwise ignored.
+	 */
+
+	cdb = db;
+	if ((opts & SQLBOX_STMT_PARALLEL) && box->mux != NULL &&
+	    db->src->mode == SQLBOX_SRC_RO && db->src->fname[0] != '\0' &&
+	    strcmp(db->src->fname, ":memory:") && 
+	    sqlbox_mux_wal(box, db) &&
+	    (cdb = rdb = sqlbox_mux_reader_get(box, db)) == NULL) {
+		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
+			"sqlbox_mux_reader_get", db->src->fname);
+		free(parms);
+		return NULL;
+	}
+
 	/* Actually prepare the statement. */
 
-	if ((stmt = sqlbox_wrap_prep(box, db, pst)) == NULL) {
+	if ((stmt = sqlbox_stmtcache_get(box, cdb, idx)) == NULL) {
 		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
-			"sqlbox_wrap_prep", db->src->fname);
+			"sqlbox_stmtcache_get", db->src->fname);
 		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
 			"statement: %s", db->src->fname, pst->stmt);
 		free(parms);
-		return NULL;
+		goto err;
 	}
 
 	/* Now bind parameters. */
 
-	if (!sqlbox_parm_bind(box, db, pst, stmt, parms, parmsz)) {
+	if (!sqlbox_parm_bind(box, cdb, pst, stmt, parms, parmsz)) {
 		sqlbox_warnx(&box->cfg, "%s: sqlbox_parm_bind",
 			db->src->fname);
 		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
 			"statement: %s", db->src->fname, pst->stmt);
-		sqlbox_wrap_finalise(box, db, pst, stmt);
 		free(parms);
-		return NULL;
+		goto err;
 	}
 	free(parms);
 
@@ -304,8 +372,7 @@ sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz)
 			"calloc", db->src->fname);
 		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
 			"statement: %s", db->src->fname, pst->stmt);
-		sqlbox_wrap_finalise(box, db, pst, stmt);
-		return NULL;
+		goto err;
 	}
 
 	st->flags = opts;
@@ -313,10 +380,21 @@ sqlbox_op_prepare_bind(struct sqlbox *box, const char *buf, size_t sz)
 	st->pstmt = pst;
 	st->idx = idx;
 	st->db = db;
-	st->id = ++box->lastid;
+	st->rdb = rdb;
+	if ((st->id = sqlbox_handle_alloc(box, &box->stmts, st)) == 0) {
+		sqlbox_warnx(&box->cfg, "%s: prepare-bind: "
+			"sqlbox_handle_alloc", db->src->fname);
+		free(st);
+		goto err;
+	}
 	TAILQ_INSERT_TAIL(&db->stmtq, st, entries);
 	TAILQ_INSERT_TAIL(&box->stmtq, st, gentries);
 	return st;
+err:
+	sqlbox_stmtcache_put(box, cdb, idx, stmt);
+	if (rdb != NULL)
+		sqlbox_mux_reader_put(box, rdb);
+	return NULL;
 }
 
 int
@@ -325,7 +403,7 @@ sqlbox_op_prepare_bind_sync(struct sqlbox *box, const char *buf, size_t sz)
 	struct sqlbox_stmt	*st;
 	uint32_t		 ack;
 
-	if ((st = sqlbox_op_prepare_bind(box, buf, sz)) == NULL) {
+	if ((st = sqlbox_op_prepare_bind(box, buf, sz, NULL)) == NULL) {
 		sqlbox_warnx(&box->cfg, "prepare-bind-sync: "
 			"sqlbox_op_prepare_bind");
 		return 0;
@@ -344,8 +422,8 @@ sqlbox_op_prepare_bind_sync(struct sqlbox *box, const char *buf, size_t sz)
 		"statement: %s", st->db->src->fname, st->pstmt->stmt);
 	TAILQ_REMOVE(&st->db->stmtq, st, entries);
 	TAILQ_REMOVE(&box->stmtq, st, gentries);
-	sqlbox_wrap_finalise(box, st->db, st->pstmt, st->stmt);
-	free(st);
+	sqlbox_handle_free(&box->stmts, st->id);
+	sqlbox_stmt_release(box, st);
 	return 0;
 }
 
@@ -354,10 +432,44 @@ sqlbox_op_prepare_bind_async(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_stmt	*st;
 
-	if ((st = sqlbox_op_prepare_bind(box, buf, sz)) == NULL) {
+	if ((st = sqlbox_op_prepare_bind(box, buf, sz, NULL)) == NULL) {
 		sqlbox_warnx(&box->cfg, "prepare-bind-async: "
 			"sqlbox_op_prepare_bind");
 		return 0;
 	}
 	return 1;
 }
+
+int
+sqlbox_op_prepare_bind_ticket(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+	int			 denied = 0;
+
+	/* 
+	 * Errors are reported to the client, not fatal, except for
+	 * role violations as in the other modes.
+	 */
+
+	st = sqlbox_op_prepare_bind(box, buf, sz, &denied);
+	if (st == NULL)
+		sqlbox_warnx(&box->cfg, "prepare-bind-ticket: "
+			"sqlbox_op_prepare_bind");
+	if (denied)
+		return 0;
+
+	if (sqlbox_ticket_reply(box, st == NULL ? 
+	    SQLBOX_CODE_ERROR : SQLBOX_CODE_OK, 
+	    st == NULL ? 0 : st->id, 0))
+		return 1;
+
+	sqlbox_warnx(&box->cfg, "prepare-bind-ticket: "
+		"sqlbox_ticket_reply");
+	if (st == NULL)
+		return 0;
+	TAILQ_REMOVE(&st->db->stmtq, st, entries);
+	TAILQ_REMOVE(&box->stmtq, st, gentries);
+	sqlbox_handle_free(&box->stmts, st->id);
+	sqlbox_stmt_release(box, st);
+	return 0;
+}
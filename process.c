@@ -0,0 +1,95 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+int
+sqlbox_fd(const struct sqlbox *box)
+{
+
+	return box->fd;
+}
+
+int
+sqlbox_process(struct sqlbox *box)
+{
+	int	 c, want = 0;
+	size_t	 need;
+	ssize_t	 rsz;
+
+	/* 
+	 * With the ring, the socket only carries wakeups, which we must
+	 * read so that it doesn't stay readable.
+	 */
+
+	if (box->ring != NULL && (c = sqlbox_ring_wakeups(box)) <= 0) {
+		if (c == 0)
+			sqlbox_warnx(&box->cfg, "process: peer exited");
+		return -1;
+	}
+
+	/* Write as much as we can... */
+
+	if ((c = sqlbox_flush_some(box)) < 0) {
+		sqlbox_warnx(&box->cfg, "process: sqlbox_flush_some");
+		return -1;
+	} else if (c > 0)
+		want |= box->ring != NULL ? 
+			SQLBOX_WANT_READ : SQLBOX_WANT_WRITE;
+
+	/* 
+	 * ...then read as many answers as are available.
+	 * Only complete answers are parsed, so that the reads from the
+	 * read-ahead buffer never block.
+	 */
+
+	while (box->ticketpend > 0) {
+		if (sqlbox_ticket_ready(box, &need)) {
+			box->draining++;
+			c = sqlbox_ticket_read(box);
+			box->draining--;
+			if (!c) {
+				sqlbox_warnx(&box->cfg, 
+					"process: sqlbox_ticket_read");
+				return -1;
+			}
+			continue;
+		}
+		if ((rsz = sqlbox_fill_some(box, need)) < 0) {
+			sqlbox_warnx(&box->cfg, 
+				"process: sqlbox_fill_some");
+			return -1;
+		} else if (rsz == 0) {
+			want |= SQLBOX_WANT_READ;
+			break;
+		}
+	}
+
+	return want;
+}
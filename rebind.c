@@ -32,14 +32,15 @@
 #include "sqlbox.h"
 #include "extern.h"
 
-int
-sqlbox_rebind(struct sqlbox *box, size_t id,
+static int
+sqlbox_rebind_locked(struct sqlbox *box, size_t id,
 	size_t psz, const struct sqlbox_parm *ps)
 {
 	size_t			 pos = 0, bufsz = SQLBOX_FRAME, i;
 	uint32_t		 val;
 	char			*buf;
 	struct sqlbox_stmt	*st;
+	struct sqlbox_push	*push;
 
 	/* 
 	 * Make sure explicit-sized strings are NUL terminated.
@@ -93,22 +94,54 @@ sqlbox_rebind(struct sqlbox *box, size_t id,
 	val = htole32(pos - 4);
 	memcpy(buf, (char *)&val, sizeof(uint32_t));
 
-	/* Write data, free our buffer. */
+	/* Queue data, free our buffer. */
 
-	if (!sqlbox_write(box, buf,
-	    pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME)) {
-		sqlbox_warnx(&box->cfg, "rebind: sqlbox_write");
+	if (!sqlbox_queue(box, buf, pos)) {
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_queue");
 		free(buf);
 		return 0;
 	}
+	sqlbox_stats_sent(box, SQLBOX_OP_REBIND, 
+		buf + sizeof(uint32_t) * 2, pos - sizeof(uint32_t) * 2);
 	free(buf);
 
-	/* Remove any pending results. */
+	/* 
+	 * Remove any pending results.
+	 * Streaming statements and submitted steps first need to have
+	 * the results in flight read, so they're consistent with the
+	 * server.
+	 */
 
+	if (st->granted > 0 && !sqlbox_stream_drain(box)) {
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_stream_drain");
+		return 0;
+	}
+	if (st->stepping > 0 && !sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "rebind: sqlbox_ticket_drain");
+		return 0;
+	}
+	while ((push = TAILQ_FIRST(&st->pushq)) != NULL) {
+		TAILQ_REMOVE(&st->pushq, push, entries);
+		sqlbox_res_clear(&push->res);
+		free(push);
+	}
+	st->streamend = 0;
 	sqlbox_res_clear(&st->res);
 	return 1;
 }
 
+int
+sqlbox_rebind(struct sqlbox *box, size_t id,
+	size_t psz, const struct sqlbox_parm *ps)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_rebind_locked(box, id, psz, ps);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
 /*
  * Prepare and bind parameters to a statement in one step.
  * Return TRUE on success, FALSE on failure (nothing is allocated).
@@ -147,7 +180,8 @@ sqlbox_op_rebind(struct sqlbox *box, const char *buf, size_t sz)
 		st->db->src->fname, st->pstmt->stmt);
 	if (sqlite3_clear_bindings(st->stmt) != SQLITE_OK) {
 		sqlbox_warnx(&box->cfg, "%s: sqlite3_clear_bindings: %s", 
-			st->db->src->fname, sqlite3_errmsg(st->db->db));
+			st->db->src->fname, 
+			sqlite3_errmsg(sqlite3_db_handle(st->stmt)));
 		sqlbox_warnx(&box->cfg, "%s: rebind statement: %s", 
 			st->db->src->fname, st->pstmt->stmt);
 		return 0;
@@ -232,7 +266,7 @@ sqlbox_op_rebind(struct sqlbox *box, const char *buf, size_t sz)
 		if (c != SQLITE_OK) {
 			sqlbox_warnx(&box->cfg, "%s: rebind: %s", 
 				st->db->src->fname, 
-				sqlite3_errmsg(st->db->db));
+				sqlite3_errmsg(sqlite3_db_handle(st->stmt)));
 			sqlbox_warnx(&box->cfg, "%s: rebind: "
 				"statement: %s", 
 				st->db->src->fname, st->pstmt->stmt);
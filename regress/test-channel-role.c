@@ -0,0 +1,80 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox		*p, *c;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_role	 roles[] = {
+		{ .rolesz = 1,
+		  .roles = (size_t[]){ 1 },
+		  .stmtsz = 0,
+		  .srcsz = 0 },
+		{ .rolesz = 0,
+		  .stmtsz = 0,
+		  .srcs = (size_t[]){ 0 },
+		  .srcsz = 1 },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.roles.rolesz = nitems(roles);
+	cfg.roles.roles = roles;
+	cfg.roles.defrole = 0;
+	cfg.flags = SQLBOX_CFG_CHANNEL;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_role(p, 1))
+		errx(EXIT_FAILURE, "sqlbox_role");
+
+	/* Fail: the channel starts in the default role. */
+
+	if ((c = sqlbox_channel(p)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_channel");
+	if (sqlbox_open(c, 0))
+		errx(EXIT_FAILURE, "sqlbox_open should fail");
+	sqlbox_free(c);
+
+	/* Succeed: only the channel was dropped. */
+
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_close(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
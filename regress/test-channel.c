@@ -0,0 +1,128 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Count the rows of "foo" over "p", which has source 0 open.
+ * Returns the count or -1 on failure.
+ */
+static int
+count(struct sqlbox *p)
+{
+	size_t			 id;
+	int			 rows = 0;
+	const struct sqlbox_parmset *res;
+
+	if (!(id = sqlbox_prepare_bind(p, 0, 2, 0, NULL, 0)))
+		return -1;
+	while ((res = sqlbox_step(p, id)) != NULL && res->psz)
+		rows++;
+	if (res == NULL || !sqlbox_finalise(p, id))
+		return -1;
+	return rows;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i;
+	struct sqlbox		*p, *c[3];
+	struct sqlbox_cfg	 cfg;
+	char			 db[256];
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+		{ .stmt = (char *)"SELECT bar FROM foo" }
+	};
+	int			 rc = EXIT_FAILURE;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.flags = SQLBOX_CFG_CHANNEL;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Each channel sees the others' changes to the source. */
+
+	for (i = 0; i < nitems(c); i++) {
+		if ((c[i] = sqlbox_channel(p)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_channel");
+		if (!sqlbox_open(c[i], 0))
+			errx(EXIT_FAILURE, "sqlbox_open");
+		if (sqlbox_exec(c[i], 0, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	for (i = 0; i < nitems(c); i++)
+		if (count(c[i]) != (int)nitems(c))
+			goto out;
+	if (count(p) != (int)nitems(c))
+		goto out;
+
+	/* Channels outlive the box they were created from. */
+
+	if (!sqlbox_close(p, 0))
+		goto out;
+	sqlbox_free(p);
+	p = NULL;
+
+	for (i = 0; i < nitems(c); i++) {
+		if (sqlbox_exec(c[i], 0, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+			goto out;
+		if (count(c[i]) != (int)(nitems(c) + i + 1))
+			goto out;
+		if (!sqlbox_close(c[i], 0))
+			goto out;
+		sqlbox_free(c[i]);
+		c[i] = NULL;
+	}
+
+	rc = EXIT_SUCCESS;
+out:
+	sqlbox_free(p);
+	for (i = 0; i < nitems(c); i++)
+		sqlbox_free(c[i]);
+	unlink(db);
+	return rc;
+}
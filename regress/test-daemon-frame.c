@@ -0,0 +1,108 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" }
+	};
+	struct sockaddr_un	 sun;
+	uint32_t		 len = 0xffffffff;
+	char			 path[256], c;
+	int			 fd, rc = EXIT_FAILURE;
+	pid_t			 pid;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	strlcpy(path, tmpnam(NULL), sizeof(path));
+	if ((fd = sqlbox_listen(path, &cfg)) == -1)
+		errx(EXIT_FAILURE, "sqlbox_listen");
+	if ((pid = fork()) == -1)
+		err(EXIT_FAILURE, "fork");
+	if (pid == 0) {
+		sqlbox_daemon(&cfg, fd);
+		_exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	/* 
+	 * A client announcing an overlong frame is dropped without
+	 * the daemon trying to read it.
+	 */
+
+	memset(&sun, 0, sizeof(struct sockaddr_un));
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		err(EXIT_FAILURE, "connect");
+	if (write(fd, &len, sizeof(uint32_t)) != sizeof(uint32_t))
+		err(EXIT_FAILURE, "write");
+	if (read(fd, &c, 1) != 0)
+		goto out;
+	close(fd);
+
+	/* Other clients are still served. */
+
+	if ((p = sqlbox_connect(path, &cfg)) == NULL)
+		goto out;
+	if (!sqlbox_open(p, 0))
+		goto out;
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		goto out;
+	if (!sqlbox_close(p, 0))
+		goto out;
+	sqlbox_free(p);
+
+	rc = EXIT_SUCCESS;
+out:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(path);
+	return rc;
+}
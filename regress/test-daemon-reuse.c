@@ -0,0 +1,123 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/wait.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Run statement "stmt" on a fresh client and return the number of rows
+ * in "foo" or -1 on failure.
+ * If "trans", leave a transaction open when disconnecting.
+ */
+static int
+client(const char *path, struct sqlbox_cfg *cfg, size_t stmt, int trans)
+{
+	struct sqlbox		*p;
+	size_t			 id;
+	int			 rows = 0;
+	const struct sqlbox_parmset *res;
+
+	if ((p = sqlbox_connect(path, cfg)) == NULL)
+		return -1;
+	if (!sqlbox_open(p, 0))
+		return -1;
+	if (trans && !sqlbox_trans_immediate(p, 0, 1))
+		return -1;
+	if (sqlbox_exec(p, 0, stmt, 0, NULL, 0) != SQLBOX_CODE_OK)
+		return -1;
+	if (!(id = sqlbox_prepare_bind(p, 0, 2, 0, NULL, 0)))
+		return -1;
+	while ((res = sqlbox_step(p, id)) != NULL && res->psz)
+		rows++;
+	if (res == NULL || !sqlbox_finalise(p, id))
+		return -1;
+	if (!trans && !sqlbox_close(p, 0))
+		return -1;
+	sqlbox_free(p);
+	return rows;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+		{ .stmt = (char *)"SELECT bar FROM foo" }
+	};
+	char			 path[256];
+	int			 fd, rc = EXIT_FAILURE;
+	pid_t			 pid;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	strlcpy(path, tmpnam(NULL), sizeof(path));
+	if ((fd = sqlbox_listen(path, &cfg)) == -1)
+		errx(EXIT_FAILURE, "sqlbox_listen");
+	if ((pid = fork()) == -1)
+		err(EXIT_FAILURE, "fork");
+	if (pid == 0) {
+		sqlbox_daemon(&cfg, fd);
+		_exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	/* 
+	 * Clients one after the other get the same in-memory database,
+	 * so the table created by the first is seen by the others.
+	 * A transaction left open by a client is rolled back.
+	 */
+
+	if (client(path, &cfg, 0, 0) != 0)
+		goto out;
+	if (client(path, &cfg, 1, 0) != 1)
+		goto out;
+	if (client(path, &cfg, 1, 1) != 2)
+		goto out;
+	if (client(path, &cfg, 1, 0) != 2)
+		goto out;
+
+	rc = EXIT_SUCCESS;
+out:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(path);
+	return rc;
+}
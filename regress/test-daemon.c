@@ -0,0 +1,115 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/wait.h>
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, stmtid;
+	struct sqlbox		*p[4];
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT bar FROM foo" }
+	};
+	struct sqlbox_parm	 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+	const struct sqlbox_parmset *res;
+	char			 path[256];
+	int			 fd, rc = EXIT_FAILURE;
+	pid_t			 pid;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	strlcpy(path, tmpnam(NULL), sizeof(path));
+	if ((fd = sqlbox_listen(path, &cfg)) == -1)
+		errx(EXIT_FAILURE, "sqlbox_listen");
+	if ((pid = fork()) == -1)
+		err(EXIT_FAILURE, "fork");
+	if (pid == 0) {
+		sqlbox_daemon(&cfg, fd);
+		_exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	/* 
+	 * Several clients at once: each has its own in-memory
+	 * database because none has been released.
+	 */
+
+	for (i = 0; i < nitems(p); i++) {
+		if ((p[i] = sqlbox_connect(path, &cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_connect");
+		if (!sqlbox_open(p[i], 0))
+			errx(EXIT_FAILURE, "sqlbox_open");
+		if (sqlbox_exec(p[i], 0, 0, 0, NULL, 0) != 
+		    SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		parm.iparm = i;
+		if (sqlbox_exec(p[i], 0, 1, 1, &parm, 0) != 
+		    SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	for (i = 0; i < nitems(p); i++) {
+		if (!(stmtid = sqlbox_prepare_bind
+		    (p[i], 0, 2, 0, NULL, 0)))
+			goto out;
+		if ((res = sqlbox_step(p[i], stmtid)) == NULL)
+			goto out;
+		if (res->psz != 1 || res->ps[0].iparm != (int64_t)i)
+			goto out;
+		if (!sqlbox_finalise(p[i], stmtid))
+			goto out;
+		if (!sqlbox_close(p[i], 0))
+			goto out;
+		sqlbox_free(p[i]);
+	}
+
+	rc = EXIT_SUCCESS;
+out:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(path);
+	return rc;
+}
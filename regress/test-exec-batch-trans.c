@@ -0,0 +1,115 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	ROWS	20000
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, stmtid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	*parms;
+	enum sqlbox_code	*codes;
+	const struct sqlbox_parmset *res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo "
+			"(a INTEGER UNIQUE, b TEXT)" },
+		{ .stmt = (char *)"INSERT INTO foo (a, b) VALUES (?,?)" },
+		{ .stmt = (char *)"SELECT count(*), sum(a) FROM foo" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((parms = calloc(ROWS * 2, sizeof(struct sqlbox_parm))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	if ((codes = calloc(ROWS, sizeof(enum sqlbox_code))) == NULL)
+		err(EXIT_FAILURE, NULL);
+
+	/* 
+	 * Enough rows to span several frames, with every thousandth a
+	 * duplicate.
+	 */
+
+	for (i = 0; i < ROWS; i++) {
+		parms[i * 2].type = SQLBOX_PARM_INT;
+		parms[i * 2].iparm = (i % 1000) == 999 ? 0 : i;
+		parms[i * 2 + 1].type = SQLBOX_PARM_STRING;
+		parms[i * 2 + 1].sparm = "a string of some length";
+	}
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open_async(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_exec_async(p, 0, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+
+	if (sqlbox_exec_batch(p, 0, 1, ROWS, 2, parms, 
+	    SQLBOX_STMT_TRANS | SQLBOX_STMT_CONSTRAINT, 
+	    codes) != SQLBOX_CODE_CONSTRAINT)
+		errx(EXIT_FAILURE, "sqlbox_exec_batch");
+	for (i = 0; i < ROWS; i++)
+		if (codes[i] != ((i % 1000) == 999 ?
+		    SQLBOX_CODE_CONSTRAINT : SQLBOX_CODE_OK))
+			errx(EXIT_FAILURE, "sqlbox_exec_batch: "
+				"bad code for row %zu", i);
+
+	if (!(stmtid = sqlbox_prepare_bind(p, 0, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 2 || res->ps[0].iparm != ROWS - ROWS / 1000)
+		errx(EXIT_FAILURE, "sqlbox_step: bad result");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	/* The transaction's closed, so we can open another. */
+
+	if (!sqlbox_trans_immediate(p, 0, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_immediate");
+	if (!sqlbox_trans_commit(p, 0, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_commit");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	sqlbox_free(p);
+	free(parms);
+	free(codes);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, stmtid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	 parms[10 * 2];
+	const struct sqlbox_parmset *res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER, b TEXT)" },
+		{ .stmt = (char *)"INSERT INTO foo (a, b) VALUES (?,?)" },
+		{ .stmt = (char *)"SELECT sum(a), count(b) FROM foo" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open_async(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_exec_async(p, 0, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+
+	memset(parms, 0, sizeof(parms));
+	for (i = 0; i < 10; i++) {
+		parms[i * 2].type = SQLBOX_PARM_INT;
+		parms[i * 2].iparm = i;
+		parms[i * 2 + 1].type = SQLBOX_PARM_STRING;
+		parms[i * 2 + 1].sparm = "foo";
+	}
+
+	if (sqlbox_exec_batch(p, 0, 1, 10, 2, 
+	    parms, 0, NULL) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_batch");
+
+	/* Empty batches do nothing. */
+
+	if (sqlbox_exec_batch(p, 0, 1, 0, 2, 
+	    NULL, 0, NULL) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec_batch");
+
+	if (!(stmtid = sqlbox_prepare_bind(p, 0, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 2 || 
+	    res->ps[0].iparm != 45 || res->ps[1].iparm != 10)
+		errx(EXIT_FAILURE, "sqlbox_step: bad result");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
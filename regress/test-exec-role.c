@@ -0,0 +1,79 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, id;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:" }
+	};
+	struct sqlbox_pstmt	 pstmts[130];
+	size_t			 rsrcs[] = { 0 };
+	size_t			 rstmts[] = { 63, 64, 129 };
+	struct sqlbox_role	 roles[] = {
+		{ .rolesz = 0,
+		  .stmts = rstmts,
+		  .stmtsz = nitems(rstmts),
+		  .srcs = rsrcs,
+		  .srcsz = nitems(rsrcs) },
+	};
+
+	/* Permissions span several words of the role's bitset. */
+
+	for (i = 0; i < nitems(pstmts); i++)
+		pstmts[i].stmt = (char *)"select 1";
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.roles.rolesz = nitems(roles);
+	cfg.roles.roles = roles;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(id = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	for (i = 0; i < nitems(rstmts); i++)
+		if (sqlbox_exec(p, id, rstmts[i], 
+		    0, NULL, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Fail: statement not in our role. */
+
+	if (sqlbox_exec(p, id, 65, 0, NULL, 0) != SQLBOX_CODE_ERROR)
+		errx(EXIT_FAILURE, "sqlbox_exec should fail");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
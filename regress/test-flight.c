@@ -0,0 +1,199 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+static int	 fds[2] = { -1, -1 };
+
+/*
+ * Run in both processes: pass messages of the recorder over the pipe.
+ */
+static void
+msg(const char *buf, void *arg)
+{
+
+	if (strncmp(buf, "flight: ", 8) == 0)
+		(void)write(fds[1], "", 1);
+}
+
+/*
+ * Read one end's events from "f", checking they're in the order they
+ * finished.
+ * Returns the number of events.
+ */
+static size_t
+section(FILE *f, uint32_t end, struct sqlbox_flightev *evs)
+{
+	uint32_t	 hdr[2];
+	size_t		 i;
+
+	if (fread(hdr, sizeof(hdr), 1, f) != 1)
+		errx(EXIT_FAILURE, "short section header");
+	if (hdr[0] != end || hdr[1] > SQLBOX_FLIGHT_EVENTS)
+		errx(EXIT_FAILURE, "bad section header");
+	if (hdr[1] > 0 && fread(evs, 
+	    sizeof(struct sqlbox_flightev), hdr[1], f) != hdr[1])
+		errx(EXIT_FAILURE, "short section");
+	for (i = 1; i < hdr[1]; i++)
+		if (evs[i].time + evs[i].nsec < 
+		    evs[i - 1].time + evs[i - 1].nsec)
+			errx(EXIT_FAILURE, "events out of order");
+	return hdr[1];
+}
+
+/*
+ * Whether any of the "n" events in "evs" is of "type" for operation
+ * "op" with the first argument "arg".
+ */
+static int
+find(const struct sqlbox_flightev *evs, size_t n, 
+	uint32_t type, const char *op, uint32_t arg)
+{
+	size_t	 i;
+
+	for (i = 0; i < n; i++)
+		if (evs[i].type == type && 
+		    sqlbox_stats_op(evs[i].op) != NULL &&
+		    strcmp(sqlbox_stats_op(evs[i].op), op) == 0 &&
+		    evs[i].args[0] == arg)
+			return 1;
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, id, cn, sn;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_flightev	 client[SQLBOX_FLIGHT_EVENTS],
+				 server[SQLBOX_FLIGHT_EVENTS];
+	uint32_t		 hdr[4];
+	char			 path[] = "/tmp/test-flight.XXXXXXXXXX", c;
+	FILE			*f;
+	int			 fd;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"SELECT 1" },
+	};
+
+	if (pipe(fds) == -1)
+		err(EXIT_FAILURE, "pipe");
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "fcntl");
+	if ((fd = mkstemp(path)) == -1)
+		err(EXIT_FAILURE, "mkstemp");
+	unlink(path);
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func = msg;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!(id = sqlbox_prepare_bind(p, 1, 0, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (sqlbox_step(p, id) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (!sqlbox_flight_dump(p, fd))
+		errx(EXIT_FAILURE, "sqlbox_flight_dump");
+
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(EXIT_FAILURE, "lseek");
+	if ((f = fdopen(fd, "r")) == NULL)
+		err(EXIT_FAILURE, "fdopen");
+	if (fread(hdr, sizeof(hdr), 1, f) != 1)
+		errx(EXIT_FAILURE, "short header");
+	if (memcmp(hdr, SQLBOX_FLIGHT_MAGIC, 8) ||
+	    hdr[2] != SQLBOX_FLIGHT_VERSION || hdr[3] != 2)
+		errx(EXIT_FAILURE, "bad header");
+	cn = section(f, 0, client);
+	sn = section(f, 1, server);
+
+	/* The client sent and the server ran with the same identifiers. */
+
+	if (!find(client, cn, SQLBOX_FLIGHT_SEND, "open-sync", 0) ||
+	    !find(server, sn, SQLBOX_FLIGHT_RUN, "open-sync", 0))
+		errx(EXIT_FAILURE, "open not recorded");
+	if (!find(client, cn, SQLBOX_FLIGHT_SEND, "step", id) ||
+	    !find(server, sn, SQLBOX_FLIGHT_RUN, "step", id))
+		errx(EXIT_FAILURE, "step not recorded");
+	if (!find(client, cn, SQLBOX_FLIGHT_ANSWER, "step", 0))
+		errx(EXIT_FAILURE, "step answer not recorded");
+	for (i = 0; i < sn; i++)
+		if (server[i].type == SQLBOX_FLIGHT_READ ||
+		    server[i].type == SQLBOX_FLIGHT_WRITE)
+			break;
+	if (i == sn)
+		errx(EXIT_FAILURE, "server transfers not recorded");
+
+	/* Only the most recent are kept. */
+
+	for (i = 0; i < SQLBOX_FLIGHT_EVENTS; i++)
+		if (!sqlbox_ping(p))
+			errx(EXIT_FAILURE, "sqlbox_ping");
+	rewind(f);
+	if (ftruncate(fd, 0) == -1)
+		err(EXIT_FAILURE, "ftruncate");
+	if (!sqlbox_flight_dump(p, fd))
+		errx(EXIT_FAILURE, "sqlbox_flight_dump");
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		err(EXIT_FAILURE, "lseek");
+	if (fread(hdr, sizeof(hdr), 1, f) != 1)
+		errx(EXIT_FAILURE, "short header");
+	if (section(f, 0, client) != SQLBOX_FLIGHT_EVENTS ||
+	    section(f, 1, server) != SQLBOX_FLIGHT_EVENTS)
+		errx(EXIT_FAILURE, "recorder not full");
+	if (find(client, SQLBOX_FLIGHT_EVENTS, 
+	    SQLBOX_FLIGHT_SEND, "step", id))
+		errx(EXIT_FAILURE, "old events kept");
+	fclose(f);
+
+	/* The server passes its events as messages when failing. */
+
+	if (read(fds[0], &c, 1) != -1 || errno != EAGAIN)
+		errx(EXIT_FAILURE, "messages before failure");
+	if (!sqlbox_close(p, 100))
+		errx(EXIT_FAILURE, "sqlbox_close");
+	if (sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping should fail");
+	sqlbox_free(p);
+	if (read(fds[0], &c, 1) != 1)
+		errx(EXIT_FAILURE, "no messages after failure");
+	return EXIT_SUCCESS;
+}
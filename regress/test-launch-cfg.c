@@ -0,0 +1,131 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+static int
+filter_int(struct sqlbox_parm *p, void **arg)
+{
+
+	p->type = SQLBOX_PARM_INT;
+	p->iparm = 20;
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 stmtid;
+	struct sqlbox_launcher	*l;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC,
+		  .cachesz = 2 }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"SELECT 1" },
+		{ .stmt = (char *)"SELECT 2" },
+	};
+	struct sqlbox_role	 roles[] = {
+		{ .rolesz = 1,
+		  .roles = (size_t[]){ 1 },
+		  .stmts = (size_t[]){ 0 },
+		  .stmtsz = 1,
+		  .srcs = (size_t[]){ 0 },
+		  .srcsz = 1 },
+		{ .rolesz = 0,
+		  .stmts = (size_t[]){ 0, 1 },
+		  .stmtsz = 2,
+		  .srcsz = 0 },
+	};
+	struct sqlbox_filt	 filts[] = {
+		{ .col = 0,
+		  .stmt = 1,
+		  .type = SQLBOX_FILT_GEN_OUT,
+		  .filt = filter_int,
+		  .free = NULL }
+	};
+	const struct sqlbox_parmset *res;
+
+	if ((l = sqlbox_launcher_alloc()) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launcher_alloc");
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.roles.rolesz = nitems(roles);
+	cfg.roles.roles = roles;
+	cfg.filts.filtsz = nitems(filts);
+	cfg.filts.filts = filts;
+
+	/* Fail: the launcher can't share memory with us. */
+
+	cfg.flags = SQLBOX_CFG_RING;
+	if ((p = sqlbox_launch(l, &cfg)) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_launch should fail");
+	cfg.flags = 0;
+
+	if ((p = sqlbox_launch(l, &cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launch");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* Fail: statement not in our role. */
+
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (sqlbox_exec(p, 0, 1, 0, NULL, 0) != SQLBOX_CODE_ERROR)
+		errx(EXIT_FAILURE, "sqlbox_exec should fail");
+	sqlbox_free(p);
+
+	/* Roles and filters make it to the launched box. */
+
+	if ((p = sqlbox_launch(l, &cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launch");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_role(p, 1))
+		errx(EXIT_FAILURE, "sqlbox_role");
+	if (!(stmtid = sqlbox_prepare_bind(p, 0, 1, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1)
+		errx(EXIT_FAILURE, "res->psz != 1");
+	if (res->ps[0].iparm != 20)
+		errx(EXIT_FAILURE, "res->ps[0].iparm != 20");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	sqlbox_free(p);
+
+	sqlbox_launcher_free(l);
+	return EXIT_SUCCESS;
+}
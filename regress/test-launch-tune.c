@@ -0,0 +1,168 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Step the single-row pragma "stmt" and check that its value is "want",
+ * or the string "swant" if not NULL.
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+pragma(struct sqlbox *p, size_t stmt, int64_t want, const char *swant)
+{
+	size_t			 id;
+	int			 rc;
+	const struct sqlbox_parmset *res;
+
+	if (!(id = sqlbox_prepare_bind(p, 0, stmt, 0, NULL, 0)))
+		return 0;
+	if ((res = sqlbox_step(p, id)) == NULL || res->psz != 1)
+		rc = 0;
+	else if (swant != NULL)
+		rc = res->ps[0].type == SQLBOX_PARM_STRING &&
+			strcmp(res->ps[0].sparm, swant) == 0;
+	else
+		rc = res->ps[0].type == SQLBOX_PARM_INT &&
+			res->ps[0].iparm == want;
+	return sqlbox_finalise(p, id) && rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox_launcher	*l;
+	struct sqlbox		*p1 = NULL, *p2 = NULL;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_stats	 st;
+	char			 db[256], buf[272];
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC,
+		  .tune = {
+			.journal = SQLBOX_JOURNAL_WAL,
+			.sync = SQLBOX_SYNC_NORMAL,
+			.temp = SQLBOX_TEMP_MEMORY,
+			.cachesz = -4096,
+			.pagesz = 1024,
+			.busytimeo = 1234 } },
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RW,
+		  .tune = {
+			.backoff = 50000,
+			.backoffmax = 50000,
+			.jitter = 1,
+			.busymax = 1000 } }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"PRAGMA journal_mode" },
+		{ .stmt = (char *)"PRAGMA synchronous" },
+		{ .stmt = (char *)"PRAGMA temp_store" },
+		{ .stmt = (char *)"PRAGMA cache_size" },
+		{ .stmt = (char *)"PRAGMA page_size" },
+		{ .stmt = (char *)"PRAGMA busy_timeout" },
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (1)" },
+	};
+	int			 rc = EXIT_FAILURE;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	if ((l = sqlbox_launcher_alloc()) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launcher_alloc");
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	/* The tuning profile makes it to the launched box. */
+
+	if ((p1 = sqlbox_launch(l, &cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launch");
+	if (!sqlbox_open(p1, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!pragma(p1, 0, 0, "wal") || !pragma(p1, 1, 1, NULL) ||
+	    !pragma(p1, 2, 2, NULL) || !pragma(p1, 3, -4096, NULL) ||
+	    !pragma(p1, 4, 1024, NULL) || !pragma(p1, 5, 1234, NULL))
+		goto out;
+	if (sqlbox_exec(p1, 0, 6, 0, NULL, 0) != SQLBOX_CODE_OK)
+		goto out;
+
+	/*
+	 * So does the back-off policy: with the first box holding the
+	 * database, the second backs off in the few long steps it was
+	 * given until the first commits...
+	 */
+
+	if ((p2 = sqlbox_launch(l, &cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launch");
+	if (!sqlbox_open(p2, 1))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_trans_exclusive(p1, 0, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_exclusive");
+	if (!sqlbox_ping(p1))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (!sqlbox_exec_async(p2, 0, 7, 0, NULL, 0) || !sqlbox_flush(p2))
+		goto out;
+	usleep(100000);
+	if (!sqlbox_trans_commit(p1, 0, 1) || !sqlbox_ping(p1))
+		goto out;
+	if (!sqlbox_ping(p2) || !sqlbox_stats(p2, NULL, &st))
+		goto out;
+	if (st.busyretries == 0 || st.busyretries > 4 || 
+	    st.busywait < 50000)
+		goto out;
+
+	/* ...and gives up instead of waiting forever. */
+
+	if (!sqlbox_trans_exclusive(p1, 0, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_exclusive");
+	if (!sqlbox_ping(p1))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	alarm(10);
+	if (sqlbox_exec(p2, 0, 7, 0, NULL, 0) != SQLBOX_CODE_ERROR)
+		goto out;
+	alarm(0);
+	if (!sqlbox_trans_commit(p1, 0, 1) || !sqlbox_ping(p1))
+		goto out;
+
+	rc = EXIT_SUCCESS;
+out:
+	sqlbox_free(p2);
+	sqlbox_free(p1);
+	sqlbox_launcher_free(l);
+	unlink(db);
+	snprintf(buf, sizeof(buf), "%s-wal", db);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-shm", db);
+	unlink(buf);
+	return rc;
+}
@@ -0,0 +1,95 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, stmtid;
+	struct sqlbox_launcher	*l;
+	struct sqlbox		*p[4];
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT bar FROM foo" }
+	};
+	struct sqlbox_parm	 parm = {
+		.type = SQLBOX_PARM_INT
+	};
+	const struct sqlbox_parmset *res;
+
+	if ((l = sqlbox_launcher_alloc()) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_launcher_alloc");
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	/* Several boxes from the launcher, each on its own. */
+
+	for (i = 0; i < nitems(p); i++) {
+		if ((p[i] = sqlbox_launch(l, &cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_launch");
+		if (!sqlbox_open(p[i], 0))
+			errx(EXIT_FAILURE, "sqlbox_open");
+		if (sqlbox_exec(p[i], 0, 0, 0, NULL, 0) != 
+		    SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		parm.iparm = i;
+		if (sqlbox_exec(p[i], 0, 1, 1, &parm, 0) != 
+		    SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	for (i = 0; i < nitems(p); i++) {
+		if (!(stmtid = sqlbox_prepare_bind
+		    (p[i], 0, 2, 0, NULL, 0)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+		if ((res = sqlbox_step(p[i], stmtid)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 1)
+			errx(EXIT_FAILURE, "res->psz != 1");
+		if (res->ps[0].iparm != (int64_t)i)
+			errx(EXIT_FAILURE, "res->ps[0].iparm != i");
+		if (!sqlbox_finalise(p[i], stmtid))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+		if (!sqlbox_close(p[i], 0))
+			errx(EXIT_FAILURE, "sqlbox_close");
+		sqlbox_free(p[i]);
+	}
+
+	sqlbox_launcher_free(l);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * What the database process tells us about a slow operation.
+ */
+struct	rec {
+	char	 	 op[32];
+	size_t	 	 srcidx;
+	size_t	 	 stmtidx;
+	uint64_t	 rows;
+	uint64_t	 usec;
+};
+
+static int	 fds[2] = { -1, -1 };
+
+/*
+ * Run in the database process: pass the record back over the pipe.
+ */
+static void
+slow(const struct sqlbox_slow *s, void *arg)
+{
+	struct rec	 r;
+
+	memset(&r, 0, sizeof(struct rec));
+	strlcpy(r.op, s->op, sizeof(r.op));
+	r.srcidx = s->srcidx;
+	r.stmtidx = s->stmtidx;
+	r.rows = s->rows;
+	r.usec = s->usec;
+	(void)write(fds[1], &r, sizeof(struct rec));
+}
+
+/*
+ * Read all records ready, returning whether one was for stepping
+ * statement "stmtidx".
+ * Any record is an error if "none" is set.
+ */
+static int
+drain(size_t stmtidx, int none)
+{
+	struct rec	 r;
+	ssize_t		 ssz;
+	int		 found = 0;
+
+	while ((ssz = read(fds[0], &r, sizeof(struct rec))) > 0) {
+		if ((size_t)ssz != sizeof(struct rec))
+			errx(EXIT_FAILURE, "short record");
+		if (none)
+			errx(EXIT_FAILURE, "%s: unexpected record", r.op);
+		if (strcmp(r.op, "step") == 0 && r.stmtidx == stmtidx) {
+			if (r.srcidx != 0 || r.rows != 1 || r.usec < 1000)
+				errx(EXIT_FAILURE, "bad step record");
+			found = 1;
+		}
+	}
+	if (ssz < 0 && errno != EAGAIN)
+		err(EXIT_FAILURE, "read");
+	return found;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, id;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"SELECT 1" },
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS "
+		  "(SELECT 1 UNION ALL SELECT x + 1 FROM c "
+		  "WHERE x < 200000) SELECT count(*) FROM c" },
+	};
+
+	if (pipe(fds) == -1)
+		err(EXIT_FAILURE, "pipe");
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1)
+		err(EXIT_FAILURE, "fcntl");
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.msg.func_slow = slow;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* 
+	 * Off, on at a millisecond, then at a minute: only the middle
+	 * one is slow.
+	 */
+
+	for (i = 0; i < 3; i++) {
+		if (i == 1 && !sqlbox_msg_set_slow(p, 1000))
+			errx(EXIT_FAILURE, "sqlbox_msg_set_slow");
+		if (i == 2 && !sqlbox_msg_set_slow(p, 60000000))
+			errx(EXIT_FAILURE, "sqlbox_msg_set_slow");
+		if (!(id = sqlbox_prepare_bind(p, 0, 1, 0, NULL, 0)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+		if (sqlbox_step(p, id) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (!sqlbox_finalise(p, id))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+		if (!sqlbox_ping(p))
+			errx(EXIT_FAILURE, "sqlbox_ping");
+		if (i == 1 && !drain(1, 0))
+			errx(EXIT_FAILURE, "slow step not reported");
+		else if (i != 1)
+			drain(1, 1);
+	}
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox		*p1, *p2;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_stats	 ss;
+	char			 db[256], buf[272];
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC },
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RW,
+		  .tune = {
+			.backoff = 5000,
+			.backoffmax = 5000,
+			.jitter = SQLBOX_JITTER_NONE } }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (1)" },
+	};
+	int			 rc = EXIT_FAILURE;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p1 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if ((p2 = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+
+	if (!sqlbox_open(p1, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p1, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!sqlbox_open(p2, 1))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* 
+	 * Have the second box insert while the first holds the
+	 * database, then let it go.
+	 */
+
+	if (!sqlbox_trans_exclusive(p1, 0, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_exclusive");
+	if (!sqlbox_ping(p1))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (!sqlbox_exec_async(p2, 0, 1, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+	if (!sqlbox_flush(p2))
+		errx(EXIT_FAILURE, "sqlbox_flush");
+	usleep(20000);
+	if (!sqlbox_trans_commit(p1, 0, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_commit");
+	if (!sqlbox_ping(p1))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	if (!sqlbox_stats(p2, NULL, &ss))
+		errx(EXIT_FAILURE, "sqlbox_stats");
+	if (ss.busyretries == 0)
+		goto out;
+
+	/* Without jitter, each back-off is exactly as configured. */
+
+	if (ss.busywait != ss.busyretries * 5000)
+		goto out;
+
+	rc = EXIT_SUCCESS;
+out:
+	sqlbox_free(p2);
+	sqlbox_free(p1);
+	unlink(db);
+	snprintf(buf, sizeof(buf), "%s-journal", db);
+	unlink(buf);
+	return rc;
+}
@@ -0,0 +1,111 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox		*p;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_tune	*tune = &srcs[0].tune;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+
+	/* Fail: values out of range. */
+
+	tune->journal = SQLBOX_JOURNAL_OFF + 1;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	memset(tune, 0, sizeof(struct sqlbox_tune));
+
+	tune->sync = -1;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	memset(tune, 0, sizeof(struct sqlbox_tune));
+
+	tune->temp = SQLBOX_TEMP_MEMORY + 1;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	memset(tune, 0, sizeof(struct sqlbox_tune));
+
+	tune->mmapsz = -1;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	memset(tune, 0, sizeof(struct sqlbox_tune));
+
+	/* Fail: page sizes are powers of two from 512 to 65536. */
+
+	tune->pagesz = 256;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	tune->pagesz = 3000;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	tune->pagesz = 131072;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+
+	/* Fail: jitter is a percentage, back-off within its maximum. */
+
+	memset(tune, 0, sizeof(struct sqlbox_tune));
+	tune->jitter = 101;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	memset(tune, 0, sizeof(struct sqlbox_tune));
+	tune->backoff = 2000;
+	tune->backoffmax = 1000;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+	tune->backoffmax = 0;
+	tune->backoff = 1000000;
+	if (sqlbox_alloc(&cfg) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc should fail");
+
+	/* Pass. */
+
+	tune->backoffmax = 1000000;
+	tune->jitter = 100;
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	sqlbox_free(p);
+	memset(tune, 0, sizeof(struct sqlbox_tune));
+
+
+	tune->pagesz = 65536;
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	sqlbox_free(p);
+
+	return EXIT_SUCCESS;
+}
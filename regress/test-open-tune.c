@@ -0,0 +1,117 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Step the single-row pragma "stmt" and check that its value is "want",
+ * or the string "swant" if not NULL.
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+pragma(struct sqlbox *p, size_t stmt, int64_t want, const char *swant)
+{
+	size_t			 id;
+	int			 rc;
+	const struct sqlbox_parmset *res;
+
+	if (!(id = sqlbox_prepare_bind(p, 0, stmt, 0, NULL, 0)))
+		return 0;
+	if ((res = sqlbox_step(p, id)) == NULL || res->psz != 1)
+		rc = 0;
+	else if (swant != NULL)
+		rc = res->ps[0].type == SQLBOX_PARM_STRING &&
+			strcmp(res->ps[0].sparm, swant) == 0;
+	else
+		rc = res->ps[0].type == SQLBOX_PARM_INT &&
+			res->ps[0].iparm == want;
+	return sqlbox_finalise(p, id) && rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	char			 db[256], buf[272];
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC,
+		  .tune = {
+			.journal = SQLBOX_JOURNAL_WAL,
+			.sync = SQLBOX_SYNC_NORMAL,
+			.temp = SQLBOX_TEMP_MEMORY,
+			.cachesz = -4096,
+			.mmapsz = 1024 * 1024,
+			.pagesz = 8192,
+			.busytimeo = 1000 } }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"PRAGMA journal_mode" },
+		{ .stmt = (char *)"PRAGMA synchronous" },
+		{ .stmt = (char *)"PRAGMA temp_store" },
+		{ .stmt = (char *)"PRAGMA cache_size" },
+		{ .stmt = (char *)"PRAGMA page_size" },
+		{ .stmt = (char *)"PRAGMA foreign_keys" },
+	};
+	int			 rc = EXIT_FAILURE;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	if (!pragma(p, 0, 0, "wal") || !pragma(p, 1, 1, NULL) ||
+	    !pragma(p, 2, 2, NULL) || !pragma(p, 3, -4096, NULL) ||
+	    !pragma(p, 4, 8192, NULL))
+		goto out;
+
+	/* Tuning doesn't replace the defaults. */
+
+	if (!pragma(p, 5, 1, NULL))
+		goto out;
+
+	rc = EXIT_SUCCESS;
+out:
+	sqlbox_free(p);
+	unlink(db);
+	snprintf(buf, sizeof(buf), "%s-wal", db);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-shm", db);
+	unlink(buf);
+	return rc;
+}
@@ -0,0 +1,138 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, id, t, ct, src[2];
+	struct sqlbox		*p, *c[2];
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 r;
+	struct pollfd		 pfd;
+	const struct sqlbox_parmset *res;
+	char			 db[256], buf[272];
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC },
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RO }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS (SELECT 1 "
+			"UNION ALL SELECT x + 1 FROM c WHERE x < 3000000) "
+			"SELECT count(*) FROM c" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	int			 rc = EXIT_FAILURE;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.flags = SQLBOX_CFG_CHANNEL;
+
+	c[0] = c[1] = NULL;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	for (i = 0; i < nitems(c); i++) {
+		if ((c[i] = sqlbox_channel(p)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_channel");
+		if (!(src[i] = sqlbox_open(c[i], 1)))
+			errx(EXIT_FAILURE, "sqlbox_open");
+	}
+
+	/* 
+	 * The source is in rollback-journal mode, where a reader would
+	 * hold up writers, so a long parallel query is run serially.
+	 * Its channel is then served alone until it's finalised, so the
+	 * other channel's operation is only answered afterward.
+	 */
+
+	if (!(id = sqlbox_prepare_bind
+	    (c[0], src[0], 1, 0, NULL, SQLBOX_STMT_PARALLEL)))
+		goto out;
+	if (!(t = sqlbox_step_submit(c[0], id)) || !sqlbox_flush(c[0]))
+		goto out;
+	if (!(ct = sqlbox_prepare_bind_submit
+	    (c[1], src[1], 2, 0, NULL, SQLBOX_STMT_PARALLEL)) ||
+	    !sqlbox_flush(c[1]))
+		goto out;
+
+	if (sqlbox_wait(c[0], t, &r) != 1 || r.code != SQLBOX_CODE_OK)
+		goto out;
+	if ((res = sqlbox_step(c[0], id)) == NULL || 
+	    res->psz != 1 || res->ps[0].iparm != 3000000)
+		goto out;
+
+	pfd.fd = sqlbox_fd(c[1]);
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 100) != 0)
+		goto out;
+
+	if (!sqlbox_finalise(c[0], id) || !sqlbox_flush(c[0]))
+		goto out;
+	if (sqlbox_wait(c[1], ct, &r) != 1 || 
+	    r.code != SQLBOX_CODE_OK || r.id == 0)
+		goto out;
+	if ((res = sqlbox_step(c[1], r.id)) == NULL || 
+	    res->psz != 1 || res->ps[0].iparm != 0)
+		goto out;
+	if (!sqlbox_finalise(c[1], r.id))
+		goto out;
+
+	for (i = 0; i < nitems(c); i++) {
+		if (!sqlbox_close(c[i], src[i]))
+			goto out;
+		sqlbox_free(c[i]);
+		c[i] = NULL;
+	}
+
+	rc = EXIT_SUCCESS;
+out:
+	sqlbox_free(p);
+	for (i = 0; i < nitems(c); i++)
+		sqlbox_free(c[i]);
+	unlink(db);
+	snprintf(buf, sizeof(buf), "%s-journal", db);
+	unlink(buf);
+	return rc;
+}
@@ -0,0 +1,176 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Count the rows of "foo" over "p" with a parallel statement.
+ * Returns the count or -1 on failure.
+ */
+static int64_t
+count(struct sqlbox *p, size_t src)
+{
+	size_t			 id;
+	int64_t			 rows = -1;
+	const struct sqlbox_parmset *res;
+
+	if (!(id = sqlbox_prepare_bind
+	    (p, src, 4, 0, NULL, SQLBOX_STMT_PARALLEL)))
+		return -1;
+	if ((res = sqlbox_step(p, id)) != NULL && res->psz == 1 &&
+	    res->ps[0].type == SQLBOX_PARM_INT)
+		rows = res->ps[0].iparm;
+	if (!sqlbox_finalise(p, id))
+		return -1;
+	return rows;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, id, t, src[2];
+	struct sqlbox		*p, *c[2];
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 r;
+	struct pollfd		 pfd;
+	const struct sqlbox_parmset *res;
+	char			 db[256], buf[272];
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RWC },
+		{ .fname = db,
+		  .mode = SQLBOX_SRC_RO }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"PRAGMA journal_mode = WAL" },
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS (SELECT 1 "
+			"UNION ALL SELECT x + 1 FROM c WHERE x < 3000000) "
+			"SELECT count(*) FROM c" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	int			 rc = EXIT_FAILURE;
+
+	strlcpy(db, tmpnam(NULL), sizeof(db));
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.flags = SQLBOX_CFG_CHANNEL;
+
+	c[0] = c[1] = NULL;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (sqlbox_exec(p, 0, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (sqlbox_exec(p, 0, 2, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Without channels, the flag is ignored. */
+
+	if (!(src[0] = sqlbox_open(p, 1)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (count(p, src[0]) != 1)
+		goto out;
+	if (!sqlbox_close(p, src[0]))
+		goto out;
+
+	for (i = 0; i < nitems(c); i++) {
+		if ((c[i] = sqlbox_channel(p)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_channel");
+		if (!(src[i] = sqlbox_open(c[i], 1)))
+			errx(EXIT_FAILURE, "sqlbox_open");
+	}
+
+	/* 
+	 * Start a long query on the first channel.
+	 * It mustn't keep the others from reading or writing.
+	 */
+
+	if (!(id = sqlbox_prepare_bind
+	    (c[0], src[0], 3, 0, NULL, SQLBOX_STMT_PARALLEL)))
+		goto out;
+	if (!(t = sqlbox_step_submit(c[0], id)) || !sqlbox_flush(c[0]))
+		goto out;
+
+	if (count(c[1], src[1]) != 1)
+		goto out;
+	if (sqlbox_exec(p, 0, 2, 0, NULL, 0) != SQLBOX_CODE_OK)
+		goto out;
+	if (count(c[1], src[1]) != 2)
+		goto out;
+
+	/* The long query should still be running. */
+
+	pfd.fd = sqlbox_fd(c[0]);
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 0) != 0)
+		goto out;
+
+	if (sqlbox_wait(c[0], t, &r) != 1 || r.code != SQLBOX_CODE_OK)
+		goto out;
+	if ((res = sqlbox_step(c[0], id)) == NULL || 
+	    res->psz != 1 || res->ps[0].iparm != 3000000)
+		goto out;
+	if (!sqlbox_finalise(c[0], id))
+		goto out;
+
+	/* The connections are reused, and see the latest writes. */
+
+	if (count(c[0], src[0]) != 2)
+		goto out;
+
+	for (i = 0; i < nitems(c); i++) {
+		if (!sqlbox_close(c[i], src[i]))
+			goto out;
+		sqlbox_free(c[i]);
+		c[i] = NULL;
+	}
+
+	rc = EXIT_SUCCESS;
+out:
+	sqlbox_free(p);
+	for (i = 0; i < nitems(c); i++)
+		sqlbox_free(c[i]);
+	unlink(db);
+	snprintf(buf, sizeof(buf), "%s-wal", db);
+	unlink(buf);
+	snprintf(buf, sizeof(buf), "%s-shm", db);
+	unlink(buf);
+	return rc;
+}
@@ -0,0 +1,97 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 id;
+	struct sqlbox_pool	*pool;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	const struct sqlbox_parmset *res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+		{ .stmt = (char *)"BEGIN TRANSACTION" },
+	};
+	size_t			 open[] = { 0 };
+	int64_t			 v;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((pool = sqlbox_pool_alloc
+	    (&cfg, 1, nitems(open), open)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_pool_alloc");
+	if ((p = sqlbox_pool_get(pool)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_pool_get");
+	if (sqlbox_exec(p, 1, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* 
+	 * Leave behind a transaction begun by our own statement, not
+	 * the transaction functions, with an insertion.
+	 */
+
+	if (sqlbox_exec(p, 1, 3, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (sqlbox_exec(p, 1, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!sqlbox_pool_put(pool, p))
+		errx(EXIT_FAILURE, "sqlbox_pool_put");
+
+	/* The next user starts outside of it and without the row. */
+
+	if (sqlbox_pool_get(pool) != p)
+		errx(EXIT_FAILURE, "sqlbox_pool_get: not pooled");
+	if (sqlbox_exec(p, 1, 3, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "transaction not rolled back");
+	if (!(id = sqlbox_prepare_bind(p, 1, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, id)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1)
+		errx(EXIT_FAILURE, "res->psz != 1");
+	if (sqlbox_parm_int(&res->ps[0], &v) == -1)
+		errx(EXIT_FAILURE, "sqlbox_parm_int");
+	if (v != 0)
+		errx(EXIT_FAILURE, "insertion not rolled back");
+	if (!sqlbox_pool_put(pool, p))
+		errx(EXIT_FAILURE, "sqlbox_pool_put");
+
+	sqlbox_pool_free(pool);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 id;
+	struct sqlbox_pool	*pool;
+	struct sqlbox		*p, *p2;
+	struct sqlbox_cfg	 cfg;
+	const struct sqlbox_parmset *res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" },
+	};
+	size_t			 rsrcs[] = { 0 };
+	size_t			 rstmts[] = { 0, 1, 2 };
+	struct sqlbox_role	 roles[] = {
+		{ .rolesz = 1,
+		  .roles = (size_t[]){ 1 },
+		  .stmts = rstmts,
+		  .stmtsz = nitems(rstmts),
+		  .srcs = rsrcs,
+		  .srcsz = nitems(rsrcs) },
+		{ .rolesz = 0,
+		  .stmtsz = 0,
+		  .srcsz = 0 },
+	};
+	size_t			 open[] = { 0 };
+	int64_t			 v;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.roles.rolesz = nitems(roles);
+	cfg.roles.roles = roles;
+
+	if ((pool = sqlbox_pool_alloc
+	    (&cfg, 1, nitems(open), open)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_pool_alloc");
+	if ((p = sqlbox_pool_get(pool)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_pool_get");
+	if (sqlbox_exec(p, 1, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* 
+	 * Leave behind a statement, another source, an open
+	 * transaction with an insertion, and a lesser role.
+	 */
+
+	if (!sqlbox_prepare_bind(p, 1, 2, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_trans_immediate(p, 1, 1))
+		errx(EXIT_FAILURE, "sqlbox_trans_immediate");
+	if (sqlbox_exec(p, 1, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	if (!sqlbox_role(p, 1))
+		errx(EXIT_FAILURE, "sqlbox_role");
+	if (!sqlbox_pool_put(pool, p))
+		errx(EXIT_FAILURE, "sqlbox_pool_put");
+
+	/* We get the same box back, but reset. */
+
+	if ((p2 = sqlbox_pool_get(pool)) != p)
+		errx(EXIT_FAILURE, "sqlbox_pool_get: not pooled");
+	if (!sqlbox_trans_immediate(p, 1, 2))
+		errx(EXIT_FAILURE, "sqlbox_trans_immediate");
+	if (!sqlbox_trans_rollback(p, 1, 2))
+		errx(EXIT_FAILURE, "sqlbox_trans_rollback");
+	if (!(id = sqlbox_prepare_bind(p, 1, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, id)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1)
+		errx(EXIT_FAILURE, "res->psz != 1");
+	if (sqlbox_parm_int(&res->ps[0], &v) == -1)
+		errx(EXIT_FAILURE, "sqlbox_parm_int");
+	if (v != 0)
+		errx(EXIT_FAILURE, "insertion not rolled back");
+
+	/* The extra source was closed: this one is new. */
+
+	if ((id = sqlbox_open(p, 0)) == 0)
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (id == 2)
+		errx(EXIT_FAILURE, "source not closed");
+	if (!sqlbox_pool_put(pool, p))
+		errx(EXIT_FAILURE, "sqlbox_pool_put");
+
+	sqlbox_pool_free(pool);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i;
+	struct sqlbox_pool	*pool;
+	struct sqlbox		*p[3];
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (1)" },
+	};
+	size_t			 open[] = { 0 };
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((pool = sqlbox_pool_alloc
+	    (&cfg, 2, nitems(open), open)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_pool_alloc");
+
+	/* The last checkout is cold: the pool only has two. */
+
+	for (i = 0; i < nitems(p); i++) {
+		if ((p[i] = sqlbox_pool_get(pool)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_pool_get");
+		if (sqlbox_exec(p[i], 1, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+
+	/* The last returned is freed: the pool is full. */
+
+	for (i = 0; i < nitems(p); i++)
+		if (!sqlbox_pool_put(pool, p[i]))
+			errx(EXIT_FAILURE, "sqlbox_pool_put");
+
+	/* Sources stay open (with their tables) when returned. */
+
+	for (i = 0; i < 2; i++) {
+		if ((p[i] = sqlbox_pool_get(pool)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_pool_get");
+		if (sqlbox_exec(p[i], 1, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+	for (i = 0; i < 2; i++)
+		if (!sqlbox_pool_put(pool, p[i]))
+			errx(EXIT_FAILURE, "sqlbox_pool_put");
+
+	sqlbox_pool_free(pool);
+	return EXIT_SUCCESS;
+}
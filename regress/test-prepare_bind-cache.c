@@ -0,0 +1,105 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 i, stmt1, stmt2;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_parm	 parm;
+	const struct sqlbox_parmset *res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC,
+		  .cachesz = 2 }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT bar FROM foo WHERE bar=?" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open_async(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_exec_async(p, 0, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+
+	/*
+	 * With a cache of two, the same statement prepared twice at
+	 * once is found once in the cache and compiled once, then the
+	 * two evict the insertion statement when they're finalised.
+	 * Each must be reset and rebound when it's reused.
+	 */
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+
+	for (i = 0; i < 50; i++) {
+		parm.iparm = i;
+		if (sqlbox_exec(p, 0, 1, 1, &parm, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		if (!(stmt1 = sqlbox_prepare_bind(p, 0, 2, 1, &parm, 0)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+		parm.iparm = i + 1;
+		if (!(stmt2 = sqlbox_prepare_bind(p, 0, 2, 1, &parm, 0)))
+			errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+
+		if ((res = sqlbox_step(p, stmt1)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 1 || res->ps[0].iparm != (int64_t)i)
+			errx(EXIT_FAILURE, "sqlbox_step: bad result");
+		if ((res = sqlbox_step(p, stmt2)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 0)
+			errx(EXIT_FAILURE, "sqlbox_step: bad result");
+
+		if (!sqlbox_finalise(p, stmt1))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+		if (!sqlbox_finalise(p, stmt2))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+	}
+
+	if (!sqlbox_close(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_close");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
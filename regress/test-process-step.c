@@ -0,0 +1,155 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Process until ticket "t" is answered, returning its result.
+ */
+static void
+drive(struct sqlbox *p, size_t t, struct sqlbox_result *res)
+{
+	struct pollfd	 pfd;
+	int		 c;
+
+	while ((c = sqlbox_poll(p, t, res)) == 0) {
+		if ((c = sqlbox_process(p)) < 0)
+			errx(EXIT_FAILURE, "sqlbox_process");
+		if (sqlbox_poll(p, t, res) > 0)
+			return;
+		pfd.fd = sqlbox_fd(p);
+		pfd.events = 0;
+		if (c & SQLBOX_WANT_READ)
+			pfd.events |= POLLIN;
+		if (c & SQLBOX_WANT_WRITE)
+			pfd.events |= POLLOUT;
+		if (pfd.events == 0)
+			errx(EXIT_FAILURE, "sqlbox_process: idle");
+		if (poll(&pfd, 1, -1) == -1)
+			err(EXIT_FAILURE, "poll");
+	}
+	if (c < 0)
+		errx(EXIT_FAILURE, "sqlbox_poll");
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 t, id, i;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 res;
+	const struct sqlbox_parmset *ps;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"WITH RECURSIVE c(x) AS "
+			"(VALUES(1) UNION ALL SELECT x+1 FROM c "
+			"WHERE x<3) SELECT x FROM c" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.flags = SQLBOX_CFG_NONBLOCK;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+
+	/* Nothing's answered until processed. */
+
+	if (!(t = sqlbox_open_submit(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open_submit");
+	if (sqlbox_poll(p, t, &res) != 0)
+		errx(EXIT_FAILURE, "sqlbox_poll: answered");
+	drive(p, t, &res);
+	if (res.code != SQLBOX_CODE_OK || res.id == 0)
+		errx(EXIT_FAILURE, "sqlbox_open_submit: bad result");
+
+	if (!(t = sqlbox_prepare_bind_submit(p, res.id, 0, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind_submit");
+	drive(p, t, &res);
+	if (res.code != SQLBOX_CODE_OK || (id = res.id) == 0)
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind_submit: bad result");
+
+	/* Each submitted step is then returned by sqlbox_step(). */
+
+	for (i = 1; i <= 4; i++) {
+		if (!(t = sqlbox_step_submit(p, id)))
+			errx(EXIT_FAILURE, "sqlbox_step_submit");
+		drive(p, t, &res);
+		if (res.code != SQLBOX_CODE_OK || res.id != id)
+			errx(EXIT_FAILURE, "sqlbox_step_submit: "
+				"bad result");
+		if ((ps = sqlbox_step(p, id)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (i == 4 && ps->psz != 0)
+			errx(EXIT_FAILURE, "sqlbox_step: not done");
+		if (i < 4 && (ps->psz != 1 || ps->ps[0].iparm != 
+		    (int64_t)i))
+			errx(EXIT_FAILURE, "sqlbox_step: bad row");
+	}
+
+	/* Stepping past the end is an error, but not a fatal one. */
+
+	if (!(t = sqlbox_step_submit(p, id)))
+		errx(EXIT_FAILURE, "sqlbox_step_submit");
+	drive(p, t, &res);
+	if (res.code != SQLBOX_CODE_ERROR)
+		errx(EXIT_FAILURE, "sqlbox_step_submit: should fail");
+
+	/* Outstanding steps are read before stepping synchronously. */
+
+	if (!sqlbox_rebind(p, id, 0, NULL))
+		errx(EXIT_FAILURE, "sqlbox_rebind");
+	if (!sqlbox_step_submit(p, id))
+		errx(EXIT_FAILURE, "sqlbox_step_submit");
+	if ((ps = sqlbox_step(p, id)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (ps->psz != 1 || ps->ps[0].iparm != 1)
+		errx(EXIT_FAILURE, "sqlbox_step: bad row");
+	if ((ps = sqlbox_step(p, id)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (ps->psz != 1 || ps->ps[0].iparm != 2)
+		errx(EXIT_FAILURE, "sqlbox_step: bad row");
+
+	if (!sqlbox_step_submit(p, id))
+		errx(EXIT_FAILURE, "sqlbox_step_submit");
+	if (!sqlbox_finalise(p, id))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	BOXES	16
+#define	ROWS	2000
+
+/*
+ * Drive many boxes from a single poll(2) loop.
+ * Each inserts rows without waiting for any of them, then checks that
+ * they were all answered in order.
+ */
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, j, got[BOXES], first[BOXES], left;
+	struct sqlbox		*p[BOXES];
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 res;
+	struct sqlbox_parm	 parm;
+	struct pollfd		 pfd[BOXES];
+	int			 c;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (?)" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.flags = SQLBOX_CFG_NONBLOCK;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+
+	for (i = 0; i < BOXES; i++) {
+		if ((p[i] = sqlbox_alloc(&cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_alloc");
+		if (!(first[i] = sqlbox_open_submit(p[i], 0)))
+			errx(EXIT_FAILURE, "sqlbox_open_submit");
+		if (!sqlbox_exec_submit(p[i], 0, 0, 0, NULL, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_submit");
+		for (j = 0; j < ROWS; j++) {
+			parm.iparm = j;
+			if (!sqlbox_exec_submit(p[i], 0, 1, 1, &parm, 0))
+				errx(EXIT_FAILURE, "sqlbox_exec_submit");
+		}
+		got[i] = 0;
+	}
+
+	for (left = BOXES; left > 0; ) {
+		for (i = 0; i < BOXES; i++) {
+			pfd[i].fd = sqlbox_fd(p[i]);
+			pfd[i].events = 0;
+			if (got[i] == ROWS + 2)
+				continue;
+			if ((c = sqlbox_process(p[i])) < 0)
+				errx(EXIT_FAILURE, "sqlbox_process");
+			if (c & SQLBOX_WANT_READ)
+				pfd[i].events |= POLLIN;
+			if (c & SQLBOX_WANT_WRITE)
+				pfd[i].events |= POLLOUT;
+			while ((c = sqlbox_poll(p[i], 0, &res)) > 0) {
+				if (res.ticket != first[i] + got[i])
+					errx(EXIT_FAILURE, "out of order");
+				if (res.code != SQLBOX_CODE_OK)
+					errx(EXIT_FAILURE, "bad code");
+				if (++got[i] == ROWS + 2)
+					left--;
+			}
+			if (c < 0)
+				errx(EXIT_FAILURE, "sqlbox_poll");
+			if (got[i] == ROWS + 2)
+				pfd[i].events = 0;
+			else if (pfd[i].events == 0)
+				errx(EXIT_FAILURE, "sqlbox_process: idle");
+		}
+		if (left > 0 && poll(pfd, BOXES, -1) == -1)
+			err(EXIT_FAILURE, "poll");
+	}
+
+	for (i = 0; i < BOXES; i++) {
+		if (sqlbox_process(p[i]) != 0)
+			errx(EXIT_FAILURE, "sqlbox_process: not idle");
+		sqlbox_free(p[i]);
+	}
+	return EXIT_SUCCESS;
+}
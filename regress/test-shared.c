@@ -0,0 +1,135 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	THREADS	8
+#define	ROWS	500
+
+struct	arg {
+	struct sqlbox	*p;
+	size_t		 id;
+	int		 ok;
+};
+
+/*
+ * Insert this thread's rows, each second one twice so that it fails
+ * the unique constraint, waiting on every few and checking that the
+ * answers are our own.
+ */
+static void *
+worker(void *v)
+{
+	struct arg		*a = v;
+	struct sqlbox_parm	 parm = { .type = SQLBOX_PARM_INT };
+	struct sqlbox_result	 res;
+	size_t			 i, j, t[10];
+	enum sqlbox_code	 want;
+
+	for (i = 0; i < ROWS; i += nitems(t)) {
+		for (j = 0; j < nitems(t); j++) {
+			parm.iparm = a->id * ROWS + ((i + j) & ~1);
+			t[j] = sqlbox_exec_submit(a->p, 0, 1, 1, 
+				&parm, SQLBOX_STMT_CONSTRAINT);
+			if (t[j] == 0)
+				return NULL;
+		}
+		for (j = nitems(t); j > 0; j--) {
+			if (sqlbox_wait(a->p, t[j - 1], &res) <= 0)
+				return NULL;
+			want = ((j - 1) & 1) ? 
+				SQLBOX_CODE_CONSTRAINT : SQLBOX_CODE_OK;
+			if (res.ticket != t[j - 1] || res.code != want)
+				return NULL;
+		}
+	}
+	a->ok = 1;
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, stmtid;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct arg		 args[THREADS];
+	pthread_t		 threads[THREADS];
+	const struct sqlbox_parmset *res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER UNIQUE)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT count(*) FROM foo" }
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.flags = SQLBOX_CFG_SHARED;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	/* Threads submit and wait on the same box at once. */
+
+	for (i = 0; i < THREADS; i++) {
+		args[i].p = p;
+		args[i].id = i;
+		args[i].ok = 0;
+		if (pthread_create(&threads[i], NULL, worker, &args[i]))
+			errx(EXIT_FAILURE, "pthread_create");
+	}
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_join(threads[i], NULL))
+			errx(EXIT_FAILURE, "pthread_join");
+		if (!args[i].ok)
+			errx(EXIT_FAILURE, "thread %zu failed", i);
+	}
+
+	if (!(stmtid = sqlbox_prepare_bind(p, 0, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if ((res = sqlbox_step(p, stmtid)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (res->psz != 1 || res->ps[0].iparm != THREADS * ROWS / 2)
+		errx(EXIT_FAILURE, "bad row count");
+	if (!sqlbox_finalise(p, stmtid))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+/*
+ * Look up the index of operation "name" in the statistics.
+ */
+static size_t
+opidx(const char *name)
+{
+	size_t	 i;
+
+	for (i = 0; i < SQLBOX_STATS_OPS; i++)
+		if (sqlbox_stats_op(i) != NULL &&
+		    strcmp(sqlbox_stats_op(i), name) == 0)
+			return i;
+	errx(EXIT_FAILURE, "%s: unknown operation", name);
+}
+
+/*
+ * Sum of the latency histogram of "op".
+ */
+static uint64_t
+histsum(const struct sqlbox_opstats *op)
+{
+	uint64_t	 sum = 0;
+	size_t		 i;
+
+	for (i = 0; i < SQLBOX_STATS_BUCKETS; i++)
+		sum += op->hist[i];
+	return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, id, ping, exec, step;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_stats	 cs, ss;
+	struct sqlbox_parm	 parm = { .type = SQLBOX_PARM_INT };
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (?)" },
+		{ .stmt = (char *)"SELECT a FROM foo" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if (sqlbox_stats_op(SQLBOX_STATS_OPS) != NULL)
+		errx(EXIT_FAILURE, "sqlbox_stats_op: out of range");
+	ping = opidx("ping");
+	exec = opidx("exec-async");
+	step = opidx("step");
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_exec_async(p, 0, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+	for (i = 0; i < 10; i++) {
+		parm.iparm = i;
+		if (!sqlbox_exec_async(p, 0, 1, 1, &parm, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_async");
+	}
+	for (i = 0; i < 5; i++)
+		if (!sqlbox_ping(p))
+			errx(EXIT_FAILURE, "sqlbox_ping");
+	if (!(id = sqlbox_prepare_bind
+	    (p, 0, 2, 0, NULL, SQLBOX_STMT_MULTI)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (sqlbox_step(p, id) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (!sqlbox_finalise(p, id))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	if (!sqlbox_stats(p, NULL, NULL))
+		errx(EXIT_FAILURE, "sqlbox_stats");
+	if (!sqlbox_stats(p, &cs, &ss))
+		errx(EXIT_FAILURE, "sqlbox_stats");
+
+	/* Both ends count every operation. */
+
+	if (cs.ops[ping].count != 5 || ss.ops[ping].count != 5)
+		errx(EXIT_FAILURE, "bad ping count");
+	if (cs.ops[exec].count != 11 || ss.ops[exec].count != 11)
+		errx(EXIT_FAILURE, "bad exec count");
+	if (cs.ops[step].count != 1 || ss.ops[step].count != 1)
+		errx(EXIT_FAILURE, "bad step count");
+
+	/* 
+	 * The child times all of them, the client only those it waits
+	 * on.
+	 */
+
+	if (histsum(&ss.ops[exec]) != 11 || histsum(&cs.ops[exec]) != 0)
+		errx(EXIT_FAILURE, "bad exec histogram");
+	if (histsum(&cs.ops[ping]) != 5 || cs.ops[ping].nsec == 0)
+		errx(EXIT_FAILURE, "bad ping histogram");
+
+	/* What one end writes, the other reads. */
+
+	if (cs.txframes != ss.rxframes)
+		errx(EXIT_FAILURE, "bad frame count");
+	if (cs.rxbytes != ss.txbytes + sizeof(struct sqlbox_stats))
+		errx(EXIT_FAILURE, "bad byte count");
+	if (cs.txbytes == 0 || cs.syscalls == 0 || ss.syscalls == 0)
+		errx(EXIT_FAILURE, "bad transfer counts");
+
+	/* 
+	 * The client has read a frame of rows, the child has cached a
+	 * batch of those following, and statements are cached.
+	 */
+
+	if (cs.batches != 1 || ss.batches != 1)
+		errx(EXIT_FAILURE, "bad batch count");
+	if (ss.cachemiss != 2 || ss.cachehits != 9 || cs.cachemiss != 0)
+		errx(EXIT_FAILURE, "bad cache count");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
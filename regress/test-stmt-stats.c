@@ -0,0 +1,122 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, id;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_stmtstats	 ss[5];
+	struct sqlbox_parm	 parm = { .type = SQLBOX_PARM_INT };
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (?)" },
+		{ .stmt = (char *)"SELECT a FROM foo ORDER BY a DESC" },
+		{ .stmt = (char *)"SELECT 1" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open");
+
+	/* Nothing's been run: all zero, even beyond what we have. */
+
+	memset(ss, 0xff, sizeof(ss));
+	if (!sqlbox_stmt_stats(p, ss, nitems(ss)))
+		errx(EXIT_FAILURE, "sqlbox_stmt_stats");
+	for (i = 0; i < nitems(ss); i++)
+		if (ss[i].prepares || ss[i].steps || ss[i].nsec)
+			errx(EXIT_FAILURE, "%zu: not zero", i);
+
+	if (sqlbox_exec(p, 0, 0, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+	for (i = 0; i < 10; i++) {
+		parm.iparm = i;
+		if (sqlbox_exec(p, 0, 1, 1, &parm, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+	}
+	if (!(id = sqlbox_prepare_bind(p, 0, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	for (i = 0; i < 10; i++)
+		if (sqlbox_step(p, id) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+	if (sqlbox_step(p, id) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (!sqlbox_finalise(p, id))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	/* Only ask for some of them. */
+
+	memset(ss, 0xff, sizeof(ss));
+	if (!sqlbox_stmt_stats(p, ss, 2))
+		errx(EXIT_FAILURE, "sqlbox_stmt_stats");
+	if (ss[2].prepares != UINT64_MAX)
+		errx(EXIT_FAILURE, "wrote past array");
+	if (!sqlbox_stmt_stats(p, ss, nitems(ss)))
+		errx(EXIT_FAILURE, "sqlbox_stmt_stats");
+
+	/* Executed without parameters: one step. */
+
+	if (ss[0].prepares != 1 || ss[0].steps != 1 || ss[0].rows != 0)
+		errx(EXIT_FAILURE, "bad create counters");
+
+	/* Prepared and stepped to completion each time. */
+
+	if (ss[1].prepares != 10 || ss[1].steps != 10 || ss[1].rows != 0)
+		errx(EXIT_FAILURE, "bad insert counters");
+	if (ss[1].vmsteps == 0)
+		errx(EXIT_FAILURE, "bad insert vm counters");
+
+	/* Ten rows and the end, scanning and sorting the table. */
+
+	if (ss[2].prepares != 1 || ss[2].steps != 11 || ss[2].rows != 10)
+		errx(EXIT_FAILURE, "bad select counters");
+	if (ss[2].fullscans == 0 || ss[2].sorts == 0 || ss[2].nsec == 0)
+		errx(EXIT_FAILURE, "bad select status counters");
+
+	/* Never run and not configured. */
+
+	if (ss[3].prepares || ss[3].steps || ss[4].prepares || ss[4].steps)
+		errx(EXIT_FAILURE, "bad unused counters");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t		 	 dbid, st1, st2, i;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RW }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (bar INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (bar) VALUES (?)" },
+		{ .stmt = (char *)"SELECT * FROM foo ORDER BY bar" },
+		{ .stmt = (char *)"SELECT * FROM foo WHERE bar < ? "
+			"ORDER BY bar DESC" }
+	};
+	struct sqlbox_parm	 parms = {
+		.type = SQLBOX_PARM_INT
+	};
+	const struct sqlbox_parmset *res;
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!(dbid = sqlbox_open(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open");
+	if (!sqlbox_exec_async(p, dbid, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+	for (i = 0; i < 4096; i++) {
+		parms.iparm = i;
+		if (!sqlbox_exec_async(p, dbid, 1, 1, &parms, 0))
+			errx(EXIT_FAILURE, "sqlbox_exec_async");
+	}
+
+	/* Two streams, small batches so that many are in flight. */
+
+	if (!(st1 = sqlbox_prepare_bind(p, dbid, 2, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (!sqlbox_stmt_prefetch(p, st1, 3, 0))
+		errx(EXIT_FAILURE, "sqlbox_stmt_prefetch");
+	if (!sqlbox_stmt_stream(p, st1, 5))
+		errx(EXIT_FAILURE, "sqlbox_stmt_stream");
+
+	parms.iparm = 4096;
+	if (!(st2 = sqlbox_prepare_bind(p, dbid, 3, 1, &parms, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind");
+	if (!sqlbox_stmt_prefetch(p, st2, 7, 0))
+		errx(EXIT_FAILURE, "sqlbox_stmt_prefetch");
+	if (!sqlbox_stmt_stream(p, st2, 2))
+		errx(EXIT_FAILURE, "sqlbox_stmt_stream");
+
+	/* 
+	 * Interleave them with each other and with other requests,
+	 * rebinding the second half-way through.
+	 */
+
+	for (i = 0; i < 4096; i++) {
+		if ((res = sqlbox_step(p, st1)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (res->psz != 1 || res->ps[0].iparm != (int64_t)i)
+			errx(EXIT_FAILURE, "st1: bad row %zu", i);
+		if (i == 2048) {
+			parms.iparm = 100;
+			if (!sqlbox_rebind(p, st2, 1, &parms))
+				errx(EXIT_FAILURE, "sqlbox_rebind");
+		}
+		if (i <= 2148 && (res = sqlbox_step(p, st2)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_step");
+		if (i < 2048) {
+			if (res->psz != 1 || 
+			    res->ps[0].iparm != (int64_t)(4095 - i))
+				errx(EXIT_FAILURE, "st2: bad row %zu", i);
+		} else if (i < 2148) {
+			if (res->psz != 1 || 
+			    res->ps[0].iparm != (int64_t)(99 - i + 2048))
+				errx(EXIT_FAILURE, "st2: bad row %zu", i);
+		} else if (i == 2148) {
+			if (res->psz != 0)
+				errx(EXIT_FAILURE, "st2: not done");
+		}
+		if (i % 100 == 0 && !sqlbox_ping(p))
+			errx(EXIT_FAILURE, "sqlbox_ping");
+		if (i % 100 == 50 && 
+		    sqlbox_exec(p, dbid, 1, 1, &parms, 0) != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_exec");
+		if (i == 2148 && !sqlbox_finalise(p, st2))
+			errx(EXIT_FAILURE, "sqlbox_finalise");
+	}
+
+	/* Finalise the first before reading it all. */
+
+	if (!sqlbox_finalise(p, st1))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (!sqlbox_close(p, dbid))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
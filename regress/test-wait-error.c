@@ -0,0 +1,104 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, t[5];
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 res;
+	struct sqlbox_parm	 parm;
+	enum sqlbox_code	 codes[5] = {
+		SQLBOX_CODE_OK,
+		SQLBOX_CODE_CONSTRAINT,
+		SQLBOX_CODE_ERROR,
+		SQLBOX_CODE_ERROR,
+		SQLBOX_CODE_ERROR,
+	};
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER UNIQUE)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (?)" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+	parm.iparm = 10;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open_async(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open_async");
+	if (!sqlbox_exec_async(p, 0, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+	if (!sqlbox_exec_async(p, 0, 1, 1, &parm, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+
+	/*
+	 * A constraint violation, a violation without the constraint
+	 * flag, a bad statement, and a bad source: each is reported on
+	 * its ticket and the child lives on.
+	 */
+
+	t[0] = sqlbox_exec_submit(p, 0, 1, 0, NULL, 0);
+	t[1] = sqlbox_exec_submit(p, 0, 1, 
+		1, &parm, SQLBOX_STMT_CONSTRAINT);
+	t[2] = sqlbox_exec_submit(p, 0, 1, 1, &parm, 0);
+	t[3] = sqlbox_exec_submit(p, 0, 2, 0, NULL, 0);
+	t[4] = sqlbox_open_submit(p, 1);
+
+	for (i = 0; i < nitems(t); i++) {
+		if (t[i] == 0)
+			errx(EXIT_FAILURE, "submit %zu", i);
+		if (sqlbox_wait(p, t[i], &res) <= 0)
+			errx(EXIT_FAILURE, "sqlbox_wait");
+		if (res.code != codes[i])
+			errx(EXIT_FAILURE, "sqlbox_wait: bad "
+				"code for ticket %zu", i);
+	}
+
+	if (!sqlbox_ping(p))
+		errx(EXIT_FAILURE, "sqlbox_ping");
+	if (sqlbox_exec(p, 0, 1, 0, NULL, 0) != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_exec");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+#define	COUNT	5000
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, t[COUNT];
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 res;
+	struct sqlbox_parm	 parm;
+	int64_t			 id;
+	int			 c;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (?)" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open_async(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open_async");
+	if (!sqlbox_exec_async(p, 0, 0, 0, NULL, 0))
+		errx(EXIT_FAILURE, "sqlbox_exec_async");
+
+	/*
+	 * More than fit in the queue or can be answered without reading,
+	 * interleaving last identifiers.
+	 */
+
+	for (i = 0; i < COUNT; i++) {
+		parm.iparm = i;
+		t[i] = (i % 2) ? sqlbox_lastid_submit(p, 0) :
+			sqlbox_exec_submit(p, 0, 1, 1, &parm, 0);
+		if (t[i] == 0)
+			errx(EXIT_FAILURE, "submit %zu", i);
+	}
+
+	/* A synchronous operation reads all answers before its own. */
+
+	if (!sqlbox_lastid(p, 0, &id) || id != COUNT / 2)
+		errx(EXIT_FAILURE, "sqlbox_lastid");
+
+	/* Collect the last explicitly, then the rest in order. */
+
+	if (sqlbox_wait(p, t[COUNT - 1], &res) <= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait");
+	if (res.lastid != COUNT / 2)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad lastid");
+
+	for (i = 0; i < COUNT - 1; i++) {
+		if ((c = sqlbox_wait(p, 0, &res)) <= 0)
+			errx(EXIT_FAILURE, "sqlbox_wait");
+		if (res.ticket != t[i])
+			errx(EXIT_FAILURE, "sqlbox_wait: out of order");
+		if (res.code != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_wait: bad code");
+		if ((i % 2) && res.lastid != (int64_t)(i + 1) / 2)
+			errx(EXIT_FAILURE, "sqlbox_wait: bad lastid");
+	}
+
+	if (sqlbox_wait(p, 0, NULL) != 0)
+		errx(EXIT_FAILURE, "sqlbox_wait should be empty");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 t, bad;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 res;
+	const struct sqlbox_parmset *ps;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"SELECT 1" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+	if (!sqlbox_open_async(p, 0))
+		errx(EXIT_FAILURE, "sqlbox_open_async");
+
+	if (!(bad = sqlbox_prepare_bind_submit(p, 0, 1, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind_submit");
+	if (!(t = sqlbox_prepare_bind_submit(p, 0, 0, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_prepare_bind_submit");
+
+	/* Waiting on the good ticket reads the bad one too. */
+
+	if (sqlbox_wait(p, t, &res) <= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait");
+	if (res.code != SQLBOX_CODE_OK || res.id == 0)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad result");
+
+	if ((ps = sqlbox_step(p, res.id)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_step");
+	if (ps->psz != 1 || ps->ps[0].type != SQLBOX_PARM_INT ||
+	    ps->ps[0].iparm != 1)
+		errx(EXIT_FAILURE, "sqlbox_step: bad result");
+	if (!sqlbox_finalise(p, res.id))
+		errx(EXIT_FAILURE, "sqlbox_finalise");
+
+	if (sqlbox_wait(p, bad, &res) <= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait");
+	if (res.code != SQLBOX_CODE_ERROR || res.id != 0)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad result");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
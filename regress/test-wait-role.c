@@ -0,0 +1,98 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 i, id, t;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 res;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC },
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"SELECT 1" },
+		{ .stmt = (char *)"SELECT 2" },
+	};
+	size_t			 rsrcs[] = { 0 };
+	size_t			 rstmts[] = { 0 };
+	struct sqlbox_role	 roles[] = {
+		{ .rolesz = 0,
+		  .stmts = rstmts,
+		  .stmtsz = nitems(rstmts),
+		  .srcs = rsrcs,
+		  .srcsz = nitems(rsrcs) },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+	cfg.roles.rolesz = nitems(roles);
+	cfg.roles.roles = roles;
+
+	/*
+	 * Unlike other errors, submitting an operation our role doesn't
+	 * permit kills the child as in the other modes: opening a
+	 * source, executing, and preparing a statement.
+	 */
+
+	for (i = 0; i < 3; i++) {
+		if ((p = sqlbox_alloc(&cfg)) == NULL)
+			errx(EXIT_FAILURE, "sqlbox_alloc");
+		if (!(id = sqlbox_open(p, 0)))
+			errx(EXIT_FAILURE, "sqlbox_open");
+		if (!(t = sqlbox_exec_submit(p, id, 0, 0, NULL, 0)))
+			errx(EXIT_FAILURE, "sqlbox_exec_submit");
+		if (sqlbox_wait(p, t, &res) <= 0 ||
+		    res.code != SQLBOX_CODE_OK)
+			errx(EXIT_FAILURE, "sqlbox_wait");
+
+		if (i == 0)
+			t = sqlbox_open_submit(p, 1);
+		else if (i == 1)
+			t = sqlbox_exec_submit(p, id, 1, 0, NULL, 0);
+		else
+			t = sqlbox_prepare_bind_submit
+				(p, id, 1, 0, NULL, 0);
+		if (t == 0)
+			errx(EXIT_FAILURE, "submit %zu", i);
+		if (sqlbox_wait(p, t, &res) >= 0)
+			errx(EXIT_FAILURE, "sqlbox_wait "
+				"should fail %zu", i);
+		sqlbox_free(p);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sqlbox.h"
+#include "regress.h"
+
+int
+main(int argc, char *argv[])
+{
+	size_t			 open, create, ins, last, id;
+	struct sqlbox		*p;
+	struct sqlbox_cfg	 cfg;
+	struct sqlbox_result	 res;
+	struct sqlbox_parm	 parm;
+	struct sqlbox_src	 srcs[] = {
+		{ .fname = (char *)":memory:",
+		  .mode = SQLBOX_SRC_RWC }
+	};
+	struct sqlbox_pstmt	 pstmts[] = {
+		{ .stmt = (char *)"CREATE TABLE foo (a INTEGER)" },
+		{ .stmt = (char *)"INSERT INTO foo (a) VALUES (?)" },
+	};
+
+	memset(&cfg, 0, sizeof(struct sqlbox_cfg));
+	cfg.msg.func_short = warnx;
+
+	cfg.srcs.srcsz = nitems(srcs);
+	cfg.srcs.srcs = srcs;
+	cfg.stmts.stmtsz = nitems(pstmts);
+	cfg.stmts.stmts = pstmts;
+
+	memset(&parm, 0, sizeof(struct sqlbox_parm));
+	parm.type = SQLBOX_PARM_INT;
+	parm.iparm = 10;
+
+	if ((p = sqlbox_alloc(&cfg)) == NULL)
+		errx(EXIT_FAILURE, "sqlbox_alloc");
+
+	/* Nothing is read until we wait. */
+
+	if (!(open = sqlbox_open_submit(p, 0)))
+		errx(EXIT_FAILURE, "sqlbox_open_submit");
+	if (!(create = sqlbox_exec_submit(p, 1, 0, 0, NULL, 0)))
+		errx(EXIT_FAILURE, "sqlbox_exec_submit");
+	if (!(ins = sqlbox_exec_submit(p, 1, 1, 1, &parm, 0)))
+		errx(EXIT_FAILURE, "sqlbox_exec_submit");
+	if (!(last = sqlbox_lastid_submit(p, 1)))
+		errx(EXIT_FAILURE, "sqlbox_lastid_submit");
+
+	if (sqlbox_wait(p, open, &res) <= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait");
+	if (res.ticket != open || res.code != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad open result");
+	if ((id = res.id) != 1)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad source id");
+	if (sqlbox_wait(p, create, &res) <= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait");
+	if (res.code != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad create result");
+	if (sqlbox_wait(p, ins, &res) <= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait");
+	if (res.code != SQLBOX_CODE_OK)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad insert result");
+	if (sqlbox_wait(p, last, &res) <= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait");
+	if (res.code != SQLBOX_CODE_OK || 
+	    res.id != id || res.lastid != 1)
+		errx(EXIT_FAILURE, "sqlbox_wait: bad lastid result");
+
+	/* Tickets are forgotten once collected. */
+
+	if (sqlbox_wait(p, last, &res) >= 0)
+		errx(EXIT_FAILURE, "sqlbox_wait should fail");
+	if (sqlbox_wait(p, 0, &res) != 0)
+		errx(EXIT_FAILURE, "sqlbox_wait should be empty");
+
+	if (!sqlbox_close(p, id))
+		errx(EXIT_FAILURE, "sqlbox_close");
+
+	sqlbox_free(p);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,437 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Size of each direction's ring in bytes.
+ * This must be a power of two.
+ * Frames larger than this are simply streamed through the ring.
+ */
+#define	SQLBOX_RING_SIZE (64 * 1024)
+
+/*
+ * How many times we poll the ring positions before falling back to
+ * sleeping on the socket.
+ * This covers the usual turnaround of a small synchronous operation.
+ */
+#define	SQLBOX_RING_SPIN 20000
+
+/*
+ * Keep the producer and consumer positions on separate cache lines so
+ * that each side only dirties its own.
+ */
+#define	SQLBOX_RING_LINE 64
+
+/*
+ * A single-producer, single-consumer byte ring in shared memory.
+ * The positions are free-running and only ever masked by the reader's
+ * own notion of the ring size, so a misbehaving peer can at worst
+ * corrupt the bytes it sends, never make us read or write outside of
+ * the mapping.
+ */
+struct	sqlbox_ring {
+	_Atomic size_t	 head; /* producer position */
+	char		 pad1[SQLBOX_RING_LINE - sizeof(size_t)];
+	_Atomic size_t	 tail; /* consumer position */
+	char		 pad2[SQLBOX_RING_LINE - sizeof(size_t)];
+	_Atomic int	 rsleep; /* consumer sleeping on data */
+	_Atomic int	 wsleep; /* producer sleeping on space */
+	char		 pad3[SQLBOX_RING_LINE - sizeof(int) * 2];
+	char		 buf[SQLBOX_RING_SIZE];
+};
+
+/*
+ * Map the shared memory for both directions of the transport.
+ * This must be called before the fork(2), as the mapping is inherited
+ * by the child.
+ * Returns the mapping or NULL on failure.
+ */
+void *
+sqlbox_ring_alloc(const struct sqlbox_cfg *cfg)
+{
+	void	*map;
+
+	map = mmap(NULL, sizeof(struct sqlbox_ring) * 2, 
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+	if (map == MAP_FAILED) {
+		sqlbox_warn(cfg, "mmap");
+		return NULL;
+	}
+
+	/* Anonymous mappings are zeroed, which is our initial state. */
+
+	return map;
+}
+
+/*
+ * Unmap a mapping from sqlbox_ring_alloc().
+ * Does nothing if "map" is NULL.
+ */
+void
+sqlbox_ring_unmap(void *map)
+{
+
+	if (map != NULL)
+		munmap(map, sizeof(struct sqlbox_ring) * 2);
+}
+
+/*
+ * Attach the rings in "map" to the box.
+ * The first ring carries client requests and the second server
+ * responses, so the child uses them the other way around.
+ */
+void
+sqlbox_ring_attach(struct sqlbox *box, void *map, int child)
+{
+	struct sqlbox_ring	*rings = map;
+
+	box->ring = map;
+	box->ring_tx = &rings[child ? 1 : 0];
+	box->ring_rx = &rings[child ? 0 : 1];
+
+	/* Spinning is only useful if the peer runs at the same time. */
+
+	box->ring_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 
+		SQLBOX_RING_SPIN : 0;
+}
+
+/*
+ * Is the ring "r" ready for reading (it has data) or writing (it has
+ * space)?
+ */
+static int
+sqlbox_ring_ready(struct sqlbox_ring *r, int reader)
+{
+	size_t	 used;
+
+	used = atomic_load_explicit(&r->head, memory_order_acquire) -
+	       atomic_load_explicit(&r->tail, memory_order_acquire);
+	return reader ? used > 0 : used < SQLBOX_RING_SIZE;
+}
+
+/*
+ * Notify the peer that something has changed in the ring.
+ * The socket only carries these single-byte wakeups.
+ * If the socket is full, the peer has wakeups pending anyway.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_ring_wake(struct sqlbox *box)
+{
+	char	 c = 0;
+	int	 fl = MSG_DONTWAIT;
+
+#ifdef	MSG_NOSIGNAL
+	fl |= MSG_NOSIGNAL;
+#endif /* MSG_NOSIGNAL */
+
+	box->stats.syscalls++;
+	if (send(box->fd, &c, 1, fl) != -1 ||
+	    errno == EAGAIN || errno == EWOULDBLOCK)
+		return 1;
+	sqlbox_warn(&box->cfg, "send (ring wakeup)");
+	return 0;
+}
+
+/*
+ * Wait until the ring "r" can be read or written.
+ * First spin on the positions, then advertise that we're sleeping and
+ * block on the socket until the peer wakes us up.
+ * The sleeping flag is set before re-checking the ring and the peer
+ * checks it after updating its position (both fully fenced), so no
+ * wakeup can be lost.
+ * The socket also tells us when the peer has died.
+ * Return <0 on failure, 0 if the peer has exited, >0 if ready.
+ */
+static int
+sqlbox_ring_wait(struct sqlbox *box, struct sqlbox_ring *r, int reader)
+{
+	struct pollfd	 pfd = { .fd = box->fd, .events = POLLIN };
+	_Atomic int	*sleeping = reader ? &r->rsleep : &r->wsleep;
+	char		 buf[64];
+	size_t		 i;
+	ssize_t		 rsz;
+	uint64_t	 start;
+
+	for (i = 0; i < box->ring_spin; i++)
+		if (sqlbox_ring_ready(r, reader))
+			return 1;
+
+	for (;;) {
+		atomic_store(sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (sqlbox_ring_ready(r, reader))
+			break;
+
+		box->stats.syscalls++;
+		start = sqlbox_stats_now();
+		if (poll(&pfd, 1, INFTIM) == -1) {
+			if (errno == EINTR)
+				continue;
+			sqlbox_warn(&box->cfg, "poll (ring)");
+			atomic_store(sleeping, 0);
+			return -1;
+		}
+		sqlbox_flight(box, SQLBOX_FLIGHT_POLL, 
+			UINT32_MAX, NULL, 0, start);
+		box->stats.polls++;
+		if ((pfd.revents & (POLLNVAL|POLLERR))) {
+			sqlbox_warnx(&box->cfg, "poll (ring): nval");
+			atomic_store(sleeping, 0);
+			return -1;
+		}
+
+		/* Drain all pending wakeups. */
+
+		while ((rsz = read(box->fd, buf, sizeof(buf))) > 0)
+			box->stats.syscalls++;
+		box->stats.syscalls++;
+		if (rsz == 0) {
+			atomic_store(sleeping, 0);
+			return sqlbox_ring_ready(r, reader) ? 1 : 0;
+		} else if (errno != EAGAIN && 
+		           errno != EWOULDBLOCK && errno != EINTR) {
+			sqlbox_warn(&box->cfg, "read (ring)");
+			atomic_store(sleeping, 0);
+			return -1;
+		}
+	}
+
+	atomic_store(sleeping, 0);
+	return 1;
+}
+
+/*
+ * Copy at most "sz" bytes of what's available in the receiving ring
+ * into "buf", waking the peer if it's waiting on space.
+ * Returns <0 on failure, otherwise the number of bytes read.
+ */
+static ssize_t
+sqlbox_ring_take(struct sqlbox *box, char *buf, size_t sz)
+{
+	struct sqlbox_ring	*r = box->ring_rx;
+	size_t			 head, tail, n, off, first;
+
+	head = atomic_load_explicit(&r->head, memory_order_acquire);
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	n = head - tail;
+	if (n > SQLBOX_RING_SIZE)
+		n = SQLBOX_RING_SIZE;
+	if (n > sz)
+		n = sz;
+
+	off = tail & (SQLBOX_RING_SIZE - 1);
+	first = SQLBOX_RING_SIZE - off;
+	if (first > n)
+		first = n;
+	memcpy(buf, r->buf + off, first);
+	memcpy(buf + first, r->buf, n - first);
+
+	atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&r->wsleep) && !sqlbox_ring_wake(box))
+		return -1;
+	return (ssize_t)n;
+}
+
+/*
+ * Read at most "sz" bytes from the receiving ring into "buf", blocking
+ * until at least one byte is available.
+ * Returns <0 on failure, 0 if the peer has exited, otherwise the
+ * number of bytes read.
+ */
+ssize_t
+sqlbox_ring_read(struct sqlbox *box, char *buf, size_t sz)
+{
+	int	 c;
+
+	if ((c = sqlbox_ring_wait(box, box->ring_rx, 1)) <= 0)
+		return c;
+	return sqlbox_ring_take(box, buf, sz);
+}
+
+/*
+ * Like sqlbox_ring_read(), but don't block.
+ * If the ring is empty, stay marked as sleeping so that the peer wakes
+ * us through the socket when it writes.
+ * Returns <0 on failure, otherwise the number of bytes read (possibly
+ * zero).
+ */
+ssize_t
+sqlbox_ring_tryread(struct sqlbox *box, char *buf, size_t sz)
+{
+	struct sqlbox_ring	*r = box->ring_rx;
+
+	if (!sqlbox_ring_ready(r, 1)) {
+		atomic_store(&r->rsleep, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (!sqlbox_ring_ready(r, 1))
+			return 0;
+	}
+	atomic_store(&r->rsleep, 0);
+	return sqlbox_ring_take(box, buf, sz);
+}
+
+/*
+ * Read and discard all pending wakeups from the socket without
+ * blocking.
+ * Returns <0 on failure, 0 if the peer has exited, >0 otherwise.
+ */
+int
+sqlbox_ring_wakeups(struct sqlbox *box)
+{
+	char	 buf[64];
+	ssize_t	 rsz;
+
+	while ((rsz = read(box->fd, buf, sizeof(buf))) > 0)
+		box->stats.syscalls++;
+	box->stats.syscalls++;
+	if (rsz == 0)
+		return 0;
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return 1;
+	sqlbox_warn(&box->cfg, "read (ring)");
+	return -1;
+}
+
+/*
+ * Write all "iovcnt" buffers in "iov" into the sending ring, blocking
+ * while the ring is full.
+ * The peer is woken only if it's asleep, once we've published as much
+ * as we can.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_ring_writev(struct sqlbox *box, const struct iovec *iov, int iovcnt)
+{
+	struct sqlbox_ring	*r = box->ring_tx;
+	size_t			 head, tail, n, off, first, done;
+	const char		*buf;
+	int			 i, c;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	for (i = 0; i < iovcnt; i++) {
+		buf = iov[i].iov_base;
+		done = 0;
+		while (done < iov[i].iov_len) {
+			tail = atomic_load_explicit
+				(&r->tail, memory_order_acquire);
+			if (head - tail >= SQLBOX_RING_SIZE) {
+				/* Full: let the reader drain it. */
+				atomic_thread_fence
+					(memory_order_seq_cst);
+				if (atomic_load(&r->rsleep) &&
+				    !sqlbox_ring_wake(box))
+					return 0;
+				if ((c = sqlbox_ring_wait
+				    (box, r, 0)) < 0)
+					return 0;
+				if (c == 0) {
+					sqlbox_warnx(&box->cfg, 
+						"ring: peer exited");
+					return 0;
+				}
+				continue;
+			}
+			n = SQLBOX_RING_SIZE - (head - tail);
+			if (n > iov[i].iov_len - done)
+				n = iov[i].iov_len - done;
+			off = head & (SQLBOX_RING_SIZE - 1);
+			first = SQLBOX_RING_SIZE - off;
+			if (first > n)
+				first = n;
+			memcpy(r->buf + off, buf + done, first);
+			memcpy(r->buf, buf + done + first, n - first);
+			head += n;
+			done += n;
+			atomic_store_explicit
+				(&r->head, head, memory_order_release);
+		}
+	}
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&r->rsleep) && !sqlbox_ring_wake(box))
+		return 0;
+	return 1;
+}
+
+/*
+ * Like sqlbox_ring_writev() with a single buffer, but don't block.
+ * If the ring is full, stay marked as sleeping so that the peer wakes
+ * us through the socket when it reads.
+ * Returns <0 on failure, otherwise the number of bytes written
+ * (possibly zero).
+ */
+ssize_t
+sqlbox_ring_trywrite(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_ring	*r = box->ring_tx;
+	size_t			 head, tail, n, off, first;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (head - tail >= SQLBOX_RING_SIZE) {
+		atomic_store(&r->wsleep, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		tail = atomic_load_explicit
+			(&r->tail, memory_order_acquire);
+		if (head - tail >= SQLBOX_RING_SIZE)
+			return 0;
+	}
+	atomic_store(&r->wsleep, 0);
+
+	n = SQLBOX_RING_SIZE - (head - tail);
+	if (n > sz)
+		n = sz;
+	off = head & (SQLBOX_RING_SIZE - 1);
+	first = SQLBOX_RING_SIZE - off;
+	if (first > n)
+		first = n;
+	memcpy(r->buf + off, buf, first);
+	memcpy(r->buf, buf + first, n - first);
+	atomic_store_explicit(&r->head, head + n, memory_order_release);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&r->rsleep) && !sqlbox_ring_wake(box))
+		return -1;
+	return (ssize_t)n;
+}
@@ -32,31 +32,127 @@
 #include "sqlbox.h"
 #include "extern.h"
 
+static	const char *const perms[SQLBOX_PERM__MAX] = {
+	"role", /* SQLBOX_PERM_ROLE */
+	"source", /* SQLBOX_PERM_SRC */
+	"statement", /* SQLBOX_PERM_STMT */
+};
+
 /*
- * Return TRUE if the current role has the ability to transition to the
- * given role (or it's the same role), FALSE if otherwise.
+ * Fill in the bitsets of "p", which has "max" bits per role, from the
+ * "sz" indices in "idx" of role "role".
+ */
+static void
+sqlbox_perms_set(struct sqlbox_perms *p,
+	size_t role, const size_t *idx, size_t sz)
+{
+	uint64_t	*bits = &p->bits[role * p->words];
+	size_t		 i;
+
+	for (i = 0; i < sz; i++) {
+		assert(idx[i] < p->max);
+		bits[idx[i] / 64] |= (uint64_t)1 << (idx[i] % 64);
+	}
+}
+
+/*
+ * Allocate "p" for "max" bits per role.
+ * Returns FALSE on memory allocation failure, TRUE otherwise.
  */
 static int
-sqlbox_rolecheck_role(struct sqlbox *box, size_t idx)
+sqlbox_perms_alloc(struct sqlbox *box, struct sqlbox_perms *p, size_t max)
+{
+
+	p->max = max;
+	p->words = max / 64 + 1;
+	p->bits = calloc(box->cfg.roles.rolesz, p->words * sizeof(uint64_t));
+	if (p->bits == NULL) {
+		sqlbox_warn(&box->cfg, "calloc");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Compile the roles in the configuration into per-role bitsets so that
+ * permission checks needn't scan the role arrays (server).
+ * This must be called after the configuration is verified.
+ * Does nothing if roles are disabled.
+ * Returns FALSE on memory allocation failure, TRUE otherwise.
+ */
+int
+sqlbox_roles_compile(struct sqlbox *box)
+{
+	const struct sqlbox_role *r;
+	size_t			  i;
+
+	if (box->cfg.roles.rolesz == 0)
+		return 1;
+
+	if (!sqlbox_perms_alloc(box, &box->perms[SQLBOX_PERM_ROLE],
+	     box->cfg.roles.rolesz) ||
+	    !sqlbox_perms_alloc(box, &box->perms[SQLBOX_PERM_SRC],
+	     box->cfg.srcs.srcsz) ||
+	    !sqlbox_perms_alloc(box, &box->perms[SQLBOX_PERM_STMT],
+	     box->cfg.stmts.stmtsz)) {
+		sqlbox_warnx(&box->cfg, "sqlbox_perms_alloc");
+		sqlbox_roles_free(box);
+		return 0;
+	}
+
+	for (i = 0; i < box->cfg.roles.rolesz; i++) {
+		r = &box->cfg.roles.roles[i];
+		sqlbox_perms_set(&box->perms[SQLBOX_PERM_ROLE],
+			i, r->roles, r->rolesz);
+		sqlbox_perms_set(&box->perms[SQLBOX_PERM_SRC],
+			i, r->srcs, r->srcsz);
+		sqlbox_perms_set(&box->perms[SQLBOX_PERM_STMT],
+			i, r->stmts, r->stmtsz);
+	}
+	return 1;
+}
+
+void
+sqlbox_roles_free(struct sqlbox *box)
 {
 	size_t	 i;
 
-	assert(box->cfg.roles.rolesz);
-	if (box->role == idx) {
+	for (i = 0; i < SQLBOX_PERM__MAX; i++) {
+		free(box->perms[i].bits);
+		memset(&box->perms[i], 0, sizeof(struct sqlbox_perms));
+	}
+}
+
+/*
+ * Return TRUE if the current role has permission "type" for the given
+ * index (or no roles are specified), FALSE if otherwise.
+ * Transitions into the current role are always allowed.
+ */
+int
+sqlbox_rolecheck(struct sqlbox *box, enum sqlbox_perm type, size_t idx)
+{
+	const struct sqlbox_perms *p = &box->perms[type];
+
+	if (box->cfg.roles.rolesz == 0)
+		return 1;
+	if (type == SQLBOX_PERM_ROLE && box->role == idx) {
 		sqlbox_warnx(&box->cfg, "role: changing into "
 			"current role %zu (harmless)", idx);
 		return 1;
 	}
-	for (i = 0; i < box->cfg.roles.roles[box->role].rolesz; i++)
-		if (box->cfg.roles.roles[box->role].roles[i] == idx)
-			return 1;
-	sqlbox_warnx(&box->cfg, "role: role %zu denied to role %zu",
-		idx, box->role);
+
+	assert(p->bits != NULL);
+	if (idx < p->max && (p->bits[box->role * p->words + idx / 64] & 
+	    ((uint64_t)1 << (idx % 64))))
+		return 1;
+
+	sqlbox_warnx(&box->cfg, "%s %zu denied to role %zu",
+		perms[type], idx, box->role);
 	return 0;
 }
 
-int
-sqlbox_role(struct sqlbox *box, size_t role)
+static int
+sqlbox_role_locked(struct sqlbox *box, size_t role)
 {
 	uint32_t	 v = htole32(role);
 
@@ -68,6 +164,17 @@ sqlbox_role(struct sqlbox *box, size_t role)
 	return 1;
 }
 
+int
+sqlbox_role(struct sqlbox *box, size_t role)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_role_locked(box, role);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
 /*
  * Change our role.
  * First validate the requested role and its transition, then perform
@@ -90,13 +197,13 @@ sqlbox_op_role(struct sqlbox *box, const char *buf, size_t sz)
 	}
 
 	role = le32toh(*(uint32_t *)buf);
-	if (role > box->cfg.roles.rolesz) {
+	if (role >= box->cfg.roles.rolesz) {
 		sqlbox_warnx(&box->cfg, "role: invalid role %zu "
 			"(have %zu)", role, box->cfg.roles.rolesz);
 		return 0;
-	} else if (!sqlbox_rolecheck_role(box, role)) {
+	} else if (!sqlbox_rolecheck(box, SQLBOX_PERM_ROLE, role)) {
 		sqlbox_warnx(&box->cfg, "role: "
-			"sqlbox_rolecheck_role");
+			"sqlbox_rolecheck");
 		return 0;
 	}
 
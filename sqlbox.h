@@ -112,6 +112,40 @@ struct	sqlbox_pstmts {
 	size_t		 	 stmtsz; /* no. statements or 0 */
 };
 
+/*
+ * Tuning of a source applied when it's opened.
+ * Zero leaves the SQLite default.
+ */
+struct	sqlbox_tune {
+#define	SQLBOX_JOURNAL_DEFAULT	 0
+#define	SQLBOX_JOURNAL_DELETE	 1
+#define	SQLBOX_JOURNAL_TRUNCATE	 2
+#define	SQLBOX_JOURNAL_PERSIST	 3
+#define	SQLBOX_JOURNAL_MEMORY	 4
+#define	SQLBOX_JOURNAL_WAL	 5
+#define	SQLBOX_JOURNAL_OFF	 6
+	int		 journal; /* journal_mode */
+#define	SQLBOX_SYNC_DEFAULT	 0
+#define	SQLBOX_SYNC_OFF		 1
+#define	SQLBOX_SYNC_NORMAL	 2
+#define	SQLBOX_SYNC_FULL	 3
+#define	SQLBOX_SYNC_EXTRA	 4
+	int		 sync; /* synchronous */
+#define	SQLBOX_TEMP_DEFAULT	 0
+#define	SQLBOX_TEMP_FILE	 1
+#define	SQLBOX_TEMP_MEMORY	 2
+	int		 temp; /* temp_store */
+	int64_t		 cachesz; /* cache_size: pages or -KiB */
+	int64_t		 mmapsz; /* mmap_size in bytes */
+	size_t		 pagesz; /* page_size in bytes */
+	size_t		 busytimeo; /* busy timeout in milliseconds */
+	size_t		 backoff; /* first back-off in microseconds */
+	size_t		 backoffmax; /* longest back-off in microseconds */
+#define	SQLBOX_JITTER_NONE	 SIZE_MAX
+	size_t		 jitter; /* percent of back-off randomised */
+	size_t		 busymax; /* give up after milliseconds */
+};
+
 /*
  * A database source.
  */
@@ -121,6 +155,8 @@ struct	sqlbox_src {
 #define	SQLBOX_SRC_RW	 1 /* open read-write */
 #define	SQLBOX_SRC_RWC	 2 /* read-write-create */
 	int		 mode; /* open mode */
+	size_t		 cachesz; /* cached statements or 0 (default) */
+	struct sqlbox_tune tune; /* applied on open */
 };
 
 /*
@@ -131,16 +167,36 @@ struct	sqlbox_srcs {
 	size_t			 srcsz; /* no. sources or 0 */
 };
 
+/*
+ * An operation of the database process slower than the threshold set
+ * in struct sqlbox_msg.
+ * Strings are only valid for the duration of the callback.
+ */
+struct	sqlbox_slow {
+	const char	*op; /* as named by sqlbox_stats_op() */
+	const char	*src; /* source filename */
+	size_t		 srcidx; /* source index */
+	const char	*stmt; /* statement text or NULL */
+	size_t		 stmtidx; /* statement index or SIZE_MAX */
+	uint64_t	 usec; /* microseconds elapsed */
+	uint64_t	 retries; /* busy or locked retries */
+	uint64_t	 rows; /* rows stepped */
+};
+
 /*
  * How we pass messages to the frontend.
  * We first check if func is non-NULL, then func_short.
  * The reason for func_short is that it's used for things like warnx
  * that don't take any additional parameters.
+ * Slow operations are passed to func_slow or, if NULL, formatted as
+ * messages.
  */
 struct	sqlbox_msg {
 	void	(*func)(const char *, void *);
 	void	(*func_short)(const char *, ...);
 	void	 *dat; /* passed to func */
+	void	(*func_slow)(const struct sqlbox_slow *, void *);
+	uint64_t  slow; /* threshold (microseconds) or zero */
 };
 
 /*
@@ -191,6 +247,15 @@ struct	sqlbox_filts {
 	size_t		 	 filtsz;
 };
 
+/*
+ * Flag bit values for sqlbox_cfg.
+ */
+#define	SQLBOX_CFG_RING		0x01 /* shared-memory transport */
+#define	SQLBOX_CFG_NOCACHE	0x02 /* don't cache statements */
+#define	SQLBOX_CFG_NONBLOCK	0x04 /* never block submitting */
+#define	SQLBOX_CFG_SHARED	0x08 /* submit and wait from threads */
+#define	SQLBOX_CFG_CHANNEL	0x10 /* may create channels */
+
 /*
  * Contains all data required for an sqlbox configuration.
  */
@@ -200,6 +265,7 @@ struct	sqlbox_cfg {
 	struct sqlbox_srcs	srcs; /* databases */
 	struct sqlbox_filts	filts; /* filters */
 	struct sqlbox_msg	msg; /* message system */
+	unsigned long		flags; /* SQLBOX_CFG_xxx */
 };
 
 enum	sqlbox_code {
@@ -219,15 +285,126 @@ struct	sqlbox_parmset {
 	enum sqlbox_code	 code; /* return type */
 };
 
+/*
+ * The answer to an operation submitted with sqlbox_exec_submit(),
+ * sqlbox_lastid_submit(), sqlbox_open_submit(),
+ * sqlbox_prepare_bind_submit(), or sqlbox_step_submit() and collected
+ * with sqlbox_wait() or sqlbox_poll().
+ */
+struct	sqlbox_result {
+	size_t			 ticket; /* ticket of operation */
+	enum sqlbox_code	 code; /* result code */
+	size_t			 id; /* database or statement (or zero) */
+	int64_t			 lastid; /* last insertion row identifier */
+};
+
+/*
+ * Latency buckets of struct sqlbox_opstats: the first counts operations
+ * taking under a microsecond, each next those taking under twice as
+ * long, and the last all longer.
+ */
+#define	SQLBOX_STATS_BUCKETS	24
+
+/*
+ * Counters of one type of operation.
+ */
+struct	sqlbox_opstats {
+	uint64_t	 count; /* operations */
+	uint64_t	 nsec; /* total nanoseconds of those timed */
+	uint64_t	 hist[SQLBOX_STATS_BUCKETS]; /* timed, by latency */
+};
+
+/*
+ * Maximum number of types of operation in struct sqlbox_stats.
+ */
+#define	SQLBOX_STATS_OPS	32
+
+/*
+ * Counters of one end of a box filled in by sqlbox_stats().
+ * These are all 64-bit integers.
+ */
+struct	sqlbox_stats {
+	struct sqlbox_opstats ops[SQLBOX_STATS_OPS]; /* by sqlbox_stats_op() */
+	uint64_t	 txbytes; /* bytes written */
+	uint64_t	 rxbytes; /* bytes read */
+	uint64_t	 txframes; /* frames written */
+	uint64_t	 rxframes; /* frames read */
+	uint64_t	 syscalls; /* reads, writes, and polls */
+	uint64_t	 polls; /* wakeups from poll(2) */
+	uint64_t	 busyretries; /* back-offs from a busy database */
+	uint64_t	 busywait; /* microseconds backing off */
+	uint64_t	 batches; /* batches of result rows */
+	uint64_t	 cachehits; /* statements from the cache */
+	uint64_t	 cachemiss; /* statements compiled */
+};
+
+/*
+ * Counters of one configured statement filled in by
+ * sqlbox_stmt_stats().
+ * These are all 64-bit integers.
+ */
+struct	sqlbox_stmtstats {
+	uint64_t	 prepares; /* prepared or executed */
+	uint64_t	 steps; /* sqlite3_step() or sqlite3_exec() */
+	uint64_t	 rows; /* rows returned */
+	uint64_t	 nsec; /* nanoseconds stepping */
+	uint64_t	 fullscans; /* steps of full table scans */
+	uint64_t	 sorts; /* sort operations */
+	uint64_t	 autoindex; /* rows put in automatic indices */
+	uint64_t	 vmsteps; /* virtual machine operations */
+};
+
+/*
+ * Number of events kept by each end of a box for sqlbox_flight_dump().
+ */
+#define	SQLBOX_FLIGHT_EVENTS	256
+
+/*
+ * Leading bytes and version of a dump by sqlbox_flight_dump().
+ */
+#define	SQLBOX_FLIGHT_MAGIC	"sqlboxfr"
+#define	SQLBOX_FLIGHT_VERSION	1
+
+#define	SQLBOX_FLIGHT_SEND	0 /* operation queued (client) */
+#define	SQLBOX_FLIGHT_ANSWER	1 /* answer read (client) */
+#define	SQLBOX_FLIGHT_RUN	2 /* operation run (server) */
+#define	SQLBOX_FLIGHT_WRITE	3 /* bytes written */
+#define	SQLBOX_FLIGHT_READ	4 /* bytes read */
+#define	SQLBOX_FLIGHT_POLL	5 /* waited on the channel */
+
+/*
+ * One event of the flight recorder, as dumped (little-endian) by
+ * sqlbox_flight_dump().
+ */
+struct	sqlbox_flightev {
+	uint64_t	 time; /* CLOCK_MONOTONIC nanoseconds */
+	uint64_t	 nsec; /* time taken or zero */
+	uint32_t	 type; /* SQLBOX_FLIGHT_xxx */
+	uint32_t	 op; /* by sqlbox_stats_op() or UINT32_MAX */
+	uint32_t	 size; /* payload or bytes transferred */
+	uint32_t	 args[3]; /* leading words of payload */
+};
+
+/*
+ * What sqlbox_process() is waiting for on sqlbox_fd().
+ */
+#define	SQLBOX_WANT_READ	0x01
+#define	SQLBOX_WANT_WRITE	0x02
+
 /*
  * Flag bit values for sqlbox_exec, sqlbox_exec_async,
- * sqlbox_preapre_bind, and sqlbox_prepare_bind_async.
+ * sqlbox_exec_batch, sqlbox_preapre_bind, and sqlbox_prepare_bind_async.
  */
 #define	SQLBOX_STMT_NORMAL	0x00
 #define	SQLBOX_STMT_CONSTRAINT	0x01
 #define	SQLBOX_STMT_MULTI	0x02
+#define	SQLBOX_STMT_ADAPTIVE	0x04
+#define	SQLBOX_STMT_TRANS	0x08
+#define	SQLBOX_STMT_PARALLEL	0x10
 
 struct	sqlbox;
+struct	sqlbox_launcher;
+struct	sqlbox_pool;
 
 __BEGIN_DECLS
 
@@ -244,20 +421,41 @@ int		 sqlbox_role_hier_sink(struct sqlbox_role_hier *, size_t);
 int		 sqlbox_role_hier_start(struct sqlbox_role_hier *, size_t);
 
 struct sqlbox	*sqlbox_alloc(struct sqlbox_cfg *);
+struct sqlbox	*sqlbox_channel(struct sqlbox *);
 int		 sqlbox_close(struct sqlbox *, size_t);
+struct sqlbox	*sqlbox_connect(const char *, struct sqlbox_cfg *);
+int		 sqlbox_daemon(struct sqlbox_cfg *, int);
 int		 sqlbox_exec_async(struct sqlbox *, size_t, size_t, 
 			size_t, const struct sqlbox_parm *,
 			unsigned long);
 enum sqlbox_code sqlbox_exec(struct sqlbox *, size_t, size_t, 
 			size_t, const struct sqlbox_parm *,
 			unsigned long);
+enum sqlbox_code sqlbox_exec_batch(struct sqlbox *, size_t, size_t, 
+			size_t, size_t, const struct sqlbox_parm *,
+			unsigned long, enum sqlbox_code *);
+size_t		 sqlbox_exec_submit(struct sqlbox *, size_t, size_t, 
+			size_t, const struct sqlbox_parm *,
+			unsigned long);
+int		 sqlbox_fd(const struct sqlbox *);
 int		 sqlbox_finalise(struct sqlbox *, size_t);
+int		 sqlbox_flight_dump(struct sqlbox *, int);
+const char	*sqlbox_flight_type(size_t);
+int		 sqlbox_flush(struct sqlbox *);
 void		 sqlbox_free(struct sqlbox *);
 int		 sqlbox_lastid(struct sqlbox *, size_t, int64_t *);
+size_t		 sqlbox_lastid_submit(struct sqlbox *, size_t);
+struct sqlbox	*sqlbox_launch(struct sqlbox_launcher *, struct sqlbox_cfg *);
+struct sqlbox_launcher
+		*sqlbox_launcher_alloc(void);
+void		 sqlbox_launcher_free(struct sqlbox_launcher *);
+int		 sqlbox_listen(const char *, const struct sqlbox_cfg *);
 int		 sqlbox_msg_set_dat(struct sqlbox *, 
 			const void *, size_t);
+int		 sqlbox_msg_set_slow(struct sqlbox *, uint64_t);
 size_t		 sqlbox_open(struct sqlbox *, size_t);
 int		 sqlbox_open_async(struct sqlbox *, size_t);
+size_t		 sqlbox_open_submit(struct sqlbox *, size_t);
 int		 sqlbox_parm_blob(const struct sqlbox_parm *, void *, size_t, size_t *);
 int		 sqlbox_parm_blob_alloc(const struct sqlbox_parm *, void **, size_t *);
 int		 sqlbox_parm_float(const struct sqlbox_parm *, double *);
@@ -265,22 +463,43 @@ int		 sqlbox_parm_int(const struct sqlbox_parm *, int64_t *);
 int		 sqlbox_parm_string(const struct sqlbox_parm *, char *, size_t, size_t *);
 int		 sqlbox_parm_string_alloc(const struct sqlbox_parm *, char **, size_t *);
 int		 sqlbox_ping(struct sqlbox *);
+int		 sqlbox_poll(struct sqlbox *, size_t, struct sqlbox_result *);
+struct sqlbox_pool
+		*sqlbox_pool_alloc(struct sqlbox_cfg *, size_t,
+			size_t, const size_t *);
+int		 sqlbox_pool_fill(struct sqlbox_pool *);
+void		 sqlbox_pool_free(struct sqlbox_pool *);
+struct sqlbox	*sqlbox_pool_get(struct sqlbox_pool *);
+int		 sqlbox_pool_put(struct sqlbox_pool *, struct sqlbox *);
 size_t		 sqlbox_prepare_bind(struct sqlbox *, size_t,
 			size_t, size_t, const struct sqlbox_parm *,
 			unsigned long);
 int		 sqlbox_prepare_bind_async(struct sqlbox *, size_t,
 			size_t, size_t, const struct sqlbox_parm *,
 			unsigned long);
+size_t		 sqlbox_prepare_bind_submit(struct sqlbox *, size_t,
+			size_t, size_t, const struct sqlbox_parm *,
+			unsigned long);
+int		 sqlbox_process(struct sqlbox *);
 int		 sqlbox_rebind(struct sqlbox *, size_t,
 			size_t, const struct sqlbox_parm *);
 int	 	 sqlbox_role(struct sqlbox *, size_t);
+int		 sqlbox_stats(struct sqlbox *, 
+			struct sqlbox_stats *, struct sqlbox_stats *);
+const char	*sqlbox_stats_op(size_t);
 const struct sqlbox_parmset
 		*sqlbox_step(struct sqlbox *, size_t);
+size_t		 sqlbox_step_submit(struct sqlbox *, size_t);
+int		 sqlbox_stmt_prefetch(struct sqlbox *, size_t, size_t, size_t);
+int		 sqlbox_stmt_stats(struct sqlbox *, 
+			struct sqlbox_stmtstats *, size_t);
+int		 sqlbox_stmt_stream(struct sqlbox *, size_t, size_t);
 int		 sqlbox_trans_immediate(struct sqlbox *, size_t, size_t);
 int		 sqlbox_trans_deferred(struct sqlbox *, size_t, size_t);
 int		 sqlbox_trans_exclusive(struct sqlbox *, size_t, size_t);
 int		 sqlbox_trans_commit(struct sqlbox *, size_t, size_t);
 int		 sqlbox_trans_rollback(struct sqlbox *, size_t, size_t);
+int		 sqlbox_wait(struct sqlbox *, size_t, struct sqlbox_result *);
 
 __END_DECLS
 
@@ -21,6 +21,7 @@
 #endif 
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <sqlite3.h>
@@ -28,11 +29,87 @@
 #include "sqlbox.h"
 #include "extern.h"
 
+/*
+ * Back off from a locked or protocol error on "db" before retry
+ * "attempt", counting it against the source.
+ * Busy errors are instead waited out by sqlbox_wrap_busy().
+ * Returns FALSE if the source's maximum wait has been reached, TRUE
+ * otherwise.
+ */
+int
+sqlbox_wrap_backoff(struct sqlbox *box, struct sqlbox_db *db,
+	size_t attempt, uint64_t *waited)
+{
+	uint64_t	 before = *waited;
+
+	if (!sqlbox_backoff(&db->src->tune, attempt, waited)) {
+		sqlbox_warnx(&box->cfg, "%s: gave up after %zu "
+			"retries", db->src->fname, attempt);
+		return 0;
+	}
+	db->busyretries++;
+	db->busywait += *waited - before;
+	return 1;
+}
+
+/*
+ * Busy handler of each connection, "arg" being its database (server).
+ * SQLite calls this when it may retry: not when waiting would deadlock,
+ * such as when a transaction holding a read lock wants to write while
+ * another waits on that lock to commit.
+ * Returns zero to give up (SQLITE_BUSY), non-zero to retry.
+ */
+int
+sqlbox_wrap_busy(void *arg, int count)
+{
+	struct sqlbox_db	*db = arg;
+	uint64_t		 before;
+
+	/* The count starts again for each operation. */
+
+	if (count == 0)
+		db->busynow = 0;
+	before = db->busynow;
+	if (!sqlbox_backoff(&db->src->tune, count, &db->busynow))
+		return 0;
+	db->busyretries++;
+	db->busywait += db->busynow - before;
+	return 1;
+}
+
+/*
+ * Account for a step of "stmt", or an execution if it's NULL, begun at
+ * "start" and returning "rc".
+ * The statement's own counters are reset so that the next step only
+ * adds what's new.
+ */
+static void
+sqlbox_wrap_account(struct sqlbox_stmtstats *ss, 
+	sqlite3_stmt *stmt, uint64_t start, int rc)
+{
+
+	ss->steps++;
+	ss->nsec += sqlbox_stats_now() - start;
+	if (rc == SQLITE_ROW)
+		ss->rows++;
+	if (stmt == NULL)
+		return;
+	ss->fullscans += sqlite3_stmt_status
+		(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+	ss->sorts += sqlite3_stmt_status
+		(stmt, SQLITE_STMTSTATUS_SORT, 1);
+	ss->autoindex += sqlite3_stmt_status
+		(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+	ss->vmsteps += sqlite3_stmt_status
+		(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+}
+
 /* 
  * Actually prepare a statement "pst".
- * In the usual way we sleep if SQLite gives us a busy, locked, or weird
+ * In the usual way we back off if SQLite gives us a locked or weird
  * protocol error.
- * All other errors are real errorrs.
+ * All other errors, including busy after the busy handler has given
+ * up, are real errorrs.
  * Returns the statement or NULL on failure.
  */
 sqlite3_stmt *
@@ -42,6 +119,7 @@ sqlbox_wrap_prep(struct sqlbox *box, struct sqlbox_db *db,
 	sqlite3_stmt	*stmt;
 	int		 c;
 	size_t		 attempt = 0;
+	uint64_t	 waited = 0;
 
 	assert(pst != NULL && pst->stmt != NULL);
 	sqlbox_debug(&box->cfg, "%s: sqlite3_prepare_v2: %s",
@@ -49,15 +127,23 @@ sqlbox_wrap_prep(struct sqlbox *box, struct sqlbox_db *db,
 
 again:
 	stmt = NULL;
+#ifdef SQLITE_PREPARE_PERSISTENT
+	/* Statements are cached, so they're long-lived. */
+
+	c = sqlite3_prepare_v3(db->db, pst->stmt, -1, 
+		SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+#else
 	c = sqlite3_prepare_v2(db->db, pst->stmt, -1, &stmt, NULL);
+#endif
 
 	switch (c) {
-	case SQLITE_BUSY:
 	case SQLITE_LOCKED:
 	case SQLITE_PROTOCOL:
 		sqlbox_wrap_finalise(box, db, pst, stmt);
-		sqlbox_sleep(attempt++);
-		goto again;
+		stmt = NULL;
+		if (sqlbox_wrap_backoff(box, db, attempt++, &waited))
+			goto again;
+		break;
 	case SQLITE_OK:
 		assert(stmt != NULL);
 		return stmt;
@@ -79,6 +165,7 @@ sqlbox_wrap_open(struct sqlbox *box, const struct sqlbox_src *src)
 {
 	int	 	 fl = SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE;
 	size_t		 attempt = 0;
+	uint64_t	 waited = 0;
 	sqlite3		*db;
 
 	if (src->mode == SQLBOX_SRC_RO)
@@ -89,8 +176,8 @@ sqlbox_wrap_open(struct sqlbox *box, const struct sqlbox_src *src)
 	/*
 	 * We can legit be asked to wait for a while for opening
 	 * especially if the source is stressed.
-	 * Use our usual backing-off algorithm but keep trying ad
-	 * infinitum.
+	 * Use our usual backing-off algorithm for as long as the source
+	 * allows, which defaults to ad infinitum.
 	 * If we error out, be sure to free all resources.
 	 */
 again:
@@ -103,8 +190,12 @@ again:
 		sqlbox_debug(&box->cfg, 
 			"sqlite3_close: %s", src->fname);
 		sqlite3_close(db);
-		sqlbox_sleep(attempt++);
-		goto again;
+		db = NULL;
+		if (sqlbox_backoff(&src->tune, attempt++, &waited))
+			goto again;
+		sqlbox_warnx(&box->cfg, "%s: gave up after %zu "
+			"retries", src->fname, attempt - 1);
+		break;
 	case SQLITE_OK:
 		assert(db != NULL);
 		return db;
@@ -138,8 +229,10 @@ sqlbox_wrap_step(struct sqlbox *box, struct sqlbox_db *db,
 	const struct sqlbox_pstmt *pst, sqlite3_stmt *stmt,
 	size_t *cols, int allow_cstep)
 {
-	size_t	 attempt = 0;
-	int	 ccount;
+	size_t	 	 	 attempt = 0;
+	uint64_t	 	 waited = 0, start = 0;
+	int	 	 	 ccount, rc;
+	struct sqlbox_stmtstats	*ss;
 
 	*cols = 0;
 
@@ -147,22 +240,21 @@ sqlbox_wrap_step(struct sqlbox *box, struct sqlbox_db *db,
 	sqlbox_debug(&box->cfg, "%s: sqlite3_step: %s",
 		db->src->fname, pst->stmt);
 
-again_step:
-	switch (sqlite3_step(stmt)) {
-	case SQLITE_BUSY:
-		/*
-		 * FIXME: according to sqlite3_step(3), this
-		 * should return if we're in a transaction.
-		 */
-		sqlbox_sleep(attempt++);
-		goto again_step;
-	case SQLITE_LOCKED:
-	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again_step;
+	sqlbox_slow_note(box, db, pst);
+	if ((ss = sqlbox_stats_stmt(box, pst)) != NULL)
+		start = sqlbox_stats_now();
+	while ((rc = sqlite3_step(stmt)) == SQLITE_LOCKED ||
+	       rc == SQLITE_PROTOCOL)
+		if (!sqlbox_wrap_backoff(box, db, attempt++, &waited))
+			break;
+	if (ss != NULL)
+		sqlbox_wrap_account(ss, stmt, start, rc);
+
+	switch (rc) {
 	case SQLITE_DONE:
 		return SQLBOX_CODE_OK;
 	case SQLITE_ROW:
+		box->slow.rows++;
 		if ((ccount = sqlite3_column_count(stmt)) > 0) {
 			*cols = (size_t)ccount;
 			return SQLBOX_CODE_OK;
@@ -213,25 +305,29 @@ enum sqlbox_code
 sqlbox_wrap_exec(struct sqlbox *box, struct sqlbox_db *db,
 	const struct sqlbox_pstmt *pst, int allow_cstep)
 {
-	size_t	 attempt = 0;
+	size_t	 	 	 attempt = 0;
+	uint64_t	 	 waited = 0, start = 0;
+	int			 rc;
+	struct sqlbox_stmtstats	*ss;
 
 	assert(pst != NULL && pst->stmt != NULL);
 	sqlbox_debug(&box->cfg, "%s: sqlite3_exec: %s",
 		db->src->fname, pst->stmt);
 
-again_step:
-	switch (sqlite3_exec(db->db, pst->stmt, NULL, NULL, NULL)) {
-	case SQLITE_BUSY:
-		/*
-		 * FIXME: according to sqlite3_step(3), this
-		 * should return if we're in a transaction.
-		 */
-		sqlbox_sleep(attempt++);
-		goto again_step;
-	case SQLITE_LOCKED:
-	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again_step;
+	sqlbox_slow_note(box, db, pst);
+	if ((ss = sqlbox_stats_stmt(box, pst)) != NULL)
+		start = sqlbox_stats_now();
+	while ((rc = sqlite3_exec(db->db,
+	       pst->stmt, NULL, NULL, NULL)) == SQLITE_LOCKED ||
+	       rc == SQLITE_PROTOCOL)
+		if (!sqlbox_wrap_backoff(box, db, attempt++, &waited))
+			break;
+	if (ss != NULL) {
+		ss->prepares++;
+		sqlbox_wrap_account(ss, NULL, start, rc);
+	}
+
+	switch (rc) {
 	case SQLITE_OK:
 		return SQLBOX_CODE_OK;
 	case SQLITE_CONSTRAINT:
@@ -0,0 +1,410 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Operations index the fixed-size array of struct sqlbox_stats: fail
+ * to compile if there are too many for it.
+ */
+typedef char sqlbox_stats_ops_fit
+	[SQLBOX_OP__MAX <= SQLBOX_STATS_OPS ? 1 : -1];
+
+static	const char *const opnames[SQLBOX_OP__MAX] = {
+	"channel", /* SQLBOX_OP_CHANNEL */
+	"close", /* SQLBOX_OP_CLOSE */
+	"exec-async", /* SQLBOX_OP_EXEC_ASYNC */
+	"exec-batch", /* SQLBOX_OP_EXEC_BATCH */
+	"exec-sync", /* SQLBOX_OP_EXEC_SYNC */
+	"exec-ticket", /* SQLBOX_OP_EXEC_TICKET */
+	"finalise", /* SQLBOX_OP_FINAL */
+	"flight", /* SQLBOX_OP_FLIGHT */
+	"lastid", /* SQLBOX_OP_LASTID */
+	"lastid-ticket", /* SQLBOX_OP_LASTID_TICKET */
+	"msg-set-dat", /* SQLBOX_OP_MSG_SET_DAT */
+	"msg-set-slow", /* SQLBOX_OP_MSG_SET_SLOW */
+	"open-async", /* SQLBOX_OP_OPEN_ASYNC */
+	"open-sync", /* SQLBOX_OP_OPEN_SYNC */
+	"open-ticket", /* SQLBOX_OP_OPEN_TICKET */
+	"ping", /* SQLBOX_OP_PING */
+	"prefetch", /* SQLBOX_OP_PREFETCH */
+	"prepare-bind-async", /* SQLBOX_OP_PREPARE_BIND_ASYNC */
+	"prepare-bind-sync", /* SQLBOX_OP_PREPARE_BIND_SYNC */
+	"prepare-bind-ticket", /* SQLBOX_OP_PREPARE_BIND_TICKET */
+	"rebind", /* SQLBOX_OP_REBIND */
+	"reset", /* SQLBOX_OP_RESET */
+	"role", /* SQLBOX_OP_ROLE */
+	"stats", /* SQLBOX_OP_STATS */
+	"step", /* SQLBOX_OP_STEP */
+	"step-ticket", /* SQLBOX_OP_STEP_TICKET */
+	"stmt-stats", /* SQLBOX_OP_STMT_STATS */
+	"stream", /* SQLBOX_OP_STREAM */
+	"trans-close", /* SQLBOX_OP_TRANS_CLOSE */
+	"trans-open", /* SQLBOX_OP_TRANS_OPEN */
+};
+
+/*
+ * The monotonic time in nanoseconds.
+ * This is cheap enough (no system call on most systems) to take around
+ * every operation.
+ */
+uint64_t
+sqlbox_stats_now(void)
+{
+	struct timespec	 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Account for an operation of "op" having taken "ns" nanoseconds.
+ */
+void
+sqlbox_stats_time(struct sqlbox_opstats *op, uint64_t ns)
+{
+	uint64_t	 us = ns / 1000;
+	size_t		 i = 0;
+
+	while (us > 0 && i < SQLBOX_STATS_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+	op->nsec += ns;
+	op->hist[i]++;
+}
+
+/*
+ * Account for a frame of "op" having been queued (client).
+ * It's timed until the next answer is read, which is only its own if
+ * it's synchronous: see sqlbox_stats_answer().
+ */
+void
+sqlbox_stats_sent(struct sqlbox *box, enum sqlbox_op op, 
+	const char *buf, size_t sz)
+{
+
+	sqlbox_flight(box, SQLBOX_FLIGHT_SEND, op, buf, sz, 0);
+	box->stats.ops[op].count++;
+	box->statop = op;
+	box->statstart = sqlbox_stats_now();
+}
+
+/*
+ * An answer has been read (client).
+ * Time it against the last operation queued, if not already answered:
+ * answers to anything queued before it were read earlier.
+ */
+void
+sqlbox_stats_answer(struct sqlbox *box)
+{
+
+	if (box->statop == SQLBOX_OP__MAX)
+		return;
+	sqlbox_stats_time(&box->stats.ops[box->statop], 
+		sqlbox_flight(box, SQLBOX_FLIGHT_ANSWER, 
+		box->statop, NULL, 0, box->statstart));
+	box->statop = SQLBOX_OP__MAX;
+}
+
+/*
+ * Move the busy and cache counters of "db", which is being released
+ * (server), into those of the box.
+ * Its connection may be reused by another box, which starts counting
+ * afresh.
+ */
+void
+sqlbox_stats_db(struct sqlbox *box, struct sqlbox_db *db)
+{
+
+	box->stats.busyretries += db->busyretries;
+	box->stats.busywait += db->busywait;
+	box->stats.cachehits += db->cachehits;
+	box->stats.cachemiss += db->cachemiss;
+	db->busyretries = db->busywait = 0;
+	db->cachehits = db->cachemiss = 0;
+}
+
+/*
+ * Allocate the per-statement counters of "box" (server).
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_stats_alloc(struct sqlbox *box)
+{
+
+	if (box->cfg.stmts.stmtsz == 0)
+		return 1;
+	box->stmtstats = calloc(box->cfg.stmts.stmtsz,
+		sizeof(struct sqlbox_stmtstats));
+	if (box->stmtstats == NULL) {
+		sqlbox_warn(&box->cfg, "calloc");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Look up the counters of "pst" (server).
+ * Returns NULL if it's not one of the configured statements, such as
+ * those used internally for transactions.
+ */
+struct sqlbox_stmtstats *
+sqlbox_stats_stmt(struct sqlbox *box, const struct sqlbox_pstmt *pst)
+{
+	const struct sqlbox_pstmts *pstmts = &box->cfg.stmts;
+
+	if (box->stmtstats == NULL ||
+	    (uintptr_t)pst < (uintptr_t)pstmts->stmts ||
+	    (uintptr_t)pst >= (uintptr_t)(pstmts->stmts + pstmts->stmtsz))
+		return NULL;
+	return &box->stmtstats[pst - pstmts->stmts];
+}
+
+/*
+ * Fill "stats" with the counters of "box", including those of the
+ * databases still open.
+ */
+static void
+sqlbox_stats_fill(const struct sqlbox *box, struct sqlbox_stats *stats)
+{
+	const struct sqlbox_db	 *db;
+	const struct sqlbox_stmt *st;
+
+	*stats = box->stats;
+	TAILQ_FOREACH(db, &box->dbq, entries) {
+		stats->busyretries += db->busyretries;
+		stats->busywait += db->busywait;
+		stats->cachehits += db->cachehits;
+		stats->cachemiss += db->cachemiss;
+	}
+	TAILQ_FOREACH(st, &box->stmtq, gentries)
+		if (st->rdb != NULL) {
+			stats->busyretries += st->rdb->busyretries;
+			stats->busywait += st->rdb->busywait;
+			stats->cachehits += st->rdb->cachehits;
+			stats->cachemiss += st->rdb->cachemiss;
+		}
+}
+
+/*
+ * The name of operation type "op" in struct sqlbox_stats or NULL if it
+ * isn't used.
+ */
+const char *
+sqlbox_stats_op(size_t op)
+{
+
+	return op < SQLBOX_OP__MAX ? opnames[op] : NULL;
+}
+
+/*
+ * Fill in "client" and "server", either of which may be NULL, with the
+ * counters of each end of "box".
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_stats_locked(struct sqlbox *box, 
+	struct sqlbox_stats *client, struct sqlbox_stats *server)
+{
+	uint64_t	*p;
+	size_t		 i;
+
+	if (server != NULL) {
+		if (!sqlbox_write_frame(box, SQLBOX_OP_STATS, NULL, 0)) {
+			sqlbox_warnx(&box->cfg, 
+				"stats: sqlbox_write_frame");
+			return 0;
+		} else if (!sqlbox_read(box, 
+		           (char *)server, sizeof(struct sqlbox_stats))) {
+			sqlbox_warnx(&box->cfg, "stats: sqlbox_read");
+			return 0;
+		}
+		p = (uint64_t *)server;
+		for (i = 0; i < sizeof(struct sqlbox_stats) / 8; i++)
+			p[i] = le64toh(p[i]);
+	}
+
+	/* Threads sharing the box count under its lock. */
+
+	if (client != NULL) {
+		sqlbox_lock(box);
+		sqlbox_stats_fill(box, client);
+		sqlbox_unlock(box);
+	}
+	return 1;
+}
+
+int
+sqlbox_stats(struct sqlbox *box, 
+	struct sqlbox_stats *client, struct sqlbox_stats *server)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_stats_locked(box, client, server);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+/*
+ * Write out our counters, as an array of 64-bit integers.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_op_stats(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stats	 stats;
+	uint64_t		*p = (uint64_t *)&stats;
+	size_t			 i;
+
+	if (sz != 0) {
+		sqlbox_warnx(&box->cfg, "stats: bad frame size: %zu", sz);
+		return 0;
+	}
+
+	sqlbox_stats_fill(box, &stats);
+	for (i = 0; i < sizeof(struct sqlbox_stats) / 8; i++)
+		p[i] = htole64(p[i]);
+
+	if (!sqlbox_write(box, (char *)&stats, sizeof(stats))) {
+		sqlbox_warnx(&box->cfg, "stats: sqlbox_write");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Fill in the first "statsz" elements of "stats" with the counters of
+ * the configured statements of "box", zeroing any beyond them.
+ * Returns FALSE on failure, TRUE on success.
+ */
+static int
+sqlbox_stmt_stats_locked(struct sqlbox *box,
+	struct sqlbox_stmtstats *stats, size_t statsz)
+{
+	struct sqlbox_stmtstats	 st;
+	uint64_t		*p;
+	uint32_t		 val;
+	size_t			 i, j, n;
+
+	if (!sqlbox_write_frame(box, SQLBOX_OP_STMT_STATS, NULL, 0)) {
+		sqlbox_warnx(&box->cfg,
+			"stmt-stats: sqlbox_write_frame");
+		return 0;
+	} else if (!sqlbox_read(box, (char *)&val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "stmt-stats: sqlbox_read");
+		return 0;
+	}
+
+	/* Read them all, even those we don't keep. */
+
+	n = le32toh(val);
+	for (i = 0; i < n; i++) {
+		if (sqlbox_read_full(box, (char *)&st,
+		    sizeof(struct sqlbox_stmtstats), 0) <= 0) {
+			sqlbox_warnx(&box->cfg, 
+				"stmt-stats: sqlbox_read_full");
+			return 0;
+		} else if (i >= statsz)
+			continue;
+		p = (uint64_t *)&st;
+		for (j = 0; j < sizeof(struct sqlbox_stmtstats) / 8; j++)
+			p[j] = le64toh(p[j]);
+		stats[i] = st;
+	}
+
+	for (i = n; i < statsz; i++)
+		memset(&stats[i], 0, sizeof(struct sqlbox_stmtstats));
+	return 1;
+}
+
+int
+sqlbox_stmt_stats(struct sqlbox *box,
+	struct sqlbox_stmtstats *stats, size_t statsz)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_stmt_stats_locked(box, stats, statsz);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+/*
+ * Write out the number of configured statements followed by the
+ * counters of each, as arrays of 64-bit integers.
+ * Returns FALSE on failure, TRUE on success.
+ */
+int
+sqlbox_op_stmt_stats(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmtstats	 st;
+	char			*out;
+	uint64_t		*p;
+	uint32_t		 val;
+	size_t			 i, j, n, outsz;
+	int			 rc;
+
+	if (sz != 0) {
+		sqlbox_warnx(&box->cfg,
+			"stmt-stats: bad frame size: %zu", sz);
+		return 0;
+	}
+
+	n = box->stmtstats == NULL ? 0 : box->cfg.stmts.stmtsz;
+	outsz = sizeof(uint32_t) + n * sizeof(struct sqlbox_stmtstats);
+	if ((out = malloc(outsz)) == NULL) {
+		sqlbox_warn(&box->cfg, "malloc");
+		return 0;
+	}
+
+	/* The counters aren't aligned after the count. */
+
+	val = htole32(n);
+	memcpy(out, &val, sizeof(uint32_t));
+	for (i = 0; i < n; i++) {
+		st = box->stmtstats[i];
+		p = (uint64_t *)&st;
+		for (j = 0; j < sizeof(struct sqlbox_stmtstats) / 8; j++)
+			p[j] = htole64(p[j]);
+		memcpy(out + sizeof(uint32_t) +
+			i * sizeof(struct sqlbox_stmtstats),
+			&st, sizeof(struct sqlbox_stmtstats));
+	}
+
+	if (!(rc = sqlbox_write(box, out, outsz)))
+		sqlbox_warnx(&box->cfg, "stmt-stats: sqlbox_write");
+	free(out);
+	return rc;
+}
@@ -32,11 +32,19 @@
 #include "extern.h"
 
 /*
- * When we're caching results, cache at most 10 times the frame size.
- * XXX: this will probably end up being tuned or dynamically set.
+ * When we're caching results, cache at most 10 times the frame size
+ * unless sqlbox_stmt_prefetch() says otherwise.
  */
 #define	SQLBOX_CACHE_MAX (SQLBOX_FRAME * 10)
 
+/*
+ * Adaptive statements start with a window of this many rows, doubling
+ * whenever the client consumes a full window, until capped in bytes by
+ * sqlbox_stmt_prefetch() or SQLBOX_PREFETCH_MAX.
+ */
+#define	SQLBOX_PREFETCH_MIN 16
+#define	SQLBOX_PREFETCH_MAX (SQLBOX_FRAME * 1024)
+
 struct	freen {
 	void			 *dat;
 	void			(*fp)(void *);
@@ -45,14 +53,78 @@ struct	freen {
 
 TAILQ_HEAD(freeq, freen);
 
-const struct sqlbox_parmset *
-sqlbox_step(struct sqlbox *box, size_t stmtid)
+/*
+ * Parse the rows of a frame read into "res" by sqlbox_read_frame(),
+ * which must have at least one row.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_res_parse(struct sqlbox *box, 
+	struct sqlbox_res *res, const char *frame, size_t framesz)
+{
+	size_t			 i, psz, setmax = 0;
+	void			*pp;
+
+	if (framesz == 0) {
+		sqlbox_warnx(&box->cfg, "step: empty frame");
+		return 0;
+	}
+
+	/* Read as many results sets as are available. */
+
+	while (framesz > 0) {
+		if (framesz < sizeof(uint32_t)) {
+			sqlbox_warnx(&box->cfg, 
+				"step: bad frame size");
+			return 0;
+		}
+
+		/* Large batches: don't reallocate for every row. */
+
+		if (res->setsz == setmax) {
+			setmax = setmax == 0 ? 1 : setmax * 2;
+			pp = reallocarray(res->set, 
+				setmax, sizeof(struct sqlbox_parmset));
+			if (pp == NULL) {
+				sqlbox_warn(&box->cfg, 
+					"step: reallocarray");
+				return 0;
+			}
+			res->set = pp;
+		}
+		i = res->setsz++;
+		memset(&res->set[i], 0, 
+			sizeof(struct sqlbox_parmset));
+
+		res->set[i].code = le32toh(*(uint32_t *)frame);
+		frame += sizeof(uint32_t);
+		framesz -= sizeof(uint32_t);
+
+		psz = sqlbox_parm_unpack(box, 
+			&res->set[i].ps, 
+			&res->set[i].psz,
+			frame, framesz);
+		if (psz == 0) {
+			sqlbox_warnx(&box->cfg, 
+				"step: sqlbox_parm_unpack");
+			return 0;
+		}
+		frame += psz;
+		framesz -= psz;
+	}
+
+	box->stats.batches++;
+	return 1;
+}
+
+static const struct sqlbox_parmset *
+sqlbox_step_locked(struct sqlbox *box, size_t stmtid)
 {
 	uint32_t		 val;
 	const char		*frame;
-	size_t			 i, framesz, psz;
+	size_t			 framesz;
 	struct sqlbox_stmt 	*st;
-	void			*pp;
+	struct sqlbox_push	*push;
 
 	/* Look up the statement. */
 
@@ -66,10 +138,35 @@ sqlbox_step(struct sqlbox *box, size_t stmtid)
 	if (st->res.curset < st->res.setsz)
 		return &st->res.set[st->res.curset++];
 
+	/* Rows from sqlbox_step_submit() come before any others. */
+
+	if (st->stepping > 0 && !sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "step: sqlbox_ticket_drain");
+		return NULL;
+	}
+
 	/* Clear any existing results. */
 
 	sqlbox_res_clear(&st->res);
 
+	if (!st->stream && (push = TAILQ_FIRST(&st->pushq)) != NULL) {
+		TAILQ_REMOVE(&st->pushq, push, entries);
+		st->res = push->res;
+		free(push);
+		return &st->res.set[st->res.curset++];
+	}
+
+	/* Streaming statements have rows pushed to them. */
+
+	if (st->stream) {
+		if (!sqlbox_stream_next(box, st)) {
+			sqlbox_warnx(&box->cfg, 
+				"step: sqlbox_stream_next");
+			return NULL;
+		}
+		return &st->res.set[st->res.curset++];
+	}
+
 	/* Write id frame. */
 
 	val = htole32(stmtid);
@@ -86,53 +183,65 @@ sqlbox_step(struct sqlbox *box, size_t stmtid)
 	 * packed parameters.
 	 */
 
-	if (sqlbox_read_frame(box, 
+	if (!sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "step: sqlbox_ticket_drain");
+		return NULL;
+	} else if (sqlbox_read_frame(box, 
 	    &st->res.buf, &st->res.bufsz, &frame, &framesz) <= 0) {
 		sqlbox_warnx(&box->cfg, "step: sqlbox_read_frame");
 		return NULL;
 	}
+	sqlbox_stats_answer(box);
+	if (!sqlbox_res_parse(box, &st->res, frame, framesz)) {
+		sqlbox_warnx(&box->cfg, "step: sqlbox_res_parse");
+		return NULL;
+	}
 
-	/* Read as many results sets as are available. */
+	/* Return the first cached entry. */
 
-	while (framesz > 0) {
-		if (framesz < sizeof(uint32_t)) {
-			sqlbox_warnx(&box->cfg, 
-				"step: bad frame size");
-			return NULL;
-		}
+	return &st->res.set[st->res.curset++];
+}
 
-		pp = reallocarray(st->res.set, 
-			st->res.setsz + 1, 
-			sizeof(struct sqlbox_parmset));
-		if (pp == NULL) {
-			sqlbox_warn(&box->cfg, "step: reallocarray");
-			return NULL;
-		}
-		st->res.set = pp;
-		i = st->res.setsz++;
-		memset(&st->res.set[i], 0, 
-			sizeof(struct sqlbox_parmset));
+const struct sqlbox_parmset *
+sqlbox_step(struct sqlbox *box, size_t stmtid)
+{
+	const struct sqlbox_parmset *res;
 
-		st->res.set[i].code = le32toh(*(uint32_t *)frame);
-		frame += sizeof(uint32_t);
-		framesz -= sizeof(uint32_t);
+	sqlbox_lock_sync(box);
+	res = sqlbox_step_locked(box, stmtid);
+	sqlbox_unlock_sync(box);
+	return res;
+}
 
-		psz = sqlbox_parm_unpack(box, 
-			&st->res.set[i].ps, 
-			&st->res.set[i].psz,
-			frame, framesz);
-		if (psz == 0) {
-			sqlbox_warnx(&box->cfg, 
-				"step: sqlbox_parm_unpack");
-			return NULL;
-		}
-		frame += psz;
-		framesz -= psz;
+size_t
+sqlbox_step_submit(struct sqlbox *box, size_t stmtid)
+{
+	uint32_t		 val = htole32(stmtid);
+	struct sqlbox_stmt 	*st;
+	struct sqlbox_ticket	*t;
+
+	if ((st = sqlbox_stmt_find(box, stmtid)) == NULL) {
+		sqlbox_warnx(&box->cfg, "step-submit: sqlbox_stmt_find");
+		return 0;
+	} else if (st->stream) {
+		sqlbox_warnx(&box->cfg, "step-submit: "
+			"statement %zu is streaming", st->id);
+		return 0;
 	}
 
-	/* Return the first cached entry. */
+	if ((t = sqlbox_ticket_alloc(box)) == NULL) {
+		sqlbox_warnx(&box->cfg, "step-submit: sqlbox_ticket_alloc");
+		return 0;
+	} else if (!sqlbox_write_frame(box, 
+	    SQLBOX_OP_STEP_TICKET, (char *)&val, sizeof(uint32_t))) {
+		sqlbox_warnx(&box->cfg, "step-submit: sqlbox_write_frame");
+		sqlbox_ticket_abort(box, t);
+		return 0;
+	}
 
-	return &st->res.set[st->res.curset++];
+	t->step = st;
+	st->stepping++;
+	return sqlbox_ticket_push(box, t, SQLBOX_OP_STEP_TICKET, NULL);
 }
 
 /*
@@ -156,7 +265,8 @@ sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
 
 	/* Start with the step itself. */
 
-	code = sqlbox_wrap_step(box, st->db, 
+	code = sqlbox_wrap_step(box, 
+		st->rdb != NULL ? st->rdb : st->db, 
 		st->pstmt, st->stmt, &cols, 
 		(st->flags & SQLBOX_STMT_CONSTRAINT));
 	if (code == SQLBOX_CODE_ERROR) {
@@ -275,13 +385,13 @@ sqlbox_pack_step(struct sqlbox *box, size_t *bufpos, struct sqlbox_stmt *st)
 
 	assert(st->res.bufsz);
 	if (*bufpos + sizeof(uint32_t) >= st->res.bufsz) {
-		pp = realloc(st->res.buf, *bufpos + SQLBOX_FRAME);
+		pp = realloc(st->res.buf, st->res.bufsz * 2);
 		if (pp == NULL) {
 			sqlbox_warn(&box->cfg, "step: realloc");
 			goto out;
 		}
 		st->res.buf = pp;
-		st->res.bufsz = *bufpos + SQLBOX_FRAME;
+		st->res.bufsz *= 2;
 	}
 
 	/* 
@@ -311,6 +421,83 @@ out:
 	return rc;
 }
 
+/*
+ * Step through the next batch of rows of a multi-row statement and
+ * cache them, framed, in the statement's result buffer.
+ * The batch is bounded by the statement's prefetch limits and ends
+ * early with the last row (setting the "done" marker).
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_stmt_batch(struct sqlbox *box, struct sqlbox_stmt *st)
+{
+	size_t			 i, pos, rows, bytes;
+	int			 rc;
+	uint32_t		 val;
+
+	/*
+	 * Figure out how much: the byte limit always applies, the row
+	 * limit only if set or adaptive.
+	 */
+
+	bytes = st->pf_bytes;
+	if (bytes == 0)
+		bytes = (st->flags & SQLBOX_STMT_ADAPTIVE) ?
+			SQLBOX_PREFETCH_MAX : SQLBOX_CACHE_MAX;
+	rows = st->pf_rows;
+	if ((st->flags & SQLBOX_STMT_ADAPTIVE)) {
+		if (st->pf_window == 0)
+			st->pf_window = SQLBOX_PREFETCH_MIN;
+		if (rows == 0 || st->pf_window < rows)
+			rows = st->pf_window;
+	}
+
+	assert(st->res.bufsz == 0);
+	st->res.bufsz = SQLBOX_FRAME;
+	st->res.buf = calloc(st->res.bufsz, 1);
+	if (st->res.buf == NULL) {
+		sqlbox_warn(&box->cfg, "step: calloc");
+		return 0;
+	}
+	pos = sizeof(uint32_t);
+	assert(!st->res.done);
+	i = 0;
+	while (pos < bytes && (rows == 0 || i < rows)) {
+		rc = sqlbox_pack_step(box, &pos, st);
+		if (rc < 0) {
+			sqlbox_warnx(&box->cfg, "%s: step: "
+				"sqlbox_pack_step (multi)", 
+				st->db->src->fname);
+			sqlbox_warnx(&box->cfg, 
+				"%s: statement: %s",
+				st->db->src->fname, 
+				st->pstmt->stmt);
+			return 0;
+		} else if (rc == 0) {
+			st->res.done = 1;
+			break;
+		}
+		i++;
+	}
+
+	/*
+	 * If we filled the window before the byte limit, grow it
+	 * for the next batch.
+	 * (Rows are at least four bytes, so bounding by "bytes"
+	 * stops the window from growing without bound.)
+	 */
+
+	if ((st->flags & SQLBOX_STMT_ADAPTIVE) && 
+	    i == st->pf_window && i < bytes)
+		st->pf_window *= 2;
+
+	val = htole32(pos - sizeof(uint32_t));
+	memcpy(st->res.buf, (char *)&val, sizeof(uint32_t));
+	st->res.bufsz = pos;
+	box->stats.batches++;
+	return 1;
+}
+
 /*
  * Step through zero or more results to a prepared statement.
  * We do not allow constraint violations.
@@ -320,7 +507,7 @@ int
 sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_stmt	*st;
-	size_t			 i, pos;
+	size_t			 pos;
 	int			 rc, done, wrote = 0;
 	uint32_t		 val;
 	
@@ -394,7 +581,6 @@ sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 
 		val = htole32(pos - sizeof(uint32_t));
 		memcpy(st->res.buf, (char *)&val, sizeof(uint32_t));
-		pos = pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME;
 		if (!sqlbox_write(box, st->res.buf, pos)) {
 			sqlbox_warnx(&box->cfg, "step: sqlbox_write");
 			return 0;
@@ -408,7 +594,8 @@ sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 		 * data, then continue to collect for the next request.
 		 */
 
-		if ((st->flags & SQLBOX_STMT_MULTI))
+		if ((st->flags & 
+		     (SQLBOX_STMT_MULTI | SQLBOX_STMT_ADAPTIVE)))
 			wrote = 1;
 	} 
 
@@ -417,38 +604,42 @@ sqlbox_op_step(struct sqlbox *box, const char *buf, size_t sz)
 	 * this function.
 	 */
 
-	if (wrote && !st->res.done) {
-		assert(st->res.bufsz == 0);
-		st->res.bufsz = SQLBOX_FRAME;
-		st->res.buf = calloc(st->res.bufsz, 1);
-		if (st->res.buf == NULL) {
-			sqlbox_warn(&box->cfg, "step: calloc");
-			return 0;
-		}
-		pos = sizeof(uint32_t);
-		assert(!st->res.done);
-		i = 0;
-		while (pos < SQLBOX_CACHE_MAX) {
-			rc = sqlbox_pack_step(box, &pos, st);
-			if (rc < 0) {
-				sqlbox_warnx(&box->cfg, "%s: step: "
-					"sqlbox_pack_step (multi)", 
-					st->db->src->fname);
-				sqlbox_warnx(&box->cfg, 
-					"%s: statement: %s",
-					st->db->src->fname, 
-					st->pstmt->stmt);
-				return 0;
-			} else if (rc == 0) {
-				st->res.done = 1;
-				break;
-			}
-			i++;
-		}
-		val = htole32(pos - sizeof(uint32_t));
-		memcpy(st->res.buf, (char *)&val, sizeof(uint32_t));
-		st->res.bufsz = pos > SQLBOX_FRAME ? pos : SQLBOX_FRAME;
+	if (wrote && !st->res.done && !sqlbox_stmt_batch(box, st)) {
+		sqlbox_warnx(&box->cfg, "%s: step: "
+			"sqlbox_stmt_batch", st->db->src->fname);
+		return 0;
 	}
 
 	return 1;
 }
+
+int
+sqlbox_op_step_ticket(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st = NULL;
+
+	/* 
+	 * Errors looking up the statement are reported to the client.
+	 * Once rows are promised, errors are fatal as for sqlbox_step().
+	 */
+
+	if (sz == sizeof(uint32_t))
+		st = sqlbox_stmt_find(box, le32toh(*(uint32_t *)buf));
+	if (st == NULL || (st->res.done && st->res.bufsz == 0)) {
+		sqlbox_warnx(&box->cfg, "step-ticket: %s", st == NULL ?
+			"sqlbox_stmt_find" : "already stepped");
+		if (sqlbox_ticket_reply(box, SQLBOX_CODE_ERROR, 0, 0))
+			return 1;
+		sqlbox_warnx(&box->cfg, "step-ticket: sqlbox_ticket_reply");
+		return 0;
+	}
+
+	if (!sqlbox_ticket_reply(box, SQLBOX_CODE_OK, st->id, 0)) {
+		sqlbox_warnx(&box->cfg, "step-ticket: sqlbox_ticket_reply");
+		return 0;
+	} else if (!sqlbox_op_step(box, buf, sz)) {
+		sqlbox_warnx(&box->cfg, "step-ticket: sqlbox_op_step");
+		return 0;
+	}
+	return 1;
+}
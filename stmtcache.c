@@ -0,0 +1,168 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Remove a cached statement from all queues and free it, returning the
+ * compiled statement.
+ */
+static sqlite3_stmt *
+sqlbox_stmtcache_remove(struct sqlbox_db *db, struct sqlbox_cstmt *cs)
+{
+	sqlite3_stmt	*stmt = cs->stmt;
+
+	TAILQ_REMOVE(&db->cacheq, cs, entries);
+	TAILQ_REMOVE(&db->cacheidx[cs->idx], cs, ientries);
+	assert(db->cachesz > 0);
+	db->cachesz--;
+	free(cs);
+	return stmt;
+}
+
+/*
+ * Get a compiled statement "idx" for the database, from the cache if
+ * possible or by preparing it otherwise.
+ * The statement has no bound parameters.
+ * Returns the statement or NULL on failure.
+ */
+sqlite3_stmt *
+sqlbox_stmtcache_get(struct sqlbox *box, struct sqlbox_db *db, size_t idx)
+{
+	const struct sqlbox_pstmt *pst = &box->cfg.stmts.stmts[idx];
+	struct sqlbox_cstmt	  *cs;
+
+	assert(idx < box->cfg.stmts.stmtsz);
+
+	if (box->stmtstats != NULL)
+		box->stmtstats[idx].prepares++;
+	sqlbox_slow_note(box, db, &box->cfg.stmts.stmts[idx]);
+	if (db->cacheidx != NULL &&
+	    (cs = TAILQ_FIRST(&db->cacheidx[idx])) != NULL) {
+		db->cachehits++;
+		sqlbox_debug(&box->cfg, "%s: statement cache "
+			"hit: %s", db->src->fname, pst->stmt);
+		return sqlbox_stmtcache_remove(db, cs);
+	}
+
+	db->cachemiss++;
+	return sqlbox_wrap_prep(box, db, pst);
+}
+
+/*
+ * Return a compiled statement "idx" to the database's cache.
+ * It's reset and its bindings cleared.
+ * If the cache is full, the least-recently returned statement is
+ * finalised; if caching is disabled, "stmt" itself is.
+ * Does nothing if "stmt" is NULL.
+ */
+void
+sqlbox_stmtcache_put(struct sqlbox *box, 
+	struct sqlbox_db *db, size_t idx, sqlite3_stmt *stmt)
+{
+	const struct sqlbox_pstmt *pst = &box->cfg.stmts.stmts[idx];
+	struct sqlbox_cstmt	  *cs;
+	size_t			   i;
+
+	assert(idx < box->cfg.stmts.stmtsz);
+
+	if (stmt == NULL)
+		return;
+
+	if (db->cachemax == 0) {
+		sqlbox_wrap_finalise(box, db, pst, stmt);
+		return;
+	}
+
+	/* Lazily allocate the per-statement queues. */
+
+	if (db->cacheidx == NULL) {
+		db->cacheidx = calloc(box->cfg.stmts.stmtsz, 
+			sizeof(struct sqlbox_cstmtq));
+		if (db->cacheidx == NULL) {
+			sqlbox_warn(&box->cfg, "calloc");
+			sqlbox_wrap_finalise(box, db, pst, stmt);
+			return;
+		}
+		for (i = 0; i < box->cfg.stmts.stmtsz; i++)
+			TAILQ_INIT(&db->cacheidx[i]);
+	}
+
+	if ((cs = malloc(sizeof(struct sqlbox_cstmt))) == NULL) {
+		sqlbox_warn(&box->cfg, "malloc");
+		sqlbox_wrap_finalise(box, db, pst, stmt);
+		return;
+	}
+
+	/* 
+	 * Resetting returns the last step's error, which we've already
+	 * reported, so ignore it.
+	 */
+
+	sqlbox_debug(&box->cfg, "%s: sqlite3_reset: %s",
+		db->src->fname, pst->stmt);
+	(void)sqlite3_reset(stmt);
+	(void)sqlite3_clear_bindings(stmt);
+
+	cs->stmt = stmt;
+	cs->idx = idx;
+	TAILQ_INSERT_HEAD(&db->cacheq, cs, entries);
+	TAILQ_INSERT_HEAD(&db->cacheidx[idx], cs, ientries);
+	db->cachesz++;
+
+	while (db->cachesz > db->cachemax) {
+		cs = TAILQ_LAST(&db->cacheq, sqlbox_cstmtq);
+		pst = &box->cfg.stmts.stmts[cs->idx];
+		stmt = sqlbox_stmtcache_remove(db, cs);
+		sqlbox_wrap_finalise(box, db, pst, stmt);
+	}
+}
+
+/*
+ * Finalise all cached statements, e.g., before closing the database.
+ */
+void
+sqlbox_stmtcache_clear(struct sqlbox *box, struct sqlbox_db *db)
+{
+	struct sqlbox_cstmt	  *cs;
+	const struct sqlbox_pstmt *pst;
+	sqlite3_stmt		  *stmt;
+
+	sqlbox_debug(&box->cfg, "%s: statement cache: %zu hits, "
+		"%zu misses", db->src->fname, db->cachehits, 
+		db->cachemiss);
+
+	while ((cs = TAILQ_FIRST(&db->cacheq)) != NULL) {
+		pst = &box->cfg.stmts.stmts[cs->idx];
+		stmt = sqlbox_stmtcache_remove(db, cs);
+		sqlbox_wrap_finalise(box, db, pst, stmt);
+	}
+
+	free(db->cacheidx);
+	db->cacheidx = NULL;
+}
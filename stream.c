@@ -0,0 +1,304 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Default number of batches in flight for a streaming statement.
+ */
+#define	SQLBOX_STREAM_CREDITS 4
+
+/*
+ * Don't let the credit frames themselves (which the server only reads
+ * once it has written its rows) fill the channel.
+ * The server rejects grants of more, which would keep it writing
+ * instead of serving anything else.
+ */
+#define	SQLBOX_STREAM_CREDITS_MAX 1024
+
+static int
+sqlbox_stmt_stream_locked(struct sqlbox *box, size_t id, size_t credits)
+{
+	struct sqlbox_stmt	*st;
+
+	if ((st = sqlbox_stmt_find(box, id)) == NULL) {
+		sqlbox_warnx(&box->cfg, "stream: sqlbox_stmt_find");
+		return 0;
+	}
+
+	if (credits == 0)
+		credits = SQLBOX_STREAM_CREDITS;
+	else if (credits > SQLBOX_STREAM_CREDITS_MAX)
+		credits = SQLBOX_STREAM_CREDITS_MAX;
+
+	/* Nothing is sent until the first sqlbox_step(). */
+
+	st->stream = credits;
+	return 1;
+}
+
+int
+sqlbox_stmt_stream(struct sqlbox *box, size_t id, size_t credits)
+{
+	int	 rc;
+
+	sqlbox_lock_sync(box);
+	rc = sqlbox_stmt_stream_locked(box, id, credits);
+	sqlbox_unlock_sync(box);
+	return rc;
+}
+
+/*
+ * Grant "credits" more batches to streaming statement "st".
+ * Return TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_stream_grant(struct sqlbox *box, 
+	struct sqlbox_stmt *st, size_t credits)
+{
+	uint32_t		 v[2];
+	struct sqlbox_grant	*g;
+
+	if ((g = calloc(1, sizeof(struct sqlbox_grant))) == NULL) {
+		sqlbox_warn(&box->cfg, "stream: calloc");
+		return 0;
+	}
+
+	v[0] = htole32(st->id);
+	v[1] = htole32(credits);
+
+	if (!sqlbox_send_frame
+	    (box, SQLBOX_OP_STREAM, (char *)v, sizeof(v))) {
+		sqlbox_warnx(&box->cfg, "stream: sqlbox_send_frame");
+		free(g);
+		return 0;
+	}
+
+	g->st = st;
+	g->credits = credits;
+	st->granted += credits;
+	TAILQ_INSERT_TAIL(&box->grantq, g, entries);
+	return 1;
+}
+
+/*
+ * Read the next pushed frame, which answers the oldest credit, and
+ * queue its rows (if any) on the owning statement.
+ * Return TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_stream_read(struct sqlbox *box)
+{
+	struct sqlbox_grant	*g;
+	struct sqlbox_stmt	*st;
+	struct sqlbox_push	*push;
+	const char		*frame;
+	size_t			 framesz;
+	int			 c;
+
+	g = TAILQ_FIRST(&box->grantq);
+	st = g->st;
+	if (--g->credits == 0) {
+		TAILQ_REMOVE(&box->grantq, g, entries);
+		free(g);
+	}
+	st->granted--;
+
+	if ((push = calloc(1, sizeof(struct sqlbox_push))) == NULL) {
+		sqlbox_warn(&box->cfg, "stream: calloc");
+		return 0;
+	}
+
+	/* 
+	 * Tickets submitted before the credit are answered before it.
+	 * (Tickets are never submitted with credits in flight.)
+	 */
+
+	box->draining++;
+	c = sqlbox_ticket_drain(box) ? sqlbox_read_frame(box, 
+		&push->res.buf, &push->res.bufsz, &frame, &framesz) : -1;
+	box->draining--;
+
+	if (c <= 0) {
+		sqlbox_warnx(&box->cfg, "stream: sqlbox_read_frame");
+		sqlbox_res_clear(&push->res);
+		free(push);
+		return 0;
+	}
+
+	/* Empty frames answer credits granted past the last row. */
+
+	if (framesz == 0) {
+		sqlbox_res_clear(&push->res);
+		free(push);
+		return 1;
+	}
+
+	if (!sqlbox_res_parse(box, &push->res, frame, framesz)) {
+		sqlbox_warnx(&box->cfg, "stream: sqlbox_res_parse");
+		sqlbox_res_clear(&push->res);
+		free(push);
+		return 0;
+	}
+
+	/* A row without columns ends the results. */
+
+	if (push->res.set[push->res.setsz - 1].psz == 0)
+		st->streamend = 1;
+	TAILQ_INSERT_TAIL(&st->pushq, push, entries);
+	return 1;
+}
+
+/*
+ * Read all frames owed to streaming statements.
+ * This is required before writing any other request, before stopping a
+ * stream with sqlbox_rebind() or sqlbox_finalise(), and on exit.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_stream_drain(struct sqlbox *box)
+{
+
+	while (!TAILQ_EMPTY(&box->grantq))
+		if (!sqlbox_stream_read(box)) {
+			sqlbox_warnx(&box->cfg, 
+				"stream: sqlbox_stream_read");
+			return 0;
+		}
+
+	return 1;
+}
+
+/*
+ * Set the next batch of pushed rows as the results of "st", which
+ * must be empty, reading from the wire if needed.
+ * Each consumed batch is replaced by a new credit, so the server keeps
+ * the statement's credits worth of rows in flight.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_stream_next(struct sqlbox *box, struct sqlbox_stmt *st)
+{
+	struct sqlbox_push	*push;
+
+	/* Start (or restart after rebinding) the stream. */
+
+	if (TAILQ_EMPTY(&st->pushq) && 
+	    !st->streamend && st->granted == 0 &&
+	    !sqlbox_stream_grant(box, st, st->stream)) {
+		sqlbox_warnx(&box->cfg, "stream: sqlbox_stream_grant");
+		return 0;
+	}
+
+	while (TAILQ_EMPTY(&st->pushq)) {
+		if (st->granted == 0) {
+			sqlbox_warnx(&box->cfg, 
+				"stream: already stepped");
+			return 0;
+		} else if (!sqlbox_stream_read(box)) {
+			sqlbox_warnx(&box->cfg, 
+				"stream: sqlbox_stream_read");
+			return 0;
+		}
+	}
+
+	push = TAILQ_FIRST(&st->pushq);
+	TAILQ_REMOVE(&st->pushq, push, entries);
+	st->res = push->res;
+	free(push);
+
+	if (!st->streamend && 
+	    !sqlbox_stream_grant(box, st, 1)) {
+		sqlbox_warnx(&box->cfg, "stream: sqlbox_stream_grant");
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Write batches of rows for a streaming statement, one per credit, and
+ * without waiting for the client to ask.
+ * Credits granted after the last row are answered with empty frames.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_op_stream(struct sqlbox *box, const char *buf, size_t sz)
+{
+	struct sqlbox_stmt	*st;
+	uint32_t		 v[2], empty = 0;
+	size_t			 i, credits;
+	int			 done;
+
+	if (sz != sizeof(v)) {
+		sqlbox_warnx(&box->cfg, "stream: bad frame size");
+		return 0;
+	}
+	memcpy(v, buf, sizeof(v));
+	if ((st = sqlbox_stmt_find(box, le32toh(v[0]))) == NULL) {
+		sqlbox_warnx(&box->cfg, "stream: sqlbox_stmt_find");
+		return 0;
+	}
+	credits = le32toh(v[1]);
+	if (credits == 0 || credits > SQLBOX_STREAM_CREDITS_MAX) {
+		sqlbox_warnx(&box->cfg, "stream: "
+			"bad credits: %zu", credits);
+		return 0;
+	}
+
+	for (i = 0; i < credits; i++) {
+		if (st->res.bufsz == 0 && st->res.done) {
+			if (!sqlbox_write(box, 
+			    (char *)&empty, sizeof(uint32_t))) {
+				sqlbox_warnx(&box->cfg, 
+					"stream: sqlbox_write");
+				return 0;
+			}
+			continue;
+		}
+		if (st->res.bufsz == 0 && 
+		    !sqlbox_stmt_batch(box, st)) {
+			sqlbox_warnx(&box->cfg, "%s: stream: "
+				"sqlbox_stmt_batch", st->db->src->fname);
+			return 0;
+		}
+		if (!sqlbox_write(box, st->res.buf, st->res.bufsz)) {
+			sqlbox_warnx(&box->cfg, "%s: stream: "
+				"sqlbox_write", st->db->src->fname);
+			return 0;
+		}
+		done = st->res.done;
+		sqlbox_res_clear(&st->res);
+		st->res.done = done;
+	}
+
+	return 1;
+}
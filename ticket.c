@@ -0,0 +1,422 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+#include COMPAT_ENDIAN_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * Read answers until "t" has been answered or, if NULL, until fewer
+ * than SQLBOX_TICKET_MAX are outstanding (client).
+ * With SQLBOX_CFG_SHARED, threads take turns reading, each unlocking
+ * the box while waiting for the server (see sqlbox_lock_poll()), and
+ * the others wait for their answers to be read.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_ticket_read_until(struct sqlbox *box, const struct sqlbox_ticket *t)
+{
+	int	 rc;
+
+	if (box->lock == NULL) {
+		assert(t != NULL);
+		if (!t->done && !box->draining && !sqlbox_flush(box)) {
+			sqlbox_warnx(&box->cfg, "ticket: sqlbox_flush");
+			return 0;
+		}
+		while (!t->done)
+			if (!sqlbox_ticket_read(box)) {
+				sqlbox_warnx(&box->cfg, 
+					"ticket: sqlbox_ticket_read");
+				return 0;
+			}
+		return 1;
+	}
+
+	while (t != NULL ? !t->done : 
+	       box->ticketpend >= SQLBOX_TICKET_MAX) {
+		if (!sqlbox_lock_reader(box))
+			continue;
+		rc = sqlbox_flush(box) &&
+			sqlbox_lock_poll(box) &&
+			sqlbox_ticket_read(box);
+		sqlbox_lock_unreader(box);
+		if (!rc) {
+			sqlbox_warnx(&box->cfg, 
+				"ticket: sqlbox_ticket_read");
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Allocate a ticket for an operation about to be queued (client).
+ * Streams are drained first: their frames would otherwise arrive ahead
+ * of the ticket's answer while the ticket's frame was still queued.
+ * Answers are also read if too many are outstanding, unless the box is
+ * non-blocking: then sqlbox_process() reads as it writes.
+ * With SQLBOX_CFG_SHARED, this locks the box until the ticket is
+ * enqueued by sqlbox_ticket_push() or freed by sqlbox_ticket_abort().
+ * Returns the ticket or NULL on failure.
+ */
+struct sqlbox_ticket *
+sqlbox_ticket_alloc(struct sqlbox *box)
+{
+	struct sqlbox_ticket	*t;
+
+	sqlbox_lock(box);
+
+	if (!TAILQ_EMPTY(&box->grantq) && !sqlbox_stream_drain(box)) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_stream_drain");
+		sqlbox_unlock(box);
+		return NULL;
+	} else if (box->lock != NULL && 
+	    !sqlbox_ticket_read_until(box, NULL)) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_ticket_read_until");
+		sqlbox_unlock(box);
+		return NULL;
+	} else if (!(box->cfg.flags & SQLBOX_CFG_NONBLOCK) &&
+	    box->ticketpend >= SQLBOX_TICKET_MAX &&
+	    !sqlbox_ticket_drain(box)) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_ticket_drain");
+		sqlbox_unlock(box);
+		return NULL;
+	} else if ((t = calloc(1, sizeof(struct sqlbox_ticket))) == NULL) {
+		sqlbox_warn(&box->cfg, "ticket: calloc");
+		sqlbox_unlock(box);
+		return NULL;
+	}
+	return t;
+}
+
+/*
+ * Free a ticket from sqlbox_ticket_alloc() whose frame couldn't be
+ * queued (client).
+ */
+void
+sqlbox_ticket_abort(struct sqlbox *box, struct sqlbox_ticket *t)
+{
+
+	sqlbox_ticket_free(t);
+	sqlbox_unlock(box);
+}
+
+/*
+ * Enqueue a ticket whose frame has been queued (client).
+ * Returns its non-zero number.
+ */
+size_t
+sqlbox_ticket_push(struct sqlbox *box, 
+	struct sqlbox_ticket *t, enum sqlbox_op op, struct sqlbox_stmt *st)
+{
+	size_t	 ticket;
+
+	if (++box->ticketlast == 0)
+		box->ticketlast = 1;
+	t->op = op;
+	t->st = st;
+	t->res.ticket = ticket = box->ticketlast;
+	TAILQ_INSERT_TAIL(&box->ticketq, t, entries);
+	if (box->ticketnext == NULL)
+		box->ticketnext = t;
+	box->ticketpend++;
+	sqlbox_unlock(box);
+	return ticket;
+}
+
+void
+sqlbox_ticket_free(struct sqlbox_ticket *t)
+{
+
+	if (t->st != NULL)
+		sqlbox_stmt_free(t->st);
+	free(t);
+}
+
+/*
+ * Read the rows answering a ticket from sqlbox_step_submit() (client).
+ * They're queued on the statement for sqlbox_step() or discarded if
+ * the statement has since been freed.
+ * Returns TRUE on success, FALSE on failure.
+ */
+static int
+sqlbox_ticket_read_step(struct sqlbox *box, struct sqlbox_ticket *t)
+{
+	struct sqlbox_push	*push;
+	const char		*frame;
+	size_t			 framesz;
+
+	if ((push = calloc(1, sizeof(struct sqlbox_push))) == NULL) {
+		sqlbox_warn(&box->cfg, "ticket: calloc");
+		return 0;
+	} else if (sqlbox_read_frame(box, &push->res.buf, 
+	    &push->res.bufsz, &frame, &framesz) <= 0) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_read_frame");
+		sqlbox_res_clear(&push->res);
+		free(push);
+		return 0;
+	} else if (!sqlbox_res_parse(box, &push->res, frame, framesz)) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_res_parse");
+		sqlbox_res_clear(&push->res);
+		free(push);
+		return 0;
+	}
+
+	TAILQ_INSERT_TAIL(&t->step->pushq, push, entries);
+	return 1;
+}
+
+/*
+ * See whether the answer to the oldest pending ticket is entirely in
+ * the read-ahead buffer, so that it can be read without blocking
+ * (client).
+ * Sets "want" to the number of bytes (so far) known to be required.
+ */
+int
+sqlbox_ticket_ready(struct sqlbox *box, size_t *want)
+{
+	const struct sqlbox_ticket *t = box->ticketnext;
+	size_t			 avail;
+	uint32_t		 val;
+
+	assert(t != NULL);
+	avail = box->rbufsz - box->rbufpos;
+	*want = sizeof(uint32_t) * 4;
+
+	/* Steps are followed by a frame of rows, unless in error. */
+
+	if (avail < *want || t->op != SQLBOX_OP_STEP_TICKET)
+		return avail >= *want;
+	memcpy(&val, box->rbuf + box->rbufpos, sizeof(uint32_t));
+	if (le32toh(val) == SQLBOX_CODE_ERROR)
+		return 1;
+
+	*want += sizeof(uint32_t);
+	if (avail < *want)
+		return 0;
+	memcpy(&val, box->rbuf + box->rbufpos + 
+		sizeof(uint32_t) * 4, sizeof(uint32_t));
+	*want += le32toh(val);
+	return avail >= *want;
+}
+
+/*
+ * Read the answer to the oldest pending ticket (client).
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_ticket_read(struct sqlbox *box)
+{
+	struct sqlbox_ticket	*t;
+	uint32_t		 vals[4];
+	int64_t			 val;
+
+	t = box->ticketnext;
+	assert(t != NULL && !t->done);
+
+	if (sqlbox_read_full(box, (char *)vals, sizeof(vals), 0) <= 0) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_read_full");
+		return 0;
+	}
+	box->stats.rxframes++;
+	memcpy(&val, &vals[2], sizeof(int64_t));
+
+	t->done = 1;
+	box->ticketnext = TAILQ_NEXT(t, entries);
+	box->ticketpend--;
+	t->res.code = (enum sqlbox_code)le32toh(vals[0]);
+	t->res.id = le32toh(vals[1]);
+	t->res.lastid = le64toh(val);
+
+	if (t->step != NULL) {
+		t->step->stepping--;
+		if (t->res.code != SQLBOX_CODE_ERROR &&
+		    !sqlbox_ticket_read_step(box, t)) {
+			sqlbox_warnx(&box->cfg, 
+				"ticket: sqlbox_ticket_read_step");
+			return 0;
+		}
+		t->step = NULL;
+	}
+
+	/* Register successfully-prepared statements. */
+
+	if (t->st == NULL)
+		return 1;
+	if (t->res.code != SQLBOX_CODE_ERROR && t->res.id != 0) {
+		t->st->id = t->res.id;
+		if (!sqlbox_handle_set(box, &box->stmts, t->st->id, t->st)) {
+			sqlbox_warnx(&box->cfg, 
+				"ticket: sqlbox_handle_set");
+			return 0;
+		}
+		TAILQ_INSERT_TAIL(&box->stmtq, t->st, gentries);
+	} else {
+		t->res.code = SQLBOX_CODE_ERROR;
+		sqlbox_stmt_free(t->st);
+	}
+	t->st = NULL;
+	return 1;
+}
+
+/*
+ * Read the answers to all pending tickets (client).
+ * These precede the answer to any other operation, so this must be
+ * called before reading anything else.
+ * Returns TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_ticket_drain(struct sqlbox *box)
+{
+
+	if (box->ticketpend == 0)
+		return 1;
+
+	/* 
+	 * Flushing may itself drain streams (and thus tickets), so
+	 * re-check what's pending afterward.
+	 */
+
+	if (!box->draining && !sqlbox_flush(box)) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_flush");
+		return 0;
+	}
+	while (box->ticketpend > 0)
+		if (!sqlbox_ticket_read(box)) {
+			sqlbox_warnx(&box->cfg, 
+				"ticket: sqlbox_ticket_read");
+			return 0;
+		}
+	return 1;
+}
+
+/*
+ * Look up an uncollected ticket or, if zero, the oldest.
+ * Tickets already being waited on by other threads are skipped.
+ * Returns the ticket or NULL if not found.
+ */
+static struct sqlbox_ticket *
+sqlbox_ticket_find(struct sqlbox *box, size_t ticket)
+{
+	struct sqlbox_ticket	*t;
+
+	TAILQ_FOREACH(t, &box->ticketq, entries)
+		if (t->waited)
+			continue;
+		else if (ticket == 0 || t->res.ticket == ticket)
+			break;
+	if (t == NULL && ticket != 0)
+		sqlbox_warnx(&box->cfg, "unknown ticket: %zu", ticket);
+	return t;
+}
+
+/*
+ * Collect an answered ticket, copying its result into "res" if not
+ * NULL.
+ */
+static void
+sqlbox_ticket_collect(struct sqlbox *box, 
+	struct sqlbox_ticket *t, struct sqlbox_result *res)
+{
+
+	assert(t->done);
+	if (res != NULL)
+		*res = t->res;
+	TAILQ_REMOVE(&box->ticketq, t, entries);
+	sqlbox_ticket_free(t);
+}
+
+int
+sqlbox_poll(struct sqlbox *box, size_t ticket, struct sqlbox_result *res)
+{
+	struct sqlbox_ticket	*t;
+	int			 rc = 0;
+
+	sqlbox_lock(box);
+	if ((t = sqlbox_ticket_find(box, ticket)) == NULL)
+		rc = ticket == 0 ? 0 : -1;
+	else if (t->done) {
+		sqlbox_ticket_collect(box, t, res);
+		rc = 1;
+	}
+	sqlbox_unlock(box);
+	return rc;
+}
+
+int
+sqlbox_wait(struct sqlbox *box, size_t ticket, struct sqlbox_result *res)
+{
+	struct sqlbox_ticket	*t;
+
+	sqlbox_lock(box);
+	if ((t = sqlbox_ticket_find(box, ticket)) == NULL) {
+		sqlbox_unlock(box);
+		return ticket == 0 ? 0 : -1;
+	}
+
+	/* Answers come in order, so read up to our own. */
+
+	t->waited = 1;
+	if (!sqlbox_ticket_read_until(box, t)) {
+		sqlbox_warnx(&box->cfg, "wait: sqlbox_ticket_read_until");
+		t->waited = 0;
+		sqlbox_unlock(box);
+		return -1;
+	}
+
+	sqlbox_ticket_collect(box, t, res);
+	sqlbox_unlock(box);
+	return 1;
+}
+
+/*
+ * Answer a ticket (server).
+ * The answer is queued, so it's written along with anything following
+ * it (the rows of a step) or before reading the next request.
+ * Return TRUE on success, FALSE on failure.
+ */
+int
+sqlbox_ticket_reply(struct sqlbox *box, 
+	enum sqlbox_code code, size_t id, int64_t lastid)
+{
+	uint32_t	 vals[4];
+	int64_t		 val = htole64(lastid);
+
+	vals[0] = htole32(code);
+	vals[1] = htole32(id);
+	memcpy(&vals[2], &val, sizeof(int64_t));
+
+	if (!sqlbox_queue(box, (char *)vals, sizeof(vals))) {
+		sqlbox_warnx(&box->cfg, "ticket: sqlbox_queue");
+		return 0;
+	}
+	return 1;
+}
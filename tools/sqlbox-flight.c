@@ -0,0 +1,181 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sqlbox.h"
+
+/*
+ * Decode a dump of sqlbox_flight_dump() from the file given or standard
+ * input into a single timeline of both ends of the box, ordered by
+ * time, relative to the earliest event.
+ * Both ends use the same monotonic clock, so their events interleave.
+ */
+
+struct	event {
+	struct sqlbox_flightev	 ev;
+	int			 server;
+};
+
+static uint32_t
+le32(const unsigned char *p)
+{
+
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+le64(const unsigned char *p)
+{
+
+	return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+/*
+ * Read all of "f" into a buffer returned in "buf" of size "sz".
+ */
+static void
+slurp(FILE *f, unsigned char **buf, size_t *sz)
+{
+	size_t	 max = 0, rsz;
+	void	*pp;
+
+	*buf = NULL;
+	*sz = 0;
+	do {
+		if (*sz == max) {
+			max = max == 0 ? 8192 : max * 2;
+			if ((pp = realloc(*buf, max)) == NULL)
+				err(EXIT_FAILURE, NULL);
+			*buf = pp;
+		}
+		rsz = fread(*buf + *sz, 1, max - *sz, f);
+		*sz += rsz;
+	} while (rsz > 0);
+	if (ferror(f))
+		err(EXIT_FAILURE, "fread");
+}
+
+static int
+evcmp(const void *a, const void *b)
+{
+	const struct event *e1 = a, *e2 = b;
+
+	if (e1->ev.time != e2->ev.time)
+		return e1->ev.time < e2->ev.time ? -1 : 1;
+	return e1->server - e2->server;
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE		*f = stdin;
+	unsigned char	*buf, *p;
+	size_t		 sz, i, j, n, evsz = 0, sects;
+	struct event	*evs = NULL;
+	const char	*op, *type;
+	void		*pp;
+	int		 c, server;
+	uint64_t	 base;
+
+	while ((c = getopt(argc, argv, "")) != -1)
+		goto usage;
+	argc -= optind;
+	argv += optind;
+	if (argc > 1)
+		goto usage;
+	if (argc == 1 && (f = fopen(argv[0], "r")) == NULL)
+		err(EXIT_FAILURE, "%s", argv[0]);
+
+	slurp(f, &buf, &sz);
+	if (f != stdin)
+		fclose(f);
+
+	if (sz < 16 || memcmp(buf, SQLBOX_FLIGHT_MAGIC, 8))
+		errx(EXIT_FAILURE, "not a flight recorder dump");
+	if (le32(buf + 8) != SQLBOX_FLIGHT_VERSION)
+		errx(EXIT_FAILURE, "unknown version: %u", le32(buf + 8));
+	sects = le32(buf + 12);
+	p = buf + 16;
+	sz -= 16;
+
+	/* Each section: which end, how many, then the events. */
+
+	for (i = 0; i < sects; i++) {
+		if (sz < 8)
+			errx(EXIT_FAILURE, "truncated section header");
+		server = le32(p) != 0;
+		n = le32(p + 4);
+		p += 8;
+		sz -= 8;
+		if (n > SQLBOX_FLIGHT_EVENTS || 
+		    sz < n * sizeof(struct sqlbox_flightev))
+			errx(EXIT_FAILURE, "truncated section");
+		pp = realloc(evs, (evsz + n) * sizeof(struct event));
+		if (pp == NULL)
+			err(EXIT_FAILURE, NULL);
+		evs = pp;
+		for (j = 0; j < n; j++, evsz++) {
+			evs[evsz].server = server;
+			evs[evsz].ev.time = le64(p);
+			evs[evsz].ev.nsec = le64(p + 8);
+			evs[evsz].ev.type = le32(p + 16);
+			evs[evsz].ev.op = le32(p + 20);
+			evs[evsz].ev.size = le32(p + 24);
+			evs[evsz].ev.args[0] = le32(p + 28);
+			evs[evsz].ev.args[1] = le32(p + 32);
+			evs[evsz].ev.args[2] = le32(p + 36);
+			p += sizeof(struct sqlbox_flightev);
+			sz -= sizeof(struct sqlbox_flightev);
+		}
+	}
+
+	if (evsz == 0)
+		return EXIT_SUCCESS;
+	qsort(evs, evsz, sizeof(struct event), evcmp);
+	base = evs[0].ev.time;
+
+	printf("# %12s %-6s %-6s %-18s %8s %32s %10s\n", "usec", 
+		"end", "event", "op", "bytes", "args", "took-usec");
+	for (i = 0; i < evsz; i++) {
+		op = sqlbox_stats_op(evs[i].ev.op);
+		type = sqlbox_flight_type(evs[i].ev.type);
+		printf("%14.3f %-6s %-6s %-18s %8u %10u %10u %10u ",
+			(evs[i].ev.time - base) / 1000.0,
+			evs[i].server ? "server" : "client",
+			type == NULL ? "?" : type,
+			op == NULL ? "-" : op, evs[i].ev.size, 
+			evs[i].ev.args[0], evs[i].ev.args[1], 
+			evs[i].ev.args[2]);
+		if (evs[i].ev.nsec > 0)
+			printf("%10.3f\n", evs[i].ev.nsec / 1000.0);
+		else
+			printf("%10s\n", "-");
+	}
+
+	free(evs);
+	free(buf);
+	return EXIT_SUCCESS;
+usage:
+	fprintf(stderr, "usage: sqlbox-flight [file]\n");
+	return EXIT_FAILURE;
+}
@@ -60,6 +60,7 @@ sqlbox_trans_close(struct sqlbox *box,
 {
 	char	 buf[sizeof(uint32_t) * 3];
 	uint32_t v;
+	int	 rc;
 
 	/* 
 	 * Don't check any values for errors: we'll do all of that in
@@ -74,8 +75,11 @@ sqlbox_trans_close(struct sqlbox *box,
 	assert(type < SQLBOX_TRANS__MAX);
 	v = htole32(type);
 	memcpy(buf + sizeof(uint32_t) * 2, &v, sizeof(uint32_t));
-	if (!sqlbox_write_frame
-	    (box, SQLBOX_OP_TRANS_CLOSE, buf, sizeof(buf))) {
+	sqlbox_lock_sync(box);
+	rc = sqlbox_write_frame
+		(box, SQLBOX_OP_TRANS_CLOSE, buf, sizeof(buf));
+	sqlbox_unlock_sync(box);
+	if (!rc) {
 		sqlbox_warnx(&box->cfg, "trans-close: sqlbox_write_frame");
 		return 0;
 	}
@@ -93,6 +97,7 @@ sqlbox_trans_open(struct sqlbox *box,
 {
 	char	 buf[sizeof(uint32_t) * 3];
 	uint32_t v;
+	int	 rc;
 
 	/* 
 	 * Don't check any values for errors: we'll do all of that in
@@ -106,8 +111,11 @@ sqlbox_trans_open(struct sqlbox *box,
 	assert(type < SQLBOX_TRANS__MAX);
 	v = htole32(type);
 	memcpy(buf + sizeof(uint32_t) * 2, &v, sizeof(uint32_t));
-	if (!sqlbox_write_frame
-	    (box, SQLBOX_OP_TRANS_OPEN, buf, sizeof(buf))) {
+	sqlbox_lock_sync(box);
+	rc = sqlbox_write_frame
+		(box, SQLBOX_OP_TRANS_OPEN, buf, sizeof(buf));
+	sqlbox_unlock_sync(box);
+	if (!rc) {
 		sqlbox_warnx(&box->cfg, "trans-open: sqlbox_write_frame");
 		return 0;
 	}
@@ -159,6 +167,7 @@ sqlbox_op_trans_open(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_db	*db;
 	size_t			 id, attempt = 0;
+	uint64_t		 waited = 0;
 	enum transt		 type;
 
 	if (sz != sizeof(uint32_t) * 3) {
@@ -198,15 +207,16 @@ sqlbox_op_trans_open(struct sqlbox *box, const char *buf, size_t sz)
 		return 0;
 	}
 
+	sqlbox_slow_note(box, db, NULL);
 again:
 	sqlbox_debug(&box->cfg, "sqlite3_exec: %s, %s",
 		db->src->fname, transts[type]);
 	switch (sqlite3_exec(db->db, transts[type], NULL, NULL, NULL)) {
-	case SQLITE_BUSY:
 	case SQLITE_LOCKED:
 	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again;
+		if (sqlbox_wrap_backoff(box, db, attempt++, &waited))
+			goto again;
+		return 0;
 	case SQLITE_OK:
 		break;
 	default:
@@ -224,6 +234,7 @@ sqlbox_op_trans_close(struct sqlbox *box, const char *buf, size_t sz)
 {
 	struct sqlbox_db	*db;
 	size_t			 id, attempt = 0;
+	uint64_t		 waited = 0;
 	enum transt		 type;
 
 	if (sz != sizeof(uint32_t) * 3) {
@@ -267,15 +278,16 @@ sqlbox_op_trans_close(struct sqlbox *box, const char *buf, size_t sz)
 		return 0;
 	}
 
+	sqlbox_slow_note(box, db, NULL);
 again:
 	sqlbox_debug(&box->cfg, "sqlite3_exec: %s, %s",
 		db->src->fname, transts[type]);
 	switch (sqlite3_exec(db->db, transts[type], NULL, NULL, NULL)) {
-	case SQLITE_BUSY:
 	case SQLITE_LOCKED:
 	case SQLITE_PROTOCOL:
-		sqlbox_sleep(attempt++);
-		goto again;
+		if (sqlbox_wrap_backoff(box, db, attempt++, &waited))
+			goto again;
+		return 0;
 	case SQLITE_OK:
 		break;
 	default:
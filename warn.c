@@ -19,9 +19,13 @@
 #if HAVE_SYS_QUEUE
 # include <sys/queue.h>
 #endif 
+#include COMPAT_ENDIAN_H
 
+#include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -160,3 +164,100 @@ sqlbox_op_msg_set_dat(struct sqlbox *box, const char *buf, size_t sz)
 	}
 	return 1;
 }
+
+int
+sqlbox_msg_set_slow(struct sqlbox *box, uint64_t usec)
+{
+	uint64_t	 val = htole64(usec);
+
+	if (!sqlbox_write_frame(box, SQLBOX_OP_MSG_SET_SLOW, 
+	    (const char *)&val, sizeof(uint64_t))) {
+		sqlbox_warnx(&box->cfg, 
+			"msg-set-slow: sqlbox_write_frame");
+		return 0;
+	}
+	box->cfg.msg.slow = usec;
+	return 1;
+}
+
+int
+sqlbox_op_msg_set_slow(struct sqlbox *box, const char *buf, size_t sz)
+{
+	uint64_t	 val;
+
+	if (sz != sizeof(uint64_t)) {
+		sqlbox_warnx(&box->cfg, 
+			"msg-set-slow: bad frame size: %zu", sz);
+		return 0;
+	}
+	memcpy(&val, buf, sizeof(uint64_t));
+	box->cfg.msg.slow = le64toh(val);
+	return 1;
+}
+
+/*
+ * Note that the current operation is working on "db" and statement
+ * "pst", which may be NULL (server).
+ * This is cheap enough to call unconditionally.
+ */
+void
+sqlbox_slow_note(struct sqlbox *box, const struct sqlbox_db *db,
+	const struct sqlbox_pstmt *pst)
+{
+
+	if (box->slow.db != db) {
+		box->slow.db = db;
+		box->slow.retries = db->busyretries;
+	}
+	box->slow.pst = pst;
+}
+
+/*
+ * Report operation "op" on the database noted with sqlbox_slow_note()
+ * as having taken "nsec" (server).
+ * This is only called past the threshold, so it may take its time.
+ */
+void
+sqlbox_slow_report(struct sqlbox *box, enum sqlbox_op op, uint64_t nsec)
+{
+	const struct sqlbox_pstmts	*pstmts = &box->cfg.stmts;
+	const struct sqlbox_slowrec	*rec = &box->slow;
+	struct sqlbox_slow		 slow;
+
+	assert(rec->db != NULL);
+	memset(&slow, 0, sizeof(struct sqlbox_slow));
+	slow.op = sqlbox_stats_op(op);
+	slow.src = rec->db->src->fname;
+	slow.srcidx = rec->db->idx;
+	slow.stmtidx = SIZE_MAX;
+	slow.usec = nsec / 1000;
+	slow.retries = rec->db->busyretries - rec->retries;
+	slow.rows = rec->rows;
+
+	/* Internal statements (transactions) have text but no index. */
+
+	if (rec->pst != NULL) {
+		slow.stmt = rec->pst->stmt;
+		if ((uintptr_t)rec->pst >= (uintptr_t)pstmts->stmts &&
+		    (uintptr_t)rec->pst < 
+		    (uintptr_t)(pstmts->stmts + pstmts->stmtsz))
+			slow.stmtidx = rec->pst - pstmts->stmts;
+	}
+
+	if (box->cfg.msg.func_slow != NULL) {
+		box->cfg.msg.func_slow(&slow, box->cfg.msg.dat);
+		return;
+	}
+	if (slow.stmtidx != SIZE_MAX)
+		sqlbox_warnx(&box->cfg, "%s: slow %s: %" PRIu64 " us, "
+			"%" PRIu64 " retries, %" PRIu64 " rows: "
+			"statement %zu: %s", slow.src, slow.op, 
+			slow.usec, slow.retries, slow.rows, 
+			slow.stmtidx, slow.stmt);
+	else
+		sqlbox_warnx(&box->cfg, "%s: slow %s: %" PRIu64 " us, "
+			"%" PRIu64 " retries, %" PRIu64 " rows%s%s", 
+			slow.src, slow.op, slow.usec, slow.retries, 
+			slow.rows, slow.stmt == NULL ? "" : ": ",
+			slow.stmt == NULL ? "" : slow.stmt);
+}
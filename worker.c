@@ -0,0 +1,283 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2019 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif 
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "sqlbox.h"
+#include "extern.h"
+
+/*
+ * An operation run by a worker thread on behalf of the multiplexer.
+ */
+struct	sqlbox_job {
+	struct sqlbox		*box; /* box of the operation */
+	char			*frame; /* copy of the frame */
+	size_t			 framesz; /* length of frame */
+	int			 rc; /* result of the operation */
+	TAILQ_ENTRY(sqlbox_job)	 entries;
+};
+
+TAILQ_HEAD(sqlbox_jobq, sqlbox_job);
+
+/*
+ * Threads stepping parallel statements for a multiplexer (server).
+ * The box of a job is left alone by the multiplexer until the job is
+ * finished, so the workers only share the queues.
+ * Finished jobs are signalled to the multiplexer by a byte on a pipe,
+ * which it polls along with its clients.
+ */
+struct	sqlbox_workers {
+	const struct sqlbox_cfg	*cfg; /* of the multiplexer */
+	pthread_mutex_t		 mutex;
+	pthread_cond_t		 cond; /* job queued or stopping */
+	struct sqlbox_jobq	 jobq; /* waiting for a worker */
+	struct sqlbox_jobq	 doneq; /* waiting for the multiplexer */
+	pthread_t		 threads[SQLBOX_WORKERS];
+	size_t			 threadsz; /* running threads */
+	int			 fds[2]; /* wakeup pipe */
+	int			 stop; /* threads should exit */
+};
+
+static void
+sqlbox_job_free(struct sqlbox_job *job)
+{
+
+	free(job->frame);
+	free(job);
+}
+
+/*
+ * Run jobs until told to stop.
+ * The answers are written by the worker itself.
+ */
+static void *
+sqlbox_worker(void *arg)
+{
+	struct sqlbox_workers	*w = arg;
+	struct sqlbox_job	*job;
+	char			 c = 0;
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;) {
+		while (!w->stop && TAILQ_EMPTY(&w->jobq))
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (w->stop)
+			break;
+		job = TAILQ_FIRST(&w->jobq);
+		TAILQ_REMOVE(&w->jobq, job, entries);
+		pthread_mutex_unlock(&w->mutex);
+
+		if (!(job->rc = sqlbox_dispatch
+		    (job->box, job->frame, job->framesz)))
+			sqlbox_warnx(&job->box->cfg, "sqlbox_dispatch");
+		else if (!(job->rc = sqlbox_flush(job->box)))
+			sqlbox_warnx(&job->box->cfg, "sqlbox_flush");
+
+		/* A full pipe already has the multiplexer awake. */
+
+		pthread_mutex_lock(&w->mutex);
+		TAILQ_INSERT_TAIL(&w->doneq, job, entries);
+		if (write(w->fds[1], &c, 1) == -1 && 
+		    errno != EAGAIN && errno != EWOULDBLOCK)
+			sqlbox_warn(w->cfg, "write");
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+/*
+ * Start SQLBOX_WORKERS worker threads.
+ * Returns the workers or NULL on failure.
+ */
+struct sqlbox_workers *
+sqlbox_workers_alloc(const struct sqlbox_cfg *cfg)
+{
+	struct sqlbox_workers	*w;
+	int			 er;
+
+	if ((w = calloc(1, sizeof(struct sqlbox_workers))) == NULL) {
+		sqlbox_warn(cfg, "calloc");
+		return NULL;
+	}
+	w->cfg = cfg;
+	TAILQ_INIT(&w->jobq);
+	TAILQ_INIT(&w->doneq);
+
+	if (pipe(w->fds) == -1) {
+		sqlbox_warn(cfg, "pipe");
+		free(w);
+		return NULL;
+	} else if (fcntl(w->fds[0], F_SETFL, O_NONBLOCK) == -1 ||
+	    fcntl(w->fds[1], F_SETFL, O_NONBLOCK) == -1) {
+		sqlbox_warn(cfg, "fcntl");
+		close(w->fds[0]);
+		close(w->fds[1]);
+		free(w);
+		return NULL;
+	} else if ((er = pthread_mutex_init(&w->mutex, NULL)) != 0) {
+		sqlbox_warnx(cfg, "pthread_mutex_init: %s", strerror(er));
+		close(w->fds[0]);
+		close(w->fds[1]);
+		free(w);
+		return NULL;
+	} else if ((er = pthread_cond_init(&w->cond, NULL)) != 0) {
+		sqlbox_warnx(cfg, "pthread_cond_init: %s", strerror(er));
+		pthread_mutex_destroy(&w->mutex);
+		close(w->fds[0]);
+		close(w->fds[1]);
+		free(w);
+		return NULL;
+	}
+
+	for ( ; w->threadsz < SQLBOX_WORKERS; w->threadsz++)
+		if ((er = pthread_create(&w->threads[w->threadsz], 
+		    NULL, sqlbox_worker, w)) != 0) {
+			sqlbox_warnx(cfg, "pthread_create: %s", 
+				strerror(er));
+			sqlbox_workers_free(w);
+			return NULL;
+		}
+
+	return w;
+}
+
+/*
+ * Stop and join the threads, which finish the jobs they're running,
+ * and free the workers.
+ * Jobs not yet finished or collected are discarded.
+ * Does nothing if "w" is NULL.
+ */
+void
+sqlbox_workers_free(struct sqlbox_workers *w)
+{
+	struct sqlbox_job	*job;
+	size_t			 i;
+
+	if (w == NULL)
+		return;
+
+	pthread_mutex_lock(&w->mutex);
+	w->stop = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	for (i = 0; i < w->threadsz; i++)
+		pthread_join(w->threads[i], NULL);
+
+	while ((job = TAILQ_FIRST(&w->jobq)) != NULL) {
+		TAILQ_REMOVE(&w->jobq, job, entries);
+		job->box->working = 0;
+		sqlbox_job_free(job);
+	}
+	while ((job = TAILQ_FIRST(&w->doneq)) != NULL) {
+		TAILQ_REMOVE(&w->doneq, job, entries);
+		job->box->working = 0;
+		sqlbox_job_free(job);
+	}
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+	close(w->fds[0]);
+	close(w->fds[1]);
+	free(w);
+}
+
+/*
+ * Descriptor readable when jobs have finished.
+ */
+int
+sqlbox_workers_fd(const struct sqlbox_workers *w)
+{
+
+	return w->fds[0];
+}
+
+/*
+ * Have a worker run the operation in "frame" for "box", after which it
+ * flushes the box's answers.
+ * The box is marked as working until the job is collected with
+ * sqlbox_workers_done().
+ * Returns FALSE on memory allocation failure, TRUE on success.
+ */
+int
+sqlbox_workers_submit(struct sqlbox_workers *w, 
+	struct sqlbox *box, const char *frame, size_t framesz)
+{
+	struct sqlbox_job	*job;
+
+	if ((job = calloc(1, sizeof(struct sqlbox_job))) == NULL) {
+		sqlbox_warn(&box->cfg, "calloc");
+		return 0;
+	} else if ((job->frame = malloc(framesz)) == NULL) {
+		sqlbox_warn(&box->cfg, "malloc");
+		free(job);
+		return 0;
+	}
+	memcpy(job->frame, frame, framesz);
+	job->framesz = framesz;
+	job->box = box;
+	box->working = 1;
+
+	pthread_mutex_lock(&w->mutex);
+	TAILQ_INSERT_TAIL(&w->jobq, job, entries);
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	return 1;
+}
+
+/*
+ * Collect a finished job, setting "rc" to whether it succeeded.
+ * Returns its box, no longer working, or NULL if no jobs have finished.
+ */
+struct sqlbox *
+sqlbox_workers_done(struct sqlbox_workers *w, int *rc)
+{
+	struct sqlbox_job	*job;
+	struct sqlbox		*box;
+	char			 buf[64];
+
+	/* Wakeups for jobs finishing from now on stay in the pipe. */
+
+	while (read(w->fds[0], buf, sizeof(buf)) > 0)
+		continue;
+
+	pthread_mutex_lock(&w->mutex);
+	if ((job = TAILQ_FIRST(&w->doneq)) != NULL)
+		TAILQ_REMOVE(&w->doneq, job, entries);
+	pthread_mutex_unlock(&w->mutex);
+
+	if (job == NULL)
+		return NULL;
+
+	box = job->box;
+	box->working = 0;
+	*rc = job->rc;
+	sqlbox_job_free(job);
+	return box;
+}